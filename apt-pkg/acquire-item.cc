@@ -19,6 +19,7 @@
 #include <apt-pkg/acquire.h>
 #include <apt-pkg/aptconfiguration.h>
 #include <apt-pkg/configuration.h>
+#include <apt-pkg/debfile.h>
 #include <apt-pkg/error.h>
 #include <apt-pkg/fileutl.h>
 #include <apt-pkg/gpgv.h>
@@ -30,16 +31,22 @@
 #include <apt-pkg/sourcelist.h>
 #include <apt-pkg/strutl.h>
 #include <apt-pkg/tagfile.h>
+#include <apt-pkg/trace.h>
 
 #include <algorithm>
+#include <atomic>
 #include <ctime>
 #include <chrono>
 #include <iostream>
+#include <map>
 #include <memory>
 #include <numeric>
 #include <random>
+#include <set>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 #include <errno.h>
@@ -266,6 +273,18 @@ static bool APT_NONNULL(3, 4, 5) AllowInsecureRepositories(InsecureType const ms
    return false;
 }
 									/*}}}*/
+static HashStringList GetHashesFromMessage(std::string const &Prefix, std::string const &Message)/*{{{*/
+{
+   HashStringList hsl;
+   for (char const *const *type = HashString::SupportedHashes(); *type != NULL; ++type)
+   {
+      std::string const hashsum = LookupTag(Message, (Prefix + *type + "-Hash").c_str());
+      if (hashsum.empty() == false)
+	 hsl.push_back(HashString(*type, hashsum));
+   }
+   return hsl;
+}
+									/*}}}*/
 static HashStringList GetExpectedHashesFromFor(metaIndex * const Parser, std::string const &MetaKey)/*{{{*/
 {
    if (Parser == NULL)
@@ -375,6 +394,33 @@ HashStringList pkgAcqIndexMergeDiffs::GetExpectedHashes() const
    return HashStringList();
 }
 
+class pkgAcqArchive::Private
+{
+   public:
+   std::string DeltaURI;
+   HashStringList DeltaHashes;
+   bool UsingDelta = false;
+   // the delta is downloaded, the debdelta method rebuilds the archive
+   bool RebuildingDelta = false;
+   std::string DeltaFile;
+   bool DeltaCopied = false;
+   std::string FullURI;
+   std::string FullDescription;
+   std::vector<std::pair<std::string, std::unordered_map<std::string, std::string>>> Alternatives;
+   bool VerifyLocal = false;
+};
+/* archives this process has verified already, so that they aren't checked
+   again if the archives are acquired more than once, e.g. for each round of
+   an installation in multiple steps */
+static std::set<std::string> VerifiedArchives;
+static std::string VerifiedArchiveKey(std::string const &File, struct stat const &Buf)
+{
+   std::string Key;
+   strprintf(Key, "%llu %llu %llu %lld %s", static_cast<unsigned long long>(Buf.st_dev),
+	     static_cast<unsigned long long>(Buf.st_ino), static_cast<unsigned long long>(Buf.st_size),
+	     static_cast<long long>(Buf.st_mtime), File.c_str());
+   return Key;
+}
 APT_PURE bool pkgAcqArchive::HashesRequired() const
 {
    return LocalSource == false;
@@ -382,6 +428,8 @@ APT_PURE bool pkgAcqArchive::HashesRequired() const
 HashStringList pkgAcqArchive::GetExpectedHashes() const
 {
    // figured out while parsing the records
+   if (d->UsingDelta && d->RebuildingDelta == false)
+      return d->DeltaHashes;
    return ExpectedHashes;
 }
 
@@ -398,6 +446,20 @@ HashStringList pkgAcqFile::GetExpectedHashes() const
 // Acquire::Item::QueueURI and specialisations from child classes	/*{{{*/
 bool pkgAcquire::Item::QueueURI(pkgAcquire::ItemDesc &Item)
 {
+   // copy the file from the shared cache instead if it has it already
+   if (Local == false && HashesRequired())
+   {
+      auto const Config = Owner->GetConfig(::URI(Item.URI).Access);
+      if (Config != nullptr && Config->LocalOnly == false)
+      {
+	 std::string const Cached = pkgAcquire::SharedCacheLookup(GetExpectedHashes());
+	 if (Cached.empty() == false)
+	 {
+	    PushAlternativeURI(std::string(Item.URI), {}, false);
+	    Item.URI = "copy:" + Cached;
+	 }
+      }
+   }
    Owner->Enqueue(Item);
    return true;
 }
@@ -1447,6 +1509,29 @@ bool pkgAcqMetaBase::CheckDownloadDone(pkgAcqTransactionItem * const I, const st
    return true;
 }
 									/*}}}*/
+// StoreVerificationResult - remember a good signature for the gpgv method	/*{{{*/
+/* The gpgv method runs unprivileged and therefore can't be allowed to write
+   its cache itself: any other method running as the same user could then
+   mark files as verified for later runs. */
+static void StoreVerificationResult(std::string const &Message)
+{
+   std::string const Key = LookupTag(Message, "Signature-Cache-Key");
+   std::string const Status = LookupTag(Message, "Signature-Cache-Status");
+   if (Key.length() != 64 || Key.find_first_not_of("0123456789abcdef") != std::string::npos || Status.empty())
+      return;
+   std::string const Dir = flCombine(_config->FindDir("Dir::State"), "signatures/");
+   if (DirectoryExists(Dir) == false)
+      return;
+
+   _error->PushToStack();
+   FileFd Out(Dir + Key, FileFd::WriteAtomic, 0644);
+   std::string const Content = Key + '\n' + Status + '\n';
+   if (Out.IsOpen())
+      Out.Write(Content.c_str(), Content.length());
+   Out.Close();
+   _error->RevertToStack();
+}
+									/*}}}*/
 bool pkgAcqMetaBase::CheckAuthDone(string const &Message, pkgAcquire::MethodConfig const *const Cnf) /*{{{*/
 {
    /* If we work with a recent version of our gpgv method, we expect that it tells us
@@ -1467,6 +1552,7 @@ bool pkgAcqMetaBase::CheckAuthDone(string const &Message, pkgAcquire::MethodConf
    // to verify the indexes we are about to download
    if (_config->FindB("Debug::pkgAcquire::Auth", false))
       std::cerr << "Signature verification succeeded: " << DestFile << std::endl;
+   StoreVerificationResult(Message);
 
    if (TransactionManager->IMSHit == false)
    {
@@ -2334,6 +2420,57 @@ static bool RemoveFileForBootstrapLinking(std::string &ErrorText, std::string co
    return true;
 }
 									/*}}}*/
+// PDiff cost model - predict if patching beats a full download		/*{{{*/
+// ---------------------------------------------------------------------
+/* Based on the latency and throughput measured for the site serving the
+   index as well as the rate at which rred patches and store decompresses
+   locally. Predictions are kept until the index is done so that the debug
+   output can compare them with reality. */
+namespace {
+struct PDiffPrediction
+{
+   bool Patching;
+   double Patch;
+   double Full;
+   std::chrono::steady_clock::time_point Start;
+};
+}
+static std::map<std::string, PDiffPrediction> PDiffPredictions;
+static bool PredictPDiffCosts(std::string const &Site, unsigned long long const PatchSize,
+			      unsigned long long const Rounds,
+			      unsigned long long const FullSize, unsigned long long const IndexSize,
+			      double &PatchCost, double &FullCost)
+{
+   if (_config->FindB("Acquire::PDiffs::CostModel", false) == false ||
+       PatchSize == 0 || FullSize == 0 || IndexSize == 0)
+      return false;
+   double Latency, Throughput, Unused, RredSpeed, StoreSpeed;
+   if (pkgAcquire::Worker::GetSiteStatistics(Site, Latency, Throughput) == false ||
+       pkgAcquire::Worker::GetSiteStatistics("rred:", Unused, RredSpeed) == false ||
+       pkgAcquire::Worker::GetSiteStatistics("store:", Unused, StoreSpeed) == false)
+      return false;
+   // patches applied one after the other are requested and applied one by one
+   PatchCost = Rounds * (Latency + IndexSize / RredSpeed) + PatchSize / Throughput;
+   FullCost = Latency + FullSize / Throughput + IndexSize / StoreSpeed;
+   return true;
+}
+static void ReportPDiffCost(IndexTarget const &Target, bool const Patched)
+{
+   auto const P = PDiffPredictions.find(Target.URI);
+   if (P == PDiffPredictions.end())
+      return;
+   if (_config->FindB("Debug::pkgAcquire::Diffs", false))
+   {
+      double const Took = std::chrono::duration<double>(std::chrono::steady_clock::now() - P->second.Start).count();
+      std::clog << "PDiff cost model for " << Target.URI << ": " << (Patched ? "patching" : "full download")
+		<< " took " << Took << "s, predicted " << (Patched ? P->second.Patch : P->second.Full) << "s";
+      if (Patched != P->second.Patching)
+	 std::clog << " (fallback)";
+      std::clog << std::endl;
+   }
+   PDiffPredictions.erase(P);
+}
+									/*}}}*/
 bool pkgAcqDiffIndex::ParseDiffIndex(string const &IndexDiffFile)	/*{{{*/
 {
    available_patches.clear();
@@ -2599,42 +2736,69 @@ bool pkgAcqDiffIndex::ParseDiffIndex(string const &IndexDiffFile)	/*{{{*/
       based merging can be attempt in which case the second is better.
       "bad things" will happen if patches are merged on the server,
       but client side merging is attempt as well */
-   pdiff_merge = _config->FindB("Acquire::PDiffs::Merge", true);
-   if (pdiff_merge == true)
-   {
-      // reprepro and dak add this flag if they merge patches on the server
-      std::string const precedence = Tags.FindS("X-Patch-Precedence");
-      pdiff_merge = (precedence != "merged");
-   }
+   // reprepro and dak add this flag if they merge patches on the server
+   bool const server_merged = Tags.FindS("X-Patch-Precedence") == "merged";
+   pdiff_merge = _config->FindB("Acquire::PDiffs::Merge", true) && not server_merged;
 
    // calculate the size of all patches we have to get
-   unsigned short const sizeLimitPercent = _config->FindI("Acquire::PDiffs::SizeLimit", 100);
-   if (sizeLimitPercent > 0)
-   {
-      unsigned long long downloadSize = 0;
-      if (pdiff_merge)
-	 downloadSize = std::accumulate(available_patches.begin(), available_patches.end(), 0llu,
-					[](unsigned long long const T, DiffInfo const &I) {
-					   return T + I.download_hashes.FileSize();
-					});
-      // if server-side merging, assume we will need only the first patch
-      else if (not available_patches.empty())
-	 downloadSize = available_patches.front().download_hashes.FileSize();
-      if (downloadSize != 0)
-      {
-	 unsigned long long downloadSizeIdx = 0;
-	 auto const types = VectorizeString(Target.Option(IndexTarget::COMPRESSIONTYPES), ' ');
-	 for (auto const &t : types)
-	 {
-	    std::string MetaKey = Target.MetaKey;
-	    if (t != "uncompressed")
-	       MetaKey += '.' + t;
-	    HashStringList const hsl = GetExpectedHashesFor(MetaKey);
-	    if (unlikely(hsl.usable() == false))
-	       continue;
-	    downloadSizeIdx = hsl.FileSize();
-	    break;
-	 }
+   unsigned long long downloadSize = 0;
+   if (pdiff_merge)
+      downloadSize = std::accumulate(available_patches.begin(), available_patches.end(), 0llu,
+				     [](unsigned long long const T, DiffInfo const &I) {
+					return T + I.download_hashes.FileSize();
+				     });
+   // if server-side merging, assume we will need only the first patch
+   else if (not available_patches.empty())
+      downloadSize = available_patches.front().download_hashes.FileSize();
+   unsigned long long downloadSizeIdx = 0;
+   if (downloadSize != 0)
+   {
+      auto const types = VectorizeString(Target.Option(IndexTarget::COMPRESSIONTYPES), ' ');
+      for (auto const &t : types)
+      {
+	 std::string MetaKey = Target.MetaKey;
+	 if (t != "uncompressed")
+	    MetaKey += '.' + t;
+	 HashStringList const hsl = GetExpectedHashesFor(MetaKey);
+	 if (unlikely(hsl.usable() == false))
+	    continue;
+	 downloadSizeIdx = hsl.FileSize();
+	 break;
+      }
+   }
+
+   // with measurements at hand predict which way is faster, otherwise guess by size
+   double patchCost, fullCost;
+   unsigned long long const indexSize = available_patches.empty() ? 0 : available_patches.back().result_hashes.FileSize();
+   // without merging all patches are needed, but each in a round of its own
+   unsigned long long patchRounds = 1;
+   unsigned long long patchSize = downloadSize;
+   if (not pdiff_merge && not server_merged && downloadSize != 0)
+   {
+      patchRounds = available_patches.size();
+      patchSize = std::accumulate(available_patches.begin(), available_patches.end(), 0llu,
+				  [](unsigned long long const T, DiffInfo const &I) {
+				     return T + I.download_hashes.FileSize();
+				  });
+   }
+   if (PredictPDiffCosts(URI::SiteOnly(Desc.URI), patchSize, patchRounds, downloadSizeIdx, indexSize, patchCost, fullCost))
+   {
+      bool const patching = patchCost <= fullCost;
+      if (Debug)
+	 std::clog << "PDiff cost model for " << Target.URI << ": patching " << patchCost
+		   << "s in " << patchRounds << " round(s), full download " << fullCost << "s" << std::endl;
+      PDiffPredictions[Target.URI] = {patching, patchCost, fullCost, std::chrono::steady_clock::now()};
+      if (not patching)
+      {
+	 strprintf(ErrorText, "Patching predicted to take %.2fs, but downloading %llu bytes only %.2fs", patchCost, downloadSizeIdx, fullCost);
+	 return false;
+      }
+   }
+   else
+   {
+      unsigned short const sizeLimitPercent = _config->FindI("Acquire::PDiffs::SizeLimit", 100);
+      if (sizeLimitPercent > 0 && downloadSize != 0)
+      {
 	 unsigned long long const sizeLimit = downloadSizeIdx * sizeLimitPercent;
 	 if ((sizeLimit/100) < downloadSize)
 	 {
@@ -2817,6 +2981,8 @@ void pkgAcqIndexDiffs::Finish(bool allDone)
       std::string const Final = GetKeepCompressedFileName(GetFinalFilename(), Target);
       TransactionManager->TransactionStageCopy(this, DestFile, Final);
 
+      ReportPDiffCost(Target, true);
+
       // this is for the "real" finish
       Complete = true;
       Status = StatDone;
@@ -3082,6 +3248,8 @@ void pkgAcqIndexMergeDiffs::Done(string const &Message, HashStringList const &Ha
 	    RemoveFile("pkgAcqIndexMergeDiffs::Done", GetMergeDiffsPatchFileName(UnpatchedFile, (*I)->patch.file));
 	 RemoveFile("pkgAcqIndexMergeDiffs::Done", UnpatchedFile);
 
+	 ReportPDiffCost(Target, true);
+
 	 // all set and done
 	 Complete = true;
 	 if(Debug)
@@ -3192,9 +3360,30 @@ string pkgAcqIndex::Custom600Headers() const
    if(Target.IsOptional)
       msg += "\nFail-Ignore: true";
 
+   // methods supporting it can decompress the index while downloading it
+   if (Stage == STAGE_DOWNLOAD && CurrentCompressionExtension != "uncompressed" &&
+       _config->FindB("Acquire::Streaming-Decompress", false))
+   {
+      HashStringList const Expected = GetExpectedHashesFor(Target.MetaKey);
+      if (Expected.usable())
+      {
+	 msg.append("\nDecompress-To: ").append(GetStreamDecompressTarget());
+	 for (auto const &hs : Expected)
+	    msg.append("\nDecompress-Expected-").append(hs.HashType()).append(": ").append(hs.HashValue());
+      }
+   }
+
    return msg;
 }
 									/*}}}*/
+// AcqIndex::GetStreamDecompressTarget - Decompress while downloading	/*{{{*/
+std::string pkgAcqIndex::GetStreamDecompressTarget() const
+{
+   std::string const Decompressed = GetKeepCompressedFileName(GetPartialFileNameFromURI(Target.URI), Target);
+   // kept compressed as downloaded, so the decompressed data is only hashed
+   return Decompressed == DestFile ? "/dev/null" : Decompressed;
+}
+									/*}}}*/
 // AcqIndex::Failed - getting the indexfile failed			/*{{{*/
 bool pkgAcqIndex::CommonFailed(std::string const &TargetURI,
 			       std::string const &Message, pkgAcquire::MethodConfig const *const Cnf)
@@ -3270,6 +3459,21 @@ void pkgAcqIndex::StageDownloadDone(string const &Message)
       SetActiveSubprocess(::URI(Desc.URI).Access);
       return;
    }
+   // the method decompressed the file while downloading it
+   else if (AltFilename.empty() == false && AltFilename == GetStreamDecompressTarget())
+   {
+      HashStringList const Expected = GetExpectedHashesFor(Target.MetaKey);
+      if (Expected.usable() && Expected == GetHashesFromMessage("Alt-", Message))
+      {
+	 Stage = STAGE_DECOMPRESS_AND_VERIFY;
+	 DestFile = GetKeepCompressedFileName(GetPartialFileNameFromURI(Target.URI), Target);
+	 if (DestFile != Filename)
+	    EraseFileName = Filename;
+	 return StageDecompressDone();
+      }
+      if (AltFilename != "/dev/null")
+	 RemoveFile("pkgAcqIndex::StageDownloadDone", AltFilename);
+   }
    // methods like file:// give us an alternative (uncompressed) file
    else if (Target.KeepCompressed == false && AltFilename.empty() == false)
    {
@@ -3318,19 +3522,76 @@ void pkgAcqIndex::StageDecompressDone()
    if (DestFile == "/dev/null")
       DestFile = GetKeepCompressedFileName(GetPartialFileNameFromURI(Target.URI), Target);
 
+   ReportPDiffCost(Target, false);
+
    // Done, queue for rename on transaction finished
    TransactionManager->TransactionStageCopy(this, DestFile, GetFinalFilename());
 }
 									/*}}}*/
 pkgAcqIndex::~pkgAcqIndex() {}
 
+// GetArchiveDeltas - deltas published next to a Packages index	/*{{{*/
+/* The deltas are listed in an index of their own, which is enabled like
+   any other target, keyed by package, architecture and both versions. */
+struct ArchiveDelta
+{
+   std::string Filename;
+   HashStringList Hashes;
+};
+static std::unordered_map<std::string, ArchiveDelta> const &GetArchiveDeltas(pkgSourceList *const Sources, IndexTarget const &Packages)
+{
+   static std::map<std::string, std::unordered_map<std::string, ArchiveDelta>> Cache;
+   auto const Key = Packages.Option(IndexTarget::FILENAME);
+   auto const Cached = Cache.find(Key);
+   if (Cached != Cache.end())
+      return Cached->second;
+
+   auto &Deltas = Cache[Key];
+   _error->PushToStack();
+   for (auto const &Meta : *Sources)
+      for (auto const &T : Meta->GetIndexTargets())
+      {
+	 if (T.Option(IndexTarget::CREATED_BY) != "Deltas" ||
+	     T.Option(IndexTarget::REPO_URI) != Packages.Option(IndexTarget::REPO_URI) ||
+	     T.Option(IndexTarget::RELEASE) != Packages.Option(IndexTarget::RELEASE) ||
+	     T.Option(IndexTarget::COMPONENT) != Packages.Option(IndexTarget::COMPONENT) ||
+	     T.Option(IndexTarget::ARCHITECTURE) != Packages.Option(IndexTarget::ARCHITECTURE))
+	    continue;
+	 std::string const File = T.Option(IndexTarget::EXISTING_FILENAME);
+	 FileFd Fd;
+	 if (File.empty() || Fd.Open(File, FileFd::ReadOnly, FileFd::Extension) == false)
+	    continue;
+	 pkgTagFile Tags(&Fd);
+	 pkgTagSection Section;
+	 while (Tags.Step(Section))
+	 {
+	    ArchiveDelta Delta;
+	    Delta.Filename = Section.FindS("Filename");
+	    for (char const *const *type = HashString::SupportedHashes(); *type != NULL; ++type)
+	    {
+	       std::string const hash = Section.FindS(*type);
+	       if (hash.empty() == false)
+		  Delta.Hashes.push_back(HashString(*type, hash));
+	    }
+	    Delta.Hashes.FileSize(Section.FindULL("Size", 0));
+	    if (Delta.Filename.empty() || Delta.Hashes.usable() == false)
+	       continue;
+	    Deltas.emplace(Section.FindS("Package") + ' ' + Section.FindS("Architecture") + ' ' +
+			      Section.FindS("Old-Version") + ' ' + Section.FindS("New-Version"),
+			   std::move(Delta));
+	 }
+      }
+   _error->RevertToStack();
+   return Deltas;
+}
+									/*}}}*/
 // AcqArchive::AcqArchive - Constructor					/*{{{*/
 // ---------------------------------------------------------------------
 /* This just sets up the initial fetch environment and queues the first
    possibilitiy */
 pkgAcqArchive::pkgAcqArchive(pkgAcquire *const Owner, pkgSourceList *const Sources,
 			     pkgRecords *const Recs, pkgCache::VerIterator const &Version,
-			     string &StoreFilename) : Item(Owner), d(NULL), LocalSource(false), Version(Version), Sources(Sources), Recs(Recs),
+			     string &StoreFilename) : Item(Owner), d(new Private()), LocalSource(false), Version(Version), Sources(Sources), Recs(Recs),
 						      StoreFilename(StoreFilename),
 						      Trusted(false)
 {
@@ -3459,9 +3720,25 @@ pkgAcqArchive::pkgAcqArchive(pkgAcquire *const Owner, pkgSourceList *const Sourc
 	 for (auto const &f : fields)
 	    customfields[f.first] = f.second;
 	 FileSize = Version->Size;
+
+	 // a delta rebuilds the archive from the files of the installed version
+	 auto const debIndex = dynamic_cast<pkgDebianIndexTargetFile const *const>(Index);
+	 auto const Current = Version.ParentPkg().CurrentVer();
+	 if (debIndex != nullptr && Current.end() == false && Current != Version &&
+	     Version.ParentPkg()->CurrentState == pkgCache::State::Installed)
+	 {
+	    auto const &Deltas = GetArchiveDeltas(Sources, debIndex->GetIndexTarget());
+	    auto const Delta = Deltas.find(std::string(Version.ParentPkg().Name()) + ' ' + Version.Arch() + ' ' +
+					   Current.VerStr() + ' ' + Version.VerStr());
+	    if (Delta != Deltas.end())
+	    {
+	       d->DeltaURI = Index->ArchiveURI(Delta->second.Filename);
+	       d->DeltaHashes = Delta->second.Hashes;
+	    }
+	 }
       }
       else
-	 PushAlternativeURI(Index->ArchiveURI(poolfilename), std::move(fields), true);
+	 d->Alternatives.emplace_back(Index->ArchiveURI(poolfilename), std::move(fields));
    }
    if (StoreFilename.empty())
    {
@@ -3489,6 +3766,9 @@ pkgAcqArchive::pkgAcqArchive(pkgAcquire *const Owner, pkgSourceList *const Sourc
 	 Local = true;
 	 Status = StatDone;
 	 StoreFilename = DestFile = FinalFile;
+	 // the content is checked for all such archives at once, see VerifyLocalArchives
+	 d->VerifyLocal = _config->FindB("Acquire::Verify-Local-Archives", true) &&
+			  VerifiedArchives.find(VerifiedArchiveKey(FinalFile, Buf)) == VerifiedArchives.end();
 	 return;
       }
 
@@ -3497,7 +3777,13 @@ pkgAcqArchive::pkgAcqArchive(pkgAcquire *const Owner, pkgSourceList *const Sourc
       RemoveFile("pkgAcqArchive::QueueNext", FinalFile);
    }
 
+   QueueDownload();
+}
+									/*}}}*/
+void pkgAcqArchive::QueueDownload()					/*{{{*/
+{
    // Check the destination file
+   struct stat Buf;
    DestFile = _config->FindDir("Dir::Cache::Archives") + "partial/" + flNotDir(StoreFilename);
    if (stat(DestFile.c_str(), &Buf) == 0)
    {
@@ -3515,10 +3801,37 @@ pkgAcqArchive::pkgAcqArchive(pkgAcquire *const Owner, pkgSourceList *const Sourc
       Complete = true;
       Local = true;
       Status = StatDone;
-      StoreFilename = DestFile = FinalFile;
+      StoreFilename = DestFile = GetFinalFilename();
       return;
    }
 
+   /* Prefer continuing a partial download and the shared cache over the
+      delta. The alternatives are all for the archive, not the delta. */
+   if (d->DeltaURI.empty() == false && PartialSize == 0 &&
+       pkgAcquire::SharedCacheLookup(ExpectedHashes).empty())
+   {
+      d->UsingDelta = true;
+      d->FullURI = Desc.URI;
+      d->FullDescription = Desc.Description;
+      Desc.URI = d->DeltaURI;
+      Desc.Description.append(" (delta)");
+      FileSize = d->DeltaHashes.FileSize();
+      DestFile.append(".delta");
+      if (stat(DestFile.c_str(), &Buf) == 0)
+      {
+	 if ((unsigned long long)Buf.st_size > FileSize)
+	    RemoveFile("pkgAcqArchive::QueueNext", DestFile);
+	 else
+	    PartialSize = Buf.st_size;
+      }
+   }
+   else
+   {
+      for (auto &A : d->Alternatives)
+	 PushAlternativeURI(std::move(A.first), std::move(A.second), true);
+      d->Alternatives.clear();
+   }
+
    // Create the item
    Local = false;
    QueueURI(Desc);
@@ -3539,7 +3852,28 @@ void pkgAcqArchive::Done(string const &Message, HashStringList const &Hashes,
 
    // Grab the output filename
    std::string const FileName = LookupTag(Message,"Filename");
-   if (DestFile !=  FileName && RealFileExists(DestFile) == false)
+   if (d->UsingDelta && d->RebuildingDelta == false)
+   {
+      // local sources hand us their file instead of a copy
+      d->DeltaCopied = RealFileExists(DestFile);
+      d->DeltaFile = d->DeltaCopied ? DestFile : FileName;
+      DestFile = _config->FindDir("Dir::Cache::Archives") + "partial/" + flNotDir(StoreFilename);
+      // the rebuild reads the installed files, so it happens in a method
+      d->RebuildingDelta = true;
+      Local = true;
+      Desc.URI = "debdelta:" + pkgAcquire::URIEncode(d->DeltaFile);
+      QueueURI(Desc);
+      SetActiveSubprocess("debdelta");
+      return;
+   }
+   else if (d->UsingDelta)
+   {
+      if (d->DeltaCopied)
+	 RemoveFile("pkgAcqArchive::Done", d->DeltaFile);
+      d->UsingDelta = d->RebuildingDelta = false;
+      Local = false;
+   }
+   else if (DestFile !=  FileName && RealFileExists(DestFile) == false)
    {
       StoreFilename = DestFile = FileName;
       Local = true;
@@ -3552,6 +3886,11 @@ void pkgAcqArchive::Done(string const &Message, HashStringList const &Hashes,
    Rename(DestFile,FinalFile);
    StoreFilename = DestFile = FinalFile;
    Complete = true;
+
+   // the hashes were checked while acquiring it already
+   struct stat Buf;
+   if (stat(FinalFile.c_str(), &Buf) == 0)
+      VerifiedArchives.insert(VerifiedArchiveKey(FinalFile, Buf));
 }
 									/*}}}*/
 // AcqArchive::Failed - Failure handler					/*{{{*/
@@ -3559,9 +3898,173 @@ void pkgAcqArchive::Done(string const &Message, HashStringList const &Hashes,
 /* Here we try other sources */
 void pkgAcqArchive::Failed(string const &Message,pkgAcquire::MethodConfig const * const Cnf)
 {
+   if (d->UsingDelta)
+   {
+      RemoveFile("pkgAcqArchive::Failed", DestFile);
+      if (d->RebuildingDelta && d->DeltaCopied)
+	 RemoveFile("pkgAcqArchive::Failed", d->DeltaFile);
+      FallbackFromDelta(LookupTag(Message, "Message"));
+      return;
+   }
    Item::Failed(Message,Cnf);
 }
 									/*}}}*/
+void pkgAcqArchive::FallbackFromDelta(std::string const &Reason)	/*{{{*/
+{
+   if (_config->FindB("Debug::pkgAcquire::Deltas", false))
+      std::clog << "Can't use delta " << Desc.URI << " (" << Reason << "), downloading the archive instead" << std::endl;
+   d->UsingDelta = d->RebuildingDelta = false;
+   Local = false;
+   Desc.URI = d->FullURI;
+   Desc.Description = d->FullDescription;
+   for (auto &A : d->Alternatives)
+      PushAlternativeURI(std::move(A.first), std::move(A.second), true);
+   d->Alternatives.clear();
+   FileSize = Version->Size;
+   PartialSize = 0;
+   DestFile = _config->FindDir("Dir::Cache::Archives") + "partial/" + flNotDir(StoreFilename);
+   RemoveFile("pkgAcqArchive::FallbackFromDelta", DestFile);
+   ErrorText.clear();
+   Status = StatIdle;
+   Complete = false;
+   QueueURI(Desc);
+}
+									/*}}}*/
+// AcqArchive::VerifyLocalArchives - Check the archives we have already	/*{{{*/
+// ---------------------------------------------------------------------
+/* Archives found in Dir::Cache::archives with the expected size were used
+   as-is so far. They are checked now against the expected hashes and for
+   the structure of a .deb in parallel, as this is bound by the CPU for a
+   cache filled e.g. by a --download-only run. Bad ones are downloaded. */
+struct VerifyLocalArchiveCheck
+{
+   // all of it is decided in the main thread as it involves the configuration
+   HashStringList Compare;
+   unsigned int Calculate;
+   bool Good;
+   std::string Reason;
+};
+static bool VerifyLocalArchive(std::string const &File, APT::Configuration::Compressor const &Plain,
+			       VerifyLocalArchiveCheck &Check)
+{
+   // runs in its own thread, so everything here has to leave _config alone:
+   // no compressor detection, no forced hash type, no usable() checks
+   _error->PushToStack();
+   FileFd Fd;
+   bool Good = Fd.Open(File, FileFd::ReadOnly, Plain);
+   if (Good == true && Check.Compare.empty() == false)
+   {
+      Hashes Hash(Check.Calculate);
+      Good = Hash.AddFD(Fd);
+      HashStringList const Calculated = Hash.GetHashStringList();
+      for (auto const &Expected : Check.Compare)
+      {
+	 if (Good == false)
+	    break;
+	 auto const Got = Calculated.find(Expected.HashType().c_str());
+	 Good = Got != nullptr && *Got == Expected;
+      }
+      if (Good == false && _error->PendingError() == false)
+	 Check.Reason = "Hash Sum mismatch";
+   }
+   if (Good == true && Fd.Seek(0) == true)
+   {
+      debDebFile const Deb(Fd);
+      Good = _error->PendingError() == false;
+   }
+   if (Good == false && Check.Reason.empty() == true)
+      _error->PopMessage(Check.Reason);
+   _error->RevertToStack();
+   return Good;
+}
+// the hashes HashStringList::operator== would compare, resolved up front
+static VerifyLocalArchiveCheck VerifyLocalArchiveChecks(HashStringList const &ExpectedHashes,
+							 std::string const &ForcedType)
+{
+   VerifyLocalArchiveCheck Check{{}, 0, false, ""};
+   if (ExpectedHashes.usable() == false)
+      return Check;
+   static struct { char const * const Name; Hashes::SupportedHashes const Type; } const Types[] = {
+      {"MD5Sum", Hashes::MD5SUM}, {"SHA1", Hashes::SHA1SUM},
+      {"SHA256", Hashes::SHA256SUM}, {"SHA512", Hashes::SHA512SUM},
+   };
+   for (auto const &Expected : ExpectedHashes)
+   {
+      if (ForcedType.empty() == false && strcasecmp(ForcedType.c_str(), Expected.HashType().c_str()) != 0)
+	 continue;
+      for (auto const &T : Types)
+	 if (strcasecmp(T.Name, Expected.HashType().c_str()) == 0)
+	    Check.Calculate |= T.Type;
+      Check.Compare.push_back(Expected);
+   }
+   return Check;
+}
+void pkgAcqArchive::VerifyLocalArchives(pkgAcquire * const Owner)
+{
+   std::vector<pkgAcqArchive *> Archives;
+   for (auto I = Owner->ItemsBegin(); I != Owner->ItemsEnd(); ++I)
+   {
+      auto const Archive = dynamic_cast<pkgAcqArchive *>(*I);
+      if (Archive != nullptr && Archive->d->VerifyLocal == true)
+	 Archives.push_back(Archive);
+   }
+   if (Archives.empty() == true)
+      return;
+   APT::Trace::Phase const phase("pkgAcqArchive::VerifyLocalArchives");
+
+   std::string const ForcedType = _config->Find("Acquire::ForceHash");
+   std::vector<VerifyLocalArchiveCheck> Checks;
+   Checks.reserve(Archives.size());
+   for (auto const &A : Archives)
+      Checks.push_back(VerifyLocalArchiveChecks(A->ExpectedHashes, ForcedType));
+   // without a binary FileFd neither detects compressors nor reads ahead
+   APT::Configuration::Compressor const Plain(".", "", "", nullptr, nullptr, 0);
+
+   long Threads = _config->FindI("Acquire::Verify-Local-Archives::Threads", 0);
+   if (Threads <= 0)
+#ifdef _SC_NPROCESSORS_ONLN
+      Threads = sysconf(_SC_NPROCESSORS_ONLN);
+#else
+      Threads = 1;
+#endif
+   Threads = std::max(1l, std::min<long>(Threads, Archives.size()));
+
+   std::atomic<size_t> Next(0);
+   auto const Verify = [&]() {
+      for (size_t I = Next++; I < Archives.size(); I = Next++)
+	 Checks[I].Good = VerifyLocalArchive(Archives[I]->DestFile, Plain, Checks[I]);
+   };
+   std::vector<std::thread> Workers;
+   for (long T = 1; T < Threads; ++T)
+      Workers.emplace_back(Verify);
+   Verify();
+   for (auto &W : Workers)
+      W.join();
+
+   bool const Debug = _config->FindB("Debug::pkgAcquire::Archives", false);
+   for (size_t I = 0; I < Archives.size(); ++I)
+   {
+      auto const A = Archives[I];
+      A->d->VerifyLocal = false;
+      if (Checks[I].Good == true)
+      {
+	 struct stat Buf;
+	 if (stat(A->DestFile.c_str(), &Buf) == 0)
+	    VerifiedArchives.insert(VerifiedArchiveKey(A->DestFile, Buf));
+	 continue;
+      }
+      if (Debug == true)
+	 std::clog << "Can't use " << A->DestFile << " (" << Checks[I].Reason << "), downloading it again" << std::endl;
+      RemoveFile("pkgAcqArchive::VerifyLocalArchives", A->DestFile);
+      A->Complete = false;
+      A->Local = false;
+      A->Status = StatIdle;
+      A->QueueDownload();
+   }
+   if (Debug == true)
+      std::clog << "Verified " << Archives.size() << " local archives with " << Threads << " threads" << std::endl;
+}
+									/*}}}*/
 APT_PURE bool pkgAcqArchive::IsTrusted() const				/*{{{*/
 {
    return Trusted;
@@ -3585,7 +4088,10 @@ std::string pkgAcqArchive::ShortDesc() const				/*{{{*/
    return Desc.ShortDesc;
 }
 									/*}}}*/
-pkgAcqArchive::~pkgAcqArchive() {}
+pkgAcqArchive::~pkgAcqArchive()
+{
+   delete d;
+}
 
 // AcqChangelog::pkgAcqChangelog - Constructors				/*{{{*/
 class pkgAcqChangelog::Private
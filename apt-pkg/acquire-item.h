@@ -678,6 +678,8 @@ class APT_HIDDEN pkgAcqIndex : public pkgAcqBaseIndex
              std::string const &ShortDesc);
    APT_HIDDEN bool CommonFailed(std::string const &TargetURI,
 				std::string const &Message, pkgAcquire::MethodConfig const *const Cnf);
+   /** \brief The file a method should decompress the download into */
+   APT_HIDDEN std::string GetStreamDecompressTarget() const;
 };
 									/*}}}*/
 struct APT_HIDDEN DiffInfo {						/*{{{*/
@@ -942,7 +944,8 @@ class APT_HIDDEN pkgAcqIndexDiffs : public pkgAcqBaseIndex
  */
 class APT_PUBLIC pkgAcqArchive : public pkgAcquire::Item
 {
-   void * const d;
+   class Private;
+   Private * const d;
 
    bool LocalSource;
    HashStringList ExpectedHashes;
@@ -974,6 +977,12 @@ class APT_PUBLIC pkgAcqArchive : public pkgAcquire::Item
    /** \brief Queue up the next available file for this version. */
    bool QueueNext();
 
+   /** \brief Download the archive itself as the delta can't be used. */
+   APT_HIDDEN void FallbackFromDelta(std::string const &Reason);
+
+   /** \brief Queue the download as the archive isn't available locally. */
+   APT_HIDDEN void QueueDownload();
+
    /** \brief Get the full pathname of the final file for the current URI */
    virtual std::string GetFinalFilename() const APT_OVERRIDE;
 
@@ -989,6 +998,14 @@ class APT_PUBLIC pkgAcqArchive : public pkgAcquire::Item
    virtual HashStringList GetExpectedHashes() const APT_OVERRIDE;
    virtual bool HashesRequired() const APT_OVERRIDE;
 
+   /** \brief Check the archives of Owner which were found locally.
+    *
+    *  The archives are checked in parallel against their hashes and
+    *  for a valid .deb structure. Bad ones are removed and queued for
+    *  download instead.
+    */
+   APT_HIDDEN static void VerifyLocalArchives(pkgAcquire * const Owner);
+
    /** \brief Create a new pkgAcqArchive.
     *
     *  \param Owner The pkgAcquire object with which this item is
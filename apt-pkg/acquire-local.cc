@@ -0,0 +1,343 @@
+// -*- mode: cpp; mode: fold -*-
+// Description								/*{{{*/
+/* ######################################################################
+
+   Local Fetcher - the file, copy and store methods
+
+   ##################################################################### */
+									/*}}}*/
+// Include Files							/*{{{*/
+#include <config.h>
+
+#include <apt-pkg/acquire-local.h>
+#include <apt-pkg/aptconfiguration.h>
+#include <apt-pkg/configuration.h>
+#include <apt-pkg/error.h>
+#include <apt-pkg/fileutl.h>
+#include <apt-pkg/hashes.h>
+#include <apt-pkg/strutl.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <apti18n.h>
+									/*}}}*/
+
+namespace APT
+{
+namespace Internal
+{
+
+class LocalFetcher::Private
+{
+   public:
+   std::string const Access;
+   bool const URIEncoded;
+   bool const Compress;
+   bool const ReadAhead;
+   std::vector<APT::Configuration::Compressor> const Compressors;
+
+   std::string Decode(std::string const &part) const
+   {
+      return URIEncoded ? DeQuoteString(part) : part;
+   }
+
+   unsigned int WithReadAhead(unsigned int const Mode) const
+   {
+      if ((Mode & FileFd::ReadWrite) != FileFd::ReadOnly)
+	 return Mode;
+      return Mode | (ReadAhead ? FileFd::ReadAhead : FileFd::NoReadAhead);
+   }
+   bool Open(FileFd &Fd, std::string const &File, unsigned int const Mode, FileFd::CompressMode const Compress) const
+   {
+      return Fd.Open(File, WithReadAhead(Mode), Compress);
+   }
+   bool OpenByName(FileFd &Fd, std::string const &File, unsigned int const Mode, std::string const &Name) const
+   {
+      if (Name == "store")
+	 return Open(Fd, File, Mode, FileFd::Extension);
+      auto const c = std::find_if(Compressors.begin(), Compressors.end(),
+				  [&](APT::Configuration::Compressor const &c) { return c.Name == Name; });
+      if (c == Compressors.end())
+	 return _error->Error("Extraction of file %s requires unknown compressor %s", File.c_str(), Name.c_str());
+      return Fd.Open(File, WithReadAhead(Mode), *c);
+   }
+
+   bool CalculateHashes(Item const &Itm, Result &Res) const
+   {
+      Hashes Hash(Itm.ExpectedHashes);
+      FileFd Fd;
+      if (Open(Fd, Res.Filename, FileFd::ReadOnly, FileFd::None) == false || Hash.AddFD(Fd) == false)
+	 return false;
+      Res.Hashes = Hash.GetHashStringList();
+      return true;
+   }
+   static bool TransferModificationTimes(char const * const From, char const * const To, time_t &LastModified)
+   {
+      if (strcmp(To, "/dev/null") == 0)
+	 return true;
+
+      struct stat Buf2;
+      if (lstat(To, &Buf2) != 0 || S_ISLNK(Buf2.st_mode))
+	 return true;
+
+      struct stat Buf;
+      if (stat(From, &Buf) != 0)
+	 return _error->Errno("stat",_("Failed to stat"));
+
+      // we don't use utimensat here for compatibility reasons: #738567
+      struct timeval times[2];
+      times[0].tv_sec = Buf.st_atime;
+      LastModified = times[1].tv_sec = Buf.st_mtime;
+      times[0].tv_usec = times[1].tv_usec = 0;
+      if (utimes(To, times) != 0)
+	 return _error->Errno("utimes",_("Failed to set modification time"));
+      return true;
+   }
+
+   Private(std::string &&Access, bool const Compress) : Access(std::move(Access)),
+      URIEncoded(_config->FindB("Acquire::Send-URI-Encoded", true)),
+      Compress(Compress),
+      ReadAhead(_config->FindB("APT::FileFd::Read-Ahead", false)),
+      Compressors(APT::Configuration::getCompressors())
+   {
+   }
+};
+
+LocalFetcher::LocalFetcher(std::string Access, bool const Compress) : d(new Private(std::move(Access), Compress)) {}
+LocalFetcher::~LocalFetcher() {}
+
+bool LocalFetcher::Supports(std::string const &Access)			/*{{{*/
+{
+   return Access == "copy" || Access == "store" || Access == "file";
+}
+									/*}}}*/
+bool LocalFetcher::Threadable() const					/*{{{*/
+{
+   return std::all_of(d->Compressors.begin(), d->Compressors.end(), [](APT::Configuration::Compressor const &c) {
+      return c.Name == "." || c.Binary.empty()
+#ifdef HAVE_ZLIB
+	 || c.Name == "gzip"
+#endif
+#ifdef HAVE_BZ2
+	 || c.Name == "bzip2"
+#endif
+#ifdef HAVE_LZMA
+	 || c.Name == "xz" || c.Name == "lzma"
+#endif
+#ifdef HAVE_LZ4
+	 || c.Name == "lz4"
+#endif
+#ifdef HAVE_ZSTD
+	 || c.Name == "zstd"
+#endif
+	 ;
+   });
+}
+									/*}}}*/
+bool LocalFetcher::Fetch(Item const &Itm) const	/*{{{*/
+{
+   if (d->Access == "copy")
+      return FetchCopy(Itm);
+   else if (d->Access == "file")
+      return FetchFile(Itm);
+   return FetchStore(Itm);
+}
+									/*}}}*/
+// LocalFetcher::FetchCopy - copies the file to the destination	/*{{{*/
+bool LocalFetcher::FetchCopy(Item const &Itm) const
+{
+   // this ensures that relative paths work in copy
+   std::string const File = d->Decode(Itm.Uri.substr(Itm.Uri.find(':')+1));
+
+   struct stat Buf;
+   if (stat(File.c_str(),&Buf) != 0)
+      return _error->Errno("stat",_("Failed to stat"));
+
+   Result Res;
+   Res.Size = Buf.st_size;
+   Res.Filename = Itm.DestFile;
+   Res.LastModified = Buf.st_mtime;
+   Res.IMSHit = false;
+   Start(Res);
+
+   // just calc the hashes if the source and destination are identical
+   if (File != Itm.DestFile && Itm.DestFile != "/dev/null")
+   {
+      FileFd From, To;
+      if (d->Open(From, File, FileFd::ReadOnly, FileFd::None) == false ||
+	  d->Open(To, Itm.DestFile, FileFd::WriteAtomic, FileFd::None) == false)
+	 return false;
+      To.EraseOnFailure();
+      if (CopyFile(From,To) == false)
+      {
+	 To.OpFail();
+	 return false;
+      }
+      From.Close();
+      if (To.Close() == false)
+	 return false;
+
+      if (d->TransferModificationTimes(File.c_str(), Res.Filename.c_str(), Res.LastModified) == false)
+	 return false;
+   }
+
+   if (d->CalculateHashes(Itm, Res) == false)
+      return false;
+   Done(Res, nullptr);
+   return true;
+}
+									/*}}}*/
+// LocalFetcher::FetchStore - (un)compresses while copying		/*{{{*/
+bool LocalFetcher::FetchStore(Item const &Itm) const
+{
+   URI Get(Itm.Uri);
+   std::string const Path = d->Decode(Get.Host + Get.Path); // To account for relative paths
+
+   Result Res;
+   Res.Filename = Itm.DestFile;
+   Start(Res);
+
+   FileFd From;
+   if (d->Compress == false)
+   {
+      if (d->OpenByName(From, Path, FileFd::ReadOnly, d->Access) == false)
+	 return false;
+      if (From.IsCompressed() && From.FileSize() == 0)
+	 return _error->Error(_("Empty files can't be valid archives"));
+   }
+   else if (d->Open(From, Path, FileFd::ReadOnly, FileFd::Extension) == false)
+      return false;
+
+   FileFd To;
+   if (Itm.DestFile != "/dev/null" && Itm.DestFile != Path)
+   {
+      if (d->Compress == false)
+      {
+	 if (d->Open(To, Itm.DestFile, FileFd::WriteOnly | FileFd::Create | FileFd::Atomic, FileFd::Extension) == false)
+	    return false;
+      }
+      else if (d->OpenByName(To, Itm.DestFile, FileFd::WriteOnly | FileFd::Create | FileFd::Empty, d->Access) == false)
+	 return false;
+      To.EraseOnFailure();
+   }
+
+   // Read data from source, generate checksums and write
+   Hashes Hash(Itm.ExpectedHashes);
+   Res.Size = 0;
+   // (de)compressors and hashes do better with big chunks than with many small ones
+   constexpr size_t BufSize = APT_BUFFER_SIZE * 16;
+   std::unique_ptr<unsigned char[]> Buf(new unsigned char[BufSize]);
+   while (true)
+   {
+      unsigned long long Count = 0;
+      if (From.Read(Buf.get(), BufSize, &Count) == false)
+      {
+	 if (To.IsOpen())
+	    To.OpFail();
+	 return false;
+      }
+      if (Count == 0)
+	 break;
+      Res.Size += Count;
+      Hash.Add(Buf.get(), Count);
+      if (To.IsOpen() && To.Write(Buf.get(), Count) == false)
+	 return false;
+   }
+   From.Close();
+   if (To.Close() == false)
+      return false;
+
+   if (d->TransferModificationTimes(Path.c_str(), Itm.DestFile.c_str(), Res.LastModified) == false)
+      return false;
+
+   Res.Hashes = Hash.GetHashStringList();
+   Done(Res, nullptr);
+   return true;
+}
+									/*}}}*/
+// LocalFetcher::FetchFile - points to the file in place		/*{{{*/
+// ---------------------------------------------------------------------
+/* If a compressed filename is requested the uncompressed one is offered
+   as an alternative as well if it exists. */
+bool LocalFetcher::FetchFile(Item const &Itm) const
+{
+   URI Get(Itm.Uri);
+   std::string const File = d->Decode(Get.Path);
+   if (Get.Host.empty() == false)
+      return _error->Error(_("Invalid URI, local URIS must not start with //"));
+
+   Result Res;
+   struct stat Buf;
+   // deal with destination files which might linger around
+   if (lstat(Itm.DestFile.c_str(), &Buf) == 0 && (Buf.st_mode & S_IFREG) != 0 &&
+       Itm.LastModified == Buf.st_mtime && Itm.LastModified != 0 &&
+       Itm.ExpectedHashes.VerifyFile(File))
+   {
+      Res.Filename = Itm.DestFile;
+      Res.IMSHit = true;
+   }
+   if (Res.IMSHit != true)
+      RemoveFile("file", Itm.DestFile);
+
+   int olderrno = 0;
+   // See if the file exists
+   if (stat(File.c_str(),&Buf) == 0)
+   {
+      Res.Size = Buf.st_size;
+      Res.Filename = File;
+      Res.LastModified = Buf.st_mtime;
+      Res.IMSHit = false;
+      if (Itm.LastModified == Buf.st_mtime && Itm.LastModified != 0)
+      {
+	 unsigned long long const filesize = Itm.ExpectedHashes.FileSize();
+	 if (filesize != 0 && filesize == Res.Size)
+	    Res.IMSHit = true;
+      }
+
+      d->CalculateHashes(Itm, Res);
+   }
+   else
+      olderrno = errno;
+   if (Res.IMSHit == false)
+      Start(Res);
+
+   // See if the uncompressed file exists and reuse it
+   Result AltRes;
+   for (auto const &c : d->Compressors)
+   {
+      if (c.Extension.empty() || c.Extension == "." || APT::String::Endswith(File, c.Extension) == false)
+	 continue;
+      std::string const unfile = File.substr(0, File.length() - c.Extension.length());
+      // no break if it doesn't exist as we could have situations similar to '.gz' vs '.tar.gz' here
+      if (stat(unfile.c_str(),&Buf) != 0)
+	 continue;
+      AltRes.Size = Buf.st_size;
+      AltRes.Filename = unfile;
+      AltRes.LastModified = Buf.st_mtime;
+      AltRes.IMSHit = Itm.LastModified == Buf.st_mtime && Itm.LastModified != 0;
+      break;
+   }
+
+   if (AltRes.Filename.empty() == false)
+      Done(Res, &AltRes);
+   else if (Res.Filename.empty() == false)
+      Done(Res, nullptr);
+   else
+   {
+      errno = olderrno;
+      return _error->Errno(File.c_str(), _("File not found"));
+   }
+   return true;
+}
+									/*}}}*/
+
+} // namespace Internal
+} // namespace APT
@@ -0,0 +1,91 @@
+// -*- mode: cpp; mode: fold -*-
+// Description								/*{{{*/
+/* ######################################################################
+
+   Local Fetcher - the file, copy and store methods
+
+   The method binaries as well as pkgAcquire::Worker running these methods
+   in a thread of its own share this implementation. Options specific to
+   the fetcher are looked at only while it is created, so that a thread
+   using it doesn't depend on when the main thread changes them. Results
+   are reported via callbacks rather than the method protocol.
+
+   This is not exported, the methods build the implementation in.
+
+   ##################################################################### */
+									/*}}}*/
+#ifndef PKGLIB_ACQUIRE_LOCAL_H
+#define PKGLIB_ACQUIRE_LOCAL_H
+
+#include <apt-pkg/hashes.h>
+#include <apt-pkg/macros.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include <time.h>
+
+namespace APT
+{
+namespace Internal
+{
+
+class APT_HIDDEN LocalFetcher
+{
+   public:
+   struct Item
+   {
+      std::string Uri;
+      std::string DestFile;
+      time_t LastModified = 0;
+      HashStringList ExpectedHashes;
+   };
+   struct Result
+   {
+      std::string Filename;
+      unsigned long long Size = 0;
+      time_t LastModified = 0;
+      bool IMSHit = false;
+      HashStringList Hashes;
+   };
+
+   /** \brief called once the file is found, like pkgAcqMethod::URIStart */
+   std::function<void(Result const &)> Start;
+   /** \brief called with the result and the uncompressed alternative if
+    *  there is one, like pkgAcqMethod::URIDone */
+   std::function<void(Result const &, Result const *)> Done;
+
+   /** \brief if the method can be implemented by this class at all */
+   static bool Supports(std::string const &Access);
+   /** \brief if fetching never needs processes of their own
+    *
+    *  External compressors are run via ExecFork, which looks at the
+    *  configuration, so a fetcher using them can't run in a thread. */
+   bool Threadable() const;
+
+   /** \brief fetches the item and reports the results via the callbacks
+    *
+    *  \return \b false if the fetch failed with the reason in _error */
+   bool Fetch(Item const &Itm) const;
+
+   /** \param Access is copy, file, store or the name of a compressor
+    *  store was called as
+    *  \param Compress if store compresses with the compressor named by
+    *  Access rather than extracting with it (Method::Compress) */
+   LocalFetcher(std::string Access, bool Compress);
+   ~LocalFetcher();
+
+   private:
+   class Private;
+   std::unique_ptr<Private> const d;
+
+   bool FetchCopy(Item const &Itm) const;
+   bool FetchStore(Item const &Itm) const;
+   bool FetchFile(Item const &Itm) const;
+};
+
+} // namespace Internal
+} // namespace APT
+
+#endif
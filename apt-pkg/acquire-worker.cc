@@ -14,26 +14,38 @@
 #include <config.h>
 
 #include <apt-pkg/acquire-item.h>
+#include <apt-pkg/acquire-local.h>
 #include <apt-pkg/acquire-worker.h>
 #include <apt-pkg/acquire.h>
+#include <apt-pkg/aptconfiguration.h>
 #include <apt-pkg/configuration.h>
 #include <apt-pkg/error.h>
 #include <apt-pkg/fileutl.h>
 #include <apt-pkg/hashes.h>
 #include <apt-pkg/proxy.h>
 #include <apt-pkg/strutl.h>
+#include <apt-pkg/tagfile.h>
 
 #include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <locale>
+#include <map>
+#include <memory>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include <sstream>
 #include <errno.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <apti18n.h>
@@ -41,9 +53,144 @@
 
 using namespace std;
 
+class pkgAcquire::Worker::Private
+{
+   public:
+   // runs the method if it is executed in-process
+   std::thread InProcess;
+};
+
+// InProcessMethod - built-in methods running as a thread		/*{{{*/
+// ---------------------------------------------------------------------
+/* The local methods copy, store and file do not touch the network and
+   need no sandbox, so the cost of forking and executing them is pure
+   overhead for them. If enabled they run as a thread instead which speaks
+   the usual method protocol over the pipes the worker creates anyhow, so
+   nothing else has to know about it. Methods which modify the global
+   configuration, drop privileges or load a seccomp filter (like everything
+   talking to the network as well as gpgv and rred) can't be run that way. */
+namespace {
+class InProcessMethod
+{
+   std::string const Access;
+   int const InFd;
+   int const OutFd;
+   std::unique_ptr<APT::Internal::LocalFetcher> const Fetcher;
+   std::string Uri;
+
+   bool Send(std::string const &Message) const
+   {
+      return FileFd::Write(OutFd, Message.c_str(), Message.length());
+   }
+   static void AddResult(std::string &Message, char const * const Prefix, APT::Internal::LocalFetcher::Result const &Res)
+   {
+      if (Res.Filename.empty() == false)
+	 Message.append(Prefix).append("Filename: ").append(Res.Filename).append("\n");
+      if (Res.Size != 0)
+	 Message.append(Prefix).append("Size: ").append(std::to_string(Res.Size)).append("\n");
+      if (Res.LastModified != 0)
+	 Message.append(Prefix).append("Last-Modified: ").append(TimeRFC1123(Res.LastModified, true)).append("\n");
+      if (Res.IMSHit)
+	 Message.append(Prefix).append("IMS-Hit: true\n");
+      for (auto const &hash : Res.Hashes)
+	 Message.append(Prefix).append(hash.HashType()).append("-Hash: ").append(hash.HashValue()).append("\n");
+   }
+   void URIStart(APT::Internal::LocalFetcher::Result const &Res) const
+   {
+      std::string Message = "200 URI Start\nURI: " + Uri + "\n";
+      if (Res.Size != 0)
+	 Message.append("Size: ").append(std::to_string(Res.Size)).append("\n");
+      if (Res.LastModified != 0)
+	 Message.append("Last-Modified: ").append(TimeRFC1123(Res.LastModified, true)).append("\n");
+      Send(Message + "\n");
+   }
+   void URIDone(APT::Internal::LocalFetcher::Result const &Res, APT::Internal::LocalFetcher::Result const * const Alt) const
+   {
+      std::string Message = "201 URI Done\nURI: " + Uri + "\n";
+      AddResult(Message, "", Res);
+      if (Alt != nullptr)
+	 AddResult(Message, "Alt-", *Alt);
+      Send(Message + "\n");
+   }
+   bool Fail() const
+   {
+      std::string Err;
+      while (_error->empty() == false)
+      {
+	 std::string msg;
+	 if (_error->PopMessage(msg))
+	 {
+	    if (Err.empty() == false)
+	       Err.append(" ");
+	    Err.append(msg);
+	 }
+      }
+      if (Err.empty())
+	 Err = "Undetermined Error";
+      std::replace(Err.begin(), Err.end(), '\n', ' ');
+      return Send("400 URI Failure\nURI: " + Uri + "\nMessage: " + Err + "\n\n");
+   }
+
+   bool Fetch(std::string const &Message)
+   {
+      APT::Internal::LocalFetcher::Item Itm;
+      Itm.Uri = Uri = LookupTag(Message, "URI");
+      Itm.DestFile = LookupTag(Message, "Filename");
+      if (RFC1123StrToTime(LookupTag(Message, "Last-Modified"), Itm.LastModified) == false)
+	 Itm.LastModified = 0;
+      for (char const * const * t = HashString::SupportedHashes(); *t != NULL; ++t)
+      {
+	 std::string const hash = LookupTag(Message, (std::string("Expected-") + *t).c_str());
+	 if (hash.empty() == false)
+	    Itm.ExpectedHashes.push_back(HashString(*t, hash));
+      }
+      if (Fetcher->Fetch(Itm) == false)
+	 return Fail();
+      return true;
+   }
+
+   public:
+   void Run()
+   {
+      // the worker closing its end is the signal to exit, not to die
+      sigset_t Sigs;
+      sigemptyset(&Sigs);
+      sigaddset(&Sigs, SIGPIPE);
+      pthread_sigmask(SIG_BLOCK, &Sigs, nullptr);
+
+      std::string Capabilities = "100 Capabilities\nVersion: 1.0\nSingle-Instance: true\nSend-URI-Encoded: true\n";
+      if (Access == "file")
+	 Capabilities.append("Local-Only: true\n");
+      if (Send(Capabilities + "\n"))
+      {
+	 std::vector<std::string> Messages;
+	 while (WaitFd(InFd) && ::ReadMessages(InFd, Messages))
+	 {
+	    for (auto const &Message : Messages)
+	       if (atoi(Message.c_str()) == 600 && Fetch(Message) == false)
+		  break;
+	    Messages.clear();
+	 }
+      }
+      _error->Discard();
+      close(InFd);
+      close(OutFd);
+   }
+
+   // created in the main thread as the fetcher looks at the configuration
+   InProcessMethod(std::string Access, int const InFd, int const OutFd, std::unique_ptr<APT::Internal::LocalFetcher> &&Fetcher) :
+      Access(std::move(Access)), InFd(InFd), OutFd(OutFd), Fetcher(std::move(Fetcher))
+   {
+      this->Fetcher->Start = [this](APT::Internal::LocalFetcher::Result const &Res) { URIStart(Res); };
+      this->Fetcher->Done = [this](APT::Internal::LocalFetcher::Result const &Res, APT::Internal::LocalFetcher::Result const *Alt) { URIDone(Res, Alt); };
+   }
+};
+}
+									/*}}}*/
+
 // Worker::Worker - Constructor for Queue startup			/*{{{*/
 pkgAcquire::Worker::Worker(Queue *Q, MethodConfig *Cnf, pkgAcquireStatus *log) :
-   d(NULL), OwnerQ(Q), Log(log), Config(Cnf), Access(Cnf->Access),
+   d(new Private()), OwnerQ(Q), Log(log), Config(Cnf), Access(Cnf->Access),
    CurrentItem(nullptr)
 {
    Construct();
@@ -85,6 +232,9 @@ pkgAcquire::Worker::~Worker()
 	 kill(Process,SIGINT);
       ExecWait(Process,Access.c_str(),true);
    }   
+   if (d->InProcess.joinable())
+      d->InProcess.join();
+   delete d;
 }
 									/*}}}*/
 // Worker::Start - Start the worker process				/*{{{*/
@@ -96,13 +246,26 @@ bool pkgAcquire::Worker::Start()
    constexpr char const * const methodsDir = "Dir::Bin::Methods";
    std::string const confItem = std::string(methodsDir) + "::" + Access;
    std::string Method;
-   if (_config->Exists(confItem))
+   // the fetcher is set up here as the thread can't look at the configuration
+   std::unique_ptr<APT::Internal::LocalFetcher> Fetcher;
+   if (_config->FindB("Acquire::In-Process-Methods", false) &&
+       APT::Internal::LocalFetcher::Supports(Access) && _config->Exists(confItem) == false &&
+       _config->Exists("Binary::" + Access) == false && _config->Exists("Method::Compress") == false)
+   {
+      Fetcher.reset(new APT::Internal::LocalFetcher(Access, false));
+      if (Fetcher->Threadable() == false)
+	 Fetcher.reset();
+   }
+   bool const InProcess = Fetcher != nullptr;
+   if (InProcess)
+      Method = "in-process " + Access;
+   else if (_config->Exists(confItem))
 	 Method = _config->FindFile(confItem.c_str());
    else if (Access == "ftp" || Access == "rsh" || Access == "ssh")
       return _error->Error(_("The method '%s' is unsupported and disabled by default. Consider switching to http(s). Set Dir::Bin::Methods::%s to \"%s\" to enable it again."), Access.c_str(), Access.c_str(), Access.c_str());
    else
 	 Method = _config->FindDir(methodsDir) + Access;
-   if (FileExists(Method) == false)
+   if (InProcess == false && FileExists(Method) == false)
    {
       if (flNotDir(Method) == "false")
       {
@@ -140,9 +303,18 @@ bool pkgAcquire::Worker::Start()
    for (int I = 0; I != 4; I++)
       SetCloseExec(Pipes[I],true);
 
+   if (InProcess)
+   {
+      // the thread owns its ends of the pipes now
+      SetNonBlock(Pipes[2],true);
+      auto const M = new InProcessMethod(Access, Pipes[2], Pipes[1], std::move(Fetcher));
+      d->InProcess = std::thread([M]() {
+	 std::unique_ptr<InProcessMethod>(M)->Run();
+      });
+      Pipes[1] = Pipes[2] = -1;
+   }
    // Fork off the process
-   Process = ExecFork();
-   if (Process == 0)
+   else if ((Process = ExecFork()) == 0)
    {
       // Setup the FDs
       dup2(Pipes[1],STDOUT_FILENO);
@@ -247,6 +419,215 @@ static void APT_NONNULL(3) ChangeSiteIsMirrorChange(std::string const &NewURI, p
       }
    }
 }
+// MirrorStatistics - How well mirrors performed across runs		/*{{{*/
+// ---------------------------------------------------------------------
+/* Items fetched from a mirror (as picked by e.g. the mirror method) are
+   timed per site: the latency until the method started to deliver the
+   file and the throughput while it did. Failures which are likely the
+   fault of the mirror are counted as well. The averages are stored in
+   Dir::State::mirror-stats so that mirror lists can be ordered by them.
+   With Acquire::PDiffs::CostModel all sites and the rred and store
+   methods are timed to predict if patching is cheaper than downloading. */
+namespace {
+class MirrorStatistics
+{
+   typedef std::chrono::steady_clock Clock;
+   struct Stats
+   {
+      double Latency = -1;
+      double Throughput = -1;
+      double FailureRate = 0;
+      unsigned long long Requests = 0;
+      time_t LastUpdate = 0;
+   };
+   struct Timing
+   {
+      std::string Site;
+      Clock::time_point Sent;
+      Clock::time_point Started;
+   };
+   bool Loaded = false;
+   bool Changed = false;
+   std::map<std::string, Stats> Sites;
+   std::unordered_map<pkgAcquire::ItemDesc const *, Timing> Items;
+   std::unordered_map<pkgAcquire::Worker const *, Clock::time_point> LastDone;
+
+   // Store writes the values in the C locale, so read them in it as well
+   static double ParseDouble(std::string const &Value)
+   {
+      std::istringstream In(Value);
+      In.imbue(std::locale::classic());
+      double Result = 0;
+      In >> Result;
+      return Result;
+   }
+   static void Average(double &Avg, double const Sample, double const Weight)
+   {
+      if (Avg < 0)
+	 Avg = Sample;
+      else
+	 Avg += Weight * (Sample - Avg);
+   }
+   Stats &Get(std::string const &Site)
+   {
+      Load();
+      Changed = true;
+      auto &S = Sites[Site];
+      ++S.Requests;
+      S.LastUpdate = time(nullptr);
+      return S;
+   }
+   void Load()
+   {
+      if (Loaded)
+	 return;
+      Loaded = true;
+      std::string const File = _config->FindFile("Dir::State::mirror-stats");
+      if (File.empty() || RealFileExists(File) == false)
+	 return;
+      _error->PushToStack();
+      FileFd Fd;
+      if (Fd.Open(File, FileFd::ReadOnly))
+      {
+	 pkgTagFile Tags(&Fd);
+	 pkgTagSection Section;
+	 while (Tags.Step(Section))
+	 {
+	    std::string const Site = Section.FindS("Site");
+	    if (Site.empty())
+	       continue;
+	    auto &S = Sites[Site];
+	    // unmeasured values are not stored, keep them unknown
+	    if (Section.Exists("Latency"))
+	       S.Latency = ParseDouble(Section.FindS("Latency"));
+	    if (Section.Exists("Throughput"))
+	       S.Throughput = ParseDouble(Section.FindS("Throughput"));
+	    S.FailureRate = ParseDouble(Section.FindS("Failure-Rate"));
+	    S.Requests = Section.FindULL("Requests");
+	    S.LastUpdate = Section.FindULL("Last-Update");
+	 }
+      }
+      _error->RevertToStack();
+   }
+
+   public:
+   static bool Wanted(std::vector<pkgAcquire::Item *> const &Owners, pkgAcquire::MethodConfig const *const Config, std::string const &Access)
+   {
+      if (_config->FindB("Acquire::Mirror::Statistics", true) == false)
+	 return false;
+      // the pdiff cost model compares downloading with patching and decompressing
+      bool const CostModel = _config->FindB("Acquire::PDiffs::CostModel", false);
+      if (Access == "rred" || Access == "store")
+	 return CostModel;
+      if (Config->LocalOnly || Config->SingleInstance)
+	 return false;
+      return CostModel || std::any_of(Owners.begin(), Owners.end(), [](pkgAcquire::Item const *const O) { return O->UsedMirror.empty() == false; });
+   }
+   void Sent(pkgAcquire::ItemDesc const *const Itm, std::string Site)
+   {
+      auto &T = Items[Itm];
+      T.Site = std::move(Site);
+      T.Sent = Clock::now();
+   }
+   bool Lookup(std::string const &Site, double &Latency, double &Throughput)
+   {
+      Load();
+      auto const S = Sites.find(Site);
+      if (S == Sites.end() || S->second.Latency < 0 || S->second.Throughput <= 0)
+	 return false;
+      Latency = S->second.Latency;
+      Throughput = S->second.Throughput;
+      return true;
+   }
+   void Started(pkgAcquire::Worker const *const Worker, pkgAcquire::ItemDesc const *const Itm)
+   {
+      auto const T = Items.find(Itm);
+      if (T == Items.end())
+	 return;
+      T->second.Started = Clock::now();
+      // with pipelining the request waited for the previous one to finish
+      auto const Last = LastDone.find(Worker);
+      auto const Begin = (Last != LastDone.end() && Last->second > T->second.Sent) ? Last->second : T->second.Sent;
+      auto &S = Get(T->second.Site);
+      Average(S.Latency, std::chrono::duration<double>(T->second.Started - Begin).count(), 0.3);
+   }
+   void Done(pkgAcquire::Worker const *const Worker, pkgAcquire::ItemDesc const *const Itm, unsigned long long const Bytes)
+   {
+      auto const T = Items.find(Itm);
+      if (T == Items.end())
+	 return;
+      auto const Now = LastDone[Worker] = Clock::now();
+      auto &S = Get(T->second.Site);
+      double const Duration = std::chrono::duration<double>(Now - T->second.Started).count();
+      // small files tell us more about the latency than about the throughput
+      if (Bytes >= 64 * 1024 && Duration > 0)
+	 Average(S.Throughput, Bytes / Duration, 0.3);
+      Average(S.FailureRate, 0, 0.2);
+      Items.erase(T);
+   }
+   void Failed(pkgAcquire::Worker const *const Worker, pkgAcquire::ItemDesc const *const Itm, bool const MirrorsFault)
+   {
+      auto const T = Items.find(Itm);
+      if (T == Items.end())
+	 return;
+      LastDone[Worker] = Clock::now();
+      if (MirrorsFault)
+	 Average(Get(T->second.Site).FailureRate, 1, 0.2);
+      Items.erase(T);
+   }
+   void Forget(pkgAcquire::ItemDesc const *const Itm)
+   {
+      Items.erase(Itm);
+   }
+   bool Store()
+   {
+      Items.clear();
+      LastDone.clear();
+      if (Changed == false)
+	 return true;
+      Changed = false;
+      std::string const File = _config->FindFile("Dir::State::mirror-stats");
+      if (File.empty() || access(flNotFile(File).c_str(), W_OK) != 0)
+	 return true;
+      // forget about mirrors we haven't used in a long time
+      time_t const Outdated = time(nullptr) - 90 * 24 * 60 * 60;
+      std::ostringstream out;
+      out.imbue(std::locale::classic());
+      for (auto const &S : Sites)
+      {
+	 if (S.second.LastUpdate < Outdated)
+	    continue;
+	 out << "Site: " << S.first << '\n';
+	 if (S.second.Latency >= 0)
+	    out << "Latency: " << S.second.Latency << '\n';
+	 if (S.second.Throughput >= 0)
+	    out << "Throughput: " << static_cast<unsigned long long>(S.second.Throughput) << '\n';
+	 out << "Failure-Rate: " << S.second.FailureRate << '\n'
+	     << "Requests: " << S.second.Requests << '\n'
+	     << "Last-Update: " << S.second.LastUpdate << "\n\n";
+      }
+      _error->PushToStack();
+      FileFd Fd(File, FileFd::WriteAtomic, 0644);
+      Fd.EraseOnFailure();
+      std::string const Data = out.str();
+      if (Fd.Write(Data.c_str(), Data.length()) == false)
+	 Fd.OpFail();
+      Fd.Close();
+      _error->RevertToStack();
+      return true;
+   }
+};
+MirrorStatistics MirrorStats;
+}
+bool pkgAcquire::Worker::StoreMirrorStatistics()
+{
+   return MirrorStats.Store();
+}
+bool pkgAcquire::Worker::GetSiteStatistics(std::string const &Site, double &Latency, double &Throughput)
+{
+   return MirrorStats.Lookup(Site, Latency, Throughput);
+}
+									/*}}}*/
 bool pkgAcquire::Worker::RunMessages()
 {
    while (MessageQueue.empty() == false)
@@ -320,6 +701,7 @@ bool pkgAcquire::Worker::RunMessages()
 
 	    auto const AltUris = VectorizeString(LookupTag(Message, "Alternate-URIs"), '\n');
 
+	    MirrorStats.Forget(Itm);
 	    ItemDone();
 
 	    // Change the status so that it can be dequeued
@@ -400,6 +782,8 @@ bool pkgAcquire::Worker::RunMessages()
 	    Itm->CurrentSize = 0;
 	    Itm->TotalSize = strtoull(LookupTag(Message,"Size","0").c_str(), NULL, 10);
 	    Itm->ResumePoint = strtoull(LookupTag(Message,"Resume-Point","0").c_str(), NULL, 10);
+	    MirrorStats.Started(this, Itm);
+	    OwnerQ->ItemStarted(Itm);
 	    for (auto const Owner: Itm->Owners)
 	    {
 	       Owner->Start(Message, Itm->TotalSize);
@@ -424,6 +808,13 @@ bool pkgAcquire::Worker::RunMessages()
 	    }
 
 	    PrepareFiles("201::URIDone", Itm);
+	    {
+	       // e.g. indexes decompressed while downloading them end up next to the file
+	       std::string const AltFilename = LookupTag(Message, "Alt-Filename");
+	       if (AltFilename.empty() == false && flNotFile(AltFilename) == flNotFile(Itm->Owner->DestFile) &&
+		   RealFileExists(AltFilename))
+		  ChangeOwnerAndPermissionOfFile("201::URIDone", AltFilename.c_str(), "root", ROOT_GROUP, 0644);
+	    }
 
 	    // Display update before completion
 	    if (Log != 0 && Log->MorePulses == true)
@@ -454,6 +845,9 @@ bool pkgAcquire::Worker::RunMessages()
 		  Log->Fetched(ReceivedHashes.FileSize(),atoi(LookupTag(Message,"Resume-Point","0").c_str()));
 	    }
 
+	    auto const FetchedBytes = ReceivedHashes.FileSize() > Itm->ResumePoint ? ReceivedHashes.FileSize() - Itm->ResumePoint : 0;
+	    MirrorStats.Done(this, Itm, FetchedBytes);
+	    OwnerQ->ItemFetched(Itm, FetchedBytes);
 	    std::vector<Item*> const ItmOwners = Itm->Owners;
 	    OwnerQ->ItemDone(Itm);
 	    Itm = NULL;
@@ -506,7 +900,11 @@ bool pkgAcquire::Worker::RunMessages()
 	       if (consideredOkay == true)
 	       {
 		  if (isDoomedItem(Owner) == false)
+		  {
+		     if (isIMSHit == false && Config->LocalOnly == false && Owner->Local == false)
+			pkgAcquire::SharedCacheStore(Owner->DestFile, ExpectedHashes);
 		     Owner->Done(Message, ReceivedHashes, Config);
+		  }
 		  if (Log != nullptr)
 		  {
 		     if (isIMSHit)
@@ -518,6 +916,15 @@ bool pkgAcquire::Worker::RunMessages()
 	       else
 	       {
 		  auto SavedDesc = Owner->GetItemDesc();
+		  // a broken file in the shared cache is no reason to fail
+		  std::string NewURI;
+		  if (isDoomedItem(Owner) == false && pkgAcquire::SharedCacheDrop(SavedDesc.URI) && Owner->PopAlternativeURI(NewURI))
+		  {
+		     auto &desc = Owner->GetItemDesc();
+		     desc.URI = NewURI;
+		     OwnerQ->Owner->Enqueue(desc);
+		     continue;
+		  }
 		  if (isDoomedItem(Owner) == false)
 		  {
 		     if (Message.find("\nFailReason:") == std::string::npos)
@@ -589,10 +996,6 @@ bool pkgAcquire::Worker::RunMessages()
 	       for (pkgAcquire::Queue::QItem::owner_iterator O = Itm->Owners.begin(); O != Itm->Owners.end(); ++O)
 		  Log->Pulse((*O)->GetOwner());
 
-	    std::vector<Item*> const ItmOwners = Itm->Owners;
-	    OwnerQ->ItemDone(Itm);
-	    Itm = nullptr;
-
 	    bool errTransient = false, errAuthErr = false;
 	    if (StringToBool(LookupTag(Message, "Transient-Failure"), false) == true)
 	       errTransient = true;
@@ -610,6 +1013,14 @@ bool pkgAcquire::Worker::RunMessages()
 		  errAuthErr = std::find(std::begin(reasons), std::end(reasons), failReason) != std::end(reasons);
 	       }
 	    }
+	    MirrorStats.Failed(this, Itm, errTransient || errAuthErr);
+	    if (errTransient)
+	       OwnerQ->Congestion();
+
+	    std::vector<Item*> const ItmOwners = Itm->Owners;
+	    OwnerQ->ItemDone(Itm);
+	    Itm = nullptr;
+
 	    HandleFailure(ItmOwners, Config, Log, Message, errTransient, errAuthErr);
 	    ItemDone();
 
@@ -845,6 +1256,11 @@ bool pkgAcquire::Worker::QueueItem(pkgAcquire::Queue::QItem *Item)
                                      SandboxUser.c_str(), ROOT_GROUP, 0600);
    }
 
+   if (MirrorStatistics::Wanted(Item->Owners, Config, Access))
+      MirrorStats.Sent(Item, Config->SingleInstance ? Access + ":" : URI::SiteOnly(Item->URI));
+   else
+      MirrorStats.Forget(Item);
+
    if (Debug == true)
       clog << " -> " << Access << ':' << QuoteString(Message,"\n") << endl;
    OutQueue += Message;
@@ -939,6 +1355,8 @@ bool pkgAcquire::Worker::MethodFailure()
    Process = -1;
    close(InFd);
    close(OutFd);
+   if (d->InProcess.joinable())
+      d->InProcess.join();
    InFd = -1;
    OutFd = -1;
    OutReady = false;
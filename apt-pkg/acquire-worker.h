@@ -46,18 +46,16 @@
  */
 class APT_PUBLIC pkgAcquire::Worker : public WeakPointable
 {
+   class Private;
    /** \brief dpointer placeholder (for later in case we need it) */
-   void * const d;
+   Private * const d;
   
    friend class pkgAcquire;
    
    protected:
    friend class Queue;
 
-   /** \brief The next link on the Queue list.
-    *
-    *  \todo This is always NULL; is it just for future use?
-    */
+   /** \brief The next link on the Queue list. */
    Worker *NextQueue;
 
    /** \brief The next link on the Acquire list. */
@@ -268,6 +266,10 @@ class APT_PUBLIC pkgAcquire::Worker : public WeakPointable
     *  Reads the first message from the worker, which is assumed to be
     *  a 100 Capabilities message.
     *
+    *  With Acquire::In-Process-Methods the built-in local methods are
+    *  not forked off, but run in a thread of this process which speaks
+    *  the same protocol over the same kind of pipes.
+    *
     *  \return \b true if all operations completed successfully.
     */
    bool Start();
@@ -280,6 +282,16 @@ class APT_PUBLIC pkgAcquire::Worker : public WeakPointable
    /** \return The fetch method configuration. */
    inline const MethodConfig *GetConf() const {return Config;};
 
+   /** \return How many items the queue currently sends to this worker
+    *  before waiting for the first to finish.
+    */
+   unsigned long GetPipelineDepth() const;
+
+   /** \return How many workers are currently fed by the queue of this
+    *  worker, which usually means connections to the same host.
+    */
+   unsigned long GetConnections() const;
+
    /** \brief Create a new Worker to download files.
     *
     *  \param OwnerQ The queue into which this worker should be
@@ -305,10 +317,27 @@ class APT_PUBLIC pkgAcquire::Worker : public WeakPointable
     */
    explicit Worker(MethodConfig *Config);
 
+   /** \brief Save what was learned about the performance of mirrors
+    *
+    *  Called by pkgAcquire once all items are done.
+    */
+   APT_HIDDEN static bool StoreMirrorStatistics();
+
+   /** \brief Performance of a site as measured in this and earlier runs
+    *
+    *  Local methods like rred are recorded as "<method>:".
+    *
+    *  \param[out] Latency in seconds until a file started to arrive
+    *  \param[out] Throughput in bytes per second
+    *  \return \b false if nothing is known about the site
+    */
+   APT_HIDDEN static bool GetSiteStatistics(std::string const &Site, double &Latency, double &Throughput);
+
    /** \brief Clean up this worker.
     *
     *  Closes the file descriptors; if MethodConfig::NeedsCleanup is
     *  \b false, also rudely interrupts the worker with a SIGINT.
+    *  In-process methods finish their current item and are joined.
     */
    virtual ~Worker();
 
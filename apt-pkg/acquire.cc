@@ -21,6 +21,7 @@
 #include <apt-pkg/error.h>
 #include <apt-pkg/fileutl.h>
 #include <apt-pkg/strutl.h>
+#include <apt-pkg/trace.h>
 
 #include <algorithm>
 #include <chrono>
@@ -30,6 +31,7 @@
 #include <numeric>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <cmath>
 
@@ -57,6 +59,117 @@ std::string pkgAcquire::URIEncode(std::string const &part)		/*{{{*/
    return QuoteString(part, _config->Find("Acquire::URIEncode", "+~ ").c_str());
 }
 									/*}}}*/
+// Acquire::SharedCache* - content addressed cache for several roots	/*{{{*/
+/* Verified downloads are stored as Dir::Cache::Shared/<hashtype>/<hash>
+   using the strongest hash we expected for them. Files are never modified
+   once they are in the cache, so any number of apt instances, e.g. in
+   different chroots, can use the same cache at the same time. Items
+   which find their file in the cache fetch it with the copy method, which
+   reflinks where the filesystem allows it, and fall back to the network. */
+static std::string SharedCacheFile(std::string const &Dir, HashString const &Hash)
+{
+   return Dir + Hash.HashType() + '/' + Hash.HashValue();
+}
+std::string pkgAcquire::SharedCacheLookup(HashStringList const &Hashes)
+{
+   std::string const Dir = _config->FindDir("Dir::Cache::Shared");
+   if (Dir.empty() || Dir == "/" || Hashes.usable() == false)
+      return "";
+   for (auto const &Hash : Hashes)
+   {
+      if (Hash.usable() == false)
+	 continue;
+      std::string const File = SharedCacheFile(Dir, Hash);
+      struct stat Buf;
+      if (stat(File.c_str(), &Buf) != 0 || S_ISREG(Buf.st_mode) == false)
+	 continue;
+      if (Hashes.FileSize() != 0 && static_cast<unsigned long long>(Buf.st_size) != Hashes.FileSize())
+	 continue;
+      // the modification time orders the files for the eviction
+      utimensat(AT_FDCWD, File.c_str(), nullptr, 0);
+      return File;
+   }
+   return "";
+}
+void pkgAcquire::SharedCacheStore(std::string const &File, HashStringList const &Hashes)
+{
+   std::string const Dir = _config->FindDir("Dir::Cache::Shared");
+   if (Dir.empty() || Dir == "/" || Hashes.usable() == false)
+      return;
+   HashString const * const Hash = Hashes.find(nullptr);
+   if (Hash == nullptr || Hash->usable() == false)
+      return;
+   std::string const Blob = SharedCacheFile(Dir, *Hash);
+   if (utimensat(AT_FDCWD, Blob.c_str(), nullptr, 0) == 0)
+      return;
+
+   // the cache is an optimisation, failing to fill it is no error
+   _error->PushToStack();
+   mkdir(Dir.c_str(), 0755);
+   mkdir(flNotFile(Blob).c_str(), 0755);
+   FileFd In(File, FileFd::ReadOnly);
+   FileFd Out(Blob, FileFd::WriteAtomic, 0644);
+   if (In.IsOpen() && Out.IsOpen() && CopyFile(In, Out) == false)
+      Out.OpFail();
+   Out.Close();
+   _error->RevertToStack();
+}
+bool pkgAcquire::SharedCacheDrop(std::string const &URI)
+{
+   std::string const Dir = _config->FindDir("Dir::Cache::Shared");
+   if (Dir.empty() || Dir == "/" || APT::String::Startswith(URI, "copy:" + Dir) == false)
+      return false;
+   RemoveFile("SharedCacheDrop", URI.substr(strlen("copy:")));
+   return true;
+}
+void pkgAcquire::SharedCacheClean()
+{
+   std::string const Dir = _config->FindDir("Dir::Cache::Shared");
+   unsigned long long const MaxSize = _config->FindI("Acquire::Shared-Cache::Max-Size", 0) * 1024ull * 1024ull;
+   if (Dir.empty() || Dir == "/" || MaxSize == 0)
+      return;
+
+   struct CachedFile
+   {
+      std::string Name;
+      time_t MTime;
+      unsigned long long Size;
+   };
+   std::vector<CachedFile> Files;
+   unsigned long long Total = 0;
+   time_t const Now = time(nullptr);
+   _error->PushToStack();
+   for (char const **Type = HashString::SupportedHashes(); *Type != nullptr; ++Type)
+   {
+      if (DirectoryExists(Dir + *Type) == false)
+	 continue;
+      for (auto const &File : GetListOfFilesInDir(Dir + *Type, false))
+      {
+	 struct stat Buf;
+	 if (stat(File.c_str(), &Buf) != 0)
+	    continue;
+	 // leftovers of interrupted stores
+	 if (flNotDir(File).find('.') != std::string::npos)
+	 {
+	    if (Buf.st_mtime + 24 * 60 * 60 < Now)
+	       RemoveFile("SharedCacheClean", File);
+	    continue;
+	 }
+	 Files.push_back({File, Buf.st_mtime, static_cast<unsigned long long>(Buf.st_size)});
+	 Total += Buf.st_size;
+      }
+   }
+   std::sort(Files.begin(), Files.end(), [](CachedFile const &A, CachedFile const &B) { return A.MTime < B.MTime; });
+   for (auto const &F : Files)
+   {
+      if (Total <= MaxSize)
+	 break;
+      if (RemoveFile("SharedCacheClean", F.Name))
+	 Total -= F.Size;
+   }
+   _error->RevertToStack();
+}
+									/*}}}*/
 // Acquire::pkgAcquire - Constructor					/*{{{*/
 // ---------------------------------------------------------------------
 /* We grab some runtime state from the configuration space */
@@ -83,6 +196,18 @@ void pkgAcquire::Initialize()
       QueueMode = QueueAccess;
 }
 									/*}}}*/
+// PruneVerificationResults - remove expired results of the gpgv method	/*{{{*/
+static void PruneVerificationResults(std::string const &Dir, int const Lifetime)
+{
+   time_t const Now = time(nullptr);
+   for (auto const &File : GetListOfFilesInDir(Dir, "", false, true))
+   {
+      struct stat St;
+      if (stat(File.c_str(), &St) == 0 && (Lifetime <= 0 || St.st_mtime + Lifetime < Now))
+	 RemoveFile("PruneVerificationResults", File);
+   }
+}
+									/*}}}*/
 // Acquire::GetLock - lock directory and prepare for action		/*{{{*/
 static bool SetupAPTPartialDirectory(std::string const &grand, std::string const &parent, std::string const &postfix, mode_t const mode)
 {
@@ -146,6 +271,13 @@ bool pkgAcquire::GetLock(std::string const &Lock)
    {
       if (SetupAPTPartialDirectory(_config->FindDir("Dir::State"), listDir, "partial", 0700) == false)
 	 return _error->Errno("Acquire", _("List directory %s is missing."), (listDir + "partial").c_str());
+      // not owned by the sandbox user as the gpgv method must not write to it
+      std::string const signaturesDir = flCombine(_config->FindDir("Dir::State"), "signatures/");
+      int const Lifetime = _config->FindI("Acquire::gpgv::Result-Cache", 0);
+      _error->PushToStack();
+      if (Lifetime > 0 ? CreateAPTDirectoryIfNeeded(_config->FindDir("Dir::State"), signaturesDir) : DirectoryExists(signaturesDir))
+	 PruneVerificationResults(signaturesDir, Lifetime);
+      _error->RevertToStack();
    }
    if (Lock == archivesDir)
    {
@@ -158,6 +290,11 @@ bool pkgAcquire::GetLock(std::string const &Lock)
       {
 	 // not being able to create lists/auxfiles isn't critical as we will use a tmpdir then
       }
+      std::string const stateDir = _config->FindDir("Dir::State");
+      if (SetupAPTPartialDirectory(stateDir, stateDir, "connections", 0700) == false)
+      {
+	 // the methods just don't cache connection setup data without it
+      }
    }
 
    if (_config->FindB("Debug::NoLocking", false) == true)
@@ -688,7 +825,9 @@ static void CheckDropPrivsMustBeDisabled(pkgAcquire const &Fetcher)
 }
 pkgAcquire::RunResult pkgAcquire::Run(int PulseIntervall)
 {
+   APT::Trace::Phase const phase("pkgAcquire::Run");
    _error->PushToStack();
+   pkgAcqArchive::VerifyLocalArchives(this);
    CheckDropPrivsMustBeDisabled(*this);
 
    Running = true;
@@ -755,6 +894,8 @@ pkgAcquire::RunResult pkgAcquire::Run(int PulseIntervall)
    // Shut down the items
    for (ItemIterator I = Items.begin(); I != Items.end(); ++I)
       (*I)->Finished();
+   Worker::StoreMirrorStatistics();
+   SharedCacheClean();
 
    bool const newError = _error->PendingError();
    _error->MergeWithStack();
@@ -916,10 +1057,52 @@ void pkgAcquire::MethodConfig::SetSendURIEncoded(bool const value)	/*{{{*/
 }
 									/*}}}*/
 
+// Queue::Private - Congestion control for a queue			/*{{{*/
+// ---------------------------------------------------------------------
+/* The pipeline depth is adapted like the window in TCP Vegas: the time from
+   handing an item to the method until it starts to arrive is compared with
+   the shortest such time seen, which tells us how many items were just
+   waiting behind others. A few of those keep the connection busy, more
+   only delay the detection of problems, so the depth shrinks or grows
+   accordingly (growing by one per item until we saw too many). Failures
+   like timeouts or "429 Too Many Requests" halve the depth.
+
+   If more than one connection per host is allowed, another one is opened
+   every few seconds as long as requests keep waiting for each other and
+   there are items left which could use it. Failures halve their number. */
+class pkgAcquire::Queue::Private
+{
+   public:
+   typedef std::chrono::steady_clock Clock;
+
+   MethodConfig *Config = nullptr;
+   bool Debug = false;
+   bool Adaptive = false;
+   double Window = 1;
+   double Threshold = std::numeric_limits<double>::max();
+   Clock::duration BaseRTT = Clock::duration::max();
+   Clock::time_point LastDecrease;
+   std::unordered_map<QItem const *, Clock::time_point> Sent;
+   std::unordered_map<Worker const *, unsigned long> InFlight;
+
+   unsigned long Connections = 1;
+   unsigned long MaxConnections = 1;
+   // requests had to wait for others even with a shallow pipeline
+   bool Saturated = false;
+   Clock::time_point RoundStart;
+
+   unsigned long Depth(unsigned long const MaxPipeDepth) const
+   {
+      if (Adaptive == false)
+	 return MaxPipeDepth;
+      return static_cast<unsigned long>(Window);
+   }
+};
+									/*}}}*/
 // Queue::Queue - Constructor						/*{{{*/
 // ---------------------------------------------------------------------
 /* */
-pkgAcquire::Queue::Queue(string const &name,pkgAcquire * const owner) : d(NULL), Next(0),
+pkgAcquire::Queue::Queue(string const &name,pkgAcquire * const owner) : d(new Private()), Next(0),
    Name(name), Items(0), Workers(0), Owner(owner), PipeDepth(0), MaxPipeDepth(1)
 {
 }
@@ -937,6 +1120,7 @@ pkgAcquire::Queue::~Queue()
       Items = Items->Next;
       delete Jnk;
    }
+   delete d;
 }
 									/*}}}*/
 // Queue::Enqueue - Queue an item to the queue				/*{{{*/
@@ -1051,13 +1235,23 @@ bool pkgAcquire::Queue::Startup()
       if (Workers->Start() == false)
 	 return false;
       
-      /* When pipelining we commit 10 items. This needs to change when we
-         added other source retry to have cycle maintain a pipeline depth
-         on its own. */
+      /* When pipelining we commit up to 10 items, depending on how well
+         the server keeps up with them */
+      d->Config = Cnf;
+      d->Debug = _config->FindB("Debug::pkgAcquire::Worker", false);
       if (Cnf->Pipeline == true)
 	 MaxPipeDepth = _config->FindI("Acquire::Max-Pipeline-Depth",10);
       else
 	 MaxPipeDepth = 1;
+      // single instance methods work locally, there is no server to adapt to
+      d->Adaptive = MaxPipeDepth > 1 && Cnf->SingleInstance == false &&
+		    _config->FindB("Acquire::Adaptive-Pipeline-Depth", false);
+      d->Window = std::min(2ul, MaxPipeDepth);
+      d->Connections = 1;
+      d->RoundStart = Private::Clock::now();
+      if (Owner->QueueMode == QueueHost && Cnf->SingleInstance == false && Cnf->LocalOnly == false &&
+	  Items != nullptr && URI(Items->URI).Host.empty() == false)
+	 d->MaxConnections = std::max(1, _config->FindI("Acquire::QueueHost::Max-Connections", 1));
    }
    
    return Cycle();
@@ -1077,6 +1271,7 @@ bool pkgAcquire::Queue::Shutdown(bool Final)
       if (Final == true || Jnk->GetConf()->NeedsCleanup == false)
       {
 	 *Cur = Jnk->NextQueue;
+	 d->InFlight.erase(Jnk);
 	 Owner->Remove(Jnk);
 	 delete Jnk;
       }
@@ -1121,6 +1316,10 @@ pkgAcquire::Queue::QItem *pkgAcquire::Queue::FindItem(string URI,pkgAcquire::Wor
 bool pkgAcquire::Queue::ItemDone(QItem *Itm)
 {
    PipeDepth--;
+   d->Sent.erase(Itm);
+   auto const F = d->InFlight.find(Itm->Worker);
+   if (F != d->InFlight.end() && F->second != 0)
+      --F->second;
    for (QItem::owner_iterator O = Itm->Owners.begin(); O != Itm->Owners.end(); ++O)
    {
       if ((*O)->Status == pkgAcquire::Item::StatFetching)
@@ -1153,7 +1352,7 @@ bool pkgAcquire::Queue::Cycle()
    // Look for a queable item
    QItem *I = Items;
    int ActivePriority = 0;
-   while (PipeDepth < static_cast<decltype(PipeDepth)>(MaxPipeDepth))
+   while (true)
    {
       for (; I != 0; I = I->Next) {
 	 if (I->Owner->Status == pkgAcquire::Item::StatFetching)
@@ -1170,17 +1369,165 @@ bool pkgAcquire::Queue::Cycle()
       // the queue is idle
       if (I->GetPriority() < ActivePriority)
 	 return true;
-      I->Worker = Workers;
+
+      // all pipelines are full
+      pkgAcquire::Worker * const W = PickWorker();
+      if (W == nullptr)
+	 return true;
+
+      I->Worker = W;
       for (auto const &O: I->Owners)
 	 O->Status = pkgAcquire::Item::StatFetching;
       PipeDepth++;
-      if (Workers->QueueItem(I) == false)
+      ++d->InFlight[W];
+      d->Sent[I] = Private::Clock::now();
+      if (W->QueueItem(I) == false)
 	 return false;
    }
 
    return true;
 }
 									/*}}}*/
+// Queue::PickWorker - Find a worker with room in its pipeline		/*{{{*/
+// ---------------------------------------------------------------------
+/* The worker with the fewest items in flight is picked. If all are busy
+   and we may use more connections to this host, a new worker is started. */
+pkgAcquire::Worker *pkgAcquire::Queue::PickWorker()
+{
+   unsigned long const Depth = d->Depth(MaxPipeDepth);
+   pkgAcquire::Worker *Best = nullptr;
+   pkgAcquire::Worker *Last = nullptr;
+   unsigned long BestInFlight = Depth;
+   unsigned long Count = 0;
+   for (pkgAcquire::Worker *W = Workers; W != nullptr && Count < d->Connections; W = W->NextQueue, ++Count)
+   {
+      Last = W;
+      auto const F = d->InFlight[W];
+      if (F < BestInFlight)
+      {
+	 Best = W;
+	 BestInFlight = F;
+      }
+   }
+   if (Best != nullptr || Last == nullptr || Count >= d->Connections || d->Config == nullptr)
+      return Best;
+
+   // Last is the end of the list as we stopped before reaching the limit
+   auto const W = new Worker(this, d->Config, Owner->Log);
+   Owner->Add(W);
+   Last->NextQueue = W;
+   if (d->Debug)
+      std::clog << " @ Queue " << Name << ": opening connection " << (Count + 1) << std::endl;
+   if (W->Start() == false)
+   {
+      d->Connections = d->MaxConnections = Count;
+      return nullptr;
+   }
+   return W;
+}
+									/*}}}*/
+// Queue::ItemStarted - Adapt the pipeline depth to the round trip time	/*{{{*/
+void pkgAcquire::Queue::ItemStarted(QItem const * const Itm)
+{
+   auto const S = d->Sent.find(Itm);
+   if (S == d->Sent.end())
+      return;
+   auto const RTT = std::max(Private::Clock::now() - S->second, Private::Clock::duration(std::chrono::microseconds(1)));
+   d->Sent.erase(S);
+
+   d->BaseRTT = std::min(d->BaseRTT, RTT);
+   auto const OldDepth = d->Depth(MaxPipeDepth);
+   // items which were just waiting behind others in the pipeline
+   double const Waiting = OldDepth * (1 - std::chrono::duration<double>(d->BaseRTT) / std::chrono::duration<double>(RTT));
+   constexpr double Alpha = 1;
+   constexpr double Beta = 3;
+   if (Waiting > Beta)
+      d->Saturated = true;
+   if (d->Adaptive == false)
+      return;
+   if (d->Window < d->Threshold)
+   {
+      if (Waiting > Beta)
+	 d->Threshold = d->Window;
+      else
+	 d->Window += 1;
+   }
+   else if (Waiting < Alpha)
+      d->Window += 1 / d->Window;
+   else if (Waiting > Beta)
+      d->Window -= 1 / d->Window;
+   d->Window = std::max(1.0, std::min(d->Window, static_cast<double>(MaxPipeDepth)));
+
+   if (d->Debug && OldDepth != d->Depth(MaxPipeDepth))
+      std::clog << " @ Queue " << Name << ": pipeline depth " << d->Depth(MaxPipeDepth)
+		<< " (rtt " << std::chrono::duration<double, std::milli>(RTT).count()
+		<< " ms, base " << std::chrono::duration<double, std::milli>(d->BaseRTT).count() << " ms)" << std::endl;
+}
+									/*}}}*/
+// Queue::ItemFetched - Open more connections if requests have to wait	/*{{{*/
+void pkgAcquire::Queue::ItemFetched(QItem const * const, unsigned long long const)
+{
+   if (d->Connections >= d->MaxConnections)
+      return;
+
+   auto const Now = Private::Clock::now();
+   if (Now - d->RoundStart < std::chrono::seconds(2))
+      return;
+   bool const Saturated = d->Saturated;
+   d->RoundStart = Now;
+   d->Saturated = false;
+   if (Saturated == false)
+      return;
+   // nothing left to spread over more connections
+   bool Backlog = false;
+   for (QItem const *I = Items; I != nullptr && Backlog == false; I = I->Next)
+      Backlog = I->Owner->Status == pkgAcquire::Item::StatIdle;
+   if (Backlog == false)
+      return;
+   ++d->Connections;
+   if (d->Debug)
+      std::clog << " @ Queue " << Name << ": " << d->Connections << " connections" << std::endl;
+}
+									/*}}}*/
+// Queue::Congestion - Back off after an overload of the server		/*{{{*/
+void pkgAcquire::Queue::Congestion()
+{
+   auto const Now = Private::Clock::now();
+   // many items fail at once if the server is in trouble, but we want to
+   // react to that only once
+   if (Now - d->LastDecrease < std::chrono::seconds(1))
+      return;
+   d->LastDecrease = Now;
+   if (d->Adaptive)
+   {
+      d->Window = std::max(1.0, d->Window / 2);
+      d->Threshold = d->Window;
+   }
+   d->Connections = std::max(1ul, d->Connections / 2);
+   d->RoundStart = Now;
+   d->Saturated = false;
+   if (d->Debug)
+      std::clog << " @ Queue " << Name << ": congestion, pipeline depth " << d->Depth(MaxPipeDepth)
+		<< " with " << d->Connections << " connections" << std::endl;
+}
+									/*}}}*/
+unsigned long pkgAcquire::Worker::GetPipelineDepth() const		/*{{{*/
+{
+   if (OwnerQ == nullptr)
+      return 0;
+   return OwnerQ->d->Depth(OwnerQ->MaxPipeDepth);
+}
+									/*}}}*/
+unsigned long pkgAcquire::Worker::GetConnections() const		/*{{{*/
+{
+   if (OwnerQ == nullptr)
+      return 0;
+   unsigned long Count = 0;
+   for (auto W = OwnerQ->Workers; W != nullptr && Count < OwnerQ->d->Connections; W = W->NextQueue)
+      ++Count;
+   return Count;
+}
+									/*}}}*/
 // Queue::Bump - Fetch any pending objects if we are idle		/*{{{*/
 // ---------------------------------------------------------------------
 /* This is called when an item in multiple queues is dequeued */
@@ -1282,7 +1629,14 @@ std::string pkgAcquire::Queue::QItem::Custom600Headers() const		/*{{{*/
 // AcquireStatus::pkgAcquireStatus - Constructor			/*{{{*/
 // ---------------------------------------------------------------------
 /* */
-pkgAcquireStatus::pkgAcquireStatus() : d(NULL), Percent(-1), Update(true), MorePulses(false)
+class pkgAcquireStatus::Private					/*{{{*/
+{
+   public:
+   unsigned long PipelineDepth = 0;
+   unsigned long Connections = 0;
+};
+									/*}}}*/
+pkgAcquireStatus::pkgAcquireStatus() : d(new Private()), Percent(-1), Update(true), MorePulses(false)
 {
    Start();
 }
@@ -1331,9 +1685,12 @@ bool pkgAcquireStatus::Pulse(pkgAcquire *Owner)
 
    // Compute the current completion
    unsigned long long ResumeSize = 0;
+   d->PipelineDepth = d->Connections = 0;
    for (pkgAcquire::Worker *I = Owner->WorkersBegin(); I != 0;
 	I = Owner->WorkerStep(I))
    {
+      d->PipelineDepth = std::max(d->PipelineDepth, I->GetPipelineDepth());
+      d->Connections = std::max(d->Connections, I->GetConnections());
       if (I->CurrentItem != 0 && I->CurrentItem->Owner->Complete == false)
       {
 	 CurrentBytes += I->CurrentItem->CurrentSize;
@@ -1396,6 +1753,8 @@ bool pkgAcquireStatus::Pulse(pkgAcquire *Owner)
          << SizeToStr(CurrentBytes) << " / " << SizeToStr(TotalBytes)
          << " # Files: "
          << CurrentItems << " / " << TotalItems
+         << " # Pipeline depth: " << d->PipelineDepth
+         << " Connections: " << d->Connections
          << std::endl;
    }
 
@@ -1444,6 +1803,18 @@ void pkgAcquireStatus::Start()
    ElapsedTime = 0;
    TotalItems = 0;
    CurrentItems = 0;
+   d->PipelineDepth = 0;
+   d->Connections = 0;
+}
+									/*}}}*/
+unsigned long pkgAcquireStatus::GetPipelineDepth() const		/*{{{*/
+{
+   return d->PipelineDepth;
+}
+									/*}}}*/
+unsigned long pkgAcquireStatus::GetConnections() const			/*{{{*/
+{
+   return d->Connections;
 }
 									/*}}}*/
 // AcquireStatus::Stop - Finished downloading				/*{{{*/
@@ -1509,4 +1880,4 @@ pkgAcquire::UriIterator::UriIterator(pkgAcquire::Queue *Q) : d(NULL), CurQ(Q), C
 
 pkgAcquire::UriIterator::~UriIterator() {}
 pkgAcquire::MethodConfig::~MethodConfig() { delete d; }
-pkgAcquireStatus::~pkgAcquireStatus() {}
+pkgAcquireStatus::~pkgAcquireStatus() { delete d; }
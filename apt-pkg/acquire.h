@@ -365,6 +365,22 @@ class APT_PUBLIC pkgAcquire
 
    APT_HIDDEN static std::string URIEncode(std::string const &part);
 
+   /** \brief Find a file with the given hashes in the shared download cache
+    *
+    *  \return the filename or an empty string if the cache is disabled or
+    *  does not contain such a file.
+    */
+   APT_HIDDEN static std::string SharedCacheLookup(HashStringList const &Hashes);
+   /** \brief Add a verified download to the shared download cache */
+   APT_HIDDEN static void SharedCacheStore(std::string const &File, HashStringList const &Hashes);
+   /** \brief Remove a file from the shared download cache
+    *
+    *  \return \b true if \a URI refers to a file in the cache
+    */
+   APT_HIDDEN static bool SharedCacheDrop(std::string const &URI);
+   /** \brief Evict the least recently used files from the shared download cache */
+   APT_HIDDEN static void SharedCacheClean();
+
    private:
    APT_HIDDEN void Initialize();
 };
@@ -396,8 +412,9 @@ class APT_PUBLIC pkgAcquire::Queue
    friend class pkgAcquire::UriIterator;
    friend class pkgAcquire::Worker;
 
+   class Private;
    /** \brief dpointer placeholder (for later in case we need it) */
-   void * const d;
+   Private * const d;
 
    /** \brief The next queue in the pkgAcquire object's list of queues. */
    Queue *Next;
@@ -471,10 +488,8 @@ class APT_PUBLIC pkgAcquire::Queue
 
    /** \brief The head of the list of workers associated with this queue.
     *
-    *  \todo This is plural because support exists in Queue for
-    *  multiple workers.  However, it does not appear that there is
-    *  any way to actually associate more than one worker with a
-    *  queue.
+    *  Each worker is a connection to the same host. More are started
+    *  if Acquire::QueueHost::Max-Connections allows and they help.
     *
     *  \todo Why not just use a std::set?
     */
@@ -489,9 +504,17 @@ class APT_PUBLIC pkgAcquire::Queue
    signed long PipeDepth;
 
    /** \brief The maximum number of entries that this queue will
-    *  attempt to download at once.
+    *  attempt to download at once per worker.
     */
    unsigned long MaxPipeDepth;
+
+   /** \brief The method started to deliver the item */
+   APT_HIDDEN void ItemStarted(QItem const * const Itm);
+   /** \brief The item was fetched successfully */
+   APT_HIDDEN void ItemFetched(QItem const * const Itm, unsigned long long const Bytes);
+   /** \brief The server failed in a way suggesting it is overloaded */
+   APT_HIDDEN void Congestion();
+   APT_HIDDEN pkgAcquire::Worker *PickWorker();
    
    public:
    
@@ -694,8 +717,8 @@ struct APT_PUBLIC pkgAcquire::MethodConfig
  */
 class APT_PUBLIC pkgAcquireStatus
 {
-   /** \brief dpointer placeholder (for later in case we need it) */
-   void * const d;
+   class Private;
+   Private * const d;
 
    protected:
    
@@ -851,6 +874,20 @@ class APT_PUBLIC pkgAcquireStatus
     */
    virtual bool Pulse(pkgAcquire *Owner);
 
+   /** \return the deepest pipeline of a queue as of the most recent call
+    *  to pkgAcquireStatus::Pulse
+    *
+    *  \see pkgAcquire::Worker::GetPipelineDepth
+    */
+   unsigned long GetPipelineDepth() const;
+
+   /** \return the most connections a queue used as of the most recent
+    *  call to pkgAcquireStatus::Pulse, usually all to the same host
+    *
+    *  \see pkgAcquire::Worker::GetConnections
+    */
+   unsigned long GetConnections() const;
+
    /** \brief Invoked when the Acquire process starts running. */
    virtual void Start();
 
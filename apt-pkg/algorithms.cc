@@ -27,6 +27,7 @@
 #include <apt-pkg/pkgcache.h>
 #include <apt-pkg/string_view.h>
 #include <apt-pkg/strutl.h>
+#include <apt-pkg/trace.h>
 #include <apt-pkg/version.h>
 
 #include <apt-pkg/prettyprinters.h>
@@ -451,30 +452,52 @@ void pkgProblemResolver::MakeScores()
 
    // maps to pkgCache::State::VerPriority: 
    //    Required Important Standard Optional Extra
+   static Configuration::Option<int> const PrioOptions[] = {
+      {"pkgProblemResolver::Scores::Required",3},
+      {"pkgProblemResolver::Scores::Important",2},
+      {"pkgProblemResolver::Scores::Standard",1},
+      {"pkgProblemResolver::Scores::Optional",-1},
+      {"pkgProblemResolver::Scores::Extra",-2}
+   };
    int PrioMap[] = {
       0,
-      _config->FindI("pkgProblemResolver::Scores::Required",3),
-      _config->FindI("pkgProblemResolver::Scores::Important",2),
-      _config->FindI("pkgProblemResolver::Scores::Standard",1),
-      _config->FindI("pkgProblemResolver::Scores::Optional",-1),
-      _config->FindI("pkgProblemResolver::Scores::Extra",-2)
+      *PrioOptions[0],
+      *PrioOptions[1],
+      *PrioOptions[2],
+      *PrioOptions[3],
+      *PrioOptions[4]
+   };
+   static Configuration::Option<int> const OptPrioEssentials("pkgProblemResolver::Scores::Essentials",100);
+   static Configuration::Option<int> const OptPrioInstalledAndNotObsolete("pkgProblemResolver::Scores::NotObsolete",1);
+   int PrioEssentials = *OptPrioEssentials;
+   int PrioInstalledAndNotObsolete = *OptPrioInstalledAndNotObsolete;
+   static Configuration::Option<int> const DepOptions[] = {
+      {"pkgProblemResolver::Scores::Depends",1},
+      {"pkgProblemResolver::Scores::PreDepends",1},
+      {"pkgProblemResolver::Scores::Suggests",0},
+      {"pkgProblemResolver::Scores::Recommends",1},
+      {"pkgProblemResolver::Scores::Conflicts",-1},
+      {"pkgProblemResolver::Scores::Replaces",0},
+      {"pkgProblemResolver::Scores::Obsoletes",0},
+      {"pkgProblemResolver::Scores::Breaks",-1},
+      {"pkgProblemResolver::Scores::Enhances",0}
    };
-   int PrioEssentials = _config->FindI("pkgProblemResolver::Scores::Essentials",100);
-   int PrioInstalledAndNotObsolete = _config->FindI("pkgProblemResolver::Scores::NotObsolete",1);
    int DepMap[] = {
       0,
-      _config->FindI("pkgProblemResolver::Scores::Depends",1),
-      _config->FindI("pkgProblemResolver::Scores::PreDepends",1),
-      _config->FindI("pkgProblemResolver::Scores::Suggests",0),
-      _config->FindI("pkgProblemResolver::Scores::Recommends",1),
-      _config->FindI("pkgProblemResolver::Scores::Conflicts",-1),
-      _config->FindI("pkgProblemResolver::Scores::Replaces",0),
-      _config->FindI("pkgProblemResolver::Scores::Obsoletes",0),
-      _config->FindI("pkgProblemResolver::Scores::Breaks",-1),
-      _config->FindI("pkgProblemResolver::Scores::Enhances",0)
+      *DepOptions[0],
+      *DepOptions[1],
+      *DepOptions[2],
+      *DepOptions[3],
+      *DepOptions[4],
+      *DepOptions[5],
+      *DepOptions[6],
+      *DepOptions[7],
+      *DepOptions[8]
    };
-   int AddProtected = _config->FindI("pkgProblemResolver::Scores::AddProtected",10000);
-   int AddEssential = _config->FindI("pkgProblemResolver::Scores::AddEssential",5000);
+   static Configuration::Option<int> const OptAddProtected("pkgProblemResolver::Scores::AddProtected",10000);
+   static Configuration::Option<int> const OptAddEssential("pkgProblemResolver::Scores::AddEssential",5000);
+   int AddProtected = *OptAddProtected;
+   int AddEssential = *OptAddEssential;
 
    if (_config->FindB("Debug::pkgProblemResolver::ShowScores",false) == true)
       clog << "Settings used to calculate pkgProblemResolver::Scores::" << endl
@@ -740,6 +763,7 @@ bool pkgProblemResolver::DoUpgrade(pkgCache::PkgIterator Pkg)
 // ProblemResolver::Resolve - calls a resolver to fix the situation	/*{{{*/
 bool pkgProblemResolver::Resolve(bool BrokenFix, OpProgress * const Progress)
 {
+   APT::Trace::Phase const phase("pkgProblemResolver::Resolve");
    std::string const solver = _config->Find("APT::Solver", "internal");
    auto const ret = EDSP::ResolveExternal(solver.c_str(), Cache, 0, Progress);
    if (solver != "internal")
@@ -1249,6 +1273,7 @@ bool pkgProblemResolver::InstOrNewPolicyBroken(pkgCache::PkgIterator I)
    system was non-broken previously. */
 bool pkgProblemResolver::ResolveByKeep(OpProgress * const Progress)
 {
+   APT::Trace::Phase const phase("pkgProblemResolver::ResolveByKeep");
    std::string const solver = _config->Find("APT::Solver", "internal");
    constexpr auto flags = EDSP::Request::UPGRADE_ALL | EDSP::Request::FORBID_NEW_INSTALL | EDSP::Request::FORBID_REMOVE;
    auto const ret = EDSP::ResolveExternal(solver.c_str(), Cache, flags, Progress);
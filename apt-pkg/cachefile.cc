@@ -265,7 +265,8 @@ bool pkgCacheFile::AddIndexFile(pkgIndexFile * const File)		/*{{{*/
       {
 	 {
 	    pkgCacheGenerator Gen(dynmmap, nullptr);
-	    if (Gen.Start() == false || File->Merge(Gen, nullptr) == false)
+	    if (Gen.Start() == false || File->Merge(Gen, nullptr) == false ||
+		Gen.BuildGrpIndex() == false)
 	       return false;
 	 }
 	 Cache = new pkgCache(Map);
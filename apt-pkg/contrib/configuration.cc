@@ -32,13 +32,16 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <fstream>
 #include <iterator>
+#include <mutex>
 #include <numeric>
 #include <sstream>
 #include <stack>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include <apti18n.h>
@@ -197,15 +200,123 @@ static bool LoadConfigurationIndex(std::string const &filename)		/*{{{*/
 }
 									/*}}}*/
 
+// Configuration::Generation - Counter of changes			/*{{{*/
+/* Bumped on every change of any configuration (including creating and
+   destroying them), so that a Configuration::Option caching a value knows
+   it has to look up its option again. */
+static std::atomic<unsigned long> ConfigGeneration(1);
+unsigned long Configuration::Generation()
+{
+   return ConfigGeneration.load(std::memory_order_relaxed);
+}
+									/*}}}*/
+// ConfigurationRoot - Hashed indexes of items with many children	/*{{{*/
+/* Tags are compared case-insensitively, so are hashed lowercased. Items
+   with an empty tag (list items) are not indexed as lookups never match
+   them. The indexes of a tree are kept by its root, which is allocated
+   by the Configuration owning the tree. They are only changed together
+   with the tree, so reading a configuration never modifies anything. */
+namespace {
+struct ChildIndex
+{
+   struct Hash
+   {
+      size_t operator()(APT::StringView const Tag) const
+      {
+	 size_t H = 5381;
+	 for (char const c : Tag)
+	    H = 33 * H + tolower_ascii(c);
+	 return H;
+      }
+   };
+   struct Equal
+   {
+      bool operator()(APT::StringView const A, APT::StringView const B) const
+      {
+	 return A.length() == B.length() && stringcasecmp(A.begin(), A.end(), B.begin(), B.end()) == 0;
+      }
+   };
+   std::unordered_map<APT::StringView, Configuration::Item *, Hash, Equal> Children;
+   Configuration::Item **Last;
+};
+struct ConfigurationRoot : public Configuration::Item
+{
+   std::unordered_map<Configuration::Item const *, ChildIndex> Indexes;
+
+   ChildIndex const *Find(Item const * const Head) const
+   {
+      auto const I = Indexes.find(Head);
+      return I == Indexes.end() ? nullptr : &I->second;
+   }
+   // (re)builds the index of Head if it has enough children for one
+   void Index(Item * const Head)
+   {
+      Indexes.erase(Head);
+      size_t Count = 0;
+      for (Item const *C = Head->Child; C != nullptr; C = C->Next)
+	 ++Count;
+      if (Count < Threshold)
+	 return;
+      auto &Idx = Indexes[Head];
+      Idx.Last = &Head->Child;
+      for (Item *C = Head->Child; C != nullptr; C = C->Next)
+      {
+	 if (C->Tag.empty() == false)
+	    Idx.Children.emplace(C->Tag, C);
+	 Idx.Last = &C->Next;
+      }
+   }
+   void Forget(Item const * const Itm)
+   {
+      if (Indexes.empty() == false)
+	 Indexes.erase(Itm);
+   }
+   // Children get an index once a node has that many of them
+   static constexpr size_t Threshold = 16;
+};
+/* A Configuration can also be created for a subtree of another one. Changes
+   made through it have to update the indexes of the owner of the tree, so
+   the roots of all owned trees are known here. */
+struct OwnedRootsSet
+{
+   std::mutex Lock;
+   std::unordered_set<Configuration::Item const *> Roots;
+};
+// _config is created during static initialisation, too
+OwnedRootsSet &OwnedRoots()
+{
+   static OwnedRootsSet Owned;
+   return Owned;
+}
+}
+static ConfigurationRoot *TreeOwner(Configuration::Item * const Root, bool const ToFree)
+{
+   if (ToFree == true)
+      return static_cast<ConfigurationRoot *>(Root);
+   Configuration::Item *Top = Root;
+   while (Top->Parent != nullptr)
+      Top = Top->Parent;
+   auto &Owned = OwnedRoots();
+   std::lock_guard<std::mutex> const Guard(Owned.Lock);
+   if (Owned.Roots.find(Top) == Owned.Roots.end())
+      return nullptr;
+   return static_cast<ConfigurationRoot *>(Top);
+}
+									/*}}}*/
 // Configuration::Configuration - Constructor				/*{{{*/
 // ---------------------------------------------------------------------
 /* */
 Configuration::Configuration() : ToFree(true)
 {
-   Root = new Item;
+   ++ConfigGeneration;
+   Root = new ConfigurationRoot;
+   auto &Owned = OwnedRoots();
+   std::lock_guard<std::mutex> const Guard(Owned.Lock);
+   Owned.Roots.insert(Root);
 }
 Configuration::Configuration(const Item *Root) : Root((Item *)Root), ToFree(false)
 {
+   ++ConfigGeneration;
 }
 									/*}}}*/
 // Configuration::~Configuration - Destructor				/*{{{*/
@@ -213,9 +324,15 @@ Configuration::Configuration(const Item *Root) : Root((Item *)Root), ToFree(fals
 /* */
 Configuration::~Configuration()
 {
+   ++ConfigGeneration;
    if (ToFree == false)
       return;
-   
+   {
+      auto &Owned = OwnedRoots();
+      std::lock_guard<std::mutex> const Guard(Owned.Lock);
+      Owned.Roots.erase(Root);
+   }
+
    Item *Top = Root;
    for (; Top != 0;)
    {
@@ -228,7 +345,10 @@ Configuration::~Configuration()
       while (Top != 0 && Top->Next == 0)
       {
 	 Item *Parent = Top->Parent;
-	 delete Top;
+	 if (Top == Root)
+	    delete static_cast<ConfigurationRoot *>(Top);
+	 else
+	    delete Top;
 	 Top = Parent;
       }      
       if (Top != 0)
@@ -247,12 +367,24 @@ Configuration::~Configuration()
 Configuration::Item *Configuration::Lookup(Item *Head,const char *S,
 					   unsigned long const &Len,bool const &Create)
 {
+   // the indexes are used for reading only if we own them
+   ChildIndex const * const Index = ToFree ? static_cast<ConfigurationRoot *>(Root)->Find(Head) : nullptr;
+   if (Index != nullptr && Len != 0)
+   {
+      auto const Found = Index->Children.find(APT::StringView(S, Len));
+      if (Found != Index->Children.end())
+	 return Found->second;
+      if (Create == false)
+	 return 0;
+   }
+
    int Res = 1;
    Item *I = Head->Child;
    Item **Last = &Head->Child;
-   
+   if (Index != nullptr)
+      Last = Index->Last;
    // Empty strings match nothing. They are used for lists.
-   if (Len != 0)
+   else if (Len != 0)
    {
       for (; I != 0; Last = &I->Next, I = I->Next)
 	 if (Len == I->Tag.length() && (Res = stringcasecmp(I->Tag,S,S + Len)) == 0)
@@ -260,17 +392,32 @@ Configuration::Item *Configuration::Lookup(Item *Head,const char *S,
    }
    else
       for (; I != 0; Last = &I->Next, I = I->Next);
-      
+
    if (Res == 0)
       return I;
    if (Create == false)
       return 0;
-   
+
+   ++ConfigGeneration;
    I = new Item;
    I->Tag.assign(S,Len);
    I->Next = *Last;
    I->Parent = Head;
    *Last = I;
+
+   ConfigurationRoot * const Owner = TreeOwner(Root, ToFree);
+   if (Owner != nullptr)
+   {
+      auto const Idx = Owner->Indexes.find(Head);
+      if (Idx == Owner->Indexes.end())
+	 Owner->Index(Head);
+      else
+      {
+	 if (Len != 0)
+	    Idx->second.Children.emplace(I->Tag, I);
+	 Idx->second.Last = &I->Next;
+      }
+   }
    return I;
 }
 									/*}}}*/
@@ -508,7 +655,10 @@ void Configuration::CndSet(const char *Name,const string &Value)
    if (Itm == 0)
       return;
    if (Itm->Value.empty() == true)
+   {
+      ++ConfigGeneration;
       Itm->Value = Value;
+   }
 }
 									/*}}}*/
 // Configuration::Set - Set an integer value				/*{{{*/
@@ -519,6 +669,7 @@ void Configuration::CndSet(const char *Name,int const Value)
    Item *Itm = Lookup(Name,true);
    if (Itm == 0 || Itm->Value.empty() == false)
       return;
+   ++ConfigGeneration;
    char S[300];
    snprintf(S,sizeof(S),"%i",Value);
    Itm->Value = S;
@@ -532,6 +683,7 @@ void Configuration::Set(const char *Name,const string &Value)
    Item *Itm = Lookup(Name,true);
    if (Itm == 0)
       return;
+   ++ConfigGeneration;
    Itm->Value = Value;
 }
 									/*}}}*/
@@ -543,6 +695,7 @@ void Configuration::Set(const char *Name,int const &Value)
    Item *Itm = Lookup(Name,true);
    if (Itm == 0)
       return;
+   ++ConfigGeneration;
    char S[300];
    snprintf(S,sizeof(S),"%i",Value);
    Itm->Value = S;
@@ -566,6 +719,8 @@ void Configuration::Clear(string const &Name, string const &Value)
    Item *Top = Lookup(Name.c_str(),false);
    if (Top == 0 || Top->Child == 0)
       return;
+   ++ConfigGeneration;
+   ConfigurationRoot * const Owner = TreeOwner(Root, ToFree);
 
    Item *Tmp, *Prev, *I;
    Prev = I = Top->Child;
@@ -580,13 +735,16 @@ void Configuration::Clear(string const &Name, string const &Value)
 	    Top->Child = I->Next;
 	 I = I->Next;
 	 Prev->Next = I;
+	 if (Owner != nullptr)
+	    Owner->Forget(Tmp);
 	 delete Tmp;
       } else {
 	 Prev = I;
 	 I = I->Next;
       }
    }
-     
+   if (Owner != nullptr)
+      Owner->Index(Top);
 }
 									/*}}}*/
 // Configuration::Clear - Clear everything				/*{{{*/
@@ -610,7 +768,11 @@ void Configuration::Clear(string const &Name)
    if (Top == 0) 
       return;
 
+   ++ConfigGeneration;
+   ConfigurationRoot * const Owner = TreeOwner(Root, ToFree);
    Top->Value.clear();
+   if (Owner != nullptr)
+      Owner->Forget(Top);
    Item *Stop = Top;
    Top = Top->Child;
    Stop->Child = 0;
@@ -626,6 +788,8 @@ void Configuration::Clear(string const &Name)
       {
 	 Item *Tmp = Top;
 	 Top = Top->Parent;
+	 if (Owner != nullptr)
+	    Owner->Forget(Tmp);
 	 delete Tmp;
 	 
 	 if (Top == Stop)
@@ -635,6 +799,8 @@ void Configuration::Clear(string const &Name)
       Item *Tmp = Top;
       if (Top != 0)
 	 Top = Top->Next;
+      if (Owner != nullptr)
+	 Owner->Forget(Tmp);
       delete Tmp;
    }
 }
@@ -661,7 +827,11 @@ void Configuration::MoveSubTree(char const * const OldRootName, char const * con
    if (NewRootName != nullptr)
       NewRoot.append(NewRootName).append("::");
 
+   ++ConfigGeneration;
+   ConfigurationRoot * const Owner = TreeOwner(Root, ToFree);
    Top->Value.clear();
+   if (Owner != nullptr)
+      Owner->Forget(Top);
    Item * const Stop = Top;
    Top = Top->Child;
    Stop->Child = 0;
@@ -678,6 +848,8 @@ void Configuration::MoveSubTree(char const * const OldRootName, char const * con
 	 Set(NewRoot + Top->FullTag(OldRoot), Top->Value);
 	 Item const * const Tmp = Top;
 	 Top = Top->Parent;
+	 if (Owner != nullptr)
+	    Owner->Forget(Tmp);
 	 delete Tmp;
 
 	 if (Top == Stop)
@@ -688,6 +860,8 @@ void Configuration::MoveSubTree(char const * const OldRootName, char const * con
       Item const * const Tmp = Top;
       if (Top != 0)
 	 Top = Top->Next;
+      if (Owner != nullptr)
+	 Owner->Forget(Tmp);
       delete Tmp;
    }
 }
@@ -36,6 +36,9 @@
 #include <apt-pkg/macros.h>
 
 
+class Configuration;
+APT_PUBLIC extern Configuration *_config;
+
 class APT_PUBLIC Configuration
 {
    public:
@@ -111,6 +114,50 @@ class APT_PUBLIC Configuration
 
    inline const Item *Tree(const char *Name) const {return Lookup(Name);};
 
+   /** \brief counter incremented by every change of any configuration
+    *
+    *  Used by #Option to notice that its cached value might be stale. */
+   static unsigned long Generation();
+
+   /** \brief cached value of an option of _config for hot code paths
+    *
+    *  The option is looked up on first use and again only if a
+    *  configuration was changed or _config replaced since, so reading it
+    *  is usually just a comparison. Use it as a (static) object instead of
+    *  calling Find, FindB or FindI over and over again. Reading the value
+    *  updates the cache, so an Option must not be shared between threads;
+    *  make it thread_local if it is used in code which might run in one.
+    *
+    *  \tparam T is std::string, bool or int, read via Find, FindB or FindI */
+   template<typename T> class Option
+   {
+      char const * const Name;
+      T const Default;
+      mutable T Value;
+      mutable Configuration const *Cnf;
+      mutable unsigned long Gen;
+
+      static std::string Read(char const * const Name, std::string const &Default) { return _config->Find(Name, Default); }
+      static bool Read(char const * const Name, bool const Default) { return _config->FindB(Name, Default); }
+      static int Read(char const * const Name, int const Default) { return _config->FindI(Name, Default); }
+
+      public:
+      /** \param Name of the option, which has to outlive this object
+       *  \param Default value if the option isn't set */
+      Option(char const * const Name, T const &Default) : Name(Name), Default(Default), Value(Default), Cnf(nullptr), Gen(0) {}
+
+      T const &operator*() const
+      {
+	 if (Cnf != _config || Gen != Generation())
+	 {
+	    Gen = Generation();
+	    Value = Read(Name, Default);
+	    Cnf = _config;
+	 }
+	 return Value;
+      }
+   };
+
    inline void Dump() { Dump(std::clog); };
    void Dump(std::ostream& str);
    void Dump(std::ostream& str, char const * const root,
@@ -139,8 +186,6 @@ class APT_PUBLIC Configuration
    };
 };
 
-APT_PUBLIC extern Configuration *_config;
-
 APT_PUBLIC bool ReadConfigFile(Configuration &Conf,const std::string &FName,
 		    bool const &AsSectional = false,
 		    unsigned const &Depth = 0);
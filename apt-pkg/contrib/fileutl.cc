@@ -44,6 +44,7 @@
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <sys/ioctl.h>
 #include <sys/select.h>
 #include <sys/stat.h>
 #include <sys/time.h>
@@ -52,8 +53,12 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <condition_variable>
+#include <deque>
 #include <memory>
+#include <mutex>
 #include <set>
+#include <thread>
 
 #ifdef HAVE_ZLIB
 #include <zlib.h>
@@ -77,6 +82,7 @@
 #include <stdint.h>
 
 #if __gnu_linux__
+#include <linux/fs.h>
 #include <sys/prctl.h>
 #endif
 
@@ -158,6 +164,73 @@ bool RunScripts(const char *Cnf)
 }
 									/*}}}*/
 
+// KernelCopyFile - Let the kernel copy between two plain files	/*{{{*/
+// ---------------------------------------------------------------------
+/* The data is shared with a reflink if the destination is still empty and
+   the filesystem supports it, otherwise copy_file_range() avoids bouncing
+   it through userspace (and can be offloaded by e.g. NFS servers).
+   Returns false with Done unset if the caller should fall back to a
+   buffered copy as the kernel can't do it for these files. */
+static bool KernelCopyFile(FileFd &From, FileFd &To, bool &Done)
+{
+   Done = false;
+#ifdef HAVE_COPY_FILE_RANGE
+   if (From.IsCompressed() == true || To.IsCompressed() == true)
+      return false;
+   struct stat FromBuf, ToBuf;
+   if (fstat(From.Fd(), &FromBuf) != 0 || S_ISREG(FromBuf.st_mode) == false ||
+	 fstat(To.Fd(), &ToBuf) != 0 || S_ISREG(ToBuf.st_mode) == false)
+      return false;
+
+   // sync the kernel offsets with the position FileFd reports as it might
+   // have buffered data in either direction
+   unsigned long long const FromPos = From.Tell();
+   unsigned long long const ToPos = To.Tell();
+   if (From.Failed() || To.Failed() || From.Seek(FromPos) == false || To.Seek(ToPos) == false)
+      return true;
+
+#ifdef FICLONE
+   if (FromPos == 0 && ToPos == 0 && ToBuf.st_size == 0 &&
+	 ioctl(To.Fd(), FICLONE, From.Fd()) == 0)
+   {
+      Done = To.Seek(FromBuf.st_size) && From.Seek(FromBuf.st_size);
+      return true;
+   }
+#endif
+
+   bool First = true;
+   while (true)
+   {
+      ssize_t const Res = copy_file_range(From.Fd(), nullptr, To.Fd(), nullptr, APT_BUFFER_SIZE * 256, 0);
+      if (Res < 0)
+      {
+	 if (errno == EINTR)
+	    continue;
+	 // nothing happened yet, so the buffered copy can take over
+	 if (First && (errno == ENOSYS || errno == EXDEV || errno == EINVAL ||
+		  errno == EOPNOTSUPP || errno == EBADF || errno == EPERM))
+	    return false;
+	 return _error->Errno("copy_file_range", _("Write error"));
+      }
+      if (Res == 0)
+	 break;
+      First = false;
+   }
+
+   // let FileFd know where the kernel left the offsets
+   off_t const FromEnd = lseek(From.Fd(), 0, SEEK_CUR);
+   off_t const ToEnd = lseek(To.Fd(), 0, SEEK_CUR);
+   if (FromEnd == -1 || ToEnd == -1)
+      return _error->Errno("lseek", "Failed to determine the current file position");
+   Done = From.Seek(FromEnd) && To.Seek(ToEnd);
+   return true;
+#else
+   (void)From;
+   (void)To;
+   return false;
+#endif
+}
+									/*}}}*/
 // CopyFile - Buffered copy of a file					/*{{{*/
 // ---------------------------------------------------------------------
 /* The caller is expected to set things so that failure causes erasure */
@@ -167,6 +240,10 @@ bool CopyFile(FileFd &From,FileFd &To)
 	 From.Failed() == true || To.Failed() == true)
       return false;
 
+   bool Done;
+   if (KernelCopyFile(From, To, Done) == true)
+      return Done;
+
    // Buffered copy between fds
    constexpr size_t BufSize = APT_BUFFER_SIZE;
    std::unique_ptr<unsigned char[]> Buf(new unsigned char[BufSize]);
@@ -1090,6 +1167,7 @@ struct APT_HIDDEN simple_buffer {							/*{{{*/
 
 class APT_HIDDEN FileFdPrivate {							/*{{{*/
    friend class BufferedWriteFileFdPrivate;
+   friend class ReadAheadFileFdPrivate;
 protected:
    FileFd * const filefd;
    simple_buffer buffer;
@@ -1099,11 +1177,24 @@ protected:
    APT::Configuration::Compressor compressor;
    unsigned int openmode;
    unsigned long long seekpos;
+   // reads run in the thread of a ReadAheadFileFdPrivate can't mark the
+   // FileFd as failed, so they record it here to have it applied later
+   bool readahead;
+   bool readfailed;
+
+   ssize_t InternalReadFailed()
+   {
+      if (readahead == true)
+	 readfailed = true;
+      else
+	 filefd->OpFail();
+      return -1;
+   }
 public:
 
    explicit FileFdPrivate(FileFd * const pfilefd) : filefd(pfilefd),
       compressed_fd(-1), compressor_pid(-1), is_pipe(false),
-      openmode(0), seekpos(0) {};
+      openmode(0), seekpos(0), readahead(false), readfailed(false) {};
    virtual APT::Configuration::Compressor get_compressor() const
    {
       return compressor;
@@ -1430,6 +1521,190 @@ public:
    }
 };
 									/*}}}*/
+class APT_HIDDEN ReadAheadFileFdPrivate : public FileFdPrivate {		/*{{{*/
+/* Decompresses the file in a thread a few chunks ahead of the reader, so
+   that reading from disk, decompressing and whatever the caller does with
+   the data can overlap. Everything but plain sequential reading stops the
+   thread and is handled by the generic implementation reading through the
+   file instead of the (potentially seeking) wrapped implementation. */
+protected:
+   FileFdPrivate *wrapped;
+
+   static constexpr size_t ChunkSize = 128 * 1024;
+   static constexpr size_t MaxChunks = 4;
+   std::thread reader;
+   std::mutex lock;
+   std::condition_variable changed;
+   std::deque<std::vector<char>> chunks;
+   size_t chunkpos = 0;
+   bool stop = false;
+   bool done = false;
+   int readerrno = 0;
+   bool failed = false;
+   // messages the wrapped implementation generated in the reader thread
+   std::vector<std::pair<bool, std::string>> messages;
+
+   void ReadAhead()
+   {
+      while (true)
+      {
+	 std::vector<char> chunk(ChunkSize);
+	 size_t filled = 0;
+	 ssize_t res = 1;
+	 while (filled < chunk.size())
+	 {
+	    res = wrapped->InternalUnbufferedRead(chunk.data() + filled, chunk.size() - filled);
+	    if (res < 0 && errno == EINTR)
+	       continue;
+	    if (res <= 0)
+	       break;
+	    filled += res;
+	 }
+	 chunk.resize(filled);
+
+	 std::unique_lock<std::mutex> guard(lock);
+	 changed.wait(guard, [&] { return stop || chunks.size() < MaxChunks; });
+	 if (stop)
+	    return;
+	 if (filled != 0)
+	    chunks.push_back(std::move(chunk));
+	 if (res <= 0)
+	 {
+	    readerrno = (res < 0) ? errno : 0;
+	    if (readerrno == 0 && res < 0)
+	       readerrno = EIO;
+	    failed = wrapped->readfailed;
+	    while (_error->empty(GlobalError::DEBUG) == false)
+	    {
+	       std::string msg;
+	       bool const error = _error->PopMessage(msg);
+	       messages.emplace_back(error, std::move(msg));
+	    }
+	    done = true;
+	 }
+	 changed.notify_all();
+	 if (done)
+	    return;
+      }
+   }
+   void StopReadAhead()
+   {
+      if (reader.joinable())
+      {
+	 {
+	    std::lock_guard<std::mutex> guard(lock);
+	    stop = true;
+	 }
+	 changed.notify_all();
+	 reader.join();
+      }
+      chunks.clear();
+      messages.clear();
+      chunkpos = 0;
+      stop = done = failed = false;
+      readerrno = 0;
+      wrapped->readfailed = false;
+   }
+
+public:
+   explicit ReadAheadFileFdPrivate(FileFdPrivate *Priv) :
+      FileFdPrivate(Priv->filefd), wrapped(Priv)
+   {
+      wrapped->readahead = true;
+   }
+
+   virtual void set_compressor(APT::Configuration::Compressor const &compressor) APT_OVERRIDE
+   {
+      FileFdPrivate::set_compressor(compressor);
+      wrapped->set_compressor(compressor);
+   }
+   virtual void set_openmode(unsigned int openmode) APT_OVERRIDE
+   {
+      FileFdPrivate::set_openmode(openmode);
+      wrapped->set_openmode(openmode);
+   }
+   virtual void set_is_pipe(bool is_pipe) APT_OVERRIDE
+   {
+      FileFdPrivate::set_is_pipe(is_pipe);
+      wrapped->set_is_pipe(is_pipe);
+   }
+   virtual bool InternalOpen(int const iFd, unsigned int const Mode) APT_OVERRIDE
+   {
+      StopReadAhead();
+      buffer.reset();
+      if (wrapped->InternalOpen(iFd, Mode) == false)
+	 return false;
+      reader = std::thread(&ReadAheadFileFdPrivate::ReadAhead, this);
+      return true;
+   }
+   virtual ssize_t InternalUnbufferedRead(void * const To, unsigned long long const Size) APT_OVERRIDE
+   {
+      std::unique_lock<std::mutex> guard(lock);
+      changed.wait(guard, [&] { return done || chunks.empty() == false; });
+      if (chunks.empty())
+      {
+	 guard.unlock();
+	 if (reader.joinable())
+	    reader.join();
+	 // the reader is gone, so its results can be applied to the FileFd now
+	 for (auto const &msg : messages)
+	    _error->Insert(msg.first ? GlobalError::ERROR : GlobalError::WARNING, "%s", msg.second.c_str());
+	 messages.clear();
+	 if (failed == true)
+	    filefd->OpFail();
+	 if (readerrno == 0)
+	    return 0;
+	 errno = readerrno;
+	 return -1;
+      }
+      auto &chunk = chunks.front();
+      size_t const n = std::min<unsigned long long>(Size, chunk.size() - chunkpos);
+      memcpy(To, chunk.data() + chunkpos, n);
+      chunkpos += n;
+      if (chunkpos == chunk.size())
+      {
+	 chunks.pop_front();
+	 chunkpos = 0;
+	 changed.notify_all();
+      }
+      return n;
+   }
+   virtual bool InternalReadError() APT_OVERRIDE
+   {
+      return wrapped->InternalReadError();
+   }
+   virtual bool InternalFlush() APT_OVERRIDE
+   {
+      return wrapped->InternalFlush();
+   }
+   virtual ssize_t InternalWrite(void const * const From, unsigned long long const Size) APT_OVERRIDE
+   {
+      return wrapped->InternalWrite(From, Size);
+   }
+   virtual bool InternalWriteError() APT_OVERRIDE
+   {
+      return wrapped->InternalWriteError();
+   }
+   virtual bool InternalClose(std::string const &FileName) APT_OVERRIDE
+   {
+      StopReadAhead();
+      return wrapped->InternalClose(FileName);
+   }
+   virtual bool InternalStream() const APT_OVERRIDE
+   {
+      return wrapped->InternalStream();
+   }
+   virtual bool InternalAlwaysAutoClose() const APT_OVERRIDE
+   {
+      return wrapped->InternalAlwaysAutoClose();
+   }
+   virtual ~ReadAheadFileFdPrivate()
+   {
+      StopReadAhead();
+      delete wrapped;
+   }
+};
+									/*}}}*/
 class APT_HIDDEN GzipFileFdPrivate: public FileFdPrivate {				/*{{{*/
 #ifdef HAVE_ZLIB
 public:
@@ -1439,7 +1714,17 @@ public:
       if ((Mode & FileFd::ReadWrite) == FileFd::ReadWrite)
 	 gz = gzdopen(iFd, "r+");
       else if ((Mode & FileFd::WriteOnly) == FileFd::WriteOnly)
-	 gz = gzdopen(iFd, "w");
+      {
+	 // honour a level given like for the binary, e.g. -9 or -6n
+	 std::string mode = "w";
+	 for (auto a = compressor.CompressArgs.rbegin(); a != compressor.CompressArgs.rend(); ++a)
+	    if (a->size() >= 2 && (*a)[0] == '-' && isdigit((*a)[1]) != 0)
+	    {
+	       mode += (*a)[1];
+	       break;
+	    }
+	 gz = gzdopen(iFd, mode.c_str());
+      }
       else
 	 gz = gzdopen(iFd, "r");
       filefd->Flags |= FileFd::Compressed;
@@ -1672,9 +1957,8 @@ public:
 	    /* Expected EOF */
 	    if (read == 0) {
 	       res = -1;
-	       return filefd->FileFdError("LZ4F: %s %s",
-					  filefd->FileName.c_str(),
-					  _("Unexpected end of file")), -1;
+	       _error->Error("LZ4F: %s %s", filefd->FileName.c_str(), _("Unexpected end of file"));
+	       return InternalReadFailed();
 	    }
 	 }
 	 // Drain compressed buffer as far as possible.
@@ -1770,6 +2054,31 @@ public:
 #endif
 };
 									/*}}}*/
+// findThreads - thread count requested via -T<n> or --threads=<n>	/*{{{*/
+// ---------------------------------------------------------------------
+/* xz and zstd both accept this option, so the same configured arguments
+   work for the binaries as well as for the libraries. 0 means one thread
+   per processor. */
+#if defined HAVE_LZMA || defined HAVE_ZSTD
+static uint32_t findThreads(std::vector<std::string> const &Args, uint32_t const Default)
+{
+   for (auto a = Args.rbegin(); a != Args.rend(); ++a)
+   {
+      std::string value;
+      if (APT::String::Startswith(*a, "--threads="))
+	 value = a->substr(strlen("--threads="));
+      else if (a->size() > 2 && APT::String::Startswith(*a, "-T"))
+	 value = a->substr(2);
+      else
+	 continue;
+      if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos)
+	 continue;
+      return std::stoul(value);
+   }
+   return Default;
+}
+#endif
+									/*}}}*/
 class APT_HIDDEN ZstdFileFdPrivate : public FileFdPrivate		/*{{{*/
 {
 #ifdef HAVE_ZSTD
@@ -1791,6 +2100,19 @@ class APT_HIDDEN ZstdFileFdPrivate : public FileFdPrivate		/*{{{*/
       {
 	 cctx = ZSTD_createCStream();
 	 res = ZSTD_initCStream(cctx, findLevel(compressor.CompressArgs));
+#if ZSTD_VERSION_NUMBER >= 10400
+	 // like the binary, -C/--check adds a checksum to the frame
+	 if (ZSTD_isError(res) == false && std::any_of(compressor.CompressArgs.begin(), compressor.CompressArgs.end(),
+							 [](std::string const &a) { return a == "-C" || a == "--check"; }))
+	    res = ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1);
+	 // libzstd only compresses in parallel, its decompression is fast enough
+	 uint32_t const threads = findThreads(compressor.CompressArgs, 1);
+	 if (ZSTD_isError(res) == false && threads != 1)
+	 {
+	    // this fails if libzstd was built without thread support, which is fine
+	    ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, threads == 0 ? std::max(1l, sysconf(_SC_NPROCESSORS_ONLN)) : threads);
+	 }
+#endif
 	 zstd_buffer.reset(APT_BUFFER_SIZE);
       }
       else
@@ -1833,10 +2155,8 @@ class APT_HIDDEN ZstdFileFdPrivate : public FileFdPrivate		/*{{{*/
 		  return 0;
 
 	       res = -1;
-	       return filefd->FileFdError("ZSTD: %s %s",
-					  filefd->FileName.c_str(),
-					  _("Unexpected end of file")),
-		      -1;
+	       _error->Error("ZSTD: %s %s", filefd->FileName.c_str(), _("Unexpected end of file"));
+	       return InternalReadFailed();
 	    }
 	 }
 	 // Drain compressed buffer as far as possible.
@@ -1889,10 +2209,16 @@ class APT_HIDDEN ZstdFileFdPrivate : public FileFdPrivate		/*{{{*/
 	 .pos = 0,
       };
 
-      res = ZSTD_compressStream(cctx, &out, &in);
+      // a full output buffer can leave the input untouched, which our
+      // caller would take as a failed write, so drain until it moves
+      do
+      {
+	 out.pos = 0;
+	 res = ZSTD_compressStream(cctx, &out, &in);
 
-      if (ZSTD_isError(res) || backend.Write(zstd_buffer.buffer, out.pos) == false)
-	 return -1;
+	 if (ZSTD_isError(res) || backend.Write(zstd_buffer.buffer, out.pos) == false)
+	    return -1;
+      } while (in.pos == 0 && out.pos != 0);
 
       return in.pos;
    }
@@ -1986,7 +2312,8 @@ class APT_HIDDEN LzmaFileFdPrivate: public FileFdPrivate {		/*{{{*/
    struct LZMAFILE {
       FILE* file;
       FileFd * const filefd;
-      uint8_t buffer[4096];
+      // the multithreaded decoder wants big chunks to distribute
+      uint8_t buffer[APT_BUFFER_SIZE];
       lzma_stream stream;
       lzma_ret err;
       bool eof;
@@ -2026,7 +2353,7 @@ class APT_HIDDEN LzmaFileFdPrivate: public FileFdPrivate {		/*{{{*/
    static uint32_t findXZlevel(std::vector<std::string> const &Args)
    {
       for (auto a = Args.rbegin(); a != Args.rend(); ++a)
-	 if (a->empty() == false && (*a)[0] == '-' && (*a)[1] != '-')
+	 if (a->empty() == false && (*a)[0] == '-' && (*a)[1] != '-' && (*a)[1] != 'T')
 	 {
 	    auto const number = a->find_last_of("0123456789");
 	    if (number == std::string::npos)
@@ -2067,12 +2394,34 @@ public:
 
       lzma_stream tmp_stream = LZMA_STREAM_INIT;
       lzma->stream = tmp_stream;
+      uint64_t constexpr memlimit = 1024 * 1024 * 500;
 
       if ((Mode & FileFd::WriteOnly) == FileFd::WriteOnly)
       {
 	 uint32_t const xzlevel = findXZlevel(compressor.CompressArgs);
 	 if (compressor.Name == "xz")
 	 {
+#if LZMA_VERSION >= 50020002
+	    /* The multithreaded encoder splits its output into independent
+	       blocks, which allows decoding them in parallel again later.
+	       The output only depends on the block size, not on the number
+	       of threads used to produce it. */
+	    uint32_t const threads = findThreads(compressor.CompressArgs, 1);
+	    if (threads != 1)
+	    {
+	       lzma_mt mt;
+	       memset(&mt, 0, sizeof(mt));
+	       mt.threads = threads == 0 ? std::max(1u, lzma_cputhreads()) : threads;
+	       mt.preset = xzlevel;
+	       mt.check = LZMA_CHECK_CRC64;
+	       // each thread buffers a few blocks, so many threads need a lot of memory
+	       while (mt.threads > 1 && lzma_stream_encoder_mt_memusage(&mt) > memlimit)
+		  --mt.threads;
+	       if (lzma_stream_encoder_mt(&lzma->stream, &mt) != LZMA_OK)
+		  return false;
+	    }
+	    else
+#endif
 	    if (lzma_easy_encoder(&lzma->stream, xzlevel, LZMA_CHECK_CRC64) != LZMA_OK)
 	       return false;
 	 }
@@ -2087,7 +2436,23 @@ public:
       }
       else
       {
-	 uint64_t constexpr memlimit = 1024 * 1024 * 500;
+#if LZMA_VERSION >= 50040002
+	 /* files with a single block are decoded by one thread regardless.
+	    Many FileFds are open at the same time e.g. while fetching, so
+	    the threads of all processors are only used if asked for. */
+	 uint32_t const threads = findThreads(compressor.UncompressArgs, 1);
+	 if (compressor.Name == "xz" && threads != 1)
+	 {
+	    lzma_mt mt;
+	    memset(&mt, 0, sizeof(mt));
+	    mt.threads = threads == 0 ? std::max(1u, lzma_cputhreads()) : threads;
+	    mt.memlimit_threading = memlimit;
+	    mt.memlimit_stop = memlimit;
+	    if (lzma_stream_decoder_mt(&lzma->stream, &mt) != LZMA_OK)
+	       return false;
+	 }
+	 else
+#endif
 	 if (lzma_auto_decoder(&lzma->stream, memlimit, 0) != LZMA_OK)
 	    return false;
 	 lzma->compressing = false;
@@ -2634,11 +2999,12 @@ bool FileFd::OpenInternDescriptor(unsigned int const Mode, APT::Configuration::C
 
    if (d == nullptr)
    {
+      bool builtin = false;
       if (false)
 	 /* dummy so that the rest can be 'else if's */;
 #define APT_COMPRESS_INIT(NAME, CONSTRUCTOR) \
       else if (compressor.Name == NAME) \
-	 d = new CONSTRUCTOR(this)
+	 d = new CONSTRUCTOR(this), builtin = true
 #ifdef HAVE_ZLIB
       APT_COMPRESS_INIT("gzip", GzipFileFdPrivate);
 #endif
@@ -2663,6 +3029,10 @@ bool FileFd::OpenInternDescriptor(unsigned int const Mode, APT::Configuration::C
 
       if (Mode & BufferedWrite)
 	 d = new BufferedWriteFileFdPrivate(d);
+      // external compressors run in a process of their own already
+      else if (builtin && (Mode & ReadWrite) == ReadOnly && (Mode & NoReadAhead) == 0 &&
+	       ((Mode & ReadAhead) != 0 || _config->FindB("APT::FileFd::Read-Ahead", false)))
+	 d = new ReadAheadFileFdPrivate(d);
 
       d->set_openmode(Mode);
       d->set_compressor(compressor);
@@ -65,6 +65,9 @@ class APT_PUBLIC FileFd
 	Atomic = Exclusive | (1 << 4),
 	Empty = (1 << 5),
 	BufferedWrite = (1 << 6),
+	// decide on reading ahead in a thread instead of APT::FileFd::Read-Ahead
+	ReadAhead = (1 << 7),
+	NoReadAhead = (1 << 8),
 
 	WriteEmpty = ReadWrite | Create | Empty,
 	WriteExists = ReadWrite,
@@ -41,6 +41,9 @@ static const constexpr struct HashAlgo
    {"SHA512", GCRY_MD_SHA512, Hashes::SHA512SUM},
 };
 
+// compared over and over again while acquiring files, which happens in threads, too
+static thread_local Configuration::Option<std::string> const ForceHash("Acquire::ForceHash", "");
+
 const char * HashString::_SupportedHashes[] =
 {
    "SHA512", "SHA256", "SHA1", "MD5Sum", "Checksum-FileSize", NULL
@@ -179,7 +182,7 @@ bool HashStringList::usable() const					/*{{{*/
 {
    if (empty() == true)
       return false;
-   std::string const forcedType = _config->Find("Acquire::ForceHash", "");
+   std::string const &forcedType = *ForceHash;
    if (forcedType.empty() == true)
    {
       // See if there is at least one usable hash
@@ -192,7 +195,7 @@ HashString const * HashStringList::find(char const * const type) const /*{{{*/
 {
    if (type == NULL || type[0] == '\0')
    {
-      std::string const forcedType = _config->Find("Acquire::ForceHash", "");
+      std::string const &forcedType = *ForceHash;
       if (forcedType.empty() == false)
 	 return find(forcedType.c_str());
       for (char const * const * t = HashString::SupportedHashes(); *t != NULL; ++t)
@@ -267,7 +270,7 @@ bool HashStringList::VerifyFile(std::string filename) const		/*{{{*/
 									/*}}}*/
 bool HashStringList::operator==(HashStringList const &other) const	/*{{{*/
 {
-   std::string const forcedType = _config->Find("Acquire::ForceHash", "");
+   std::string const &forcedType = *ForceHash;
    if (forcedType.empty() == false)
    {
       HashString const * const hs = find(forcedType);
@@ -302,7 +305,7 @@ public:
    unsigned long long FileSize;
    gcry_md_hd_t hd;
 
-   void maybeInit()
+   static void maybeInit()
    {
 
       // Yikes, we got to initialize libgcrypt, or we get warnings. But we
@@ -404,19 +407,14 @@ bool Hashes::AddFD(FileFd &Fd,unsigned long long Size)
 }
 									/*}}}*/
 
-static APT_PURE std::string HexDigest(gcry_md_hd_t hd, int algo)
+static void HexEncode(unsigned char const * const Sum, size_t const Size, char * const Result)
 {
    char Conv[16] =
       {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b',
        'c', 'd', 'e', 'f'};
 
-   auto Size = gcry_md_get_algo_dlen(algo);
-   assert(Size <= 512/8);
-   char Result[((Size)*2) + 1];
    Result[(Size)*2] = 0;
 
-   auto Sum = gcry_md_read(hd, algo);
-
    // Convert each char into two letters
    size_t J = 0;
    size_t I = 0;
@@ -425,6 +423,13 @@ static APT_PURE std::string HexDigest(gcry_md_hd_t hd, int algo)
       Result[I] = Conv[Sum[J] >> 4];
       Result[I + 1] = Conv[Sum[J] & 0xF];
    }
+}
+static APT_PURE std::string HexDigest(gcry_md_hd_t hd, int algo)
+{
+   auto Size = gcry_md_get_algo_dlen(algo);
+   assert(Size <= 512/8);
+   char Result[((Size)*2) + 1];
+   HexEncode(gcry_md_read(hd, algo), Size, Result);
    return std::string(Result);
 };
 
@@ -447,6 +452,28 @@ HashString Hashes::GetHashString(SupportedHashes hash)
 
    abort();
 }
+// Hashes::MD5Hex - MD5 of a few buffers without a gcrypt handle	/*{{{*/
+bool Hashes::MD5Hex(std::initializer_list<APT::StringView> const Data, char (&Hex)[33])
+{
+   PrivateHashes::maybeInit();
+   gcry_buffer_t iov[Data.size()];
+   size_t I = 0;
+   for (auto const &D : Data)
+   {
+      iov[I].size = 0;
+      iov[I].off = 0;
+      iov[I].len = D.size();
+      iov[I].data = const_cast<char *>(D.data());
+      ++I;
+   }
+   unsigned char Sum[16];
+   // MD5 is refused e.g. in FIPS mode, the caller has to fall back then
+   if (gcry_md_hash_buffers(GCRY_MD_MD5, 0, Sum, iov, Data.size()) != 0)
+      return false;
+   HexEncode(Sum, sizeof(Sum), Hex);
+   return true;
+}
+									/*}}}*/
 Hashes::Hashes() : d(new PrivateHashes(~0)) { }
 Hashes::Hashes(unsigned int const Hashes) : d(new PrivateHashes(Hashes)) {}
 Hashes::Hashes(HashStringList const &Hashes) : d(new PrivateHashes(Hashes)) {}
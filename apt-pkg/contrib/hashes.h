@@ -13,8 +13,10 @@
 #define APTPKG_HASHES_H
 
 #include <apt-pkg/macros.h>
+#include <apt-pkg/string_view.h>
 
 #include <cstring>
+#include <initializer_list>
 #include <string>
 #include <vector>
 
@@ -192,6 +194,14 @@ class APT_PUBLIC Hashes
    /** Get a specific hash. It is an error to use a hash that was not hashes */
    HashString GetHashString(SupportedHashes hash);
 
+   /** \brief hex encoded MD5 of the concatenated buffers
+    *
+    *  Unlike a Hashes object this doesn't need to allocate anything, so it
+    *  should be used for the many small strings like descriptions hashed
+    *  while building the cache. If it fails (e.g. as MD5 isn't allowed in
+    *  FIPS mode) \b Hex is untouched and a Hashes object has to be used. */
+   APT_HIDDEN static bool MD5Hex(std::initializer_list<APT::StringView> Data, char (&Hex)[33]);
+
    /** create a Hashes object to calculate all supported hashes
     *
     * If ALL is too much, you can limit which Hashes are calculated
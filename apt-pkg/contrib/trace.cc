@@ -0,0 +1,143 @@
+// -*- mode: cpp; mode: fold -*-
+// Description								/*{{{*/
+/* ######################################################################
+
+   Trace - Record where time is spent
+
+   Phases are collected in memory and written out in the Trace Event
+   Format understood by chrome://tracing and ui.perfetto.dev as complete
+   ("X") events when the process exits.
+
+   ##################################################################### */
+									/*}}}*/
+#include <config.h>
+
+#include <apt-pkg/configuration.h>
+#include <apt-pkg/trace.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+namespace APT {
+namespace Trace {
+
+namespace {
+struct Event
+{
+   char const *Name;
+   uint64_t Start;
+   uint64_t Duration;
+   size_t Thread;
+};
+
+enum class State { Unknown, Disabled, Enabled };
+std::atomic<State> TraceState(State::Unknown);
+// configuration generation a disabled state was decided at
+std::atomic<unsigned long> DecidedAt(0);
+std::mutex SetupLock;
+std::string TraceFile;
+pid_t TracePid = 0;
+std::mutex EventsLock;
+std::vector<Event> Events;
+
+uint64_t Now()
+{
+   return std::chrono::duration_cast<std::chrono::microseconds>(
+	     std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void WriteTrace()							/*{{{*/
+{
+   // a forked child must not overwrite the trace of its parent
+   if (getpid() != TracePid)
+      return;
+
+   // we run from atexit, so we avoid FileFd and _error as they depend on
+   // statics (like the compressor list) which might be destroyed already
+   std::lock_guard<std::mutex> guard(EventsLock);
+   std::ofstream out(TraceFile, std::ios::out | std::ios::trunc);
+   out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+   bool first = true;
+   for (auto const &E : Events)
+   {
+      if (first)
+	 first = false;
+      else
+	 out << ',';
+      out << "\n{\"name\":\"";
+      for (char const *c = E.Name; *c != '\0'; ++c)
+	 if (*c == '"' || *c == '\\')
+	    out << '\\' << *c;
+	 else if (static_cast<unsigned char>(*c) < 0x20)
+	    out << ' ';
+	 else
+	    out << *c;
+      out << "\",\"cat\":\"apt\",\"ph\":\"X\""
+	  << ",\"ts\":" << E.Start << ",\"dur\":" << E.Duration
+	  << ",\"pid\":" << TracePid << ",\"tid\":" << E.Thread << '}';
+   }
+   out << "\n]}\n";
+   out.close();
+   if (out.fail())
+      std::cerr << "W: Couldn't write trace to " << TraceFile << std::endl;
+}
+									/*}}}*/
+}
+
+bool Enabled()								/*{{{*/
+{
+   // phases can start before the configuration is loaded (or in threads),
+   // so being disabled is only final until the configuration changes
+   State const state = TraceState.load(std::memory_order_acquire);
+   if (likely(state == State::Disabled) &&
+       likely(DecidedAt.load(std::memory_order_relaxed) == Configuration::Generation()))
+      return false;
+   if (state == State::Enabled)
+      return true;
+
+   std::lock_guard<std::mutex> guard(SetupLock);
+   if (TraceState.load(std::memory_order_relaxed) == State::Enabled)
+      return true;
+   DecidedAt.store(Configuration::Generation(), std::memory_order_relaxed);
+   if (_config->Find("Debug::Trace-File").empty())
+   {
+      TraceState.store(State::Disabled, std::memory_order_release);
+      return false;
+   }
+   TraceFile = _config->FindFile("Debug::Trace-File");
+   TracePid = getpid();
+   Events.reserve(128);
+   atexit(WriteTrace);
+   TraceState.store(State::Enabled, std::memory_order_release);
+   return true;
+}
+									/*}}}*/
+Phase::Phase(char const *const Name) : Name(Name), Start(0)		/*{{{*/
+{
+   if (Enabled())
+      Start = Now();
+}
+									/*}}}*/
+Phase::~Phase()								/*{{{*/
+{
+   if (Start == 0)
+      return;
+   uint64_t const End = Now();
+   std::lock_guard<std::mutex> guard(EventsLock);
+   Events.push_back({Name, Start, End - Start, std::hash<std::thread::id>{}(std::this_thread::get_id())});
+}
+									/*}}}*/
+
+}
+}
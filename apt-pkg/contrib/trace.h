@@ -0,0 +1,52 @@
+// -*- mode: cpp; mode: fold -*-
+// Description								/*{{{*/
+/* ######################################################################
+
+   Trace - Record where time is spent
+
+   Scopes can be marked as phases which are timed and written out as a
+   Chrome/Perfetto compatible trace (JSON) on exit if Debug::Trace-File
+   names a file. Without it a phase costs hardly more than a branch.
+
+   ##################################################################### */
+									/*}}}*/
+#ifndef APTPKG_TRACE_H
+#define APTPKG_TRACE_H
+
+#include <apt-pkg/macros.h>
+
+#include <cstdint>
+
+namespace APT {
+namespace Trace {
+
+/** \brief is tracing enabled for this process
+ *
+ * The configuration is looked at the first time this is called and
+ * again after it changed as long as tracing isn't enabled, so this
+ * can be used before the configuration was set up, too.
+ */
+APT_PUBLIC bool Enabled();
+
+/** \brief times the scope it lives in as a phase named \b Name
+ *
+ * \b Name has to be a string literal (or otherwise outlive the process)
+ * as it is only stored as a pointer.
+ */
+class APT_PUBLIC Phase
+{
+   char const *const Name;
+   uint64_t Start;
+
+   public:
+   explicit Phase(char const *const Name);
+   ~Phase();
+
+   Phase(Phase const &) = delete;
+   Phase &operator=(Phase const &) = delete;
+};
+
+}
+}
+
+#endif
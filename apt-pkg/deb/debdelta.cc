@@ -0,0 +1,587 @@
+// -*- mode: cpp; mode: fold -*-
+// Description								/*{{{*/
+/* ######################################################################
+
+   Debian Archive Deltas
+
+   A delta is an xz compressed stream of operations which are executed
+   in order to write the new archive:
+
+     apt-delta 1                 identifies the format
+     L <size>\n<bytes>           bytes carried in the delta itself
+     Z <compressor> <args>...    compress everything written until E
+     C <size> <sha256> <path>    an installed file, relative to the root
+     E                           end of the compressed data member
+
+   Files are only referenced if they are unchanged between the versions
+   and not a conffile, as the local admin is free to modify those.
+
+   ##################################################################### */
+									/*}}}*/
+// Include Files							/*{{{*/
+#include <config.h>
+
+#include <apt-pkg/aptconfiguration.h>
+#include <apt-pkg/arfile.h>
+#include <apt-pkg/debdelta.h>
+#include <apt-pkg/debfile.h>
+#include <apt-pkg/dirstream.h>
+#include <apt-pkg/error.h>
+#include <apt-pkg/fileutl.h>
+#include <apt-pkg/hashes.h>
+#include <apt-pkg/macros.h>
+#include <apt-pkg/strutl.h>
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+#include <string.h>
+
+#include <apti18n.h>
+									/*}}}*/
+
+static constexpr char const *const DeltaHeader = "apt-delta 1";
+// small files are cheaper to carry than to read from the disk
+static constexpr unsigned long long MinCopySize = 1024;
+static constexpr unsigned long long MaxLiteralSize = 1024 * 1024;
+static constexpr unsigned long long MaxLongNameSize = 1024 * 1024;
+
+// IsSafePath - a path which can't leave the root directory		/*{{{*/
+static bool IsSafePath(std::string const &Path)
+{
+   if (Path.empty() || Path[0] == '/')
+      return false;
+   for (auto const &C : VectorizeString(Path, '/'))
+      if (C == "..")
+	 return false;
+   return true;
+}
+									/*}}}*/
+// DeltaTarVisitor - receives every byte of a tar stream		/*{{{*/
+/* Unlike a pkgDirStream, which gets the items ExtractTar unpacks, this
+   is handed the raw stream: the content of regular files and everything
+   else as structure, so that the stream can be reproduced exactly. */
+class APT_HIDDEN DeltaTarVisitor
+{
+   public:
+   virtual bool Structure(unsigned char const *Data, unsigned long long Size) = 0;
+   virtual bool FileStart(std::string const &Name, unsigned long long Size) = 0;
+   virtual bool FileData(unsigned char const *Data, unsigned long long Size) = 0;
+   virtual bool FileEnd() = 0;
+   virtual ~DeltaTarVisitor() = default;
+};
+									/*}}}*/
+// WalkDeltaTar - feed a tar stream into a visitor			/*{{{*/
+static bool WalkDeltaTar(FileFd &Tar, DeltaTarVisitor &Visitor)
+{
+   std::unique_ptr<unsigned char[]> Buffer(new unsigned char[APT_BUFFER_SIZE]);
+   auto const Read = [&](unsigned long long Size, bool const Content, std::string * const Keep) {
+      while (Size != 0)
+      {
+	 unsigned long long const Chunk = std::min(Size, APT_BUFFER_SIZE);
+	 if (Tar.Read(Buffer.get(), Chunk) == false)
+	    return false;
+	 if (Keep != nullptr)
+	    Keep->append(reinterpret_cast<char const *>(Buffer.get()), Chunk);
+	 if ((Content ? Visitor.FileData(Buffer.get(), Chunk) : Visitor.Structure(Buffer.get(), Chunk)) == false)
+	    return false;
+	 Size -= Chunk;
+      }
+      return true;
+   };
+
+   std::string LongName;
+   bool Extended = false;
+   while (true)
+   {
+      unsigned char Block[512];
+      if (Tar.Read(Block, sizeof(Block)) == false)
+	 return false;
+      if (Visitor.Structure(Block, sizeof(Block)) == false)
+	 return false;
+
+      // the archive ends with a block of nulls, everything after it is padding
+      if (std::all_of(Block, Block + sizeof(Block), [](unsigned char const c) { return c == 0; }))
+	 break;
+
+      char const * const Header = reinterpret_cast<char const *>(Block);
+      unsigned long long Size;
+      if (Base256ToNum(Header + 124, Size, 12) == false &&
+	  StrToNum(Header + 124, Size, 12, 8) == false)
+	 return _error->Error(_("Corrupted archive"));
+      unsigned long long const Padding = (sizeof(Block) - Size % sizeof(Block)) % sizeof(Block);
+      char const Type = Header[156];
+
+      // long names and extended headers apply to the next item
+      if (Type == 'L' || Type == 'K' || Type == 'x' || Type == 'g')
+      {
+	 if (Size > MaxLongNameSize)
+	    return _error->Error(_("Corrupted archive"));
+	 std::string Data;
+	 if (Read(Size + Padding, false, &Data) == false)
+	    return false;
+	 if (Type == 'L')
+	    LongName.assign(Data.c_str(), strnlen(Data.c_str(), Size));
+	 else if (Type != 'K')
+	    Extended = true;
+	 continue;
+      }
+
+      std::string Name = LongName;
+      if (Name.empty())
+      {
+	 Name.assign(Header, strnlen(Header, 100));
+	 if (memcmp(Header + 257, "ustar\0", 6) == 0 && Header[345] != '\0')
+	    Name = std::string(Header + 345, strnlen(Header + 345, 155)) + '/' + Name;
+      }
+      if (APT::String::Startswith(Name, "./"))
+	 Name.erase(0, 2);
+
+      /* extended headers can change the name and size, so we pass
+	 such items along as structure, just like all non-files */
+      if ((Type == '0' || Type == '\0') && Extended == false && IsSafePath(Name))
+      {
+	 if (Visitor.FileStart(Name, Size) == false ||
+	     Read(Size, true, nullptr) == false ||
+	     Visitor.FileEnd() == false ||
+	     Read(Padding, false, nullptr) == false)
+	    return false;
+      }
+      else if (Read(Size + Padding, false, nullptr) == false)
+	 return false;
+
+      LongName.clear();
+      Extended = false;
+   }
+
+   while (true)
+   {
+      unsigned long long Actual = 0;
+      if (Tar.Read(Buffer.get(), APT_BUFFER_SIZE, &Actual) == false)
+	 return false;
+      if (Actual == 0)
+	 return true;
+      if (Visitor.Structure(Buffer.get(), Actual) == false)
+	 return false;
+   }
+}
+									/*}}}*/
+// FindDataMember - locate the data member and its compressor		/*{{{*/
+static ARArchive::Member *FindDataMember(ARArchive &AR, APT::Configuration::Compressor &Compressor)
+{
+   auto const Compressors = APT::Configuration::getCompressors();
+   for (auto Member = AR.Members(); Member != nullptr; Member = Member->Next)
+   {
+      if (APT::String::Startswith(Member->Name, "data.tar") == false)
+	 continue;
+      auto const Extension = Member->Name.substr(strlen("data.tar"));
+      auto const found = std::find_if(Compressors.cbegin(), Compressors.cend(), [&](auto const &c) {
+	 return c.Extension == Extension;
+      });
+      if (found == Compressors.cend())
+      {
+	 _error->Error(_("Couldn't find a compressor for %s"), Member->Name.c_str());
+	 return nullptr;
+      }
+      Compressor = *found;
+      return Member;
+   }
+   _error->Error(_("Internal error, could not locate member %s"), "data.tar");
+   return nullptr;
+}
+									/*}}}*/
+// CopyDataMember - copy the data member into a file of its own	/*{{{*/
+/* The bytes after the member would confuse some decompressors as well
+   as the reading of the padding at the end of the tar stream. */
+static FileFd *CopyDataMember(FileFd &Deb, ARArchive::Member const * const Member)
+{
+   std::unique_ptr<FileFd> Data(GetTempFile("debdelta"));
+   if (Data == nullptr || Deb.Seek(Member->Start) == false)
+      return nullptr;
+   std::unique_ptr<unsigned char[]> Buffer(new unsigned char[APT_BUFFER_SIZE]);
+   for (unsigned long long Size = Member->Size; Size != 0;)
+   {
+      unsigned long long const Chunk = std::min(Size, APT_BUFFER_SIZE);
+      if (Deb.Read(Buffer.get(), Chunk) == false || Data->Write(Buffer.get(), Chunk) == false)
+	 return nullptr;
+      Size -= Chunk;
+   }
+   return Data.release();
+}
+									/*}}}*/
+// WalkDataMember - feed the uncompressed data member into a visitor	/*{{{*/
+static bool WalkDataMember(FileFd &Data, APT::Configuration::Compressor const &Compressor, DeltaTarVisitor &Visitor)
+{
+   FileFd Tar;
+   if (Data.Seek(0) == false ||
+       Tar.OpenDescriptor(Data.Fd(), FileFd::ReadOnly, Compressor, false) == false ||
+       WalkDeltaTar(Tar, Visitor) == false)
+      return false;
+   return Tar.Close();
+}
+									/*}}}*/
+// DeltaFileIndex - collect path, size and hash of all files		/*{{{*/
+class APT_HIDDEN DeltaFileIndex : public DeltaTarVisitor
+{
+   std::string Name;
+   unsigned long long Size = 0;
+   std::unique_ptr<Hashes> Hash;
+
+   public:
+   struct File
+   {
+      unsigned long long Size;
+      std::string SHA256;
+   };
+   std::map<std::string, File> Files;
+
+   virtual bool Structure(unsigned char const *, unsigned long long) APT_OVERRIDE { return true; }
+   virtual bool FileStart(std::string const &FileName, unsigned long long const FileSize) APT_OVERRIDE
+   {
+      Name = FileName;
+      Size = FileSize;
+      Hash.reset(new Hashes(Hashes::SHA256SUM));
+      return true;
+   }
+   virtual bool FileData(unsigned char const *Data, unsigned long long const DataSize) APT_OVERRIDE
+   {
+      return Hash->Add(Data, DataSize);
+   }
+   virtual bool FileEnd() APT_OVERRIDE
+   {
+      Files[Name] = {Size, Hash->GetHashString(Hashes::SHA256SUM).HashValue()};
+      return true;
+   }
+};
+									/*}}}*/
+// DeltaWriter - write the operations rebuilding a tar stream		/*{{{*/
+class APT_HIDDEN DeltaWriter : public DeltaTarVisitor
+{
+   FileFd &Delta;
+   std::map<std::string, DeltaFileIndex::File> const &Copy;
+   std::string Literal;
+   bool Copying = false;
+
+   public:
+   bool Flush()
+   {
+      if (Literal.empty())
+	 return true;
+      std::string const Op = "L " + std::to_string(Literal.size()) + "\n";
+      bool const Res = Delta.Write(Op.c_str(), Op.length()) && Delta.Write(Literal.c_str(), Literal.length());
+      Literal.clear();
+      return Res;
+   }
+   bool Op(std::string Line)
+   {
+      Line.append("\n");
+      return Flush() && Delta.Write(Line.c_str(), Line.length());
+   }
+   bool Add(unsigned char const *Data, unsigned long long const Size)
+   {
+      Literal.append(reinterpret_cast<char const *>(Data), Size);
+      if (Literal.size() < MaxLiteralSize)
+	 return true;
+      return Flush();
+   }
+   bool Add(FileFd &From, unsigned long long Size)
+   {
+      unsigned char Buffer[APT_BUFFER_SIZE];
+      while (Size != 0)
+      {
+	 unsigned long long const Chunk = std::min(Size, APT_BUFFER_SIZE);
+	 if (From.Read(Buffer, Chunk) == false || Add(Buffer, Chunk) == false)
+	    return false;
+	 Size -= Chunk;
+      }
+      return true;
+   }
+
+   virtual bool Structure(unsigned char const *Data, unsigned long long const Size) APT_OVERRIDE
+   {
+      return Add(Data, Size);
+   }
+   virtual bool FileStart(std::string const &Name, unsigned long long const Size) APT_OVERRIDE
+   {
+      auto const F = Copy.find(Name);
+      Copying = F != Copy.end() && F->second.Size == Size;
+      if (Copying == false)
+	 return true;
+      return Op("C " + std::to_string(Size) + " " + F->second.SHA256 + " " + QuoteString(Name, ""));
+   }
+   virtual bool FileData(unsigned char const *Data, unsigned long long const Size) APT_OVERRIDE
+   {
+      return Copying || Add(Data, Size);
+   }
+   virtual bool FileEnd() APT_OVERRIDE
+   {
+      Copying = false;
+      return true;
+   }
+
+   DeltaWriter(FileFd &Delta, std::map<std::string, DeltaFileIndex::File> const &Copy) : Delta(Delta), Copy(Copy) {}
+};
+									/*}}}*/
+// DeltaConffiles - extract the list of conffiles from the control.tar	/*{{{*/
+class APT_HIDDEN DeltaConffiles : public pkgDirStream
+{
+   public:
+   std::string Content;
+
+   virtual bool DoItem(Item &Itm, int &Fd) APT_OVERRIDE
+   {
+      if (strcmp(Itm.Name, "conffiles") == 0)
+	 Fd = -2;
+      return true;
+   }
+   virtual bool Process(Item &, const unsigned char *Data, unsigned long long Size, unsigned long long) APT_OVERRIDE
+   {
+      Content.append(reinterpret_cast<char const *>(Data), Size);
+      return true;
+   }
+};
+									/*}}}*/
+// CompressArgsCandidates - arguments archives are usually built with	/*{{{*/
+static std::vector<std::vector<std::string>> CompressArgsCandidates(std::string const &Name)
+{
+   // the defaults of dpkg-deb first
+   if (Name == "xz")
+      return {{"-6", "-T0"}, {"-6"}, {"-9", "-T0"}, {"-9"}};
+   else if (Name == "zstd")
+      return {{"-3", "-C"}, {"-19", "-C"}, {"-3"}, {"-19"}};
+   else if (Name == "gzip")
+      return {{"-9"}, {"-6"}};
+   else if (Name == "lzma")
+      return {{"-6"}, {"-9"}};
+   return {{}};
+}
+									/*}}}*/
+// FindCompressArgs - find arguments reproducing the data member	/*{{{*/
+static bool FindCompressArgs(FileFd &Data, std::string const &Name, APT::Configuration::Compressor &Compressor)
+{
+   Hashes Expected(Hashes::SHA256SUM);
+   if (Data.Seek(0) == false || Expected.AddFD(Data) == false)
+      return false;
+   auto const ExpectedHash = Expected.GetHashString(Hashes::SHA256SUM);
+
+   std::unique_ptr<unsigned char[]> Buffer(new unsigned char[APT_BUFFER_SIZE]);
+   for (auto const &Args : CompressArgsCandidates(Compressor.Name))
+   {
+      std::unique_ptr<FileFd> Tmp(GetTempFile("debdelta"));
+      if (Tmp == nullptr)
+	 return false;
+      auto Candidate = Compressor;
+      Candidate.CompressArgs = Args;
+      FileFd Tar, Comp;
+      if (Data.Seek(0) == false ||
+	  Tar.OpenDescriptor(Data.Fd(), FileFd::ReadOnly, Compressor, false) == false ||
+	  Comp.OpenDescriptor(Tmp->Fd(), FileFd::WriteOnly, Candidate, false) == false)
+	 return false;
+      unsigned long long Actual = 0;
+      do
+      {
+	 if (Tar.Read(Buffer.get(), APT_BUFFER_SIZE, &Actual) == false ||
+	     Comp.Write(Buffer.get(), Actual) == false)
+	    return false;
+      } while (Actual != 0);
+      Hashes Got(Hashes::SHA256SUM);
+      if (Tar.Close() == false || Comp.Close() == false ||
+	  Tmp->Seek(0) == false || Got.AddFD(*Tmp) == false)
+	 return false;
+      if (Got.GetHashString(Hashes::SHA256SUM) == ExpectedHash)
+      {
+	 Compressor.CompressArgs = Args;
+	 return true;
+      }
+   }
+   return _error->Error(_("Compressing %s again doesn't reproduce it"), Name.c_str());
+}
+									/*}}}*/
+// Delta::Create - create a delta between two archives			/*{{{*/
+static bool CreateDelta(std::string const &OldDeb, std::string const &NewDeb, FileFd &DeltaFd)
+{
+   // the files of the old version are what we expect on disk
+   FileFd OldFd(OldDeb, FileFd::ReadOnly);
+   if (OldFd.IsOpen() == false)
+      return false;
+   ARArchive OldAR(OldFd);
+   if (_error->PendingError())
+      return false;
+   APT::Configuration::Compressor OldCompressor;
+   auto const OldMember = FindDataMember(OldAR, OldCompressor);
+   if (OldMember == nullptr)
+      return false;
+   std::unique_ptr<FileFd> OldData(CopyDataMember(OldFd, OldMember));
+   DeltaFileIndex OldFiles;
+   if (OldData == nullptr || WalkDataMember(*OldData, OldCompressor, OldFiles) == false)
+      return false;
+
+   FileFd NewFd(NewDeb, FileFd::ReadOnly);
+   if (NewFd.IsOpen() == false)
+      return false;
+   // conffiles can be modified by the admin, so we don't look for them
+   std::set<std::string> Conffiles;
+   {
+      debDebFile Deb(NewFd);
+      DeltaConffiles Stream;
+      if (_error->PendingError() || Deb.ExtractTarMember(Stream, "control.tar") == false)
+	 return false;
+      for (auto const &Line : VectorizeString(Stream.Content, '\n'))
+      {
+	 auto const Slash = Line.find('/');
+	 if (Slash != std::string::npos)
+	    Conffiles.insert(Line.substr(Slash + 1));
+      }
+   }
+   if (NewFd.Seek(0) == false)
+      return false;
+   ARArchive NewAR(NewFd);
+   if (_error->PendingError())
+      return false;
+   APT::Configuration::Compressor NewCompressor;
+   auto const NewMember = FindDataMember(NewAR, NewCompressor);
+   if (NewMember == nullptr)
+      return false;
+   std::unique_ptr<FileFd> NewData(CopyDataMember(NewFd, NewMember));
+   DeltaFileIndex NewFiles;
+   if (NewData == nullptr || WalkDataMember(*NewData, NewCompressor, NewFiles) == false)
+      return false;
+   if (NewCompressor.Name != "." && FindCompressArgs(*NewData, NewMember->Name, NewCompressor) == false)
+      return false;
+
+   std::map<std::string, DeltaFileIndex::File> Copy;
+   for (auto const &F : NewFiles.Files)
+   {
+      if (F.second.Size < MinCopySize || Conffiles.find(F.first) != Conffiles.end())
+	 continue;
+      auto const O = OldFiles.Files.find(F.first);
+      if (O != OldFiles.Files.end() && O->second.Size == F.second.Size && O->second.SHA256 == F.second.SHA256)
+	 Copy.insert(F);
+   }
+
+   DeltaWriter Writer(DeltaFd, Copy);
+   if (Writer.Op(DeltaHeader) == false ||
+       NewFd.Seek(0) == false || Writer.Add(NewFd, NewMember->Start) == false)
+      return false;
+   if (NewCompressor.Name != ".")
+   {
+      std::string Op = "Z " + NewCompressor.Name;
+      for (auto const &A : NewCompressor.CompressArgs)
+	 Op.append(" ").append(A);
+      if (Writer.Op(Op) == false)
+	 return false;
+   }
+   if (WalkDataMember(*NewData, NewCompressor, Writer) == false)
+      return false;
+   if (NewCompressor.Name != "." && Writer.Op("E") == false)
+      return false;
+   auto const End = NewMember->Start + NewMember->Size;
+   if (NewFd.Seek(End) == false || Writer.Add(NewFd, NewFd.Size() - End) == false)
+      return false;
+   return Writer.Flush();
+}
+bool debDelta::Create(std::string const &OldDeb, std::string const &NewDeb, std::string const &Delta)
+{
+   FileFd DeltaFd(Delta, FileFd::WriteOnly | FileFd::Create | FileFd::Empty, FileFd::Xz);
+   if (DeltaFd.IsOpen() == false)
+      return false;
+   if (CreateDelta(OldDeb, NewDeb, DeltaFd) && DeltaFd.Close())
+      return true;
+   DeltaFd.Close();
+   RemoveFile("debDelta::Create", Delta);
+   return false;
+}
+									/*}}}*/
+// Delta::Apply - rebuild an archive from a delta			/*{{{*/
+bool debDelta::Apply(std::string const &Delta, std::string const &RootDir, std::string const &NewDeb)
+{
+   FileFd DeltaFd(Delta, FileFd::ReadOnly, FileFd::Xz);
+   if (DeltaFd.IsOpen() == false)
+      return false;
+   std::string Line;
+   if (DeltaFd.ReadLine(Line) == false || Line != DeltaHeader)
+      return _error->Error(_("%s is not a delta in a supported format"), Delta.c_str());
+
+   FileFd Out(NewDeb, FileFd::WriteOnly | FileFd::Create | FileFd::Empty);
+   if (Out.IsOpen() == false)
+      return false;
+   FileFd Comp;
+   FileFd *Target = &Out;
+   auto const Unsupported = [&]() {
+      return _error->Error(_("%s is not a delta in a supported format"), Delta.c_str());
+   };
+   std::unique_ptr<unsigned char[]> Buffer(new unsigned char[APT_BUFFER_SIZE]);
+   auto const Copy = [&](FileFd &From, unsigned long long Size, Hashes * const Hash) {
+      while (Size != 0)
+      {
+	 unsigned long long const Chunk = std::min(Size, APT_BUFFER_SIZE);
+	 if (From.Read(Buffer.get(), Chunk) == false || Target->Write(Buffer.get(), Chunk) == false)
+	    return false;
+	 if (Hash != nullptr)
+	    Hash->Add(Buffer.get(), Chunk);
+	 Size -= Chunk;
+      }
+      return true;
+   };
+
+   while (DeltaFd.ReadLine(Line))
+   {
+      auto const Op = VectorizeString(Line, ' ');
+      unsigned long long Size = 0;
+      if (Op.size() >= 2 && (Op[0] == "L" || Op[0] == "C") &&
+	  StrToNum(Op[1].c_str(), Size, Op[1].length(), 10) == false)
+	 return Unsupported();
+
+      if (Op.size() == 2 && Op[0] == "L")
+      {
+	 if (Copy(DeltaFd, Size, nullptr) == false)
+	    return false;
+      }
+      else if (Op.size() == 4 && Op[0] == "C")
+      {
+	 auto const Name = DeQuoteString(Op[3]);
+	 if (IsSafePath(Name) == false)
+	    return Unsupported();
+	 auto const Path = flCombine(RootDir, Name);
+	 FileFd In(Path, FileFd::ReadOnly);
+	 if (In.IsOpen() == false)
+	    return false;
+	 if (In.FileSize() != Size)
+	    return _error->Error(_("Installed file %s differs from the one the delta expects"), Path.c_str());
+	 Hashes Hash(Hashes::SHA256SUM);
+	 if (Copy(In, Size, &Hash) == false)
+	    return false;
+	 if (Hash.GetHashString(Hashes::SHA256SUM).HashValue() != Op[2])
+	    return _error->Error(_("Installed file %s differs from the one the delta expects"), Path.c_str());
+      }
+      else if (Op.size() >= 2 && Op[0] == "Z" && Target == &Out)
+      {
+	 auto const Compressors = APT::Configuration::getCompressors();
+	 auto C = std::find_if(Compressors.cbegin(), Compressors.cend(), [&](auto const &c) { return c.Name == Op[1]; });
+	 if (C == Compressors.cend())
+	    return _error->Error(_("Couldn't find a compressor for %s"), Op[1].c_str());
+	 auto Compressor = *C;
+	 Compressor.CompressArgs.assign(Op.begin() + 2, Op.end());
+	 if (Comp.OpenDescriptor(Out.Fd(), FileFd::WriteOnly, Compressor, false) == false)
+	    return false;
+	 Target = &Comp;
+      }
+      else if (Op.size() == 1 && Op[0] == "E" && Target == &Comp)
+      {
+	 if (Comp.Close() == false)
+	    return false;
+	 Target = &Out;
+      }
+      else
+	 return Unsupported();
+   }
+   if (DeltaFd.Failed())
+      return false;
+   if (Target != &Out)
+      return Unsupported();
+   return Out.Close();
+}
+									/*}}}*/
@@ -0,0 +1,50 @@
+// -*- mode: cpp; mode: fold -*-
+// Description								/*{{{*/
+/* ######################################################################
+
+   Debian Archive Deltas
+
+   A delta describes how a .deb can be rebuilt from the files an older
+   version of the package has installed on the system. Unchanged files
+   are referenced by their path and hash, all other bytes of the new
+   archive are carried in the delta itself. The data member is
+   compressed again while rebuilding, so a delta is only created if
+   that reproduces the member of the new archive bit by bit.
+
+   ##################################################################### */
+									/*}}}*/
+#ifndef PKGLIB_DEBDELTA_H
+#define PKGLIB_DEBDELTA_H
+
+#include <apt-pkg/macros.h>
+
+#include <string>
+
+class APT_PUBLIC debDelta
+{
+   public:
+   /** \brief create a delta rebuilding NewDeb from the files of OldDeb
+    *
+    *  Fails if the data member of NewDeb can't be reproduced by
+    *  compressing it again, as a delta would be useless then.
+    *
+    *  \param OldDeb is the archive whose files are expected on disk
+    *  \param NewDeb is the archive the delta should rebuild
+    *  \param Delta is the file the delta is written to
+    */
+   static bool Create(std::string const &OldDeb, std::string const &NewDeb, std::string const &Delta);
+
+   /** \brief rebuild an archive from a delta and the installed files
+    *
+    *  Files taken from the system are checked against the hashes
+    *  recorded in the delta, but the result should be verified against
+    *  the hashes expected for the archive nonetheless.
+    *
+    *  \param Delta is the delta as created by #Create
+    *  \param RootDir is the directory the files are installed in
+    *  \param NewDeb is the file the archive is written to
+    */
+   static bool Apply(std::string const &Delta, std::string const &RootDir, std::string const &NewDeb);
+};
+
+#endif
@@ -26,6 +26,7 @@
 
 #include <algorithm>
 #include <string>
+#include <utility>
 #include <vector>
 #include <ctype.h>
 #include <stddef.h>
@@ -225,26 +226,45 @@ bool debListParser::NewVersion(pkgCache::VerIterator &Ver)
 	 Ver->Priority = pkgCache::State::Extra;
    }
 
-   if (ParseDepends(Ver,pkgTagSection::Key::Pre_Depends,pkgCache::Dep::PreDepends) == false)
-      return false;
-   if (ParseDepends(Ver,pkgTagSection::Key::Depends,pkgCache::Dep::Depends) == false)
-      return false;
-   if (ParseDepends(Ver,pkgTagSection::Key::Conflicts,pkgCache::Dep::Conflicts) == false)
-      return false;
-   if (ParseDepends(Ver,pkgTagSection::Key::Breaks,pkgCache::Dep::DpkgBreaks) == false)
-      return false;
-   if (ParseDepends(Ver,pkgTagSection::Key::Recommends,pkgCache::Dep::Recommends) == false)
-      return false;
-   if (ParseDepends(Ver,pkgTagSection::Key::Suggests,pkgCache::Dep::Suggests) == false)
-      return false;
-   if (ParseDepends(Ver,pkgTagSection::Key::Replaces,pkgCache::Dep::Replaces) == false)
-      return false;
-   if (ParseDepends(Ver,pkgTagSection::Key::Enhances,pkgCache::Dep::Enhances) == false)
-      return false;
-   // Obsolete.
-   if (ParseDepends(Ver,pkgTagSection::Key::Optional,pkgCache::Dep::Suggests) == false)
-      return false;
-   
+   static std::pair<pkgTagSection::Key, unsigned int> const DependsFields[] = {
+      {pkgTagSection::Key::Pre_Depends, pkgCache::Dep::PreDepends},
+      {pkgTagSection::Key::Depends, pkgCache::Dep::Depends},
+      {pkgTagSection::Key::Conflicts, pkgCache::Dep::Conflicts},
+      {pkgTagSection::Key::Breaks, pkgCache::Dep::DpkgBreaks},
+      {pkgTagSection::Key::Recommends, pkgCache::Dep::Recommends},
+      {pkgTagSection::Key::Suggests, pkgCache::Dep::Suggests},
+      {pkgTagSection::Key::Replaces, pkgCache::Dep::Replaces},
+      {pkgTagSection::Key::Enhances, pkgCache::Dep::Enhances},
+      // Obsolete.
+      {pkgTagSection::Key::Optional, pkgCache::Dep::Suggests},
+   };
+   // the names in the fields are resolved in the architecture of the version
+   std::string &List = DependsList();
+   List.append(Ver.Arch());
+   bool HasDepends = false;
+   for (auto const &Field : DependsFields)
+   {
+      List.push_back('\0');
+      if (Section.Find(Field.first, Start, Stop) == true && Start != Stop)
+      {
+	 List.append(Start, Stop - Start);
+	 HasDepends = true;
+      }
+   }
+   if (HasDepends)
+   {
+      bool Known;
+      if (BeginDepends(Ver, Known) == false)
+	 return false;
+      if (Known == false)
+      {
+	 for (auto const &Field : DependsFields)
+	    if (ParseDepends(Ver, Field.first, Field.second) == false)
+	       return false;
+	 EndDepends();
+      }
+   }
+
    if (ParseProvides(Ver) == false)
       return false;
    if (not APT::KernelAutoRemoveHelper::getUname(Ver.ParentPkg().Name()).empty())
@@ -293,10 +313,17 @@ APT::StringView debListParser::Description_md5()
       if (desc == "\n")
 	 return StringView();
 
-      Hashes md5(Hashes::MD5SUM);
-      md5.Add(desc.data(), desc.size());
-      md5.Add("\n");
-      MD5Buffer = md5.GetHashString(Hashes::MD5SUM).HashValue();
+      char Hex[33];
+      if (likely(Hashes::MD5Hex({desc, "\n"}, Hex) == true))
+	 // reuses the storage of the previous description
+	 MD5Buffer.assign(Hex, 32);
+      else
+      {
+	 Hashes md5(Hashes::MD5SUM);
+	 md5.Add(desc.data(), desc.size());
+	 md5.Add("\n");
+	 MD5Buffer = md5.GetHashString(Hashes::MD5SUM).HashValue();
+      }
       return StringView(MD5Buffer);
    }
    else if (likely(value.size() == 32))
@@ -993,6 +1020,28 @@ bool debListParser::Step()
    return Tags.Step(Section);
 }
 									/*}}}*/
+// StatusJournalParser - Parse only selected stanzas			/*{{{*/
+bool debStatusJournalParser::Jump(map_filesize_t const Offset)
+{
+   iOffset = Offset;
+   if (Tags.Jump(Section, Offset) == false)
+      return false;
+   // Step trims the empty line after the stanza, but Jump doesn't always
+   Section.Trim();
+   return true;
+}
+void debStatusJournalParser::Restrict(std::vector<map_filesize_t> &&Stanzas)
+{
+   Offsets = std::move(Stanzas);
+   Next = 0;
+}
+bool debStatusJournalParser::Step()
+{
+   if (Next >= Offsets.size())
+      return false;
+   return Jump(Offsets[Next++]);
+}
+									/*}}}*/
 // ListParser::GetPrio - Convert the priority from a string		/*{{{*/
 // ---------------------------------------------------------------------
 /* */
@@ -121,4 +121,19 @@ class APT_HIDDEN debStatusListParser : public debListParser
    explicit debStatusListParser(FileFd *File)
       : debListParser(File) {};
 };
+
+class APT_HIDDEN debStatusJournalParser : public debStatusListParser
+{
+   std::vector<map_filesize_t> Offsets;
+   size_t Next;
+
+ public:
+   // parses the stanza starting at the given offset
+   bool Jump(map_filesize_t const Offset);
+   // restricts Step() to the stanzas starting at the given offsets
+   void Restrict(std::vector<map_filesize_t> &&Stanzas);
+   virtual bool Step() APT_OVERRIDE;
+   explicit debStatusJournalParser(FileFd *File)
+      : debStatusListParser(File), Next(0) {};
+};
 #endif
@@ -200,6 +200,99 @@ int debVersioningSystem::DoCmpVersion(const char *A,const char *AEnd,
       return 0;
 }
 									/*}}}*/
+// debVS::SortKey - Key whose byte order is the order of versions	/*{{{*/
+// ---------------------------------------------------------------------
+/* Epoch, upstream version and revision are encoded as CmpFragment compares
+   them: Each run of non-digits is mapped to bytes sorting like order() and
+   terminated by a byte sorting between '~' and everything else, each number
+   is stored without leading zeros behind a byte encoding its length.
+   Numbers which are zero do not produce any bytes and neither do the empty
+   runs of non-digits between a number and the end of a fragment, so that
+   fragments which are equal for CmpFragment have the same key.  The end of
+   a fragment is marked by a byte sorting above '~' only, as the remainder
+   of the longer fragment decides the comparison otherwise; an empty
+   fragment consists of this byte alone, as it isn't equal to "0".  Characters
+   outside of printable ASCII and numbers with too many digits can't be
+   represented, neither are the odd versions DoCmpVersion parses specially. */
+enum : unsigned char
+{
+   KeyTilde = 0x01,
+   KeyFragmentEnd = 0x02,
+   KeyRunEnd = 0x03,
+   KeyOther = 0x80, // + c - ' ' for printable non-alphanumerics
+   KeyNumber = 0xE0, // + digits for numbers with up to 31 digits
+};
+static bool SortKeyFragment(const char *I, const char * const End, std::string &Key)
+{
+   // CmpFragment sorts an empty fragment below all others not starting with ~
+   if (I == End)
+   {
+      Key.push_back(KeyFragmentEnd);
+      return true;
+   }
+   do
+   {
+      for (; I != End && (*I < '0' || *I > '9'); ++I)
+      {
+	 unsigned char const c = *I;
+	 if (c == '~')
+	    Key.push_back(KeyTilde);
+	 else if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))
+	    Key.push_back(c);
+	 else if (c >= ' ' && c < 0x7F)
+	    Key.push_back(KeyOther + (c - ' '));
+	 else
+	    return false;
+      }
+      Key.push_back(KeyRunEnd);
+
+      for (; I != End && *I == '0'; ++I);
+      const char * const Number = I;
+      for (; I != End && *I >= '0' && *I <= '9'; ++I);
+      if (I - Number > 0xFF - KeyNumber)
+	 return false;
+      if (I != Number)
+      {
+	 Key.push_back(KeyNumber + (I - Number));
+	 Key.append(Number, I - Number);
+      }
+   } while (I != End);
+   Key.push_back(KeyFragmentEnd);
+   return true;
+}
+bool debVersioningSystem::SortKey(APT::StringView const Ver, std::string &Key)
+{
+   Key.clear();
+   const char *A = Ver.data();
+   const char * const AEnd = A + Ver.length();
+   if (A == AEnd)
+      return false;
+
+   // the epoch ends at the first colon, a zero epoch is the same as no epoch
+   const char *EpochEnd = static_cast<const char *>(memchr(A, ':', AEnd - A));
+   const char *Upstream = A;
+   if (EpochEnd == nullptr || EpochEnd == A)
+      EpochEnd = A;
+   else
+   {
+      for (; *A == '0'; ++A);
+      Upstream = EpochEnd + 1;
+   }
+   if (SortKeyFragment(A, EpochEnd, Key) == false)
+      return false;
+
+   // the revision starts after the last dash, a missing one is like -0
+   const char *Revision = static_cast<const char *>(memrchr(Upstream, '-', AEnd - Upstream));
+   if (Revision == Upstream || Upstream == AEnd)
+      return false;
+   if (Revision == nullptr)
+   {
+      const char * const Zero = "0";
+      return SortKeyFragment(Upstream, AEnd, Key) && SortKeyFragment(Zero, Zero + 1, Key);
+   }
+   return SortKeyFragment(Upstream, Revision, Key) && SortKeyFragment(Revision + 1, AEnd, Key);
+}
+									/*}}}*/
 // debVS::CheckDep - Check a single dependency				/*{{{*/
 // ---------------------------------------------------------------------
 /* This simply performs the version comparison and switch based on 
@@ -11,6 +11,7 @@
 #ifndef PKGLIB_DEBVERSION_H
 #define PKGLIB_DEBVERSION_H
 
+#include <apt-pkg/string_view.h>
 #include <apt-pkg/version.h>
 
 #include <string>
@@ -33,6 +34,18 @@ class APT_PUBLIC debVersioningSystem : public pkgVersioningSystem
    }
    virtual std::string UpstreamVersion(const char *A) APT_OVERRIDE;
 
+   /** \brief compute a key whose byte order is the order of versions
+    *
+    *  Comparing the keys of two versions with memcmp (the shorter key
+    *  being smaller if it is a prefix of the other) gives the result of
+    *  DoCmpVersion for them. Not every string has a key, though.
+    *
+    *  \param Ver is the version to compute the key for
+    *  \param[out] Key is set to the key
+    *  \return false if Ver can't be represented by a key
+    */
+   static bool SortKey(APT::StringView Ver, std::string &Key);
+
    debVersioningSystem();
 };
 
@@ -22,6 +22,7 @@
 #include <apt-pkg/pkgcache.h>
 #include <apt-pkg/statechanges.h>
 #include <apt-pkg/strutl.h>
+#include <apt-pkg/trace.h>
 #include <apt-pkg/version.h>
 
 #include <dirent.h>
@@ -106,7 +107,8 @@ public:
 			dpkgbuf_pos(0), term_out(NULL), history_out(NULL),
 			progress(NULL), tt_is_valid(false), master(-1),
 			slave(NULL), protect_slave_from_dying(-1),
-			direct_stdin(false)
+			direct_stdin(false), status_before_known(false),
+			status_size_before(0), status_mtime_before(0)
    {
       dpkgbuf[0] = '\0';
    }
@@ -135,6 +137,12 @@ public:
    sigset_t original_sigmask;
 
    bool direct_stdin;
+
+   // packages whose stanza in the status file dpkg might have changed
+   std::set<std::string> status_touched;
+   bool status_before_known;
+   unsigned long long status_size_before;
+   unsigned long long status_mtime_before;
 };
 									/*}}}*/
 namespace
@@ -574,6 +582,42 @@ void pkgDPkgPM::DoTerminalPty(int master)
       fwrite(term_buf, len, sizeof(char), d->term_out);
 }
 									/*}}}*/
+// WriteStatusJournal - record which stanzas dpkg could have changed	/*{{{*/
+// ---------------------------------------------------------------------
+/* The cache generator uses this to update the cache in place instead of
+   merging the entire status file again, see ApplyStatusJournal */
+static bool WriteStatusJournal(pkgDPkgPMPrivate const * const d)
+{
+   std::string const JournalFile = _config->FindFile("Dir::Cache::status-journal");
+   if (JournalFile.empty() == true || d->status_before_known == false)
+      return false;
+   std::string const StatusFile = _config->FindFile("Dir::State::status");
+   struct stat StatusAfter;
+   if (stat(StatusFile.c_str(), &StatusAfter) != 0 ||
+       (static_cast<unsigned long long>(StatusAfter.st_size) == d->status_size_before &&
+	static_cast<unsigned long long>(StatusAfter.st_mtime) == d->status_mtime_before))
+      return false;
+
+   std::ostringstream Packages;
+   for (auto const &P : d->status_touched)
+      Packages << ' ' << P;
+   std::ostringstream Journal;
+   Journal << "File: " << StatusFile << '\n'
+	   << "Size-Before: " << d->status_size_before << '\n'
+	   << "Mtime-Before: " << d->status_mtime_before << '\n'
+	   << "Size-After: " << StatusAfter.st_size << '\n'
+	   << "Mtime-After: " << StatusAfter.st_mtime << '\n'
+	   << "Packages:" << Packages.str() << '\n';
+   std::string const Data = Journal.str();
+
+   _error->PushToStack();
+   FileFd Out(JournalFile, FileFd::WriteAtomic, FileFd::None, 0644);
+   bool const Written = Out.IsOpen() == true && Out.Write(Data.data(), Data.size()) == true &&
+			Out.Close() == true;
+   _error->RevertToStack();
+   return Written;
+}
+									/*}}}*/
 // DPkgPM::ProcessDpkgStatusBuf						/*{{{*/
 void pkgDPkgPM::ProcessDpkgStatusLine(char *line)
 {
@@ -650,6 +694,8 @@ void pkgDPkgPM::ProcessDpkgStatusLine(char *line)
       return;
    }
 
+   d->status_touched.insert(pkgname.substr(0, pkgname.find(':')));
+
    // At this point we have a pkgname, but it might not be arch-qualified !
    if (pkgname.find(":") == std::string::npos)
    {
@@ -1512,6 +1558,7 @@ public:
 };
 bool pkgDPkgPM::Go(APT::Progress::PackageManager *progress)
 {
+   APT::Trace::Phase const phase("pkgDPkgPM::Go");
    struct Inhibitor
    {
       int Fd = -1;
@@ -1563,6 +1610,18 @@ bool pkgDPkgPM::Go(APT::Progress::PackageManager *progress)
    if (RunScriptsWithPkgs("DPkg::Pre-Install-Pkgs") == false)
       return false;
 
+   d->status_touched.clear();
+   for (auto const &I : List)
+      if (I.Pkg.end() == false)
+	 d->status_touched.insert(I.Pkg.Name());
+   struct stat StatusBefore;
+   d->status_before_known = stat(_config->FindFile("Dir::State::status").c_str(), &StatusBefore) == 0;
+   if (d->status_before_known == true)
+   {
+      d->status_size_before = StatusBefore.st_size;
+      d->status_mtime_before = StatusBefore.st_mtime;
+   }
+
    auto const noopDPkgInvocation = _config->FindB("Debug::pkgDPkgPM",false);
    // store auto-bits as they are supposed to be after dpkg is run
    if (noopDPkgInvocation == false)
@@ -1710,6 +1769,10 @@ bool pkgDPkgPM::Go(APT::Progress::PackageManager *progress)
 	    currentStates.Remove(FindToBeRemovedVersion(Pkg));
       if (currentStates.empty() == false)
       {
+	 for (auto const &V : currentStates.Remove())
+	    d->status_touched.insert(V.ParentPkg().Name());
+	 for (auto const &V : currentStates.Purge())
+	    d->status_touched.insert(V.ParentPkg().Name());
 	 APT::StateChanges cleanStates;
 	 for (auto && P: currentStates.Remove())
 	    cleanStates.Install(P);
@@ -2195,7 +2258,7 @@ bool pkgDPkgPM::Go(APT::Progress::PackageManager *progress)
 
       std::string const oldpkgcache = _config->FindFile("Dir::cache::pkgcache");
       if (oldpkgcache.empty() == false && RealFileExists(oldpkgcache) == true &&
-	  RemoveFile("pkgDPkgPM::Go", oldpkgcache))
+	  (WriteStatusJournal(d) == true || RemoveFile("pkgDPkgPM::Go", oldpkgcache)))
       {
 	 std::string const srcpkgcache = _config->FindFile("Dir::cache::srcpkgcache");
 	 if (srcpkgcache.empty() == false && RealFileExists(srcpkgcache) == true)
@@ -24,6 +24,7 @@
 #include <apt-pkg/progress.h>
 #include <apt-pkg/strutl.h>
 #include <apt-pkg/tagfile.h>
+#include <apt-pkg/trace.h>
 #include <apt-pkg/version.h>
 #include <apt-pkg/versionmatch.h>
 
@@ -38,16 +39,24 @@
 #include <unordered_map>
 #include <utility>
 #include <vector>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 
 #include <sys/stat.h>
+#include <xxhash.h>
 
 #include <apti18n.h>
 									/*}}}*/
 
 using std::string;
 
+// options read for each package marked
+static Configuration::Option<bool> const OptIgnoreHold("APT::Ignore-Hold", false);
+static Configuration::Option<bool> const OptMarkAuto("APT::Get::Mark-Auto", false);
+static Configuration::Option<std::string> const OptSolver("APT::Solver", "internal");
+static Configuration::Option<bool> const OptDebugAutoRemove("Debug::pkgAutoRemove", false);
+
 // helper for kernel autoremoval				  	/*{{{*/
 
 /** \brief Returns \b true for packages matching a regular
@@ -127,6 +136,10 @@ struct pkgDepCache::Private
    std::unique_ptr<InRootSetFunc> inRootSetFunc;
    std::vector<bool> fullyExplored;
    std::unique_ptr<APT::CacheFilter::Matcher> IsAVersionedKernelPackage, IsProtectedKernelPackage;
+   // auto bits as the state file read last (or written) describes them
+   std::vector<bool> stateFileAuto;
+   unsigned long long stateFileHash = 0;
+   bool stateFileKnown = false;
 };
 pkgDepCache::pkgDepCache(pkgCache *const pCache, Policy *const Plcy) : group_level(0), Cache(pCache), PkgState(0), DepState(0),
 								       iUsrSize(0), iDownloadSize(0), iInstCount(0), iDelCount(0), iKeepCount(0),
@@ -238,6 +251,7 @@ bool pkgDepCache::CheckConsistency(char const *const msgtag)		/*{{{*/
 /* This allocats the extension buffers and initializes them. */
 bool pkgDepCache::Init(OpProgress * const Prog)
 {
+   APT::Trace::Phase const phase("pkgDepCache::Init");
    // Suppress mark updates during this operation (just in case) and
    // run a mark operation when Init terminates.
    ActionGroup actions(*this);
@@ -292,12 +306,111 @@ bool pkgDepCache::Init(OpProgress * const Prog)
    return true;
 }
 									/*}}}*/
+// StateMirror - binary copy of the auto bits in extended_states	/*{{{*/
+/* Parsing the extended_states file on every start is expensive on systems
+   with many automatically installed packages, so the bits it results in are
+   stored in Dir::Cache::extended_states as well. The mirror is only used if
+   it was created for the very same state file and cache (as the bits are
+   indexed by package ID), otherwise the text file is parsed as before. */
+struct StateMirrorHeader
+{
+   char Signature[8];
+   uint32_t CacheHash;
+   uint32_t PackageCount;
+   uint64_t StateHash;
+};
+static char const StateMirrorSignature[8] = {'A', 'P', 'T', 'A', 'U', 'T', 'O', 1};
+
+static std::string StateMirrorFile()
+{
+   if (_config->Find("Dir::Cache::extended_states").empty() == true)
+      return "";
+   return _config->FindFile("Dir::Cache::extended_states");
+}
+static bool HashStateFile(FileFd &Fd, unsigned long long &Hash)
+{
+   std::unique_ptr<XXH3_state_t, decltype(&XXH3_freeState)> state(XXH3_createState(), &XXH3_freeState);
+   if (state == nullptr || XXH3_64bits_reset(state.get()) != XXH_OK)
+      return false;
+   std::unique_ptr<char[]> buffer(new char[APT_BUFFER_SIZE]);
+   unsigned long long actual = 0;
+   do
+   {
+      if (Fd.Read(buffer.get(), APT_BUFFER_SIZE, &actual) == false)
+	 return false;
+      XXH3_64bits_update(state.get(), buffer.get(), actual);
+   } while (actual != 0);
+   Hash = XXH3_64bits_digest(state.get());
+   return true;
+}
+static bool ReadStateMirror(pkgCache &Cache, unsigned long long const StateHash, std::vector<bool> &Auto)
+{
+   std::string const file = StateMirrorFile();
+   if (file.empty() == true || RealFileExists(file) == false)
+      return false;
+
+   _error->PushToStack();
+   FileFd Fd(file, FileFd::ReadOnly);
+   StateMirrorHeader header;
+   std::vector<unsigned char> bits;
+   bool okay = Fd.IsOpen() && Fd.Read(&header, sizeof(header)) &&
+	       memcmp(header.Signature, StateMirrorSignature, sizeof(header.Signature)) == 0 &&
+	       header.CacheHash == Cache.Head().CacheFileSize &&
+	       header.PackageCount == Cache.Head().PackageCount &&
+	       header.StateHash == StateHash;
+   if (okay)
+   {
+      bits.resize((header.PackageCount + 7) / 8);
+      okay = Fd.Size() == sizeof(header) + bits.size() && Fd.Read(bits.data(), bits.size());
+   }
+   _error->RevertToStack();
+   if (okay == false)
+      return false;
+
+   Auto.assign(header.PackageCount, false);
+   for (size_t i = 0; i < Auto.size(); ++i)
+      Auto[i] = (bits[i / 8] & (1 << (i % 8))) != 0;
+   return true;
+}
+static void WriteStateMirror(pkgCache &Cache, unsigned long long const StateHash, std::vector<bool> const &Auto)
+{
+   std::string const file = StateMirrorFile();
+   if (file.empty() == true || DirectoryExists(flNotFile(file)) == false)
+      return;
+
+   StateMirrorHeader header;
+   memcpy(header.Signature, StateMirrorSignature, sizeof(header.Signature));
+   header.CacheHash = Cache.Head().CacheFileSize;
+   header.PackageCount = Cache.Head().PackageCount;
+   header.StateHash = StateHash;
+   std::vector<unsigned char> bits((Auto.size() + 7) / 8);
+   for (size_t i = 0; i < Auto.size(); ++i)
+      if (Auto[i])
+	 bits[i / 8] |= 1 << (i % 8);
+
+   // the mirror is only an optimization, so failing to write it is fine
+   _error->PushToStack();
+   FileFd Fd(file, FileFd::WriteAtomic, 0644);
+   if (Fd.IsOpen() == true)
+   {
+      if (Fd.Write(&header, sizeof(header)) == false || Fd.Write(bits.data(), bits.size()) == false)
+	 Fd.OpFail();
+      Fd.Close();
+   }
+   _error->RevertToStack();
+}
+									/*}}}*/
 bool pkgDepCache::readStateFile(OpProgress * const Prog)		/*{{{*/
 {
    FileFd state_file;
    string const state = _config->FindFile("Dir::State::extended_states");
+   d->stateFileAuto.assign(Head().PackageCount, false);
+   d->stateFileKnown = false;
    if(RealFileExists(state)) {
       state_file.Open(state, FileFd::ReadOnly, FileFd::Extension);
+      bool const debug_autoremove = _config->FindB("Debug::pkgAutoRemove",false);
+      unsigned long long state_hash = 0;
+      bool const hashed = HashStateFile(state_file, state_hash) && state_file.Seek(0);
       off_t const file_size = state_file.Size();
       if(Prog != NULL)
       {
@@ -305,11 +418,27 @@ bool pkgDepCache::readStateFile(OpProgress * const Prog)		/*{{{*/
 	 Prog->OverallProgress(0, file_size, 1,
 			       _("Reading state information"));
       }
+      if (hashed && ReadStateMirror(*Cache, state_hash, d->stateFileAuto))
+      {
+	 for (pkgCache::PkgIterator pkg = Cache->PkgBegin(); pkg.end() == false; ++pkg)
+	 {
+	    if (d->stateFileAuto[pkg->ID] == false)
+	       continue;
+	    PkgState[pkg->ID].Flags |= Flag::Auto;
+	    if (unlikely(debug_autoremove))
+	       std::clog << "Auto-Installed : " << pkg.FullName() << std::endl;
+	 }
+	 d->stateFileHash = state_hash;
+	 d->stateFileKnown = true;
+	 if(Prog != NULL)
+	    Prog->OverallProgress(file_size, file_size, 1,
+				  _("Reading state information"));
+	 return true;
+      }
 
       pkgTagFile tagfile(&state_file);
       pkgTagSection section;
       off_t amt = 0;
-      bool const debug_autoremove = _config->FindB("Debug::pkgAutoRemove",false);
       while(tagfile.Step(section)) {
 	 string const pkgname = section.FindS("Package");
 	 string pkgarch = section.FindS("Architecture");
@@ -324,6 +453,7 @@ bool pkgDepCache::readStateFile(OpProgress * const Prog)		/*{{{*/
 	 if(reason > 0)
 	 {
 	    PkgState[pkg->ID].Flags |= Flag::Auto;
+	    d->stateFileAuto[pkg->ID] = true;
 	    if (unlikely(debug_autoremove))
 	       std::clog << "Auto-Installed : " << pkg.FullName() << std::endl;
 	    if (pkgarch == "any")
@@ -331,7 +461,10 @@ bool pkgDepCache::readStateFile(OpProgress * const Prog)		/*{{{*/
 	       pkgCache::GrpIterator G = pkg.Group();
 	       for (pkg = G.NextPkg(pkg); pkg.end() != true; pkg = G.NextPkg(pkg))
 		  if (pkg->VersionList != 0)
+		  {
 		     PkgState[pkg->ID].Flags |= Flag::Auto;
+		     d->stateFileAuto[pkg->ID] = true;
+		  }
 	    }
 	 }
 	 amt += section.size();
@@ -342,6 +475,13 @@ bool pkgDepCache::readStateFile(OpProgress * const Prog)		/*{{{*/
       if(Prog != NULL)
 	 Prog->OverallProgress(file_size, file_size, 1,
 			       _("Reading state information"));
+
+      if (hashed && state_file.Failed() == false)
+      {
+	 d->stateFileHash = state_hash;
+	 d->stateFileKnown = true;
+	 WriteStateMirror(*Cache, state_hash, d->stateFileAuto);
+      }
    }
 
    return true;
@@ -371,6 +511,31 @@ bool pkgDepCache::writeStateFile(OpProgress * const /*prog*/, bool const Install
       return _error->Error(_("Failed to open StateFile %s"),
 			   state.c_str());
 
+   // the bits the file will describe once it is read again
+   std::vector<bool> newStateAuto(Head().PackageCount, false);
+   for (pkgCache::PkgIterator pkg = Cache->PkgBegin(); pkg.end() == false; ++pkg)
+   {
+      StateCache const &P = PkgState[pkg->ID];
+      if ((P.Flags & Flag::Auto) == 0 || pkg->VersionList == 0)
+	 continue;
+      if (InstalledOnly && (
+	  (pkg->CurrentVer == 0 && P.Mode != ModeInstall) ||
+	  (pkg->CurrentVer != 0 && P.Mode == ModeDelete)))
+	 continue;
+      newStateAuto[pkg->ID] = true;
+   }
+   // nothing to do if neither we nor someone else changed anything
+   unsigned long long state_hash = 0;
+   if (d->stateFileKnown && newStateAuto == d->stateFileAuto &&
+       HashStateFile(StateFile, state_hash) && state_hash == d->stateFileHash)
+   {
+      if(debug_autoremove)
+	 std::clog << "StateFile is already up to date" << std::endl;
+      return true;
+   }
+   if (StateFile.Seek(0) == false)
+      return false;
+
    FileFd OutFile(state, FileFd::ReadWrite | FileFd::Atomic, FileFd::Extension);
    if (OutFile.IsOpen() == false || OutFile.Failed() == true)
       return _error->Error(_("Failed to write temporary StateFile %s"), state.c_str());
@@ -454,6 +619,16 @@ bool pkgDepCache::writeStateFile(OpProgress * const /*prog*/, bool const Install
    if (OutFile.Close() == false)
       return false;
    chmod(state.c_str(), 0644);
+
+   d->stateFileKnown = false;
+   FileFd NewStateFile;
+   if (NewStateFile.Open(state, FileFd::ReadOnly, FileFd::Extension) && HashStateFile(NewStateFile, state_hash))
+   {
+      d->stateFileAuto.swap(newStateAuto);
+      d->stateFileHash = state_hash;
+      d->stateFileKnown = true;
+      WriteStateMirror(*Cache, state_hash, d->stateFileAuto);
+   }
    return true;
 }
 									/*}}}*/
@@ -924,7 +1099,7 @@ static bool IsModeChangeOk(pkgDepCache &Cache, pkgDepCache::ModeList const mode,
    }
    // enforce dpkg holds
    else if (mode != pkgDepCache::ModeKeep && Pkg->SelectedState == pkgCache::State::Hold &&
-	    _config->FindB("APT::Ignore-Hold",false) == false)
+	    *OptIgnoreHold == false)
    {
       if (unlikely(DebugMarker == true))
 	 std::clog << OutputInDepth(Depth) << "Hold prevents Mark" << PrintMode(mode)
@@ -1192,7 +1367,7 @@ struct CompareProviders							/*{{{*/
 									/*}}}*/
 bool pkgDepCache::MarkInstall_StateChange(pkgCache::PkgIterator const &Pkg, bool AutoInst, bool FromUser) /*{{{*/
 {
-   bool AlwaysMarkAsAuto = _config->FindB("APT::Get::Mark-Auto", false) == true;
+   bool AlwaysMarkAsAuto = *OptMarkAuto == true;
    auto &P = (*this)[Pkg];
    if (P.Protect() && P.InstallVer == P.CandidateVer)
       return true;
@@ -1603,7 +1778,7 @@ bool pkgDepCache::MarkInstall(PkgIterator const &Pkg, bool AutoInst,
    if (FromUser && not MarkInstall_StateChange(Pkg, AutoInst, FromUser))
       return false;
 
-   bool const AutoSolve = AutoInst && _config->Find("APT::Solver", "internal") == "internal";
+   bool const AutoSolve = AutoInst && *OptSolver == "internal";
    bool const failEarly = not P.Protect() && not FromUser;
    bool hasFailed = false;
 
@@ -2203,12 +2378,14 @@ pkgDepCache::InRootSetFunc *pkgDepCache::GetCachedRootSetFunc()
 									/*}}}*/
 bool pkgDepCache::MarkFollowsRecommends()
 {
-  return _config->FindB("APT::AutoRemove::RecommendsImportant", true);
+  static Configuration::Option<bool> const RecommendsImportant("APT::AutoRemove::RecommendsImportant", true);
+  return *RecommendsImportant;
 }
 
 bool pkgDepCache::MarkFollowsSuggests()
 {
-  return _config->FindB("APT::AutoRemove::SuggestsImportant", true);
+  static Configuration::Option<bool> const SuggestsImportant("APT::AutoRemove::SuggestsImportant", true);
+  return *SuggestsImportant;
 }
 
 // pkgDepCache::MarkRequired - the main mark algorithm			/*{{{*/
@@ -2300,13 +2477,13 @@ void pkgDepCache::MarkPackage(const pkgCache::PkgIterator &Pkg,
    }
 
    PkgState[Pkg->ID].Marked = true;
-   bool const debug_autoremove = _config->FindB("Debug::pkgAutoRemove", false);
+   bool const debug_autoremove = *OptDebugAutoRemove;
    if(debug_autoremove)
       std::clog << "Marking: " << Pkg.FullName() << " " << Ver.VerStr()
 		<< " (" << reason << ")" << std::endl;
 
    auto const sort_by_source_version = [](pkgCache::VerIterator const &A, pkgCache::VerIterator const &B) {
-      auto const verret = A.Cache()->VS->CmpVersion(A.SourceVerStr(), B.SourceVerStr());
+      auto const verret = A.Cache()->CmpVersion(A->SourceVerStr, B->SourceVerStr);
       if (verret != 0)
 	 return verret > 0;
       return A->ID < B->ID;
@@ -72,6 +72,8 @@ bool edspLikeSystem::Initialize(Configuration &Cnf)
    // do not store an mmap cache
    Cnf.Set("Dir::Cache::pkgcache", "");
    Cnf.Set("Dir::Cache::srcpkgcache", "");
+   Cnf.Set("Dir::Cache::extended_states", "");
+   Cnf.Set("Dir::Cache::status-journal", "");
    // the protocols only propose actions, not do them
    Cnf.Set("Debug::NoLocking", "true");
    Cnf.Set("APT::Get::Simulate", "true");
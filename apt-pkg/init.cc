@@ -137,12 +137,15 @@ bool pkgInitConfig(Configuration &Cnf)
    Cnf.CndSet("Dir::State", &STATE_DIR[1]);
    Cnf.CndSet("Dir::State::lists","lists/");
    Cnf.CndSet("Dir::State::cdroms","cdroms.list");
+   Cnf.CndSet("Dir::State::mirror-stats","mirror-stats");
 
    // Cache
    Cnf.CndSet("Dir::Cache", &CACHE_DIR[1]);
    Cnf.CndSet("Dir::Cache::archives","archives/");
    Cnf.CndSet("Dir::Cache::srcpkgcache","srcpkgcache.bin");
    Cnf.CndSet("Dir::Cache::pkgcache","pkgcache.bin");
+   Cnf.CndSet("Dir::Cache::extended_states","extended_states.bin");
+   Cnf.CndSet("Dir::Cache::status-journal","status-journal");
 
    // Configuration
    Cnf.CndSet("Dir::Etc", &CONF_DIR[1]);
@@ -193,6 +196,12 @@ bool pkgInitConfig(Configuration &Cnf)
    Cnf.CndSet("Acquire::IndexTargets::deb::Packages::Description", "$(RELEASE)/$(COMPONENT) $(ARCHITECTURE) Packages");
    Cnf.CndSet("Acquire::IndexTargets::deb::Packages::flatDescription", "$(RELEASE) Packages");
    Cnf.CndSet("Acquire::IndexTargets::deb::Packages::Optional", false);
+   Cnf.CndSet("Acquire::IndexTargets::deb::Deltas::MetaKey", "$(COMPONENT)/binary-$(ARCHITECTURE)/Deltas");
+   Cnf.CndSet("Acquire::IndexTargets::deb::Deltas::flatMetaKey", "Deltas");
+   Cnf.CndSet("Acquire::IndexTargets::deb::Deltas::ShortDescription", "Deltas");
+   Cnf.CndSet("Acquire::IndexTargets::deb::Deltas::Description", "$(RELEASE)/$(COMPONENT) $(ARCHITECTURE) Deltas");
+   Cnf.CndSet("Acquire::IndexTargets::deb::Deltas::flatDescription", "$(RELEASE) Deltas");
+   Cnf.CndSet("Acquire::IndexTargets::deb::Deltas::DefaultEnabled", false);
    Cnf.CndSet("Acquire::IndexTargets::deb::Translations::MetaKey", "$(COMPONENT)/i18n/Translation-$(LANGUAGE)");
    Cnf.CndSet("Acquire::IndexTargets::deb::Translations::flatMetaKey", "$(LANGUAGE)");
    Cnf.CndSet("Acquire::IndexTargets::deb::Translations::ShortDescription", "Translation-$(LANGUAGE)");
@@ -69,6 +69,7 @@
 #include <apt-pkg/error.h>
 #include <apt-pkg/orderlist.h>
 #include <apt-pkg/pkgcache.h>
+#include <apt-pkg/trace.h>
 
 #include <algorithm>
 #include <iostream>
@@ -174,6 +175,7 @@ bool pkgOrderList::DoRun()
    fatal and indicate that the packages cannot be installed. */
 bool pkgOrderList::OrderCritical()
 {
+   APT::Trace::Phase const phase("pkgOrderList::OrderCritical");
    FileList = 0;
 
    Primary = &pkgOrderList::DepUnPackPreD;
@@ -212,6 +214,7 @@ bool pkgOrderList::OrderCritical()
    suitable for unpacking */
 bool pkgOrderList::OrderUnpack(string *FileList)
 {
+   APT::Trace::Phase const phase("pkgOrderList::OrderUnpack");
    this->FileList = FileList;
 
    // Setup the after flags
@@ -284,6 +287,7 @@ bool pkgOrderList::OrderUnpack(string *FileList)
    for configuration */
 bool pkgOrderList::OrderConfigure()
 {
+   APT::Trace::Phase const phase("pkgOrderList::OrderConfigure");
    FileList = 0;
    Primary = &pkgOrderList::DepConfigure;
    Secondary = 0;
@@ -57,7 +57,7 @@ pkgCache::Header::Header()
 
    /* Whenever the structures change the major version should be bumped,
       whenever the generator changes the minor version should be bumped. */
-   APT_HEADER_SET(MajorVersion, 16);
+   APT_HEADER_SET(MajorVersion, 18);
    APT_HEADER_SET(MinorVersion, 0);
    APT_HEADER_SET(Dirty, false);
 
@@ -95,6 +95,8 @@ pkgCache::Header::Header()
    Architecture = 0;
    SetArchitectures(0);
    SetHashTableSize(_config->FindI("APT::Cache-HashTableSize", 196613));
+   GrpIndex = 0;
+   GrpIndexSize = 0;
    memset(Pools,0,sizeof(Pools));
 
    CacheFileSize = 0;
@@ -207,6 +209,10 @@ bool pkgCache::ReMap(bool const &Errorchecks)
    package list from bo this function gets 94% table usage on a 512 item
    table (480 used items) */
 map_id_t pkgCache::sHash(StringView Str) const
+{
+   return NameHash(Str) % HeaderP->GetHashTableSize();
+}
+uint32_t pkgCache::NameHash(StringView Str)
 {
    uint32_t Hash = 5381;
    auto I = Str.begin();
@@ -225,7 +231,7 @@ map_id_t pkgCache::sHash(StringView Str) const
    }
    for (; I != End; ++I)
       Hash = 33u * Hash + tolower_ascii_unsafe(*I);
-   return Hash % HeaderP->GetHashTableSize();
+   return Hash;
 }
 uint32_t pkgCache::CacheHash()
 {
@@ -297,6 +303,22 @@ pkgCache::GrpIterator pkgCache::FindGrp(StringView Name) {
 	if (unlikely(Name.empty() == true))
 		return GrpIterator(*this,0);
 
+	// Probe the group index if the generator provided one
+	if (HeaderP->GrpIndex != 0)
+	{
+		uint32_t const Hash = NameHash(Name);
+		auto const Index = static_cast<Header::GrpIndexEntry *>(Map.Data()) + HeaderP->GrpIndex;
+		uint32_t const Mask = HeaderP->GrpIndexSize - 1;
+		for (uint32_t Slot = HeaderP->GrpIndexSlot(Hash);; Slot = (Slot + 1) & Mask)
+		{
+			auto const &Entry = Index[Slot];
+			if (Entry.Group == 0)
+				return GrpIterator(*this, 0);
+			if (Entry.Hash == Hash && StringViewCompareFast(Name, ViewString((GrpP + Entry.Group)->Name)) == 0)
+				return GrpIterator(*this, GrpP + Entry.Group);
+		}
+	}
+
 	// Look at the hash bucket for the group
 	Group *Grp = GrpP + HeaderP->GrpHashTableP()[sHash(Name)];
 	for (; Grp != GrpP; Grp = GrpP + Grp->Next) {
@@ -310,6 +332,52 @@ pkgCache::GrpIterator pkgCache::FindGrp(StringView Name) {
 	return GrpIterator(*this,0);
 }
 									/*}}}*/
+// Cache::CmpVersion - Compare two version strings of the cache	/*{{{*/
+// ---------------------------------------------------------------------
+/* The generator stores a sort key behind each version string if the
+   versioning system can provide one, so that most comparisons are a
+   memcmp of two short keys instead of parsing both versions again. */
+int pkgCache::CmpVersionKey(APT::StringView const A, APT::StringView const B)
+{
+   int const Res = memcmp(A.data(), B.data(), std::min(A.length(), B.length()));
+   if (Res != 0)
+      return Res;
+   return (A.length() < B.length()) ? -1 : (A.length() > B.length()) ? 1 : 0;
+}
+int pkgCache::CmpVersion(map_stringitem_t const A, map_stringitem_t const B) const
+{
+   if (A == B)
+      return 0;
+   APT::StringView const KeyA = VersionKey(A);
+   APT::StringView const KeyB = VersionKey(B);
+   if (KeyA.empty() == false && KeyB.empty() == false)
+      return CmpVersionKey(KeyA, KeyB);
+   return VS->CmpVersion(StrP + A, StrP + B);
+}
+									/*}}}*/
+// Cache::CheckDep - Check a version string against a dependency	/*{{{*/
+bool pkgCache::CheckDep(map_stringitem_t const PkgVer, int const Op, map_stringitem_t const DepVer) const
+{
+   if (DepVer == 0 || PkgVer == 0 || PkgVer == DepVer)
+      return VS->CheckDep(PkgVer == 0 ? nullptr : StrP + PkgVer, Op, DepVer == 0 ? nullptr : StrP + DepVer);
+   APT::StringView const PkgKey = VersionKey(PkgVer);
+   APT::StringView const DepKey = VersionKey(DepVer);
+   if (PkgKey.empty() == true || DepKey.empty() == true)
+      return VS->CheckDep(StrP + PkgVer, Op, StrP + DepVer);
+
+   int const Res = CmpVersionKey(PkgKey, DepKey);
+   switch (Op & 0x0F)
+   {
+      case Dep::LessEq: return Res <= 0;
+      case Dep::GreaterEq: return Res >= 0;
+      case Dep::Less: return Res < 0;
+      case Dep::Greater: return Res > 0;
+      case Dep::Equals: return Res == 0;
+      case Dep::NotEquals: return Res != 0;
+   }
+   return false;
+}
+									/*}}}*/
 // Cache::CompTypeDeb - Return a string describing the compare type	/*{{{*/
 // ---------------------------------------------------------------------
 /* This returns a string representation of the dependency compare 
@@ -750,11 +818,11 @@ bool pkgCache::DepIterator::IsIgnorable(PrvIterator const &Prv) const
 // DepIterator::IsSatisfied - check if a version satisfied the dependency /*{{{*/
 bool pkgCache::DepIterator::IsSatisfied(VerIterator const &Ver) const
 {
-   return Owner->VS->CheckDep(Ver.VerStr(),S2->CompareOp,TargetVer());
+   return Owner->CheckDep(Ver->VerStr, S2->CompareOp, S2->Version);
 }
 bool pkgCache::DepIterator::IsSatisfied(PrvIterator const &Prv) const
 {
-   return Owner->VS->CheckDep(Prv.ProvideVersion(),S2->CompareOp,TargetVer());
+   return Owner->CheckDep(Prv->ProvideVersion, S2->CompareOp, S2->Version);
 }
 									/*}}}*/
 // DepIterator::IsImplicit - added by the cache generation		/*{{{*/
@@ -240,6 +240,8 @@ class APT_PUBLIC pkgCache								/*{{{*/
       
    // String hashing function (512 range)
    inline map_id_t Hash(APT::StringView S) const {return sHash(S);}
+   // Unreduced 32bit variant of the above, used by the group index
+   APT_HIDDEN static uint32_t NameHash(APT::StringView S) APT_PURE;
 
    APT_HIDDEN uint32_t CacheHash();
 
@@ -257,6 +259,21 @@ class APT_PUBLIC pkgCache								/*{{{*/
       uint16_t len = *reinterpret_cast<const uint16_t*>(name - sizeof(uint16_t));
       return APT::StringView(name, len);
    }
+   /** \brief sort key the generator stored behind a version string
+
+       Comparing these keys bytewise orders the versions as the versioning
+       system does; see debVersioningSystem::SortKey. The key is empty if
+       the version has none. Only valid for strings referenced as versions. */
+   APT_HIDDEN APT::StringView VersionKey(map_stringitem_t idx) const
+   {
+      APT::StringView const Ver = ViewString(idx);
+      auto const Key = reinterpret_cast<const unsigned char *>(Ver.end() + 1);
+      return APT::StringView(reinterpret_cast<const char *>(Key + 1), *Key);
+   }
+   APT_HIDDEN static int CmpVersionKey(APT::StringView A, APT::StringView B) APT_PURE;
+   // Version comparisons for version strings of the cache using their keys
+   APT_HIDDEN int CmpVersion(map_stringitem_t A, map_stringitem_t B) const;
+   APT_HIDDEN bool CheckDep(map_stringitem_t PkgVer, int Op, map_stringitem_t DepVer) const;
 
    Header &Head() {return *HeaderP;}
    inline GrpIterator GrpBegin();
@@ -290,6 +307,8 @@ private:
 // Header structure							/*{{{*/
 struct pkgCache::Header
 {
+   struct GrpIndexEntry;
+
    /** \brief Signature information
 
        This must contain the hex value 0x98FE76DC which is designed to
@@ -391,14 +410,42 @@ struct pkgCache::Header
 #ifdef APT_COMPILING_APT
    map_pointer<Group> * GrpHashTableP() const { return (map_pointer<Group>*) (this + 1); }
    map_pointer<Package> * PkgHashTableP() const { return reinterpret_cast<map_pointer<Package> *>(GrpHashTableP() + GetHashTableSize()); }
+   uint32_t GrpIndexSlot(uint32_t const Hash) const
+   {
+      uint32_t const Mixed = Hash * 0x9E3779B1u;
+      return (Mixed ^ (Mixed >> 15)) & (GrpIndexSize - 1);
+   }
 #endif
 
    /** \brief Hash of the file (TODO: Rename) */
    map_filesize_small_t CacheFileSize;
 
+   /** \brief open-addressing index for rapid group name lookup
+
+       In addition to the hash tables above the generator maintains a table of
+       GrpIndexSize (a power of two) entries storing the unreduced name hash
+       next to the group. A lookup probes linearly from GrpIndexSlot() and
+       only compares names for entries with a matching hash, so it usually
+       touches a single cache line instead of walking a bucket chain.
+       The generator drops the index (GrpIndex is 0) if it fills up while
+       groups are added and rebuilds it once the index files are merged. */
+   map_pointer<GrpIndexEntry> GrpIndex;
+   uint32_t GrpIndexSize;
+
    bool CheckSizes(Header &Against) const APT_PURE;
    Header();
 };
+
+#ifdef APT_COMPILING_APT
+/// \brief Entry of the open-addressing group index. APT-internal use only.
+struct pkgCache::Header::GrpIndexEntry
+{
+   /** \brief unreduced name hash as computed by pkgCache::NameHash */
+   uint32_t Hash;
+   /** \brief the group with this name, 0 marks an empty slot */
+   map_pointer<pkgCache::Group> Group;
+};
+#endif
 									/*}}}*/
 // Group structure							/*{{{*/
 /** \brief groups architecture depending packages together
@@ -12,6 +12,8 @@
 #include <config.h>
 
 #include <apt-pkg/configuration.h>
+#include <apt-pkg/deblistparser.h>
+#include <apt-pkg/debversion.h>
 #include <apt-pkg/error.h>
 #include <apt-pkg/fileutl.h>
 #include <apt-pkg/indexfile.h>
@@ -23,12 +25,19 @@
 #include <apt-pkg/pkgsystem.h>
 #include <apt-pkg/progress.h>
 #include <apt-pkg/sourcelist.h>
+#include <apt-pkg/strutl.h>
+#include <apt-pkg/tagfile.h>
+#include <apt-pkg/trace.h>
 #include <apt-pkg/version.h>
 
 #include <algorithm>
 #include <iostream>
+#include <limits>
 #include <memory>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 #include <stddef.h>
 #include <string.h>
@@ -67,7 +76,7 @@ static inline uint32_t NarrowOffset(T ptr)
 /* We set the dirty flag and make sure that is written to the disk */
 pkgCacheGenerator::pkgCacheGenerator(DynamicMMap *pMap,OpProgress *Prog) :
 		    Map(*pMap), Cache(pMap,false), Progress(Prog),
-		     CurrentRlsFile(nullptr), CurrentFile(nullptr), d(nullptr)
+		     CurrentRlsFile(nullptr), CurrentFile(nullptr), GrpIndexSpace(nullptr), d(nullptr)
 {
 }
 bool pkgCacheGenerator::Start()
@@ -130,6 +139,9 @@ bool pkgCacheGenerator::Start()
       // Map directly from the existing file
       Cache.ReMap(); 
       Map.UsePools(*Cache.HeaderP->Pools,sizeof(Cache.HeaderP->Pools)/sizeof(Cache.HeaderP->Pools[0]));
+      GrpIndexSpace = Cache.HeaderP->GrpIndex;
+      depDatasPending.assign(Cache.HeaderP->PackageCount, true);
+      stringPoolsPending = (1 << MIXED) | (1 << VERSIONNUMBER) | (1 << SECTION);
       if (Cache.VS != _system->VS)
 	 return _error->Error(_("Cache has an incompatible versioning system"));
    }
@@ -223,6 +235,32 @@ map_stringitem_t pkgCacheGenerator::WriteStringInMap(const char *String) {
    return index;
 }
 									/*}}}*/
+// CacheGenerator::WriteVersionInMap					/*{{{*/
+/* Version strings are followed by the length and the bytes of their sort
+   key (a zero length if they have none), which pkgCache::VersionKey reads */
+static bool VersionSortKey(pkgCache const &Cache, APT::StringView const Ver, std::string &Key)
+{
+   return Cache.VS == &debVS && debVersioningSystem::SortKey(Ver, Key) &&
+      Key.length() <= std::numeric_limits<uint8_t>::max();
+}
+map_stringitem_t pkgCacheGenerator::WriteVersionInMap(const char *String,
+					const unsigned long &Len) {
+   std::string Key;
+   if (VersionSortKey(Cache, APT::StringView(String, Len), Key) == false)
+      Key.clear();
+   std::string Data;
+   Data.reserve(Len + 2 + Key.length());
+   Data.append(String, Len).append(1, '\0').append(1, static_cast<char>(Key.length())).append(Key);
+
+   map_stringitem_t const index = WriteStringInMap(Data.c_str(), Data.length());
+   if (index != 0)
+   {
+      uint16_t const StrLen = Len;
+      memcpy(static_cast<char *>(Map.Data()) + index - sizeof(StrLen), &StrLen, sizeof(StrLen));
+   }
+   return index;
+}
+									/*}}}*/
 uint32_t pkgCacheGenerator::AllocateInMap(const unsigned long &size) {/*{{{*/
    size_t oldSize = Map.Size();
    void const * const oldMap = Map.Data();
@@ -380,12 +418,20 @@ bool pkgCacheGenerator::MergeListVersion(ListParser &List, pkgCache::PkgIterator
    {
       /* We know the list is sorted so we use that fact in the search.
          Insertion of new versions is done with correct sorting */
+      std::string VersionKey;
+      bool const HasKey = VersionSortKey(Cache, Version, VersionKey);
       int Res = 1;
       for (; Ver.end() == false; LastVer = &Ver->NextVer, ++Ver)
       {
-	 char const * const VerStr = Ver.VerStr();
-	 Res = Cache.VS->DoCmpVersion(Version.data(), Version.data() + Version.length(),
-	       VerStr, VerStr + strlen(VerStr));
+	 APT::StringView const VerKey = Cache.VersionKey(Ver->VerStr);
+	 if (HasKey && VerKey.empty() == false)
+	    Res = pkgCache::CmpVersionKey(VersionKey, VerKey);
+	 else
+	 {
+	    char const * const VerStr = Ver.VerStr();
+	    Res = Cache.VS->DoCmpVersion(Version.data(), Version.data() + Version.length(),
+		  VerStr, VerStr + strlen(VerStr));
+	 }
 	 // Version is higher as current version - insert here
 	 if (Res > 0)
 	    break;
@@ -564,8 +610,8 @@ bool pkgCacheGenerator::NewGroup(pkgCache::GrpIterator &Grp, StringView Name)
    Grp->Name = idxName;
 
    // Insert it into the hash table
-   unsigned long const Hash = Cache.Hash(Name);
-   map_pointer<pkgCache::Group> *insertAt = &Cache.HeaderP->GrpHashTableP()[Hash];
+   uint32_t const Hash = Cache.NameHash(Name);
+   map_pointer<pkgCache::Group> *insertAt = &Cache.HeaderP->GrpHashTableP()[Hash % Cache.HeaderP->GetHashTableSize()];
 
    while (*insertAt != 0 && StringViewCompareFast(Name, Cache.ViewString((Cache.GrpP + *insertAt)->Name)) > 0)
       insertAt = &(Cache.GrpP + *insertAt)->Next;
@@ -573,6 +619,64 @@ bool pkgCacheGenerator::NewGroup(pkgCache::GrpIterator &Grp, StringView Name)
    *insertAt = Group;
 
    Grp->ID = Cache.HeaderP->GroupCount++;
+
+   // Keep the group index usable while it has room, otherwise drop it
+   if (Cache.HeaderP->GrpIndex != 0)
+   {
+      if (Cache.HeaderP->GroupCount * 4 > Cache.HeaderP->GrpIndexSize * 3)
+	 Cache.HeaderP->GrpIndex = 0;
+      else
+	 InsertIntoGrpIndex(Hash, Group);
+   }
+   return true;
+}
+									/*}}}*/
+// CacheGenerator::InsertIntoGrpIndex - Add a group to the index	/*{{{*/
+void pkgCacheGenerator::InsertIntoGrpIndex(uint32_t const Hash, map_pointer<pkgCache::Group> const Group)
+{
+   auto const Index = static_cast<pkgCache::Header::GrpIndexEntry *>(Map.Data()) + Cache.HeaderP->GrpIndex;
+   uint32_t const Mask = Cache.HeaderP->GrpIndexSize - 1;
+   uint32_t Slot = Cache.HeaderP->GrpIndexSlot(Hash);
+   while (Index[Slot].Group != 0)
+      Slot = (Slot + 1) & Mask;
+   Index[Slot].Hash = Hash;
+   Index[Slot].Group = Group;
+}
+									/*}}}*/
+// CacheGenerator::BuildGrpIndex - (Re)create the group index		/*{{{*/
+// ---------------------------------------------------------------------
+/* The index is sized to be at most half full, so that lookups for names
+   not in the cache hit an empty slot quickly, too. If we previously built
+   an index which is still large enough we reuse its space. */
+bool pkgCacheGenerator::BuildGrpIndex()
+{
+   if (Cache.HeaderP->GrpIndex != 0)
+      return true;
+
+   uint32_t Size = 1024;
+   while (Size < Cache.HeaderP->GroupCount * 2)
+      Size *= 2;
+
+   if (GrpIndexSpace == 0 || Cache.HeaderP->GrpIndexSize < Size)
+   {
+      size_t oldSize = Map.Size();
+      void const * const oldMap = Map.Data();
+      auto const Start = Map.RawAllocate(Size * sizeof(pkgCache::Header::GrpIndexEntry), 64);
+      if (unlikely(Start == 0))
+	 return false;
+      ReMap(oldMap, Map.Data(), oldSize);
+      GrpIndexSpace = map_pointer<pkgCache::Header::GrpIndexEntry>{NarrowOffset(Start / sizeof(pkgCache::Header::GrpIndexEntry))};
+      Cache.HeaderP->GrpIndexSize = Size;
+   }
+
+   auto const Index = static_cast<pkgCache::Header::GrpIndexEntry *>(Map.Data()) + GrpIndexSpace;
+   std::fill_n(Index, Cache.HeaderP->GrpIndexSize, pkgCache::Header::GrpIndexEntry{});
+   Cache.HeaderP->GrpIndex = GrpIndexSpace;
+
+   auto const HashTable = Cache.HeaderP->GrpHashTableP();
+   for (uint32_t I = 0; I < Cache.HeaderP->GetHashTableSize(); ++I)
+      for (auto Group = HashTable[I]; Group != 0; Group = (Cache.GrpP + Group)->Next)
+	 InsertIntoGrpIndex(Cache.NameHash(Cache.ViewString((Cache.GrpP + Group)->Name)), Group);
    return true;
 }
 									/*}}}*/
@@ -967,6 +1071,26 @@ map_pointer<pkgCache::Description> pkgCacheGenerator::NewDescription(pkgCache::D
    return Description;
 }
 									/*}}}*/
+// CacheGenerator::IndexDependencyData - learn data of a loaded cache	/*{{{*/
+// ---------------------------------------------------------------------
+/* A cache loaded back from disk has its DependencyData chains, but not the
+   lookup table we use to share them, so we fill it the first time a
+   dependency on such a package is added. */
+void pkgCacheGenerator::IndexDependencyData(pkgCache::Package const * const Pkg)
+{
+   depDatasPending[Pkg->ID] = false;
+   if (Pkg->RevDepends == 0)
+      return;
+   pkgCache::Dependency const * const L = Cache.DepP + Pkg->RevDepends;
+   for (map_pointer<pkgCache::DependencyData> DependencyData = L->DependencyData; DependencyData != 0;)
+   {
+      pkgCache::DependencyData const * const D = Cache.DepDataP + DependencyData;
+      depdata_key const key{uint32_t(map_pointer<pkgCache::Package>(D->Package)), uint32_t(map_stringitem_t(D->Version)), D->Type, D->CompareOp};
+      depDatas.emplace(key, DependencyData);
+      DependencyData = D->NextData;
+   }
+}
+									/*}}}*/
 // CacheGenerator::NewDepends - Create a dependency element		/*{{{*/
 // ---------------------------------------------------------------------
 /* This creates a dependency element in the tree. It is linked to the
@@ -977,6 +1101,18 @@ bool pkgCacheGenerator::NewDepends(pkgCache::PkgIterator &Pkg,
 				   uint8_t const Op,
 				   uint8_t const Type,
 				   map_pointer<pkgCache::Dependency> * &OldDepLast)
+{
+   map_pointer<pkgCache::DependencyData> DependencyData = 0;
+   return NewDepends(Pkg, Ver, Version, Op, Type, OldDepLast, DependencyData);
+}
+/* If DependencyData is set, it is known to be the data for these values */
+bool pkgCacheGenerator::NewDepends(pkgCache::PkgIterator &Pkg,
+				   pkgCache::VerIterator &Ver,
+				   map_stringitem_t const Version,
+				   uint8_t const Op,
+				   uint8_t const Type,
+				   map_pointer<pkgCache::Dependency> * &OldDepLast,
+				   map_pointer<pkgCache::DependencyData> &DependencyData)
 {
    void const * const oldMap = Map.Data();
    // Get a structure
@@ -984,32 +1120,40 @@ bool pkgCacheGenerator::NewDepends(pkgCache::PkgIterator &Pkg,
    if (unlikely(Dependency == 0))
       return false;
 
-   bool isDuplicate = false;
-   map_pointer<pkgCache::DependencyData> DependencyData = 0;
+   depdata_key const key{uint32_t(Pkg.MapPointer()), uint32_t(map_stringitem_t(Version)), Type, Op};
+   bool isDuplicate = DependencyData != 0;
    map_pointer<pkgCache::DependencyData> PreviousData = 0;
-   if (Pkg->RevDepends != 0)
+   if (isDuplicate == false)
    {
-      pkgCache::Dependency const * const L = Cache.DepP + Pkg->RevDepends;
-      DependencyData = L->DependencyData;
-      do {
-	 pkgCache::DependencyData const * const D = Cache.DepDataP + DependencyData;
-	 if (Version > D->Version)
-	    break;
-	 if (D->Version == Version && D->Type == Type && D->CompareOp == Op)
-	 {
-	    isDuplicate = true;
-	    break;
-	 }
-	 PreviousData = DependencyData;
-	 DependencyData = D->NextData;
-      } while (DependencyData != 0);
+      if (Pkg->ID < depDatasPending.size() && depDatasPending[Pkg->ID])
+	 IndexDependencyData(Pkg);
+      auto const known = depDatas.find(key);
+      isDuplicate = known != depDatas.end();
+      if (isDuplicate)
+	 DependencyData = known->second;
    }
-
    if (isDuplicate == false)
    {
+      /* The table only saves us the walk for data we already have; new data
+	 is still sorted into the chain like it always was, so that the cache
+	 we write (and the order the RevDepends are iterated in) is the same
+	 as without the table. */
+      if (Pkg->RevDepends != 0)
+      {
+	 pkgCache::Dependency const * const L = Cache.DepP + Pkg->RevDepends;
+	 for (auto Data = L->DependencyData; Data != 0;)
+	 {
+	    pkgCache::DependencyData const * const D = Cache.DepDataP + Data;
+	    if (Version > D->Version)
+	       break;
+	    PreviousData = Data;
+	    Data = D->NextData;
+	 }
+      }
       DependencyData = AllocateInMap<pkgCache::DependencyData>();
       if (unlikely(DependencyData == 0))
         return false;
+      depDatas.emplace(key, DependencyData);
    }
 
    pkgCache::Dependency * Link = Cache.DepP + Dependency;
@@ -1105,42 +1249,101 @@ bool pkgCacheListParser::NewDepends(pkgCache::VerIterator &Ver,
 	 Type == pkgCache::Dep::Conflicts ||
 	 Type == pkgCache::Dep::Replaces);
 
+   // Locate the target package, negative dependencies target the whole group
    pkgCache::PkgIterator Pkg;
    Dynamic<pkgCache::PkgIterator> DynPkg(Pkg);
    if (isNegative == false || (Op & pkgCache::Dep::ArchSpecific) == pkgCache::Dep::ArchSpecific || Grp->FirstPackage == 0)
    {
-      // Locate the target package
       Pkg = Grp.FindPkg(Arch);
       if (Pkg.end() == true) {
 	 if (unlikely(Owner->NewPackage(Pkg, PackageName, Arch) == false))
 	    return false;
       }
+   }
 
-      /* Caching the old end point speeds up generation substantially */
-      if (OldDepVer != Ver) {
-	 OldDepLast = NULL;
-	 OldDepVer = Ver;
-      }
+   map_pointer<pkgCache::DependencyData> Data = 0;
+   if (NewDepends(Ver, Grp, Pkg, idxVersion, Op, Type, Data) == false)
+      return false;
+   if (Owner->dependsListRecording)
+      Owner->dependsListItems.push_back({Grp.MapPointer(), Pkg.end() ? 0 : Pkg.MapPointer(), idxVersion, Data, Op, Type});
+   return true;
+}
+bool pkgCacheListParser::NewDepends(pkgCache::VerIterator &Ver, pkgCache::GrpIterator &Grp,
+				    pkgCache::PkgIterator &Pkg, map_stringitem_t const Version,
+				    uint8_t const Op, uint8_t const Type,
+				    map_pointer<pkgCache::DependencyData> &Data)
+{
+   /* Caching the old end point speeds up generation substantially */
+   if (OldDepVer != Ver) {
+      OldDepLast = NULL;
+      OldDepVer = Ver;
+   }
+
+   if (Pkg.end() == false)
+      return Owner->NewDepends(Pkg, Ver, Version, Op, Type, OldDepLast, Data);
 
-      return Owner->NewDepends(Pkg, Ver, idxVersion, Op, Type, OldDepLast);
+   for (Pkg = Grp.PackageList(); Pkg.end() == false; Pkg = Grp.NextPkg(Pkg))
+   {
+      if (Owner->NewDepends(Pkg, Ver, Version, Op, Type, OldDepLast) == false)
+	 return false;
    }
-   else
+   return true;
+}
+									/*}}}*/
+// ListParser::BeginDepends - reuse the dependencies of an earlier version	/*{{{*/
+// ---------------------------------------------------------------------
+/* The names in a list resolve to the same targets for every version with
+   the same architecture (which is part of the List), so a known list is
+   added again from the recorded targets. Negative dependencies on a whole
+   group are expanded over its packages as they are now, as the group can
+   have gained packages since the list was recorded. */
+std::string &pkgCacheListParser::DependsList()
+{
+   Owner->dependsListKey.clear();
+   return Owner->dependsListKey;
+}
+bool pkgCacheListParser::BeginDepends(pkgCache::VerIterator &Ver, bool &Known)
+{
+   Owner->dependsListRecording = false;
+   auto const L = Owner->dependsLists.find(Owner->dependsListKey);
+   Known = L != Owner->dependsLists.end();
+   if (Known == false)
    {
-      /* Caching the old end point speeds up generation substantially */
-      if (OldDepVer != Ver) {
-	 OldDepLast = NULL;
-	 OldDepVer = Ver;
-      }
+      Owner->dependsListItems.clear();
+      Owner->dependsListRecording = true;
+      return true;
+   }
 
-      for (Pkg = Grp.PackageList(); Pkg.end() == false; Pkg = Grp.NextPkg(Pkg))
-      {
-	 if (Owner->NewDepends(Pkg, Ver, idxVersion, Op, Type, OldDepLast) == false)
-	       return false;
-      }
+   pkgCache::GrpIterator Grp;
+   Dynamic<pkgCache::GrpIterator> DynGrp(Grp);
+   pkgCache::PkgIterator Pkg;
+   Dynamic<pkgCache::PkgIterator> DynPkg(Pkg);
+   for (auto D : L->second)
+   {
+      bool const isNegative = (D.Type == pkgCache::Dep::DpkgBreaks ||
+	    D.Type == pkgCache::Dep::Conflicts ||
+	    D.Type == pkgCache::Dep::Replaces);
+      Grp = pkgCache::GrpIterator(Owner->Cache, Owner->Cache.GrpP + D.Group);
+      if (isNegative && (D.Op & pkgCache::Dep::ArchSpecific) != pkgCache::Dep::ArchSpecific)
+	 Pkg = pkgCache::PkgIterator();
+      else
+	 Pkg = pkgCache::PkgIterator(Owner->Cache, Owner->Cache.PkgP + D.Package);
+      if (NewDepends(Ver, Grp, Pkg, D.Version, D.Op, D.Type, D.Data) == false)
+	 return false;
    }
    return true;
 }
 									/*}}}*/
+// ListParser::EndDepends - remember the list recorded since BeginDepends	/*{{{*/
+void pkgCacheListParser::EndDepends()
+{
+   if (Owner->dependsListRecording == false)
+      return;
+   Owner->dependsListRecording = false;
+   Owner->dependsLists.emplace(Owner->dependsListKey, std::move(Owner->dependsListItems));
+   Owner->dependsListItems.clear();
+}
+									/*}}}*/
 // ListParser::NewProvides - Create a Provides element			/*{{{*/
 bool pkgCacheListParser::NewProvides(pkgCache::VerIterator &Ver,
 						StringView PkgName,
@@ -1330,6 +1533,74 @@ bool pkgCacheGenerator::SelectFile(std::string const &File,
    return true;
 }
 									/*}}}*/
+// CacheGenerator::RestoreStringPool - learn strings of a loaded cache	/*{{{*/
+// ---------------------------------------------------------------------
+/* A cache loaded back from disk (like srcpkgcache.bin for the status file)
+   contains strings we would otherwise store again, so we collect them from
+   the structures referencing them the first time a pool is used. Versions
+   and sections are only stored for new versions, which the status file
+   usually has none of, so we can often skip walking the cache entirely.
+   Mixed strings are needed for every file, but take only a few distinct
+   values, which are all found in the file lists – architectures and
+   language codes used by packages only are stored at most once more. */
+void pkgCacheGenerator::RestoreStringPool(StringType const type)
+{
+   stringPoolsPending &= ~(1 << type);
+   auto const restore = [&](std::unordered_set<string_pointer, hash> &strings, map_stringitem_t const idx) {
+      if (idx == 0)
+	 return;
+      strings.insert({nullptr, Cache.ViewString(idx).size(), this, idx});
+   };
+
+   if (type == MIXED)
+   {
+      restore(strMixed, Cache.HeaderP->Architecture);
+      for (pkgCache::RlsFileIterator R = Cache.RlsFileBegin(); R.end() == false; ++R)
+      {
+	 restore(strMixed, R->Archive);
+	 restore(strMixed, R->Codename);
+	 restore(strMixed, R->Origin);
+	 restore(strMixed, R->Label);
+	 restore(strMixed, R->Site);
+      }
+      for (pkgCache::PkgFileIterator F = Cache.FileBegin(); F.end() == false; ++F)
+      {
+	 restore(strMixed, F->Component);
+	 restore(strMixed, F->Architecture);
+	 restore(strMixed, F->IndexType);
+      }
+      return;
+   }
+
+   if (type == VERSIONNUMBER)
+   {
+      strVersions.reserve(Cache.HeaderP->VersionCount);
+      for (pkgCache::RlsFileIterator R = Cache.RlsFileBegin(); R.end() == false; ++R)
+	 restore(strVersions, R->Version);
+   }
+   for (pkgCache::PkgIterator P = Cache.PkgBegin(); P.end() == false; ++P)
+   {
+      if (type == VERSIONNUMBER && P->RevDepends != 0)
+      {
+	 pkgCache::Dependency const * const L = Cache.DepP + P->RevDepends;
+	 for (map_pointer<pkgCache::DependencyData> D = L->DependencyData; D != 0; D = Cache.DepDataP[uint32_t(D)].NextData)
+	    restore(strVersions, Cache.DepDataP[uint32_t(D)].Version);
+      }
+      for (pkgCache::VerIterator V = P.VersionList(); V.end() == false; ++V)
+      {
+	 if (type == SECTION)
+	 {
+	    restore(strSections, V->Section);
+	    continue;
+	 }
+	 restore(strVersions, V->VerStr);
+	 restore(strVersions, V->SourceVerStr);
+	 for (pkgCache::PrvIterator Prv = V.ProvidesList(); Prv.end() == false; ++Prv)
+	    restore(strVersions, Prv->ProvideVersion);
+      }
+   }
+}
+									/*}}}*/
 // CacheGenerator::WriteUniqueString - Insert a unique string		/*{{{*/
 // ---------------------------------------------------------------------
 /* This is used to create handles to strings. Given the same text it
@@ -1345,11 +1616,16 @@ map_stringitem_t pkgCacheGenerator::StoreString(enum StringType const type, cons
       default: _error->Fatal("Unknown enum type used for string storage of '%.*s'", Size, S); return 0;
    }
 
-   auto const item = strings->find({S, Size, nullptr, 0});
+   auto item = strings->find({S, Size, nullptr, 0});
+   if (item == strings->end() && (stringPoolsPending & (1 << type)) != 0)
+   {
+      RestoreStringPool(type);
+      item = strings->find({S, Size, nullptr, 0});
+   }
    if (item != strings->end())
       return item->item;
 
-   map_stringitem_t const idxString = WriteStringInMap(S,Size);
+   map_stringitem_t const idxString = (type == VERSIONNUMBER) ? WriteVersionInMap(S, Size) : WriteStringInMap(S, Size);
    strings->insert({nullptr, Size, this, idxString});
    return idxString;
 }
@@ -1372,6 +1648,7 @@ static bool CheckValidity(FileFd &CacheFile, std::string const &CacheFileName,
                           MMap **OutMap = 0,
 			  pkgCache **OutCache = 0)
 {
+   APT::Trace::Phase const phase("CheckValidity");
    if (CacheFileName.empty())
       return false;
    ScopedErrorRevert ser;
@@ -1533,6 +1810,7 @@ static bool BuildCache(pkgCacheGenerator &Gen,
 		       pkgSourceList const * const List,
 		       FileIterator const Start, FileIterator const End)
 {
+   APT::Trace::Phase const phase("BuildCache");
    bool mergeFailure = false;
 
    auto const indexFileMerge = [&](pkgIndexFile * const I) {
@@ -1587,7 +1865,230 @@ static bool BuildCache(pkgCacheGenerator &Gen,
       if (mergeFailure)
 	 return false;
    }
-   return true;
+   return Gen.BuildGrpIndex();
+}
+									/*}}}*/
+// CacheGenerator::ApplyStatusJournal - Follow dpkg in the status file	/*{{{*/
+// ---------------------------------------------------------------------
+/* pkgDPkgPM records the packages dpkg was asked to act on or reported
+   changes for. If nothing else changed the status file since the cache was
+   built, the stanzas of all other packages are still the same, they have
+   just moved. Instead of merging the entire status file into the source
+   cache again we move their entries and merge only the stanzas of the
+   recorded packages after dropping their previous entries. Anything
+   unexpected lets this fail, so that the cache is built as usual. */
+static bool StanzaStartsAt(APT::StringView const Data, map_filesize_t const Pos,
+			   char const * const Name, map_filesize_t const Size)
+{
+   size_t const NameLen = strlen(Name);
+   if (Size < 10 + NameLen || Pos + Size > Data.size())
+      return false;
+   char const * const S = Data.data() + Pos;
+   if (memcmp(S, "Package: ", 9) != 0 || memcmp(S + 9, Name, NameLen) != 0 || S[9 + NameLen] != '\n')
+      return false;
+   // like pkgTagSection, the size includes only the first newline at the end
+   if (S[Size - 1] != '\n' || S[Size - 2] == '\n' || S[Size - 2] == '\r')
+      return false;
+   return Pos + Size == Data.size() || S[Size] == '\n' || S[Size] == '\r';
+}
+bool pkgCacheGenerator::ApplyStatusJournal(std::string const &JournalFile)
+{
+   APT::Trace::Phase const phase("pkgCacheGenerator::ApplyStatusJournal");
+   bool const Debug = _config->FindB("Debug::pkgCacheGen", false);
+
+   FileFd JournalFd;
+   if (JournalFd.Open(JournalFile, FileFd::ReadOnly) == false)
+      return false;
+   pkgTagFile JournalTags(&JournalFd);
+   pkgTagSection Journal;
+   if (JournalTags.Step(Journal) == false)
+      return false;
+
+   // the cache has to be built from the status file dpkg started with
+   std::string const StatusFile = Journal.FindS("File");
+   pkgCache::PkgFileIterator File = Cache.FileBegin();
+   for (; File.end() == false; ++File)
+      if (File.Flagged(pkgCache::Flag::NotSource) && File.FileName() != nullptr && StatusFile == File.FileName())
+	 break;
+   if (File.end() == true || File->Size != Journal.FindULL("Size-Before") ||
+       static_cast<unsigned long long>(File->mtime) != Journal.FindULL("Mtime-Before"))
+   {
+      if (Debug == true)
+	 std::clog << "Status journal doesn't belong to this cache" << std::endl;
+      return false;
+   }
+   map_pointer<pkgCache::PackageFile> const FilePtr = File.MapPointer();
+
+   // … and no one but dpkg has changed it since
+   FileFd Status;
+   if (Status.Open(StatusFile, FileFd::ReadOnly, FileFd::Extension) == false)
+      return false;
+   map_filesize_t const StatusSize = Status.FileSize();
+   time_t const StatusMtime = Status.ModificationTime();
+   if (StatusSize != Journal.FindULL("Size-After") ||
+       static_cast<unsigned long long>(StatusMtime) != Journal.FindULL("Mtime-After"))
+   {
+      if (Debug == true)
+	 std::clog << "Status file was changed after the journal was written" << std::endl;
+      return false;
+   }
+   std::string Content(StatusSize, '\0');
+   if (Status.Read(&Content[0], Content.size()) == false || Status.Seek(0) == false)
+      return false;
+
+   std::unordered_set<std::string> Touched;
+   std::vector<bool> TouchedGrp(Cache.HeaderP->GroupCount, false);
+   for (auto const &Name : VectorizeString(Journal.FindS("Packages"), ' '))
+   {
+      if (Name.empty() == true)
+	 continue;
+      Touched.insert(Name);
+      auto const Grp = Cache.FindGrp(Name);
+      if (Grp.end() == false)
+	 TouchedGrp[Grp->ID] = true;
+   }
+
+   struct Stanza
+   {
+      map_filesize_t Offset;
+      map_filesize_t Size;
+      map_pointer<pkgCache::VerFile> VerFile;
+      map_pointer<pkgCache::Version> Ver;
+      char const *Name;
+      map_filesize_t NewOffset;
+   };
+   std::vector<Stanza> Kept, Dropped;
+   std::vector<map_pointer<pkgCache::DescFile>> DescFiles;
+   std::vector<bool> SeenDesc(Cache.HeaderP->DescriptionCount, false);
+   for (auto Pkg = Cache.PkgBegin(); Pkg.end() == false; ++Pkg)
+   {
+      bool const IsTouched = TouchedGrp[Pkg.Group()->ID];
+      for (auto Ver = Pkg.VersionList(); Ver.end() == false; ++Ver)
+      {
+	 for (auto VF = Ver.FileList(); VF.end() == false; ++VF)
+	    if (VF->File == FilePtr)
+	       (IsTouched ? Dropped : Kept).push_back({VF->Offset, VF->Size, VF.MapPointer(), Ver.MapPointer(), Pkg.Name(), 0});
+	 for (auto Desc = Ver.DescriptionList(); Desc.end() == false; ++Desc)
+	 {
+	    if (SeenDesc[Desc->ID] == true)
+	       continue;
+	    SeenDesc[Desc->ID] = true;
+	    for (auto DF = Desc.FileList(); DF.end() == false; ++DF)
+	       if (DF->File == FilePtr)
+		  DescFiles.push_back(DF.MapPointer());
+	 }
+      }
+   }
+   std::sort(Kept.begin(), Kept.end(), [](Stanza const &A, Stanza const &B) { return A.Offset < B.Offset; });
+
+   /* dpkg keeps the order of the stanzas, so we expect to find the ones we
+      kept one after the other with the stanzas of touched packages and those
+      without a version (which have no entry we could move) in between */
+   debStatusJournalParser Parser(&Status);
+   APT::StringView const Data(Content);
+   std::vector<map_filesize_t> Merge;
+   auto K = Kept.begin();
+   for (map_filesize_t Pos = 0; Pos < Data.size();)
+   {
+      if (Data[Pos] == '\n' || Data[Pos] == '\r')
+      {
+	 ++Pos;
+	 continue;
+      }
+      if (K != Kept.end() && StanzaStartsAt(Data, Pos, K->Name, K->Size))
+      {
+	 map_filesize_t const Offset = K->Offset, Size = K->Size;
+	 for (; K != Kept.end() && K->Offset == Offset; ++K)
+	    K->NewOffset = Pos;
+	 Pos += Size;
+	 continue;
+      }
+      if (Parser.Jump(Pos) == false || Parser.Size() == 0)
+	 return false;
+      std::string const Name = Parser.Package();
+      if (Touched.find(Name) == Touched.end() && Parser.Version().empty() == false)
+      {
+	 if (Debug == true)
+	    std::clog << "Status journal misses the changed stanza of " << Name << " at " << Pos << std::endl;
+	 return false;
+      }
+      Merge.push_back(Pos);
+      Pos += Parser.Size();
+   }
+   if (K != Kept.end())
+   {
+      if (Debug == true)
+	 std::clog << "Status journal misses the removal of " << K->Name << std::endl;
+      return false;
+   }
+
+   std::unordered_map<map_filesize_t, std::pair<map_filesize_t, map_filesize_t>> Moved;
+   for (auto const &S : Kept)
+   {
+      (Cache.VerFileP + S.VerFile)->Offset = S.NewOffset;
+      Moved.emplace(S.Offset, std::make_pair(S.NewOffset, S.Size));
+   }
+   for (auto const &S : Dropped)
+   {
+      map_pointer<pkgCache::VerFile> *Last = &(Cache.VerP + S.Ver)->FileList;
+      while (*Last != nullptr && *Last != S.VerFile)
+	 Last = &(Cache.VerFileP + *Last)->NextFile;
+      if (unlikely(*Last == nullptr))
+	 return false;
+      *Last = (Cache.VerFileP + S.VerFile)->NextFile;
+      --Cache.HeaderP->VerFileCount;
+   }
+   for (auto const &Name : Touched)
+   {
+      auto const Grp = Cache.FindGrp(Name);
+      if (Grp.end() == true)
+	 continue;
+      for (auto Pkg = Grp.PackageList(); Pkg.end() == false; Pkg = Grp.NextPkg(Pkg))
+      {
+	 Pkg->CurrentVer = 0;
+	 Pkg->SelectedState = pkgCache::State::Unknown;
+	 Pkg->InstState = pkgCache::State::Ok;
+	 Pkg->CurrentState = pkgCache::State::NotInstalled;
+      }
+   }
+
+   size_t const MergeCount = Merge.size();
+   CurrentFile = Cache.PkgFileP + FilePtr;
+   Parser.Restrict(std::move(Merge));
+   bool const Merged = MergeList(Parser);
+   CurrentFile = nullptr;
+   if (Merged == false)
+      return false;
+
+   /* versions only known from the old status file would need to be removed,
+      which we can't do, so we have to build the cache in the usual way then */
+   for (auto const &S : Dropped)
+   {
+      pkgCache::VerIterator const Ver(Cache, Cache.VerP + S.Ver);
+      if (Ver->FileList == nullptr)
+      {
+	 if (Debug == true)
+	    std::clog << "Status journal would remove version " << Ver.VerStr() << " of " << Ver.ParentPkg().FullName() << std::endl;
+	 return false;
+      }
+      for (auto VF = Ver.FileList(); VF.end() == false; ++VF)
+	 if (VF->File == FilePtr)
+	    Moved.emplace(S.Offset, std::make_pair(VF->Offset, VF->Size));
+   }
+   for (auto const &DF : DescFiles)
+   {
+      auto const M = Moved.find((Cache.DescFileP + DF)->Offset);
+      if (M == Moved.end())
+	 return false;
+      (Cache.DescFileP + DF)->Offset = M->second.first;
+      (Cache.DescFileP + DF)->Size = M->second.second;
+   }
+
+   (Cache.PkgFileP + FilePtr)->Size = StatusSize;
+   (Cache.PkgFileP + FilePtr)->mtime = StatusMtime;
+   if (Debug == true)
+      std::clog << "Status journal moved " << Kept.size() << " and merged " << MergeCount << " stanzas" << std::endl;
+   return BuildGrpIndex();
 }
 									/*}}}*/
 // CacheGenerator::MakeStatusCache - Construct the status cache		/*{{{*/
@@ -1660,6 +2161,7 @@ bool pkgCacheGenerator::MakeStatusCache(pkgSourceList &List,OpProgress *Progress
 bool pkgCacheGenerator::MakeStatusCache(pkgSourceList &List,OpProgress *Progress,
 			MMap **OutMap,pkgCache **OutCache, bool)
 {
+   APT::Trace::Phase const phase("pkgCacheGenerator::MakeStatusCache");
    // FIXME: deprecate the ignored AllowMem parameter
    bool const Debug = _config->FindB("Debug::pkgCacheGen", false);
 
@@ -1700,6 +2202,36 @@ bool pkgCacheGenerator::MakeStatusCache(pkgSourceList &List,OpProgress *Progress
       srcpkgcache_fine = true;
    }
 
+   /* if only dpkg changed the status file since the cache was built, the
+      journal it left behind lets us update the cache in place */
+   std::string const JournalFile = _config->FindFile("Dir::Cache::status-journal");
+   if (pkgcache_fine == false && JournalFile.empty() == false && FileExists(JournalFile) == true)
+   {
+      if (CacheFile.IsOpen() == true && List.GetLastModifiedTime() <= CacheFile.ModificationTime() &&
+	  access(flNotFile(CacheFileName).c_str(), W_OK) == 0)
+      {
+	 std::unique_ptr<DynamicMMap> JMap;
+	 std::unique_ptr<pkgCacheGenerator> JGen;
+	 _error->PushToStack();
+	 bool const Applied = loadBackMMapFromFile(JGen, JMap, Progress, CacheFile) &&
+			      JGen->ApplyStatusJournal(JournalFile) &&
+			      writeBackMMapToFile(JGen.get(), JMap.get(), CacheFileName);
+	 _error->RevertToStack();
+	 JGen.reset();
+	 JMap.reset();
+	 CacheFile.Close();
+	 if (Applied == true && CheckValidity(CacheFile, CacheFileName, List, Files.begin(), Files.end(),
+					      volatile_fine ? OutMap : NULL, volatile_fine ? OutCache : NULL) == true)
+	 {
+	    if (Debug == true)
+	       std::clog << "pkgcache.bin was updated from the status journal" << std::endl;
+	    pkgcache_fine = true;
+	    srcpkgcache_fine = true;
+	 }
+      }
+      RemoveFile("MakeStatusCache", JournalFile);
+   }
+
    FileFd SrcCacheFile;
    if (pkgcache_fine == false)
    {
@@ -1816,6 +2348,7 @@ public:
 };
 bool pkgCacheGenerator::MakeOnlyStatusCache(OpProgress *Progress,DynamicMMap **OutMap)
 {
+   APT::Trace::Phase const phase("pkgCacheGenerator::MakeOnlyStatusCache");
    std::vector<pkgIndexFile *> Files;
    if (_system->AddStatusFiles(Files) == false)
       return false;
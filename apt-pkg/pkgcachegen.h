@@ -25,6 +25,7 @@
 #include <string>
 #include <vector>
 #if __cplusplus >= 201103L
+#include <unordered_map>
 #include <unordered_set>
 #endif
 #include <apt-pkg/string_view.h>
@@ -44,6 +45,7 @@ class APT_HIDDEN pkgCacheGenerator					/*{{{*/
    APT_HIDDEN map_stringitem_t WriteStringInMap(APT::StringView String) { return WriteStringInMap(String.data(), String.size()); };
    APT_HIDDEN map_stringitem_t WriteStringInMap(const char *String);
    APT_HIDDEN map_stringitem_t WriteStringInMap(const char *String, const unsigned long &Len);
+   APT_HIDDEN map_stringitem_t WriteVersionInMap(const char *String, const unsigned long &Len);
    APT_HIDDEN uint32_t AllocateInMap(const unsigned long &size);
    template<typename T> map_pointer<T> AllocateInMap() {
       return map_pointer<T>{AllocateInMap(sizeof(T))};
@@ -74,6 +76,49 @@ class APT_HIDDEN pkgCacheGenerator					/*{{{*/
    std::unordered_set<string_pointer, hash> strMixed;
    std::unordered_set<string_pointer, hash> strVersions;
    std::unordered_set<string_pointer, hash> strSections;
+
+   // DependencyData records are shared by all dependencies with the same target
+   struct depdata_key {
+      uint32_t Package;
+      uint32_t Version;
+      uint8_t Type;
+      uint8_t CompareOp;
+
+      bool operator ==(depdata_key const &other) const {
+	 return Package == other.Package && Version == other.Version &&
+	    Type == other.Type && CompareOp == other.CompareOp;
+      }
+   };
+   struct depdata_hash {
+      size_t operator()(depdata_key const &that) const {
+	 uint64_t const key = (uint64_t(that.Package) << 32) | that.Version;
+	 return (key ^ (uint64_t(that.Type) << 56) ^ (uint64_t(that.CompareOp) << 48)) * 0x9E3779B97F4A7C15ULL >> 16;
+      }
+   };
+   std::unordered_map<depdata_key, map_pointer<pkgCache::DependencyData>, depdata_hash> depDatas;
+   // packages of a loaded-back cache whose DependencyData chain is not yet in depDatas
+   std::vector<bool> depDatasPending;
+   APT_HIDDEN void IndexDependencyData(pkgCache::Package const * const Pkg);
+   // string pools of a loaded-back cache not yet filled from its structures
+   uint8_t stringPoolsPending = 0;
+
+   /* Versions with the same dependency fields get the same dependencies, so
+      the resolved targets of a complete list are kept to give them to later
+      versions without parsing and looking up the list again. */
+   struct depends_item {
+      map_pointer<pkgCache::Group> Group;
+      map_pointer<pkgCache::Package> Package;
+      map_stringitem_t Version;
+      // unset if the dependency is on all packages of the group
+      map_pointer<pkgCache::DependencyData> Data;
+      uint8_t Op;
+      uint8_t Type;
+   };
+   std::unordered_map<std::string, std::vector<depends_item>> dependsLists;
+   // the list of the version currently parsed
+   std::string dependsListKey;
+   std::vector<depends_item> dependsListItems;
+   bool dependsListRecording = false;
 #endif
 
    friend class pkgCacheListParser;
@@ -108,6 +153,7 @@ class APT_HIDDEN pkgCacheGenerator					/*{{{*/
    pkgCache::ReleaseFile *CurrentRlsFile;
    std::string PkgFileName;
    pkgCache::PackageFile *CurrentFile;
+   map_pointer<pkgCache::Header::GrpIndexEntry> GrpIndexSpace;
 
    bool NewGroup(pkgCache::GrpIterator &Grp, APT::StringView Name);
    bool NewPackage(pkgCache::PkgIterator &Pkg, APT::StringView Name, APT::StringView Arch);
@@ -120,6 +166,10 @@ class APT_HIDDEN pkgCacheGenerator					/*{{{*/
    bool NewDepends(pkgCache::PkgIterator &Pkg, pkgCache::VerIterator &Ver,
 		   map_stringitem_t const Version, uint8_t const Op,
 		   uint8_t const Type, map_pointer<pkgCache::Dependency>* &OldDepLast);
+   bool NewDepends(pkgCache::PkgIterator &Pkg, pkgCache::VerIterator &Ver,
+		   map_stringitem_t const Version, uint8_t const Op,
+		   uint8_t const Type, map_pointer<pkgCache::Dependency>* &OldDepLast,
+		   map_pointer<pkgCache::DependencyData> &DependencyData);
    bool NewProvides(pkgCache::VerIterator &Ver, pkgCache::PkgIterator &Pkg,
 		    map_stringitem_t const ProvidesVersion, uint8_t const Flags);
 
@@ -148,12 +198,14 @@ class APT_HIDDEN pkgCacheGenerator					/*{{{*/
 
    void ReMap(void const * const oldMap, void * const newMap, size_t oldSize);
    bool Start();
+   bool BuildGrpIndex();
 
    pkgCacheGenerator(DynamicMMap *Map,OpProgress *Progress);
    virtual ~pkgCacheGenerator();
 
    private:
    void * const d;
+   APT_HIDDEN void InsertIntoGrpIndex(uint32_t const Hash, map_pointer<pkgCache::Group> const Group);
    APT_HIDDEN bool MergeListGroup(ListParser &List, std::string const &GrpName);
    APT_HIDDEN bool MergeListPackage(ListParser &List, pkgCache::PkgIterator &Pkg);
    APT_HIDDEN bool MergeListVersion(ListParser &List, pkgCache::PkgIterator &Pkg,
@@ -165,6 +217,9 @@ class APT_HIDDEN pkgCacheGenerator					/*{{{*/
 
    APT_HIDDEN bool AddNewDescription(ListParser &List, pkgCache::VerIterator &Ver,
 	 std::string const &lang, APT::StringView CurMd5, map_stringitem_t &md5idx);
+
+   APT_HIDDEN bool ApplyStatusJournal(std::string const &JournalFile);
+   APT_HIDDEN void RestoreStringPool(StringType const type);
 };
 									/*}}}*/
 // This is the abstract package list parser class.			/*{{{*/
@@ -179,6 +234,11 @@ class APT_HIDDEN pkgCacheListParser
 
    void * const d;
 
+   bool NewDepends(pkgCache::VerIterator &Ver, pkgCache::GrpIterator &Grp,
+		   pkgCache::PkgIterator &Pkg, map_stringitem_t const Version,
+		   uint8_t const Op, uint8_t const Type,
+		   map_pointer<pkgCache::DependencyData> &Data);
+
    protected:
    inline bool NewGroup(pkgCache::GrpIterator &Grp, APT::StringView Name) { return Owner->NewGroup(Grp, Name); }
    inline map_stringitem_t StoreString(pkgCacheGenerator::StringType const type, const char *S,unsigned int Size) {return Owner->StoreString(type, S, Size);};
@@ -189,6 +249,14 @@ class APT_HIDDEN pkgCacheListParser
    bool NewDepends(pkgCache::VerIterator &Ver,APT::StringView Package, APT::StringView Arch,
 		   APT::StringView Version,uint8_t const Op,
 		   uint8_t const Type);
+   /** \brief the (emptied) buffer for the complete text of all dependency fields */
+   std::string &DependsList();
+   /** \brief gives Ver the dependencies of an earlier version with the same DependsList()
+    *
+    *  If the list is new, \b Known is set to false and the dependencies
+    *  added until EndDepends() is called are recorded for it instead. */
+   bool BeginDepends(pkgCache::VerIterator &Ver, bool &Known);
+   void EndDepends();
    bool NewProvides(pkgCache::VerIterator &Ver,APT::StringView PkgName,
 		    APT::StringView PkgArch, APT::StringView Version,
 		    uint8_t const Flags);
@@ -23,6 +23,7 @@
 #include <apt-pkg/policy.h>
 #include <apt-pkg/strutl.h>
 #include <apt-pkg/tagfile.h>
+#include <apt-pkg/trace.h>
 #include <apt-pkg/version.h>
 #include <apt-pkg/versionmatch.h>
 
@@ -54,6 +55,7 @@ struct pkgPolicy::Private
 pkgPolicy::pkgPolicy(pkgCache *Owner) : VerPins(nullptr),
 					PFPriority(nullptr), Cache(Owner), d(new Private)
 {
+   APT::Trace::Phase const phase("pkgPolicy");
    if (Owner == 0)
       return;
    PFPriority = new signed short[Owner->Head().PackageFileCount];
@@ -142,7 +144,6 @@ pkgCache::VerIterator pkgPolicy::GetCandidateVer(pkgCache::PkgIterator const &Pk
    pkgCache::VerIterator cand;
    pkgCache::VerIterator cur = Pkg.CurrentVer();
    int candPriority = -1;
-   pkgVersioningSystem *vs = Cache->VS;
 
    for (pkgCache::VerIterator ver = Pkg.VersionList(); ver.end() == false; ++ver) {
       int priority = GetPriority(ver, true);
@@ -152,7 +153,7 @@ pkgCache::VerIterator pkgPolicy::GetCandidateVer(pkgCache::PkgIterator const &Pk
 
       // TODO: Maybe optimize to not compare versions
       if (!cur.end() && priority < 1000
-	  && (vs->CmpVersion(ver.VerStr(), cur.VerStr()) < 0))
+	  && (Cache->CmpVersion(ver->VerStr, cur->VerStr) < 0))
 	 continue;
 
       candPriority = priority;
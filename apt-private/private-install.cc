@@ -251,7 +251,8 @@ bool InstallPackages(CacheFile &Cache, APT::PackageVector &HeldBackPackages, boo
    {
       // Display statistics
       auto const DebBytes = Fetcher.TotalNeeded();
-      if (DebBytes != Cache->DebSize())
+      // archives rebuilt from deltas need less than their size
+      if (DebBytes > Cache->DebSize())
       {
 	 c0out << "E: " << DebBytes << ',' << Cache->DebSize() << std::endl;
 	 c0out << "E: " << _("How odd... The sizes didn't match, email apt@packages.debian.org") << std::endl;
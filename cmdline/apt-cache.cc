@@ -175,6 +175,36 @@ static void ShowHashTableStats(char const *const Type,
    cout << "  Shortest: " << ShortestBucket << std::endl;
 }
 									/*}}}*/
+// ShowGrpIndexStats - Show stats about the group index			/*{{{*/
+static void ShowGrpIndexStats(pkgCache &Cache)
+{
+   auto const &Head = Cache.Head();
+   if (Head.GrpIndex == 0)
+   {
+      cout << "No GrpIndex" << std::endl;
+      return;
+   }
+   auto const Index = static_cast<pkgCache::Header::GrpIndexEntry *>(Cache.GetMap().Data()) + Head.GrpIndex;
+   uint32_t const Mask = Head.GrpIndexSize - 1;
+   unsigned long UsedSlots = 0;
+   unsigned long Probes = 0;
+   unsigned long LongestProbe = 0;
+   for (uint32_t i = 0; i < Head.GrpIndexSize; ++i)
+   {
+      if (Index[i].Group == 0)
+	 continue;
+      ++UsedSlots;
+      unsigned long const ThisProbe = ((i - Head.GrpIndexSlot(Index[i].Hash)) & Mask) + 1;
+      Probes += ThisProbe;
+      LongestProbe = std::max(ThisProbe, LongestProbe);
+   }
+   cout << "Total slots in GrpIndex: " << Head.GrpIndexSize << std::endl;
+   cout << "  Used: " << UsedSlots << std::endl;
+   cout << "  Utilization: " << 100.0 * UsedSlots / Head.GrpIndexSize << "%" << std::endl;
+   cout << "  Average probes: " << (UsedSlots == 0 ? 0 : Probes / (double)UsedSlots) << std::endl;
+   cout << "  Longest: " << LongestProbe << std::endl;
+}
+									/*}}}*/
 // Stats - Dump some nice statistics					/*{{{*/
 // ---------------------------------------------------------------------
 /* */
@@ -327,13 +357,15 @@ static bool Stats(CommandLine &CmdL)
       APT_CACHESIZE(VerFileCount, VerFileSz) +
       APT_CACHESIZE(DescFileCount, DescFileSz) +
       APT_CACHESIZE(ProvidesCount, ProvidesSz) +
-      (2 * Cache->Head().GetHashTableSize() * sizeof(map_id_t));
+      (2 * Cache->Head().GetHashTableSize() * sizeof(map_id_t)) +
+      (Cache->Head().GrpIndexSize * sizeof(pkgCache::Header::GrpIndexEntry));
    cout << _("Total space accounted for: ") << SizeToStr(Total) << endl;
 #undef APT_CACHESIZE
 
    // hashtable stats
    ShowHashTableStats<pkgCache::Package>("PkgHashTable", Cache->PkgP, Cache->Head().PkgHashTableP(), Cache->Head().GetHashTableSize(), PackageNext);
    ShowHashTableStats<pkgCache::Group>("GrpHashTable", Cache->GrpP, Cache->Head().GrpHashTableP(), Cache->Head().GetHashTableSize(), GroupNext);
+   ShowGrpIndexStats(*Cache);
 
    return true;
 }
@@ -622,6 +622,7 @@ static bool ShowHelp(CommandLine &)					/*{{{*/
       "Commands: packages binarypath [overridefile [pathprefix]]\n"
       "          sources srcpath [overridefile [pathprefix]]\n"
       "          contents path\n"
+      "          deltas deltapath binarypath...\n"
       "          release path\n"
       "          generate config [groups]\n"
       "          clean config\n"
@@ -714,6 +715,28 @@ static bool SimpleGenContents(CommandLine &CmdL)
    return true;
 }
 									/*}}}*/
+// SimpleGenDeltas - Generate deltas and their index			/*{{{*/
+// ---------------------------------------------------------------------
+/* */
+static bool SimpleGenDeltas(CommandLine &CmdL)
+{
+   if (CmdL.FileSize() < 3)
+      return ShowHelp(CmdL);
+
+   // Create a delta writer object.
+   DeltasWriter Deltas(NULL, _config->Find("APT::FTPArchive::DB"), CmdL.FileList[1],
+			_config->Find("APT::FTPArchive::Architecture"));
+   if (_error->PendingError() == true)
+      return false;
+
+   // Do recursive directory searching
+   for (unsigned I = 2; I != CmdL.FileSize(); ++I)
+      if (Deltas.RecursiveScan(CmdL.FileList[I]) == false)
+	 return false;
+
+   return Deltas.Finish();
+}
+									/*}}}*/
 // SimpleGenSources - Generate a Sources file for a directory tree	/*{{{*/
 // ---------------------------------------------------------------------
 /* This emulates dpkg-scanpackages's command line interface. 'mostly' */
@@ -1026,6 +1049,7 @@ static std::vector<aptDispatchWithHelp> GetCommands()			/*{{{*/
       {"packages",&SimpleGenPackages, nullptr},
       {"contents",&SimpleGenContents, nullptr},
       {"sources",&SimpleGenSources, nullptr},
+      {"deltas",&SimpleGenDeltas, nullptr},
       {"release",&SimpleGenRelease, nullptr},
       {"generate",&Generate, nullptr},
       {"clean",&Clean, nullptr},
@@ -1043,6 +1067,13 @@ int main(int argc, const char *argv[])					/*{{{*/
    Quiet = _config->FindI("quiet",0);
    InitOutput(clog.rdbuf());
 
+   // split xz files into blocks which clients can decompress in parallel
+   if (_config->Exists("APT::Compressor::xz::CompressArg") == false)
+   {
+      _config->Set("APT::Compressor::xz::CompressArg::", "-6");
+      _config->Set("APT::Compressor::xz::CompressArg::", "-T0");
+   }
+
    return DispatchCommandLine(CmdL, Cmds);
 }
 									/*}}}*/
@@ -13,8 +13,10 @@
 #include <config.h>
 
 #include <apt-pkg/configuration.h>
+#include <apt-pkg/debdelta.h>
 #include <apt-pkg/debfile.h>
 #include <apt-pkg/deblistparser.h>
+#include <apt-pkg/debversion.h>
 #include <apt-pkg/error.h>
 #include <apt-pkg/fileutl.h>
 #include <apt-pkg/gpgv.h>
@@ -977,6 +979,118 @@ bool ContentsWriter::ReadFromPkgs(string const &PkgFile,string const &PkgCompres
 
 									/*}}}*/
 
+// DeltasWriter::DeltasWriter - Constructor				/*{{{*/
+// ---------------------------------------------------------------------
+/* */
+DeltasWriter::DeltasWriter(FileFd * const GivenOutput, string const &DB,
+      string const &DeltaDir, string const &Arch, bool const IncludeArchAll) :
+		    FTWScanner(GivenOutput, Arch, IncludeArchAll), Db(DB), Stats(Db.Stats),
+		    DeltaDir(DeltaDir)
+{
+   SetExts(".deb");
+}
+									/*}}}*/
+// DeltasWriter::DoPackage - Remember the version of an archive		/*{{{*/
+// ---------------------------------------------------------------------
+/* The deltas can only be built once all versions of a package are known,
+   so this just collects them for Finish. */
+bool DeltasWriter::DoPackage(string FileName)
+{
+   if (!Db.GetFileInfo(FileName,
+	    true, /* DoControl */
+	    false, /* DoContents */
+	    false, /* GenContentsOnly */
+	    false, /* DoSource */
+	    0, /* DoHashes */
+	    false /* checkMtime */))
+   {
+      return false;
+   }
+
+   pkgTagSection &Tags = Db.Control.Section;
+   string const Package = Tags.FindS("Package");
+   string const Architecture = Tags.FindS("Architecture");
+   string const Version = Tags.FindS("Version");
+   if (Package.empty() || Architecture.empty() || Version.empty())
+      return _error->Error(_("Archive had no package field"));
+   Archives[std::make_pair(Package, Architecture)].push_back({Version, FileName});
+
+   return Db.Finish();
+}
+									/*}}}*/
+// DeltasWriter::Finish - Create the deltas and write the index		/*{{{*/
+// ---------------------------------------------------------------------
+/* Deltas are only created towards the newest version of a package and
+   existing deltas are reused, so running this again for a grown pool only
+   creates the deltas which are missing. Deltas which would not save
+   anything are not listed. */
+bool DeltasWriter::Finish()
+{
+   if (Archives.empty() == false && DirectoryExists(DeltaDir) == false &&
+       mkdir(DeltaDir.c_str(), 0755) != 0)
+      return _error->Errno("mkdir", _("Failed to create directory %s"), DeltaDir.c_str());
+
+   for (auto &&A : Archives)
+   {
+      auto const Newest = std::max_element(A.second.begin(), A.second.end(),
+	    [](Archive const &a, Archive const &b) {
+	       return debVS.CmpVersion(a.Version, b.Version) < 0;
+	    });
+      struct stat NewSt;
+      if (stat(Newest->FileName.c_str(), &NewSt) != 0)
+	 return _error->Errno("stat", _("Failed to stat %s"), Newest->FileName.c_str());
+
+      for (auto const &Old : A.second)
+      {
+	 if (debVS.CmpVersion(Old.Version, Newest->Version) >= 0)
+	    continue;
+
+	 auto const StripEpoch = [](string const &Ver) {
+	    auto const colon = Ver.find(':');
+	    return colon == string::npos ? Ver : Ver.substr(colon + 1);
+	 };
+	 string const Delta = flCombine(DeltaDir, A.first.first + '_' + StripEpoch(Old.Version) + '_' +
+				     StripEpoch(Newest->Version) + '_' + A.first.second + ".debdelta");
+	 if (FileExists(Delta) == false)
+	 {
+	    _error->PushToStack();
+	    bool const Created = debDelta::Create(Old.FileName, Newest->FileName, Delta);
+	    if (Created == false)
+	    {
+	       std::string Msg;
+	       _error->PopMessage(Msg);
+	       _error->RevertToStack();
+	       _error->Warning(_("Can't create delta from %s to %s: %s"),
+			       Old.FileName.c_str(), Newest->FileName.c_str(), Msg.c_str());
+	       continue;
+	    }
+	    _error->MergeWithStack();
+	 }
+
+	 FileFd Fd(Delta, FileFd::ReadOnly);
+	 if (Fd.IsOpen() == false)
+	    return false;
+	 unsigned long long const Size = Fd.FileSize();
+	 if (Size >= static_cast<unsigned long long>(NewSt.st_size))
+	    continue;
+	 Hashes Hash(Hashes::SHA256SUM);
+	 if (Hash.AddFD(Fd) == false)
+	    return false;
+	 Stats.Packages++;
+
+	 std::string out;
+	 strprintf(out, "Package: %s\nArchitecture: %s\nOld-Version: %s\nNew-Version: %s\n"
+		   "Filename: %s\nSize: %llu\nSHA256: %s\n\n",
+		   A.first.first.c_str(), A.first.second.c_str(), Old.Version.c_str(),
+		   Newest->Version.c_str(), Delta.c_str(), Size,
+		   Hash.GetHashString(Hashes::SHA256SUM).HashValue().c_str());
+	 Output->Write(out.c_str(), out.length());
+      }
+   }
+   return true;
+}
+									/*}}}*/
+
 // ReleaseWriter::ReleaseWriter - Constructor				/*{{{*/
 // ---------------------------------------------------------------------
 /* */
@@ -1004,6 +1118,8 @@ ReleaseWriter::ReleaseWriter(FileFd * const GivenOutput, string const &/*DB*/) :
       AddPattern("Sources.*");
       AddPattern("Release");
       AddPattern("Contents-*");
+      AddPattern("Deltas");
+      AddPattern("Deltas.*");
       AddPattern("Index");
       AddPattern("Index.*");
       AddPattern("icons-*.tar");
@@ -158,6 +158,31 @@ class ContentsWriter : public FTWScanner
    virtual ~ContentsWriter() {};
 };
 
+class DeltasWriter : public FTWScanner
+{
+   CacheDB Db;
+
+   struct Archive
+   {
+      string Version;
+      string FileName;
+   };
+   map<std::pair<string,string>,vector<Archive> > Archives;
+
+   public:
+
+   // General options
+   struct CacheDB::Stats &Stats;
+   string DeltaDir;
+
+   virtual bool DoPackage(string FileName) APT_OVERRIDE;
+   bool Finish();
+
+   DeltasWriter(FileFd * const Output, string const &DB, string const &DeltaDir,
+	 string const &Arch = string(), bool const IncludeArchAll = true);
+   virtual ~DeltasWriter() {};
+};
+
 class SourcesWriter : public FTWScanner
 {
    CacheDB Db;
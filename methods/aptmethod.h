@@ -3,6 +3,7 @@
 
 #include "config.h"
 
+#include <apt-pkg/acquire-local.h>
 #include <apt-pkg/acquire-method.h>
 #include <apt-pkg/configuration.h>
 #include <apt-pkg/error.h>
@@ -53,6 +54,7 @@ protected:
       BASE = (1 << 1),
       NETWORK = (1 << 2),
       DIRECTORY = (1 << 3),
+      THREADS = (1 << 4),
    };
 
    public:
@@ -144,6 +146,7 @@ protected:
       ALLOW(clock_nanosleep);
       ALLOW(clock_nanosleep_time64);
       ALLOW(close);
+      ALLOW(copy_file_range);
       ALLOW(creat);
       ALLOW(dup);
       ALLOW(dup2);
@@ -304,6 +307,17 @@ protected:
 	 ALLOW(getdents64);
       }
 
+      if ((SeccompFlags & Seccomp::THREADS) != 0)
+      {
+	 ALLOW(clone);
+#ifdef __NR_clone3
+	 ALLOW(clone3);
+#endif
+#ifdef __NR_rseq
+	 ALLOW(rseq);
+#endif
+      }
+
       if (getenv("FAKED_MODE"))
       {
 	 ALLOW(semop);
@@ -374,16 +388,6 @@ protected:
       return true;
    }
 
-   bool CalculateHashes(FetchItem const * const Itm, FetchResult &Res) const APT_NONNULL(2)
-   {
-      Hashes Hash(Itm->ExpectedHashes);
-      FileFd Fd;
-      if (Fd.Open(Res.Filename, FileFd::ReadOnly) == false || Hash.AddFD(Fd) == false)
-	 return false;
-      Res.TakeHashes(Hash);
-      return true;
-   }
-
    void Warning(std::string &&msg)
    {
       std::unordered_map<std::string, std::string> fields;
@@ -507,6 +511,56 @@ protected:
       }
    }
 };
+/** \brief a method implemented by APT::Internal::LocalFetcher
+ *
+ *  The fetcher is created on first use as the configuration it is based
+ *  on is only known after the worker sent it. */
+class APT_HIDDEN aptLocalMethod : public aptMethod
+{
+   std::unique_ptr<APT::Internal::LocalFetcher> Fetcher;
+
+   static void Convert(APT::Internal::LocalFetcher::Result const &From, FetchResult &To)
+   {
+      To.Filename = From.Filename;
+      To.Size = From.Size;
+      To.LastModified = From.LastModified;
+      To.IMSHit = From.IMSHit;
+      To.Hashes = From.Hashes;
+   }
+
+   protected:
+   virtual bool Fetch(FetchItem *Itm) APT_OVERRIDE
+   {
+      if (Fetcher == nullptr)
+      {
+	 Fetcher.reset(new APT::Internal::LocalFetcher(Binary, _config->FindB("Method::Compress", false)));
+	 Fetcher->Start = [this](APT::Internal::LocalFetcher::Result const &Res) {
+	    FetchResult R;
+	    Convert(Res, R);
+	    URIStart(R);
+	 };
+	 Fetcher->Done = [this](APT::Internal::LocalFetcher::Result const &Res, APT::Internal::LocalFetcher::Result const *Alt) {
+	    FetchResult R, A;
+	    Convert(Res, R);
+	    if (Alt != nullptr)
+	       Convert(*Alt, A);
+	    URIDone(R, Alt != nullptr ? &A : nullptr);
+	 };
+      }
+      APT::Internal::LocalFetcher::Item I;
+      I.Uri = Itm->Uri;
+      I.DestFile = Itm->DestFile;
+      I.LastModified = Itm->LastModified;
+      I.ExpectedHashes = Itm->ExpectedHashes;
+      return Fetcher->Fetch(I);
+   }
+
+   public:
+   aptLocalMethod(std::string &&Binary, char const *const Ver, unsigned long const Flags) APT_NONNULL(3)
+      : aptMethod(std::move(Binary), Ver, Flags)
+   {
+   }
+};
 class aptAuthConfMethod : public aptMethod
 {
    std::vector<std::unique_ptr<FileFd>> authconfs;
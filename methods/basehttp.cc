@@ -15,12 +15,15 @@
 #include <apt-pkg/fileutl.h>
 #include <apt-pkg/strutl.h>
 
+#include <algorithm>
+#include <array>
 #include <iostream>
 #include <limits>
 #include <map>
 #include <string>
 #include <vector>
 #include <ctype.h>
+#include <errno.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -271,6 +274,119 @@ bool RequestState::AddPartialFileToHashes(FileFd &File)			/*{{{*/
    return Server->GetHashes()->AddFD(File, StartPos);
 }
 									/*}}}*/
+// StreamDecompressor - Decompress the data while it arrives		/*{{{*/
+StreamDecompressor::StreamDecompressor(std::string Target, APT::Configuration::Compressor Compressor,
+				       HashStringList const &Expected) : Target(std::move(Target)), Compressor(std::move(Compressor)), Hash(Expected)
+{
+}
+bool StreamDecompressor::Start()
+{
+   if (pipe(Pipe) != 0)
+      return _error->Errno("pipe", "Failed to create decompression pipe");
+   SetCloseExec(Pipe[0], true);
+   SetCloseExec(Pipe[1], true);
+   // the read end belongs to In from now on
+   int const ReadEnd = Pipe[0];
+   Pipe[0] = -1;
+   if (In.OpenDescriptor(ReadEnd, FileFd::ReadOnly, Compressor, true) == false ||
+       (Target != "/dev/null" && Out.Open(Target, FileFd::WriteOnly | FileFd::Create | FileFd::Empty, FileFd::Extension) == false))
+   {
+      In.Close();
+      close(Pipe[1]);
+      Pipe[1] = -1;
+      return false;
+   }
+   Thread = std::thread(&StreamDecompressor::Decompress, this);
+   return true;
+}
+void StreamDecompressor::Decompress()
+{
+   std::array<unsigned char, APT_BUFFER_SIZE> Buffer;
+   while (true)
+   {
+      unsigned long long Actual = 0;
+      if (In.Read(Buffer.data(), Buffer.size(), &Actual) == false)
+      {
+	 Failed = true;
+	 break;
+      }
+      if (Actual == 0)
+	 break;
+      Hash.Add(Buffer.data(), Actual);
+      Size += Actual;
+      if (Out.IsOpen() && Out.Write(Buffer.data(), Actual) == false)
+      {
+	 Failed = true;
+	 break;
+      }
+   }
+   if (Out.IsOpen() && Out.Close() == false)
+      Failed = true;
+   // closing the pipe lets the writer know if nobody listens anymore
+   In.Close();
+   // the store method reports the errors if it has to take over
+   _error->Discard();
+}
+void StreamDecompressor::Add(unsigned char const * const Data, unsigned long long const Length)
+{
+   Fed += Length;
+   for (unsigned long long Written = 0; Failed == false && Written < Length;)
+   {
+      ssize_t const Res = write(Pipe[1], Data + Written, Length - Written);
+      if (Res < 0)
+      {
+	 if (errno == EINTR)
+	    continue;
+	 Failed = true;
+	 break;
+      }
+      Written += Res;
+   }
+}
+bool StreamDecompressor::AddFD(FileFd &File, unsigned long long const Length)
+{
+   std::array<unsigned char, APT_BUFFER_SIZE> Buffer;
+   for (unsigned long long Todo = Length; Todo != 0;)
+   {
+      unsigned long long Actual = 0;
+      if (File.Read(Buffer.data(), std::min<unsigned long long>(Todo, Buffer.size()), &Actual) == false)
+	 return false;
+      if (Actual == 0)
+	 return _error->Error("Unexpected end of file %s", File.Name().c_str());
+      Add(Buffer.data(), Actual);
+      Todo -= Actual;
+   }
+   return true;
+}
+bool StreamDecompressor::Stop()
+{
+   if (Pipe[1] != -1)
+   {
+      close(Pipe[1]);
+      Pipe[1] = -1;
+   }
+   if (Thread.joinable())
+      Thread.join();
+   // an empty file isn't a valid compressed archive
+   return Failed == false && Fed != 0;
+}
+bool StreamDecompressor::Finish(std::string &Filename, unsigned long long &Size, HashStringList &Hashes)
+{
+   if (Stop() == false)
+      return false;
+   Done = true;
+   Filename = Target;
+   Size = this->Size;
+   Hashes = Hash.GetHashStringList();
+   return true;
+}
+StreamDecompressor::~StreamDecompressor()
+{
+   Stop();
+   if (Done == false && Target != "/dev/null")
+      RemoveFile("StreamDecompressor", Target);
+}
+									/*}}}*/
 void ServerState::Reset()						/*{{{*/
 {
    Persistent = false;
@@ -472,6 +588,12 @@ BaseHttpMethod::DealWithHeaders(FetchResult &Res, RequestState &Req)
    return FILE_IS_OPEN;
 }
 									/*}}}*/
+// BaseHttpMethod::RunData - Transfer the data of the current request	/*{{{*/
+ResultState BaseHttpMethod::RunData(RequestState &Req)
+{
+   return Server->RunData(Req);
+}
+									/*}}}*/
 // BaseHttpMethod::SigTerm - Handle a fatal signal			/*{{{*/
 // ---------------------------------------------------------------------
 /* This closes and timestamps the open file. This is necessary to get
@@ -559,6 +681,79 @@ bool BaseHttpMethod::Fetch(FetchItem *)
       ++CurrentDepth;
    } while (CurrentDepth <= AllowedDepth && QueueBack != nullptr);
 
+   return true;
+}
+									/*}}}*/
+// BaseHttpMethod::URIAcquire - Note requests for decompression	/*{{{*/
+bool BaseHttpMethod::URIAcquire(std::string const &Message, FetchItem *Itm)
+{
+   std::string const Target = LookupTag(Message, "Decompress-To");
+   if (Target.empty())
+      DecompressRequests.erase(Itm->DestFile);
+   else
+   {
+      auto &Request = DecompressRequests[Itm->DestFile];
+      Request.Target = Target;
+      Request.ExpectedHashes = HashStringList();
+      for (char const *const *type = HashString::SupportedHashes(); *type != nullptr; ++type)
+      {
+	 std::string const hash = LookupTag(Message, (std::string("Decompress-Expected-") + *type).c_str());
+	 if (hash.empty() == false)
+	    Request.ExpectedHashes.push_back(HashString(*type, hash));
+      }
+   }
+   return aptAuthConfMethod::URIAcquire(Message, Itm);
+}
+									/*}}}*/
+// BaseHttpMethod::StartDecompress - Decompress the data as it arrives	/*{{{*/
+// ---------------------------------------------------------------------
+/* Only possible for complete downloads with a built-in decompressor as
+   the data has to be seen in order and the method can't run others. */
+bool BaseHttpMethod::StartDecompress(RequestState const &Req)
+{
+   Decompress.reset();
+   auto const Request = DecompressRequests.find(Queue->DestFile);
+   if (Request == DecompressRequests.end())
+      return false;
+   auto const Info = std::move(Request->second);
+   DecompressRequests.erase(Request);
+   if (Req.StartPos != 0)
+      return false;
+   std::string const Ext = '.' + flExtension(Queue->DestFile);
+   auto const Compressors = APT::Configuration::getCompressors();
+   auto const Compressor = std::find_if(Compressors.begin(), Compressors.end(), [&](auto const &C) {
+      return C.Extension == Ext;
+   });
+   if (Compressor == Compressors.end())
+      return false;
+   static char const * const BuiltIn[] = {
+#ifdef HAVE_ZLIB
+      "gzip",
+#endif
+#ifdef HAVE_BZ2
+      "bzip2",
+#endif
+#ifdef HAVE_LZMA
+      "xz", "lzma",
+#endif
+#ifdef HAVE_LZ4
+      "lz4",
+#endif
+#ifdef HAVE_ZSTD
+      "zstd",
+#endif
+   };
+   if (std::find(std::begin(BuiltIn), std::end(BuiltIn), Compressor->Name) == std::end(BuiltIn))
+      return false;
+
+   Decompress.reset(new StreamDecompressor(Info.Target, *Compressor, Info.ExpectedHashes));
+   if (Decompress->Start() == false)
+   {
+      _error->Discard();
+      Decompress.reset();
+      return false;
+   }
+   Server->SetDecompressor(Decompress.get());
    return true;
 }
 									/*}}}*/
@@ -689,6 +884,7 @@ int BaseHttpMethod::Loop()
 	 case FILE_IS_OPEN:
 	 {
 	    URIStart(Res);
+	    StartDecompress(Req);
 
 	    // Run the data
 	    ResultState Result = ResultState::SUCCESSFUL;
@@ -730,9 +926,11 @@ int BaseHttpMethod::Loop()
 		  }
 	       }
 	       if (Result == ResultState::SUCCESSFUL)
-		  Result = Server->RunData(Req);
+		  Result = RunData(Req);
 	    }
 
+	    Server->SetDecompressor(nullptr);
+
 	    /* If the server is sending back sizeless responses then fill in
 	       the size now */
 	    if (Res.Size == 0)
@@ -751,6 +949,7 @@ int BaseHttpMethod::Loop()
 	    // Send status to APT
 	    if (Result == ResultState::SUCCESSFUL)
 	    {
+	       FetchItem const * const Decompressed = Queue;
 	       Hashes * const resultHashes = Server->GetHashes();
 	       HashStringList const hashList = resultHashes->GetHashStringList();
 	       if (PipelineDepth != 0 && Queue->ExpectedHashes.usable() == true && Queue->ExpectedHashes != hashList)
@@ -787,7 +986,13 @@ int BaseHttpMethod::Loop()
 		  Server->PipelineAnswersReceived++;
 	       }
 	       Res.TakeHashes(*resultHashes);
-	       URIDone(Res);
+	       // a reordered queue means the decompressed data belongs to another item
+	       FetchResult AltRes;
+	       if (Decompress != nullptr && Queue == Decompressed && Decompress->Finish(AltRes.Filename, AltRes.Size, AltRes.Hashes) &&
+		   TransferModificationTimes(Queue->DestFile.c_str(), AltRes.Filename.c_str(), AltRes.LastModified))
+		  URIDone(Res, &AltRes);
+	       else
+		  URIDone(Res);
 	    }
 	    else
 	    {
@@ -811,6 +1016,7 @@ int BaseHttpMethod::Loop()
 		  break;
 	       }
 	    }
+	    Decompress.reset();
 	    break;
 	 }
 	 
@@ -12,12 +12,17 @@
 #define APT_SERVER_H
 
 #include "aptmethod.h"
+#include <apt-pkg/aptconfiguration.h>
 #include <apt-pkg/fileutl.h>
+#include <apt-pkg/hashes.h>
 #include <apt-pkg/strutl.h>
 
+#include <atomic>
 #include <iostream>
 #include <memory>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <time.h>
 
 using std::cout;
@@ -27,6 +32,44 @@ class Hashes;
 class BaseHttpMethod;
 struct ServerState;
 
+/** \brief Decompresses a download while it arrives
+ *
+ *  The compressed data is passed through a pipe to a thread which reads it
+ *  with the built-in decompressors of FileFd, hashes the result and writes
+ *  it to the target (if it isn't /dev/null), so that the acquire system
+ *  doesn't need to decompress the download again in the store method.
+ */
+class StreamDecompressor
+{
+   std::string const Target;
+   APT::Configuration::Compressor const Compressor;
+   Hashes Hash;
+   int Pipe[2] = {-1, -1};
+   FileFd In;
+   FileFd Out;
+   std::thread Thread;
+   std::atomic<bool> Failed{false};
+   unsigned long long Fed = 0;
+   unsigned long long Size = 0;
+   bool Done = false;
+
+   void Decompress();
+   bool Stop();
+
+   public:
+   bool Start();
+   void Add(unsigned char const * const Data, unsigned long long const Length);
+   bool AddFD(FileFd &File, unsigned long long const Length);
+   /** \brief Wait for the thread and describe the result
+    *
+    *  \return \b false if the data couldn't be decompressed
+    */
+   bool Finish(std::string &Filename, unsigned long long &Size, HashStringList &Hashes);
+
+   StreamDecompressor(std::string Target, APT::Configuration::Compressor Compressor, HashStringList const &Expected);
+   ~StreamDecompressor();
+};
+
 struct RequestState
 {
    unsigned int Major = 0;
@@ -106,6 +149,8 @@ struct ServerState
    virtual bool IsOpen() = 0;
    virtual bool Close() = 0;
    virtual bool InitHashes(HashStringList const &ExpectedHashes) = 0;
+   /** \brief Pass the data of the current request on to \b Decompress as well */
+   virtual void SetDecompressor(StreamDecompressor * const Decompress) = 0;
    virtual ResultState Die(RequestState &Req) = 0;
    virtual bool Flush(FileFd *const File, bool MustComplete = false) = 0;
    virtual ResultState Go(bool ToFile, RequestState &Req) = 0;
@@ -123,6 +168,17 @@ class BaseHttpMethod : public aptAuthConfMethod
    std::unique_ptr<ServerState> Server;
    std::string NextURI;
 
+   // requested via Decompress-To for the item with this DestFile
+   struct DecompressRequest
+   {
+      std::string Target;
+      HashStringList ExpectedHashes;
+   };
+   std::unordered_map<std::string, DecompressRequest> DecompressRequests;
+   std::unique_ptr<StreamDecompressor> Decompress;
+   bool StartDecompress(RequestState const &Req);
+   virtual bool URIAcquire(std::string const &Message, FetchItem *Itm) APT_OVERRIDE;
+
    bool AllowRedirect;
 
    // Find the biggest item in the fetch queue for the checking of the maximum
@@ -150,6 +206,8 @@ class BaseHttpMethod : public aptAuthConfMethod
    };
    /** \brief Handle the retrieved header data */
    virtual DealWithHeadersResult DealWithHeaders(FetchResult &Res, RequestState &Req);
+   /** \brief Transfer the data of the current request into its file */
+   virtual ResultState RunData(RequestState &Req);
 
    // In the event of a fatal signal this file will be closed and timestamped.
    static std::string FailFile;
@@ -49,6 +49,11 @@ static std::string LastService;
 static struct addrinfo *LastHostAddr = 0;
 static struct addrinfo *LastUsed = 0;
 
+// addresses from the cache, LastHostAddr points into them instead of a getaddrinfo() result
+static std::vector<struct addrinfo> CachedAddrs;
+static std::vector<struct sockaddr_storage> CachedSockAddrs;
+static time_t LastHostExpires = 0;
+
 static std::vector<SrvRec> SrvRecords;
 
 // Set of IP/hostnames that we timed out before or couldn't resolve
@@ -82,6 +87,125 @@ static bool ConnectionAllowed(char const * const Service, std::string const &Hos
 }
 									/*}}}*/
 
+// Connection cache - setup data kept between method runs		/*{{{*/
+/* Resolved addresses and TLS sessions are stored in files only the sandbox
+   user can access, so that frequent runs against the same hosts can skip
+   most of the connection setup. Failing to read or write them is no error. */
+static std::string ConnectionCacheFile(char const *const Type, std::string const &Key)
+{
+   std::string const Dir = flCombine(_config->FindDir("Dir::State"), "connections/");
+   if (DirectoryExists(Dir) == false)
+      return "";
+   return Dir + Type + '_' + QuoteString(Key, "/");
+}
+static void FreeAddresses()
+{
+   if (CachedAddrs.empty() == false)
+   {
+      CachedAddrs.clear();
+      CachedSockAddrs.clear();
+   }
+   else if (LastHostAddr != 0)
+      freeaddrinfo(LastHostAddr);
+   LastHostAddr = 0;
+   LastUsed = 0;
+}
+/* getaddrinfo() doesn't tell us the time to live of the records, so we
+   reuse them for a configurable time only and resolve again if none of
+   the cached addresses can be reached */
+static bool ReadCachedAddresses(std::string const &Host, std::string const &Service,
+				std::vector<std::pair<std::string, std::string>> &Addresses, time_t &Expires)
+{
+   if (_config->FindI("Acquire::Connect::Address-Cache", 0) <= 0)
+      return false;
+   std::string const File = ConnectionCacheFile("addresses", Host + ':' + Service);
+   if (File.empty() || RealFileExists(File) == false)
+      return false;
+
+   _error->PushToStack();
+   FileFd In(File, FileFd::ReadOnly);
+   std::string Line;
+   if (In.ReadLine(Line) && (Expires = strtoll(Line.c_str(), nullptr, 10)) > time(nullptr))
+      while (In.ReadLine(Line))
+      {
+	 auto const Space = Line.find(' ');
+	 if (Space != std::string::npos)
+	    Addresses.emplace_back(Line.substr(0, Space), Line.substr(Space + 1));
+      }
+   _error->RevertToStack();
+   return Addresses.empty() == false;
+}
+static bool LoadCachedAddresses(std::string const &Host, std::string const &Service, int const Family)
+{
+   std::vector<std::pair<std::string, std::string>> Addresses;
+   if (ReadCachedAddresses(Host, Service, Addresses, LastHostExpires) == false)
+      return false;
+
+   struct addrinfo Hints;
+   memset(&Hints, 0, sizeof(Hints));
+   Hints.ai_socktype = SOCK_STREAM;
+   Hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+   Hints.ai_family = Family;
+   CachedAddrs.reserve(Addresses.size());
+   CachedSockAddrs.reserve(Addresses.size());
+   for (auto const &A : Addresses)
+   {
+      struct addrinfo *Res = nullptr;
+      if (getaddrinfo(A.first.c_str(), A.second.c_str(), &Hints, &Res) != 0 || Res == nullptr)
+	 continue;
+      struct sockaddr_storage Addr;
+      memcpy(&Addr, Res->ai_addr, std::min<size_t>(Res->ai_addrlen, sizeof(Addr)));
+      CachedSockAddrs.push_back(Addr);
+      CachedAddrs.push_back(*Res);
+      CachedAddrs.back().ai_canonname = nullptr;
+      freeaddrinfo(Res);
+   }
+   if (CachedAddrs.empty())
+      return false;
+   for (size_t I = 0; I < CachedAddrs.size(); ++I)
+   {
+      CachedAddrs[I].ai_addr = reinterpret_cast<struct sockaddr *>(&CachedSockAddrs[I]);
+      CachedAddrs[I].ai_next = I + 1 < CachedAddrs.size() ? &CachedAddrs[I + 1] : nullptr;
+   }
+   LastHostAddr = CachedAddrs.data();
+   return true;
+}
+// the address we are connected to comes first for the next run
+static void StoreCachedAddresses(std::string const &Host, std::string const &Service)
+{
+   int const Lifetime = _config->FindI("Acquire::Connect::Address-Cache", 0);
+   if (Lifetime <= 0 || LastHostAddr == nullptr)
+      return;
+   if (CachedAddrs.empty() == false && (LastUsed == nullptr || LastUsed == LastHostAddr))
+      return;
+   std::string const File = ConnectionCacheFile("addresses", Host + ':' + Service);
+   if (File.empty())
+      return;
+   if (CachedAddrs.empty())
+      LastHostExpires = time(nullptr) + Lifetime;
+
+   std::string Content = std::to_string(LastHostExpires) + '\n';
+   auto const Start = LastUsed != nullptr ? LastUsed : LastHostAddr;
+   auto Addr = Start;
+   do
+   {
+      char Name[NI_MAXHOST];
+      char Port[NI_MAXSERV];
+      if (Addr->ai_family != AF_UNIX &&
+	  getnameinfo(Addr->ai_addr, Addr->ai_addrlen, Name, sizeof(Name), Port, sizeof(Port), NI_NUMERICHOST | NI_NUMERICSERV) == 0)
+	 Content.append(Name).append(" ").append(Port).append("\n");
+      Addr = Addr->ai_next != nullptr ? Addr->ai_next : LastHostAddr;
+   } while (Addr != Start);
+
+   _error->PushToStack();
+   FileFd Out(File, FileFd::WriteAtomic, 0600);
+   if (Out.Write(Content.data(), Content.size()) == false)
+      Out.OpFail();
+   Out.Close();
+   _error->RevertToStack();
+}
+									/*}}}*/
+
 // File Descriptor based Fd /*{{{*/
 struct FdFd : public MethodFd
 {
@@ -103,6 +227,10 @@ bool MethodFd::HasPending()
 {
    return false;
 }
+std::string MethodFd::Protocol()
+{
+   return "";
+}
 std::unique_ptr<MethodFd> MethodFd::FromFd(int iFd)
 {
    FdFd *fd = new FdFd();
@@ -342,6 +470,39 @@ static ResultState WaitAndCheckErrors(std::list<Connection> &Conns, std::unique_
    return Result;
 }
 									/*}}}*/
+// Connect to one of the addresses of the last host			/*{{{*/
+static ResultState ConnectToAddresses(std::string const &Host, std::string const &ServiceNameOrPort,
+				      std::unique_ptr<MethodFd> &Fd, unsigned long const TimeOut, aptMethod *const Owner)
+{
+   // When we have an IP rotation stay with the last IP.
+   auto Addresses = OrderAddresses(LastUsed != nullptr ? LastUsed : LastHostAddr);
+   std::list<Connection> Conns;
+   ResultState Result = ResultState::SUCCESSFUL;
+
+   for (auto Addr : Addresses)
+   {
+      Connection Conn(Addr, Host, Owner);
+      if (Conn.DoConnect() != ResultState::SUCCESSFUL)
+	 continue;
+
+      Conns.push_back(std::move(Conn));
+
+      Result = WaitAndCheckErrors(Conns, Fd, Owner->ConfigFindI("ConnectionAttemptDelayMsec", 250), false);
+
+      if (Result == ResultState::SUCCESSFUL)
+	 return ResultState::SUCCESSFUL;
+   }
+
+   if (!Conns.empty())
+      return WaitAndCheckErrors(Conns, Fd, TimeOut * 1000, true);
+   if (Result != ResultState::SUCCESSFUL)
+      return Result;
+   if (_error->PendingError() == true)
+      return ResultState::FATAL_ERROR;
+   _error->Error(_("Unable to connect to %s:%s:"), Host.c_str(), ServiceNameOrPort.c_str());
+   return ResultState::TRANSIENT_ERROR;
+}
+									/*}}}*/
 // Connect to a given Hostname						/*{{{*/
 static ResultState ConnectToHostname(std::string const &Host, int const Port,
 				     const char *const Service, int DefPort, std::unique_ptr<MethodFd> &Fd,
@@ -361,12 +522,7 @@ static ResultState ConnectToHostname(std::string const &Host, int const Port,
       Owner->Status(_("Connecting to %s"),Host.c_str());
 
       // Free the old address structure
-      if (LastHostAddr != 0)
-      {
-	 freeaddrinfo(LastHostAddr);
-	 LastHostAddr = 0;
-	 LastUsed = 0;
-      }
+      FreeAddresses();
       
       // We only understand SOCK_STREAM sockets.
       struct addrinfo Hints;
@@ -399,7 +555,7 @@ static ResultState ConnectToHostname(std::string const &Host, int const Port,
       }
 
       // Resolve both the host and service simultaneously
-      while (1)
+      while (LoadCachedAddresses(Host, ServiceNameOrPort, Hints.ai_family) == false)
       {
 	 int Res;
 	 if ((Res = getaddrinfo(Host.c_str(), ServiceNameOrPort.c_str(), &Hints, &LastHostAddr)) != 0 ||
@@ -441,33 +597,18 @@ static ResultState ConnectToHostname(std::string const &Host, int const Port,
       LastService = ServiceNameOrPort;
    }
 
-   // When we have an IP rotation stay with the last IP.
-   auto Addresses = OrderAddresses(LastUsed != nullptr ? LastUsed : LastHostAddr);
-   std::list<Connection> Conns;
-   ResultState Result = ResultState::SUCCESSFUL;
-
-   for (auto Addr : Addresses)
+   auto const Result = ConnectToAddresses(Host, ServiceNameOrPort, Fd, TimeOut, Owner);
+   if (Result == ResultState::SUCCESSFUL)
+      StoreCachedAddresses(Host, ServiceNameOrPort);
+   else if (CachedAddrs.empty() == false)
    {
-      Connection Conn(Addr, Host, Owner);
-      if (Conn.DoConnect() != ResultState::SUCCESSFUL)
-	 continue;
-
-      Conns.push_back(std::move(Conn));
-
-      Result = WaitAndCheckErrors(Conns, Fd, Owner->ConfigFindI("ConnectionAttemptDelayMsec", 250), false);
-
-      if (Result == ResultState::SUCCESSFUL)
-	 return ResultState::SUCCESSFUL;
+      // the cached addresses might be outdated, so try a real lookup
+      RemoveFile("ConnectToHostname", ConnectionCacheFile("addresses", Host + ':' + ServiceNameOrPort));
+      FreeAddresses();
+      LastHost.clear();
+      return ConnectToHostname(Host, Port, Service, DefPort, Fd, TimeOut, Owner);
    }
-
-   if (!Conns.empty())
-      return WaitAndCheckErrors(Conns, Fd, TimeOut * 1000, true);
-   if (Result != ResultState::SUCCESSFUL)
-      return Result;
-   if (_error->PendingError() == true)
-      return ResultState::FATAL_ERROR;
-   _error->Error(_("Unable to connect to %s:%s:"), Host.c_str(), ServiceNameOrPort.c_str());
-   return ResultState::TRANSIENT_ERROR;
+   return Result;
 }
 									/*}}}*/
 // Connect - Connect to a server					/*{{{*/
@@ -809,12 +950,57 @@ struct TlsFd : public MethodFd
    gnutls_certificate_credentials_t credentials;
    std::string hostname;
    unsigned long Timeout;
+   // where the session is stored for resumption by later runs, if at all
+   std::string SessionFile;
+   std::string SessionKey;
+   bool SessionStored = false;
 
    int Fd() APT_OVERRIDE { return UnderlyingFd->Fd(); }
 
    ssize_t Read(void *buf, size_t count) APT_OVERRIDE
    {
-      return HandleError(gnutls_record_recv(session, buf, count));
+      auto const Res = HandleError(gnutls_record_recv(session, buf, count));
+#if GNUTLS_VERSION_NUMBER >= 0x030605
+      // TLS 1.3 servers send tickets after the handshake
+      if (SessionStored == false && SessionFile.empty() == false &&
+	  (gnutls_session_get_flags(session) & GNUTLS_SFLAGS_SESSION_TICKET) != 0)
+      {
+	 int const olderrno = errno;
+	 StoreSession();
+	 errno = olderrno;
+      }
+#endif
+      return Res;
+   }
+
+   void LoadSession()
+   {
+      if (RealFileExists(SessionFile) == false)
+	 return;
+      _error->PushToStack();
+      FileFd In(SessionFile, FileFd::ReadOnly);
+      std::string Data(In.FileSize(), '\0');
+      if (In.Read(&Data[0], Data.size()) && Data.compare(0, SessionKey.size() + 1, SessionKey + '\n') == 0)
+      {
+	 Data.erase(0, SessionKey.size() + 1);
+	 gnutls_session_set_data(session, Data.data(), Data.size());
+      }
+      _error->RevertToStack();
+   }
+   void StoreSession()
+   {
+      SessionStored = true;
+      gnutls_datum_t Data;
+      if (gnutls_session_get_data2(session, &Data) < 0)
+	 return;
+      _error->PushToStack();
+      FileFd Out(SessionFile, FileFd::WriteAtomic, 0600);
+      if (Out.Write((SessionKey + '\n').c_str(), SessionKey.size() + 1) == false ||
+	  Out.Write(Data.data, Data.size) == false)
+	 Out.OpFail();
+      Out.Close();
+      _error->RevertToStack();
+      gnutls_free(Data.data);
    }
    ssize_t Write(void *buf, size_t count) APT_OVERRIDE
    {
@@ -891,10 +1077,21 @@ struct TlsFd : public MethodFd
    {
       return gnutls_record_check_pending(session) > 0;
    }
+
+   std::string Protocol() APT_OVERRIDE
+   {
+      gnutls_datum_t proto;
+      if (gnutls_alpn_get_selected_protocol(session, &proto) < 0)
+	 return "";
+      return std::string(reinterpret_cast<char const *>(proto.data), proto.size);
+   }
 };
 
-ResultState UnwrapTLS(std::string const &Host, std::unique_ptr<MethodFd> &Fd,
-		      unsigned long Timeout, aptMethod *Owner)
+/* The Protocols are offered to the server via ALPN in order of preference,
+   the one it picked can be queried with MethodFd::Protocol() */
+ResultState UnwrapTLS(std::string const &Host, int const Port, std::unique_ptr<MethodFd> &Fd,
+		      unsigned long Timeout, aptMethod *Owner,
+		      std::vector<std::string> const &Protocols)
 {
    if (_config->FindB("Acquire::AllowTLS", true) == false)
    {
@@ -1037,6 +1234,30 @@ ResultState UnwrapTLS(std::string const &Host, std::unique_ptr<MethodFd> &Fd,
       }
    }
 
+   if (Protocols.empty() == false)
+   {
+      std::vector<gnutls_datum_t> protos;
+      for (auto const &P : Protocols)
+	 protos.push_back({reinterpret_cast<unsigned char *>(const_cast<char *>(P.c_str())), static_cast<unsigned int>(P.length())});
+      if ((err = gnutls_alpn_set_protocols(tlsFd->session, protos.data(), protos.size(), 0)) < 0)
+      {
+	 _error->Error("Internal error: Could not set application protocols: %s", gnutls_strerror(err));
+	 return ResultState::FATAL_ERROR;
+      }
+   }
+
+   /* Resume the session of an earlier run if we have one for this server.
+      Only sessions with a verified peer are kept, so that resuming one
+      never skips a check a full handshake would have done. */
+   if (Owner->ConfigFindB("Session-Cache", true) && Owner->ConfigFindB("Verify-Peer", true) &&
+       Owner->ConfigFindB("Verify-Host", true))
+   {
+      tlsFd->SessionFile = ConnectionCacheFile("tls", Host + ':' + std::to_string(Port));
+      tlsFd->SessionKey = fileinfo + ' ' + cert + ' ' + key + ' ' + crlfile;
+      if (tlsFd->SessionFile.empty() == false)
+	 tlsFd->LoadSession();
+   }
+
    // Set the FD now, so closing it works reliably.
    tlsFd->UnderlyingFd = std::move(Fd);
    Fd.reset(tlsFd);
@@ -1047,6 +1268,16 @@ ResultState UnwrapTLS(std::string const &Host, std::unique_ptr<MethodFd> &Fd,
    if (err < 0)
       return ResultState::TRANSIENT_ERROR;
 
+   if (Owner->DebugEnabled())
+      std::clog << "TLS session with " << Host << (gnutls_session_is_resumed(tlsFd->session) ? " resumed" : " established") << std::endl;
+   if (tlsFd->SessionFile.empty() == false)
+   {
+#if GNUTLS_VERSION_NUMBER >= 0x030605
+      if (gnutls_protocol_get_version(tlsFd->session) != GNUTLS_TLS1_3)
+#endif
+	 tlsFd->StoreSession();
+   }
+
    return ResultState::SUCCESSFUL;
 }
 									/*}}}*/
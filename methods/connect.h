@@ -11,6 +11,7 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 #include <stddef.h>
 
 #include "aptmethod.h"
@@ -36,13 +37,16 @@ struct MethodFd
    static std::unique_ptr<MethodFd> FromFd(int iFd);
    /// \brief If there is pending data.
    virtual bool HasPending();
+   /// \brief The application protocol negotiated for the connection, if any
+   virtual std::string Protocol();
 };
 
 ResultState Connect(std::string To, int Port, const char *Service, int DefPort,
 		    std::unique_ptr<MethodFd> &Fd, unsigned long TimeOut, aptMethod *Owner);
 
 ResultState UnwrapSocks(std::string To, int Port, URI Proxy, std::unique_ptr<MethodFd> &Fd, unsigned long Timeout, aptMethod *Owner);
-ResultState UnwrapTLS(std::string const &To, std::unique_ptr<MethodFd> &Fd, unsigned long Timeout, aptMethod *Owner);
+ResultState UnwrapTLS(std::string const &To, int Port, std::unique_ptr<MethodFd> &Fd, unsigned long Timeout, aptMethod *Owner,
+		      std::vector<std::string> const &Protocols = {});
 
 void RotateDNS();
 
@@ -0,0 +1,78 @@
+// -*- mode: cpp; mode: fold -*-
+// Description								/*{{{*/
+/* ######################################################################
+
+   Debdelta method - Rebuilds an archive from the delta given as URI and
+   the files of the installed version of the package, which are expected
+   in Dir. The rebuilt archive is written to the destination file and its
+   hashes are reported, so that it is checked like a downloaded one.
+
+   ##################################################################### */
+									/*}}}*/
+// Include Files							/*{{{*/
+#include <config.h>
+
+#include "aptmethod.h"
+#include <apt-pkg/configuration.h>
+#include <apt-pkg/debdelta.h>
+#include <apt-pkg/error.h>
+#include <apt-pkg/fileutl.h>
+#include <apt-pkg/hashes.h>
+#include <apt-pkg/strutl.h>
+
+#include <iostream>
+#include <string>
+
+#include <sys/stat.h>
+
+#include <apti18n.h>
+									/*}}}*/
+
+class DebDeltaMethod : public aptMethod
+{
+   protected:
+   virtual bool URIAcquire(std::string const &, FetchItem *Itm) APT_OVERRIDE
+   {
+      URI Get(Itm->Uri);
+      std::string const Delta = DecodeSendURI(Get.Host + Get.Path); // debdelta:/path - no host
+      std::string const RootDir = _config->FindDir("Dir");
+
+      FetchResult Res;
+      Res.Filename = Itm->DestFile;
+      URIStart(Res);
+
+      if (DebugEnabled())
+	 std::clog << "Rebuilding " << Itm->DestFile << " from " << Delta
+		   << " and the files in " << RootDir << std::endl;
+      if (debDelta::Apply(Delta, RootDir, Itm->DestFile) == false)
+      {
+	 RemoveFile("debdelta", Itm->DestFile);
+	 return false;
+      }
+
+      Hashes Hash(Itm->ExpectedHashes);
+      FileFd Fd(Itm->DestFile, FileFd::ReadOnly);
+      if (Fd.IsOpen() == false || Hash.AddFD(Fd) == false)
+	 return false;
+      struct stat Buf;
+      if (fstat(Fd.Fd(), &Buf) != 0)
+	 return _error->Errno("fstat", _("Failed to stat %s"), Itm->DestFile.c_str());
+      Res.LastModified = Buf.st_mtime;
+      Res.Size = Buf.st_size;
+      Res.TakeHashes(Hash);
+      URIDone(Res);
+      return true;
+   }
+
+   public:
+   DebDeltaMethod() : aptMethod("debdelta", "1.0", SendConfig | SendURIEncoded)
+   {
+      // FileFd may use threads for compressing the data member again
+      SeccompFlags = aptMethod::BASE | aptMethod::THREADS;
+   }
+};
+
+int main()
+{
+   return DebDeltaMethod().Run();
+}
@@ -5,6 +5,7 @@
 #include <apt-pkg/error.h>
 #include <apt-pkg/fileutl.h>
 #include <apt-pkg/gpgv.h>
+#include <apt-pkg/hashes.h>
 #include <apt-pkg/strutl.h>
 
 #include <ctype.h>
@@ -13,6 +14,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -113,17 +115,33 @@ struct APT_HIDDEN SignersStorage {
    std::vector<std::string> Valid;
    std::vector<std::string> SignedBy;
 };
+struct Verification {
+   std::string File;
+   std::string Signature;
+   std::vector<std::string> KeyFpts;
+   std::vector<std::string> KeyFiles;
+   std::string CacheKey;
+   bool Cached = false;
+   pid_t Pid = -1;
+   FILE *Pipe = nullptr;
+   // the status lines of gpgv, either read from it or from the cache
+   std::vector<std::string> Status;
+   int ExitStatus = 0;
+};
 class GPGVMethod : public aptMethod
 {
    private:
-   string VerifyGetSigners(const char *file, const char *outfile,
-				vector<string> const &keyFpts,
-				vector<string> const &keyFiles,
-				SignersStorage &Signers);
+   std::map<FetchItem const *, Verification> Verifications;
+
+   bool StartVerification(Verification &V);
+   void StartVerifications();
+   bool FinishVerification(FetchItem *Itm);
+   string VerifyGetSigners(Verification &V, SignersStorage &Signers);
    protected:
    virtual bool URIAcquire(std::string const &Message, FetchItem *Itm) APT_OVERRIDE;
    public:
-   GPGVMethod() : aptMethod("gpgv", "1.1", SingleInstance | SendConfig | SendURIEncoded){};
+   int Loop();
+   GPGVMethod() : aptMethod("gpgv", "1.1", SingleInstance | Pipeline | SendConfig | SendURIEncoded){};
 };
 static void PushEntryWithKeyID(std::vector<std::string> &Signers, char * const buffer, bool const Debug)
 {
@@ -161,44 +179,180 @@ static void implodeVector(std::vector<std::string> const &vec, std::ostream &out
    out << *vec.rbegin();
    return;
 }
-string GPGVMethod::VerifyGetSigners(const char *file, const char *outfile,
-					 vector<string> const &keyFpts,
-					 vector<string> const &keyFiles,
-					 SignersStorage &Signers)
+// VerificationCacheKey - identify a verification for the result cache	/*{{{*/
+/* A result can be reused as long as the signed file, the keys which are
+   allowed to sign it and the keyrings apt-key would use are the same. */
+static std::string VerificationCacheKey(Verification const &V, std::string const &SignedBy)
 {
-   bool const Debug = DebugEnabled();
+   if (_config->FindI("Acquire::gpgv::Result-Cache", 0) <= 0)
+      return "";
 
-   if (Debug == true)
-      std::clog << "inside VerifyGetSigners" << std::endl;
+   std::vector<std::string> Keyrings = V.KeyFiles;
+   Keyrings.push_back(_config->FindFile("Dir::Etc::Trusted"));
+   _error->PushToStack();
+   for (auto &&part : GetListOfFilesInDir(_config->FindDir("Dir::Etc::TrustedParts"), std::vector<std::string>{"gpg", "asc"}, true))
+      Keyrings.push_back(std::move(part));
+   Keyrings.push_back(_config->Find("Dir::Bin::apt-key", CMAKE_INSTALL_FULL_BINDIR "/apt-key"));
+
+   Hashes Key(Hashes::SHA256SUM);
+   std::string Data = "Signed-By: " + SignedBy + '\n';
+   for (auto const &Opt : _config->FindVector("Acquire::gpgv::Options"))
+      Data.append("Option: ").append(Opt).append("\n");
+   for (auto const &Keyring : Keyrings)
+   {
+      struct stat St;
+      if (Keyring.empty() || stat(Keyring.c_str(), &St) != 0)
+	 continue;
+      strprintf(Data, "%sKeyring: %s %llu %lld.%09ld %llu\n", Data.c_str(), Keyring.c_str(),
+		static_cast<unsigned long long>(St.st_size), static_cast<long long>(St.st_mtim.tv_sec),
+		St.st_mtim.tv_nsec, static_cast<unsigned long long>(St.st_ino));
+   }
+   bool Okay = true;
+   for (auto const &File : {V.Signature, V.File})
+   {
+      FileFd Fd(File, FileFd::ReadOnly);
+      Hashes FileHash(Hashes::SHA256SUM);
+      if (Fd.IsOpen() == false || FileHash.AddFD(Fd) == false)
+      {
+	 Okay = false;
+	 break;
+      }
+      Data.append("File: ").append(FileHash.GetHashString(Hashes::SHA256SUM).HashValue()).append("\n");
+      if (V.Signature == V.File)
+	 break;
+   }
+   _error->RevertToStack();
+   if (Okay == false)
+      return "";
+   Key.Add(Data.c_str(), Data.length());
+   return Key.GetHashString(Hashes::SHA256SUM).HashValue();
+}
+									/*}}}*/
+// LoadCachedVerification - replay the gpgv output of an earlier run	/*{{{*/
+/* The entries are written by the acquire system as we run unprivileged:
+   we might otherwise be tricked into trusting entries written by another
+   method running as the same user. So we only accept entries owned by the
+   owner of the directory, which must not be writeable for others and be
+   either root or the user we run as. */
+static bool LoadCachedVerification(Verification &V)
+{
+   if (V.CacheKey.empty())
+      return false;
+   std::string const Dir = flCombine(_config->FindDir("Dir::State"), "signatures/");
+   std::string const File = Dir + V.CacheKey;
+   struct stat DirSt, St;
+   if (stat(Dir.c_str(), &DirSt) != 0 || stat(File.c_str(), &St) != 0)
+      return false;
+   if ((DirSt.st_uid != 0 && DirSt.st_uid != getuid()) || (DirSt.st_mode & (S_IWGRP | S_IWOTH)) != 0 ||
+       St.st_uid != DirSt.st_uid || S_ISREG(St.st_mode) == false)
+      return false;
+   if (St.st_mtime + _config->FindI("Acquire::gpgv::Result-Cache", 0) < time(nullptr))
+      return false;
 
+   _error->PushToStack();
+   FileFd In(File, FileFd::ReadOnly);
+   std::string Line;
+   std::vector<std::string> Status;
+   bool const Okay = In.ReadLine(Line) && Line == V.CacheKey;
+   if (Okay)
+      while (In.ReadLine(Line))
+	 if (Line.empty() == false)
+	    Status.push_back(Line + '\n');
+   _error->RevertToStack();
+   if (Okay == false || Status.empty())
+      return false;
+   V.Status = std::move(Status);
+   V.ExitStatus = 0;
+   V.Cached = true;
+   return true;
+}
+									/*}}}*/
+bool GPGVMethod::StartVerification(Verification &V)			/*{{{*/
+{
    int fd[2];
 
    if (pipe(fd) < 0)
-      return "Couldn't create pipe";
+      return _error->Errno("pipe", "Couldn't create pipe");
 
-   pid_t pid = fork();
-   if (pid < 0)
-      return string("Couldn't spawn new process") + strerror(errno);
-   else if (pid == 0)
+   V.Pid = fork();
+   if (V.Pid < 0)
+      return _error->Errno("fork", "Couldn't spawn new process");
+   else if (V.Pid == 0)
    {
       std::ostringstream keys;
-      implodeVector(keyFiles, keys, ",");
-      ExecGPGV(outfile, file, 3, fd, keys.str());
+      implodeVector(V.KeyFiles, keys, ",");
+      ExecGPGV(V.File, V.Signature, 3, fd, keys.str());
    }
    close(fd[1]);
+   SetCloseExec(fd[0], true);
 
-   FILE *pipein = fdopen(fd[0], "r");
+   V.Pipe = fdopen(fd[0], "r");
+   return true;
+}
+									/*}}}*/
+// GPGVMethod::StartVerifications - run gpgv for the queued items	/*{{{*/
+/* gpgv is started for as many items as configured while we wait for the
+   result of the first item in the queue */
+void GPGVMethod::StartVerifications()
+{
+   long const Max = std::max(1l, static_cast<long>(_config->FindI("Acquire::gpgv::Max-Parallel",
+#ifdef _SC_NPROCESSORS_ONLN
+	 sysconf(_SC_NPROCESSORS_ONLN)
+#else
+	 1
+#endif
+	 )));
+   long Running = std::count_if(Verifications.begin(), Verifications.end(), [](auto const &V) { return V.second.Pid != -1; });
+   for (FetchItem const *I = Queue; I != nullptr; I = I->Next)
+   {
+      auto const V = Verifications.find(I);
+      if (V == Verifications.end() || V->second.Cached || V->second.Pid != -1)
+	 continue;
+      if (Running >= Max && I != Queue)
+	 break;
+      if (StartVerification(V->second) == false)
+	 break;
+      ++Running;
+   }
+}
+									/*}}}*/
+string GPGVMethod::VerifyGetSigners(Verification &V, SignersStorage &Signers)
+{
+   bool const Debug = DebugEnabled();
+
+   if (Debug == true)
+      std::clog << "inside VerifyGetSigners" << std::endl;
 
+   if (V.Cached == false)
+   {
+      if (V.Pid == -1 && StartVerification(V) == false)
+	 return "Couldn't spawn new process";
+
+      size_t buffersize = 0;
+      char *buffer = NULL;
+      while (getline(&buffer, &buffersize, V.Pipe) != -1)
+	 V.Status.emplace_back(buffer);
+      fclose(V.Pipe);
+      free(buffer);
+      V.Pipe = nullptr;
+
+      int status;
+      waitpid(V.Pid, &status, 0);
+      V.Pid = -1;
+      V.ExitStatus = WIFEXITED(status) ? WEXITSTATUS(status) : 255;
+   }
+   else if (Debug == true)
+      std::clog << "Using cached result " << V.CacheKey << std::endl;
+
+   vector<string> const &keyFpts = V.KeyFpts;
    // Loop over the output of apt-key (which really is gnupg), and check the signatures.
    std::vector<std::string> ErrSigners;
    std::map<std::string, std::vector<std::string>> SubKeyMapping;
-   size_t buffersize = 0;
-   char *buffer = NULL;
    bool gotNODATA = false;
-   while (1)
+   for (auto const &Line : V.Status)
    {
-      if (getline(&buffer, &buffersize, pipein) == -1)
-	 break;
+      std::string Copy = Line;
+      char * const buffer = &Copy[0];
       if (Debug == true)
          std::clog << "Read: " << buffer << std::endl;
 
@@ -268,8 +422,6 @@ string GPGVMethod::VerifyGetSigners(const char *file, const char *outfile,
       else if (strncmp(buffer, APTKEYERROR, sizeof(APTKEYERROR)-1) == 0)
 	 _error->Error("%s", buffer + sizeof(APTKEYERROR));
    }
-   fclose(pipein);
-   free(buffer);
    std::move(ErrSigners.begin(), ErrSigners.end(), std::back_inserter(Signers.Worthless));
 
    // apt-key has a --keyid parameter, but this requires gpg, so we call it without it
@@ -350,11 +502,10 @@ string GPGVMethod::VerifyGetSigners(const char *file, const char *outfile,
    }
    std::sort(Signers.SignedBy.begin(), Signers.SignedBy.end());
 
-   int status;
-   waitpid(pid, &status, 0);
+   int const status = V.ExitStatus;
    if (Debug == true)
    {
-      ioprintf(std::clog, "gpgv exited with status %i\n", WEXITSTATUS(status));
+      ioprintf(std::clog, "gpgv exited with status %i\n", status);
    }
 
    if (Debug)
@@ -376,7 +527,7 @@ string GPGVMethod::VerifyGetSigners(const char *file, const char *outfile,
       std::cerr << std::endl << "  NODATA: " << (gotNODATA ? "yes" : "no") << std::endl;
    }
 
-   if (WEXITSTATUS(status) == 112)
+   if (status == 112)
    {
       // acquire system checks for "NODATA" to generate GPG errors (the others are only warnings)
       std::string errmsg;
@@ -392,7 +543,7 @@ string GPGVMethod::VerifyGetSigners(const char *file, const char *outfile,
       strprintf(errmsg, _("Signed file isn't valid, got '%s' (does the network require authentication?)"), "NODATA");
       return errmsg;
    }
-   else if (WEXITSTATUS(status) == 0)
+   else if (status == 0)
    {
       if (keyFpts.empty() == false)
       {
@@ -408,9 +559,9 @@ string GPGVMethod::VerifyGetSigners(const char *file, const char *outfile,
       }
       return "";
    }
-   else if (WEXITSTATUS(status) == 1)
+   else if (status == 1)
       return _("At least one invalid signature was encountered.");
-   else if (WEXITSTATUS(status) == 111)
+   else if (status == 111)
       return _("Could not execute 'apt-key' to verify signature (is gnupg installed?)");
    else
       return _("Unknown error executing apt-key");
@@ -419,18 +570,44 @@ string GPGVMethod::VerifyGetSigners(const char *file, const char *outfile,
 bool GPGVMethod::URIAcquire(std::string const &Message, FetchItem *Itm)
 {
    URI const Get(Itm->Uri);
-   std::string const Path = DecodeSendURI(Get.Host + Get.Path); // To account for relative paths
-   SignersStorage Signers;
+   Verification V;
+   V.Signature = DecodeSendURI(Get.Host + Get.Path); // To account for relative paths
+   V.File = Itm->DestFile;
 
-   std::vector<std::string> keyFpts, keyFiles;
-   for (auto &&key : VectorizeString(LookupTag(Message, "Signed-By"), ','))
+   std::string const SignedBy = LookupTag(Message, "Signed-By");
+   for (auto &&key : VectorizeString(SignedBy, ','))
       if (key.empty() == false && key[0] == '/')
-	 keyFiles.emplace_back(std::move(key));
+	 V.KeyFiles.emplace_back(std::move(key));
       else
-	 keyFpts.emplace_back(std::move(key));
+	 V.KeyFpts.emplace_back(std::move(key));
+
+   V.CacheKey = VerificationCacheKey(V, SignedBy);
+   LoadCachedVerification(V);
+   Verifications[Itm] = std::move(V);
+   // the verification is run by Loop() along with the other queued items
+   return true;
+}
+// CanBeCached - check if the status lines can be passed on		/*{{{*/
+static bool CanBeCached(std::vector<std::string> const &Status)
+{
+   return std::all_of(Status.begin(), Status.end(), [](std::string const &Line) {
+      return std::all_of(Line.begin(), Line.end(), [](unsigned char const c) {
+	 return c > 127 || (c > 31 && c < 127) || c == '\n' || c == '\t';
+      });
+   });
+}
+									/*}}}*/
+bool GPGVMethod::FinishVerification(FetchItem *Itm)
+{
+   auto const Found = Verifications.find(Itm);
+   if (Found == Verifications.end())
+      return _error->Error("Internal error: No verification for %s", Itm->Uri.c_str());
+   Verification V = std::move(Found->second);
+   Verifications.erase(Found);
+   SignersStorage Signers;
 
    // Run apt-key on file, extract contents and get the key ID of the signer
-   string const msg = VerifyGetSigners(Path.c_str(), Itm->DestFile.c_str(), keyFpts, keyFiles, Signers);
+   string const msg = VerifyGetSigners(V, Signers);
    if (_error->PendingError())
       return false;
 
@@ -509,6 +686,22 @@ bool GPGVMethod::URIAcquire(std::string const &Message, FetchItem *Itm)
 	 fields.emplace("GPGVOutput", out.str());
       }
    }
+   // we can't write to the cache ourselves, see LoadCachedVerification
+   if (V.Cached == false && V.CacheKey.empty() == false && msg.empty() && Signers.Bad.empty() &&
+       Signers.NoPubKey.empty() && CanBeCached(V.Status))
+   {
+      std::string Status;
+      for (auto const &Line : V.Status)
+      {
+	 auto const End = Line.find_last_not_of("\n");
+	 if (End != std::string::npos)
+	    Status.append(Line, 0, End + 1).append("\n");
+      }
+      if (Status.empty() == false)
+	 Status.pop_back();
+      fields.emplace("Signature-Cache-Key", V.CacheKey);
+      fields.emplace("Signature-Cache-Status", std::move(Status));
+   }
    SendMessage("201 URI Done", std::move(fields));
    Dequeue();
 
@@ -519,7 +712,30 @@ bool GPGVMethod::URIAcquire(std::string const &Message, FetchItem *Itm)
 }
 
 
+int GPGVMethod::Loop()
+{
+   while (true)
+   {
+      // We have no commands, wait for some to arrive
+      if (Queue == nullptr && WaitFd(STDIN_FILENO) == false)
+	 return 0;
+
+      /* Run messages, we can accept 0 (no message) if we didn't
+         do a WaitFd above.. Otherwise the FD is closed. */
+      int const Result = Run(true);
+      if (Result != -1 && (Result != 0 || Queue == nullptr))
+	 return Result;
+
+      if (Queue == nullptr)
+	 continue;
+
+      StartVerifications();
+      if (FinishVerification(Queue) == false)
+	 Fail();
+   }
+}
+
 int main()
 {
-   return GPGVMethod().Run();
+   return GPGVMethod().Loop();
 }
@@ -62,7 +62,7 @@ const unsigned int CircleBuf::BW_HZ=10;
 // ---------------------------------------------------------------------
 /* */
 CircleBuf::CircleBuf(HttpMethod const * const Owner, unsigned long long Size)
-   : Size(Size), Hash(NULL), TotalWriten(0)
+   : Size(Size), Hash(NULL), Decompress(nullptr), TotalWriten(0)
 {
    Buf = new unsigned char[Size];
    Reset();
@@ -218,6 +218,8 @@ bool CircleBuf::Write(std::unique_ptr<MethodFd> const &Fd)
 
       if (Hash != NULL)
 	 Hash->Add(Buf + (OutP%Size),Res);
+      if (Decompress != nullptr)
+	 Decompress->Add(Buf + (OutP%Size),Res);
       
       OutP += Res;
    }
@@ -518,7 +520,7 @@ ResultState HttpServerState::Open()
 	 return result;
       if (Host == Proxy.Host && Proxy.Access == "https")
       {
-	 result = UnwrapTLS(Proxy.Host, ServerFd, TimeOut, Owner);
+	 result = UnwrapTLS(Proxy.Host, Port, ServerFd, TimeOut, Owner);
 	 if (result != ResultState::SUCCESSFUL)
 	    return result;
       }
@@ -531,16 +533,74 @@ ResultState HttpServerState::Open()
    }
 
    if (tls)
-      return UnwrapTLS(ServerName.Host, ServerFd, TimeOut, Owner);
+   {
+      std::vector<std::string> Protocols;
+      if (Owner->ConfigFindB("HTTP2", false))
+	 Protocols = {"h2", "http/1.1"};
+      auto const result = UnwrapTLS(ServerName.Host, ServerName.Port == 0 ? DefaultPort : ServerName.Port, ServerFd, TimeOut, Owner, Protocols);
+      if (result != ResultState::SUCCESSFUL)
+	 return result;
+      if (ServerFd->Protocol() == "h2")
+	 StartHttp2(true);
+   }
+   // Without TLS we can only know the server talks HTTP/2 if we are told so,
+   // and a proxy expects the requests in HTTP/1.1
+   else if ((Proxy.Access == "socks5h" || Proxy.empty() == true || Proxy.Host.empty() == true) &&
+	    Owner->ConfigFindB("HTTP2-Prior-Knowledge", false))
+      StartHttp2(false);
 
    return ResultState::SUCCESSFUL;
 }
 									/*}}}*/
+// HttpServerState::StartHttp2 - Talk HTTP/2 on the new connection	/*{{{*/
+void HttpServerState::StartHttp2(bool const TLS)
+{
+   auto const Window = std::min(std::max(Owner->ConfigFindI("HTTP2-Window-Size", 4 * 1024 * 1024), 65535), INT32_MAX);
+   Http2.reset(new Http2Connection(TLS, Window));
+   Wire.reset(new CircleBuf(static_cast<HttpMethod *>(Owner), APT_BUFFER_SIZE));
+   Out.Read(Http2->TakeOutput());
+   // responses can't be mixed up as each has its own stream
+   PipelineAllowed = true;
+   Pipeline = true;
+   if (Owner->Debug == true)
+      clog << "Using HTTP/2 for " << ServerName.Host << endl;
+}
+									/*}}}*/
+// HttpServerState::ReceiveHttp2 - Process the data of the server	/*{{{*/
+bool HttpServerState::ReceiveHttp2()
+{
+   std::string Data;
+   while (Wire->WriteSpace() == true)
+   {
+      Wire->Write(Data);
+      if (Http2->Receive(Data) == false)
+	 return false;
+   }
+   TakeHttp2Response();
+   return true;
+}
+									/*}}}*/
+// HttpServerState::TakeHttp2Response - Fill In with the responses	/*{{{*/
+// ---------------------------------------------------------------------
+/* Returns true if data was added. Only as much as fits is taken as the
+   stream is held back by flow control for the rest. */
+bool HttpServerState::TakeHttp2Response()
+{
+   std::string Data;
+   Http2->Response(Data, In.FreeSpace());
+   Out.Read(Http2->TakeOutput());
+   if (Data.empty() == true)
+      return false;
+   return In.Read(Data);
+}
+									/*}}}*/
 // HttpServerState::Close - Close a connection to the server		/*{{{*/
 // ---------------------------------------------------------------------
 /* */
 bool HttpServerState::Close()
 {
+   Http2.reset();
+   Wire.reset();
    ServerFd->Close();
    return true;
 }
@@ -668,6 +728,12 @@ ResultState HttpServerState::LoadNextResponse(bool const ToFile, RequestState &R
 									/*}}}*/
 bool HttpServerState::WriteResponse(const std::string &Data)		/*{{{*/
 {
+   if (Http2 != nullptr)
+   {
+      if (Http2->Request(Data) == false)
+	 return false;
+      return Out.Read(Http2->TakeOutput());
+   }
    return Out.Read(Data);
 }
 									/*}}}*/
@@ -690,6 +756,11 @@ void HttpServerState::Reset()						/*{{{*/
 }
 									/*}}}*/
 
+void HttpServerState::SetDecompressor(StreamDecompressor * const Decompress)/*{{{*/
+{
+   In.Decompress = Decompress;
+}
+									/*}}}*/
 APT_PURE Hashes * HttpServerState::GetHashes()				/*{{{*/
 {
    return In.Hash;
@@ -771,6 +842,19 @@ ResultState HttpServerState::Go(bool ToFile, RequestState &Req)
    // read into a methodfd's buffer - the TCP queue might be empty at that
    // point.
    bool ServerPending = ServerFd->HasPending();
+   if (Http2 != nullptr)
+   {
+      // responses might wait for room in the buffer, which we don't have to
+      // wait for in select() then
+      if (In.ReadSpace() == true && TakeHttp2Response() == true)
+	 ServerPending = true;
+      uint32_t ErrorCode;
+      if (In.WriteSpace() == false && Http2->Failed(ErrorCode) == true)
+      {
+	 _error->Error("The HTTP/2 server closed the stream (error %u)", ErrorCode);
+	 return ResultState::TRANSIENT_ERROR;
+      }
+   }
 
    fd_set rfds,wfds;
    FD_ZERO(&rfds);
@@ -780,7 +864,7 @@ ResultState HttpServerState::Go(bool ToFile, RequestState &Req)
       be persisting */
    if (Out.WriteSpace() == true && ServerFd->Fd() != -1 && Persistent == true)
       FD_SET(ServerFd->Fd(), &wfds);
-   if (In.ReadSpace() == true && ServerFd->Fd() != -1)
+   if ((Http2 != nullptr ? Wire->ReadSpace() : In.ReadSpace()) == true && ServerFd->Fd() != -1)
       FD_SET(ServerFd->Fd(), &rfds);
 
    // Add the file. Note that we need to add the file to the select and
@@ -834,7 +918,14 @@ ResultState HttpServerState::Go(bool ToFile, RequestState &Req)
    if (ServerPending || (ServerFd->Fd() != -1 && FD_ISSET(ServerFd->Fd(), &rfds)))
    {
       errno = 0;
-      if (In.Read(ServerFd) == false)
+      if (Http2 != nullptr)
+      {
+	 if (Wire->Read(ServerFd) == false)
+	    return Die(Req);
+	 if (ReceiveHttp2() == false)
+	    return ResultState::TRANSIENT_ERROR;
+      }
+      else if (In.Read(ServerFd) == false)
 	 return Die(Req);
    }
 
@@ -875,6 +966,16 @@ ResultState HttpServerState::Go(bool ToFile, RequestState &Req)
 // ---------------------------------------------------------------------
 /* This places the http request in the outbound buffer */
 void HttpMethod::SendReq(FetchItem *Itm)
+{
+   Server->WriteResponse(BuildRequest(Itm, *Server, 0, 0));
+}
+									/*}}}*/
+// HttpMethod::BuildRequest - Build the HTTP request			/*{{{*/
+// ---------------------------------------------------------------------
+/* If RangeStart is given the file is requested from there on if it still
+   has the modification time IfRange instead of the rest of a partial file */
+std::string HttpMethod::BuildRequest(FetchItem *Itm, ServerState &Srv,
+				     unsigned long long const RangeStart, time_t const IfRange)
 {
    URI Uri(Itm->Uri);
    {
@@ -896,7 +997,7 @@ void HttpMethod::SendReq(FetchItem *Itm)
       but while its a must for all servers to accept absolute URIs,
       it is assumed clients will sent an absolute path for non-proxies */
    std::string requesturi;
-   if ((Server->Proxy.Access != "http" && Server->Proxy.Access != "https") || APT::String::Endswith(Uri.Access, "https") || Server->Proxy.empty() == true || Server->Proxy.Host.empty())
+   if ((Srv.Proxy.Access != "http" && Srv.Proxy.Access != "https") || APT::String::Endswith(Uri.Access, "https") || Srv.Proxy.empty() == true || Srv.Proxy.Host.empty())
       requesturi = Uri.Path;
    else
       requesturi = Uri;
@@ -938,16 +1039,19 @@ void HttpMethod::SendReq(FetchItem *Itm)
 
    // Check for a partial file and send if-queries accordingly
    struct stat SBuf;
-   if (Server->RangesAllowed && stat(Itm->DestFile.c_str(),&SBuf) >= 0 && SBuf.st_size > 0)
+   if (RangeStart != 0)
+      Req << "Range: bytes=" << std::to_string(RangeStart) << "-\r\n"
+	 << "If-Range: " << TimeRFC1123(IfRange, false) << "\r\n";
+   else if (Srv.RangesAllowed && stat(Itm->DestFile.c_str(),&SBuf) >= 0 && SBuf.st_size > 0)
       Req << "Range: bytes=" << std::to_string(SBuf.st_size) << "-\r\n"
 	 << "If-Range: " << TimeRFC1123(SBuf.st_mtime, false) << "\r\n";
    else if (Itm->LastModified != 0)
       Req << "If-Modified-Since: " << TimeRFC1123(Itm->LastModified, false).c_str() << "\r\n";
 
-   if ((Server->Proxy.Access == "http" || Server->Proxy.Access == "https") &&
-       (Server->Proxy.User.empty() == false || Server->Proxy.Password.empty() == false))
+   if ((Srv.Proxy.Access == "http" || Srv.Proxy.Access == "https") &&
+       (Srv.Proxy.User.empty() == false || Srv.Proxy.Password.empty() == false))
       Req << "Proxy-Authorization: Basic "
-	 << Base64Encode(Server->Proxy.User + ":" + Server->Proxy.Password) << "\r\n";
+	 << Base64Encode(Srv.Proxy.User + ":" + Srv.Proxy.Password) << "\r\n";
 
    MaybeAddAuthTo(Uri);
    if (Uri.User.empty() == false || Uri.Password.empty() == false)
@@ -984,7 +1088,7 @@ void HttpMethod::SendReq(FetchItem *Itm)
    if (Debug == true)
       cerr << Req.str() << endl;
 
-   Server->WriteResponse(Req.str());
+   return Req.str();
 }
 									/*}}}*/
 std::unique_ptr<ServerState> HttpMethod::CreateServerState(URI const &uri)/*{{{*/
@@ -1021,9 +1125,270 @@ BaseHttpMethod::DealWithHeadersResult HttpMethod::DealWithHeaders(FetchResult &R
    return FILE_IS_OPEN;
 }
 									/*}}}*/
+// HttpMethod::RunData - Transfer the data, maybe split in parts	/*{{{*/
+ResultState HttpMethod::RunData(RequestState &Req)
+{
+   auto const Connections = ConfigFindI("Split-Connections", 1);
+   auto const MinSize = ConfigFindI("Split-Size", 64 * 1024 * 1024);
+   if (Connections < 2 || MinSize < 0 || Server->RangesAllowed == false ||
+       Req.Encoding != RequestState::Stream || Req.JunkSize != 0 ||
+       Req.DownloadSize < static_cast<unsigned long long>(MinSize) ||
+       Req.StartPos + Req.DownloadSize != Req.TotalFileSize ||
+       (Req.MaximumSize != 0 && Req.DownloadSize > Req.MaximumSize) ||
+       Queue->ExpectedHashes.usable() == false ||
+       Queue->ExpectedHashes.FileSize() != Req.TotalFileSize)
+      return BaseHttpMethod::RunData(Req);
+   return RunDataSplit(Req, Connections);
+}
+									/*}}}*/
+// HttpMethod::RunDataSplit - Transfer the data over multiple connections /*{{{*/
+// ---------------------------------------------------------------------
+/* The connection we already have fetches the first part of the file while
+   additional connections to the server fetch the others, each written
+   directly to its place in the file. Every part is requested up to the end
+   of the file and cut short once the next part is underway, so if a
+   connection fails to start, the part before it just continues through it.
+   The file is hashed in order: the first part as it arrives, the others
+   once all parts are complete. */
+namespace
+{
+struct SplitPart
+{
+   enum { HEADERS, DATA, DONE, DEAD } State;
+   HttpServerState *Server;
+   RequestState *Req;
+   std::unique_ptr<HttpServerState> OwnedServer;
+   std::unique_ptr<RequestState> OwnedReq;
+   // the part of the file we get from this connection: [Start, End)
+   unsigned long long Start;
+   unsigned long long End;
+   // bytes written by the connection before this part started
+   unsigned long long Base;
+
+   unsigned long long Position() const { return Start + (Server->In.TotalWriten - Base); }
+   bool Alive() const { return State == DATA || State == DONE; }
+   void SetEnd(unsigned long long const NewEnd)
+   {
+      End = NewEnd;
+      Server->In.Limit(End - Position());
+   }
+};
+}
+ResultState HttpMethod::RunDataSplit(RequestState &Req, unsigned long long const Parts)
+{
+   unsigned long long const Total = Req.TotalFileSize;
+   unsigned long long const PartSize = Req.DownloadSize / Parts;
+   std::vector<SplitPart> parts(Parts);
+   {
+      auto &P = parts.front();
+      P.State = SplitPart::DATA;
+      P.Server = static_cast<HttpServerState *>(Server.get());
+      P.Req = &Req;
+      P.Start = Req.StartPos;
+      P.Base = P.Server->In.TotalWriten;
+      P.SetEnd(Total);
+      Req.State = RequestState::Data;
+   }
+   for (unsigned long long i = 1; i < Parts; ++i)
+   {
+      auto &P = parts[i];
+      P.State = SplitPart::DEAD;
+      P.OwnedServer.reset(new HttpServerState(Server->ServerName, this));
+      P.Server = P.OwnedServer.get();
+      P.OwnedReq.reset(new RequestState(this, P.Server));
+      P.Req = P.OwnedReq.get();
+      P.Start = Req.StartPos + i * PartSize;
+      P.End = Total;
+      P.Base = 0;
+      // this part is covered by the previous one if we can't get it
+      _error->PushToStack();
+      if (P.Server->Open() == ResultState::SUCCESSFUL)
+      {
+	 ServerState &Srv = *P.Server;
+	 Srv.WriteResponse(BuildRequest(Queue, Srv, P.Start, Req.Date));
+	 P.State = SplitPart::HEADERS;
+      }
+      _error->RevertToStack();
+   }
+   if (Debug == true)
+      clog << "Splitting " << Queue->Uri << " from " << Req.StartPos << " in " << Parts << " parts of " << PartSize << endl;
+
+   // on failure keep only the data we can resume from
+   auto const Abort = [&](ResultState const Result) {
+      unsigned long long Contiguous = parts.front().Position();
+      for (auto const &P : parts)
+      {
+	 if (&P == &parts.front() || P.Alive() == false)
+	    continue;
+	 if (P.Start != Contiguous)
+	    break;
+	 Contiguous = P.Position();
+      }
+      Req.File.Truncate(Contiguous);
+      return Result;
+   };
+   auto const Lost = [](SplitPart &P) {
+      if (P.State == SplitPart::HEADERS)
+      {
+	 P.State = SplitPart::DEAD;
+	 P.Server->Close();
+	 return false;
+      }
+      return true;
+   };
+
+   bool const DependOnSTDIN = ConfigFindB("DependOnSTDIN", true);
+   while (true)
+   {
+      fd_set rfds, wfds;
+      FD_ZERO(&rfds);
+      FD_ZERO(&wfds);
+      // parts still waiting for an answer are of no use without a running part
+      if (std::none_of(parts.begin(), parts.end(), [](SplitPart const &P) { return P.State == SplitPart::DATA; }))
+	 break;
+      int MaxFd = -1;
+      bool Pending = false;
+      for (auto const &P : parts)
+      {
+	 if (P.State != SplitPart::HEADERS && P.State != SplitPart::DATA)
+	    continue;
+	 int const Fd = P.Server->ServerFd->Fd();
+	 if (P.Server->Out.WriteSpace() == true)
+	    FD_SET(Fd, &wfds);
+	 if (P.Server->In.ReadSpace() == true)
+	    FD_SET(Fd, &rfds);
+	 if (P.Server->ServerFd->HasPending())
+	    Pending = true;
+	 MaxFd = std::max(MaxFd, Fd);
+      }
+      if (DependOnSTDIN == true)
+	 FD_SET(STDIN_FILENO, &rfds);
+
+      struct timeval tv;
+      tv.tv_sec = Pending ? 0 : Server->TimeOut;
+      tv.tv_usec = 0;
+      int const Res = select(MaxFd + 1, &rfds, &wfds, nullptr, &tv);
+      if (Res < 0)
+      {
+	 if (errno == EINTR)
+	    continue;
+	 _error->Errno("select", _("Select failed"));
+	 return Abort(ResultState::TRANSIENT_ERROR);
+      }
+      if (Res == 0 && Pending == false)
+      {
+	 bool Failed = false;
+	 for (auto &P : parts)
+	    if (P.State == SplitPart::DATA || P.State == SplitPart::HEADERS)
+	       Failed |= Lost(P);
+	 if (Failed == false)
+	    continue;
+	 _error->Error(_("Connection timed out"));
+	 return Abort(ResultState::TRANSIENT_ERROR);
+      }
+
+      for (size_t i = 0; i < parts.size(); ++i)
+      {
+	 auto &P = parts[i];
+	 if (P.State != SplitPart::HEADERS && P.State != SplitPart::DATA)
+	    continue;
+	 int const Fd = P.Server->ServerFd->Fd();
+	 bool Closed = false;
+	 if (FD_ISSET(Fd, &wfds) && P.Server->Out.Write(P.Server->ServerFd) == false)
+	    Closed = true;
+	 if ((P.Server->ServerFd->HasPending() || FD_ISSET(Fd, &rfds)) &&
+	     P.Server->In.Read(P.Server->ServerFd) == false)
+	    Closed = true;
+
+	 if (P.State == SplitPart::HEADERS)
+	 {
+	    std::string Data;
+	    if (P.Server->In.WriteTillEl(Data) == false)
+	    {
+	       if (Closed)
+		  Lost(P);
+	       continue;
+	    }
+	    if (Debug == true)
+	       clog << "Answer for part " << i << " of " << Queue->Uri << endl << Data;
+	    bool HeadersOkay = true;
+	    for (auto const &Line : VectorizeString(Data, '\n'))
+	       if (P.Req->HeaderLine(APT::String::Strip(Line)) == false)
+		  HeadersOkay = false;
+	    // the previous alive part has to still be before us
+	    auto Prev = std::find_if(parts.rbegin() + (parts.size() - i), parts.rend(),
+				     [](SplitPart const &O) { return O.Alive(); });
+	    if (HeadersOkay == false || P.Req->Result != 206 || P.Req->StartPos != P.Start ||
+		P.Req->TotalFileSize != Total || P.Req->Encoding == RequestState::Chunked ||
+		Prev->State != SplitPart::DATA || Prev->Position() >= P.Start ||
+		P.Req->File.Open(Queue->DestFile, FileFd::WriteOnly) == false ||
+		P.Req->File.Seek(P.Start) == false)
+	    {
+	       _error->Discard();
+	       Lost(P);
+	       continue;
+	    }
+	    auto const Next = std::find_if(parts.begin() + i + 1, parts.end(),
+					   [](SplitPart const &O) { return O.Alive(); });
+	    P.State = SplitPart::DATA;
+	    P.Req->State = RequestState::Data;
+	    P.Base = P.Server->In.TotalWriten;
+	    P.SetEnd(Next == parts.end() ? Total : Next->Start);
+	    Prev->SetEnd(P.Start);
+	 }
+
+	 if (P.State == SplitPart::DATA)
+	 {
+	    if (P.Server->In.WriteSpace() == true &&
+		P.Server->In.Write(MethodFd::FromFd(P.Req->File.Fd())) == false)
+	    {
+	       _error->Errno("write", _("Error writing to file"));
+	       return Abort(ResultState::FATAL_ERROR);
+	    }
+	    if (P.Server->In.IsLimit() == true)
+	    {
+	       P.State = SplitPart::DONE;
+	       if (P.End != Total)
+		  P.Server->Close();
+	    }
+	    else if (Closed == true)
+	    {
+	       _error->Error(_("Error reading from server. Remote end closed connection"));
+	       return Abort(ResultState::TRANSIENT_ERROR);
+	    }
+	 }
+      }
+
+      if (DependOnSTDIN == true && FD_ISSET(STDIN_FILENO, &rfds))
+      {
+	 if (Run(true) != -1)
+	    exit(100);
+      }
+   }
+
+   // the first part was hashed (and decompressed) while it arrived
+   auto const &First = parts.front();
+   if (First.End != Total)
+   {
+      FileFd File(Queue->DestFile, FileFd::ReadOnly);
+      if (File.Seek(First.End) == false || Server->GetHashes()->AddFD(File, Total - First.End) == false)
+      {
+	 _error->Errno("read", _("Problem hashing file"));
+	 return ResultState::FATAL_ERROR;
+      }
+      if (Decompress != nullptr && (File.Seek(First.End) == false || Decompress->AddFD(File, Total - First.End) == false))
+      {
+	 _error->Discard();
+	 Decompress.reset();
+      }
+   }
+   return ResultState::SUCCESSFUL;
+}
+									/*}}}*/
 HttpMethod::HttpMethod(std::string &&pProg) : BaseHttpMethod(std::move(pProg), "1.2", Pipeline | SendConfig | SendURIEncoded) /*{{{*/
 {
-   SeccompFlags = aptMethod::BASE | aptMethod::NETWORK;
+   // decompressing downloads on the fly happens in a thread
+   SeccompFlags = aptMethod::BASE | aptMethod::NETWORK | aptMethod::THREADS;
 
    auto addName = std::inserter(methodNames, methodNames.begin());
    if (Binary != "http")
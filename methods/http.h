@@ -20,6 +20,7 @@
 
 #include "basehttp.h"
 #include "connect.h"
+#include "http2.h"
 
 using std::cout;
 using std::endl;
@@ -63,6 +64,7 @@ class CircleBuf
 
    public:
    Hashes *Hash;
+   StreamDecompressor *Decompress;
    // total amount of data that got written so far
    unsigned long long TotalWriten;
 
@@ -82,6 +84,7 @@ class CircleBuf
 
    // Test for free space in the buffer
    bool ReadSpace() const {return Size - (InP - OutP) > 0;};
+   unsigned long long FreeSpace() const {return Size - (InP - OutP);};
    bool WriteSpace() const {return InP - OutP > 0;};
 
    void Reset();
@@ -96,11 +99,18 @@ struct HttpServerState: public ServerState
    CircleBuf In;
    CircleBuf Out;
    std::unique_ptr<MethodFd> ServerFd;
+   // If the connection speaks HTTP/2 the data from the server is received
+   // in Wire and the responses are put into In in HTTP/1.1 form
+   std::unique_ptr<Http2Connection> Http2;
+   std::unique_ptr<CircleBuf> Wire;
 
    protected:
    virtual bool ReadHeaderLines(std::string &Data) APT_OVERRIDE;
    virtual ResultState LoadNextResponse(bool const ToFile, RequestState &Req) APT_OVERRIDE;
    virtual bool WriteResponse(std::string const &Data) APT_OVERRIDE;
+   void StartHttp2(bool const TLS);
+   bool ReceiveHttp2();
+   bool TakeHttp2Response();
 
    public:
    virtual void Reset() APT_OVERRIDE;
@@ -112,6 +122,7 @@ struct HttpServerState: public ServerState
    virtual bool IsOpen() APT_OVERRIDE;
    virtual bool Close() APT_OVERRIDE;
    virtual bool InitHashes(HashStringList const &ExpectedHashes) APT_OVERRIDE;
+   virtual void SetDecompressor(StreamDecompressor * const Decompress) APT_OVERRIDE;
    virtual Hashes * GetHashes() APT_OVERRIDE;
    virtual ResultState Die(RequestState &Req) APT_OVERRIDE;
    virtual bool Flush(FileFd *const File, bool MustComplete = true) APT_OVERRIDE;
@@ -129,10 +140,15 @@ class HttpMethod : public BaseHttpMethod
    virtual std::unique_ptr<ServerState> CreateServerState(URI const &uri) APT_OVERRIDE;
    virtual void RotateDNS() APT_OVERRIDE;
    virtual DealWithHeadersResult DealWithHeaders(FetchResult &Res, RequestState &Req) APT_OVERRIDE;
+   virtual ResultState RunData(RequestState &Req) APT_OVERRIDE;
 
    protected:
    std::string AutoDetectProxyCmd;
 
+   std::string BuildRequest(FetchItem *Itm, ServerState &Srv,
+			    unsigned long long const RangeStart, time_t const IfRange);
+   ResultState RunDataSplit(RequestState &Req, unsigned long long const Parts);
+
    public:
    friend struct HttpServerState;
 
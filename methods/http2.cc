@@ -0,0 +1,869 @@
+// -*- mode: cpp; mode: fold -*-
+// Description								/*{{{*/
+/* ######################################################################
+
+   HTTP/2 framing for the HTTP method - RFC 7540 and RFC 7541 (HPACK)
+
+   Only what a client fetching files needs is implemented: requests are
+   sent as header blocks without any compression state, responses are
+   decoded with the full HPACK decoder as servers make use of it, and
+   server push is disabled.
+
+   Each stream may buffer up to the window size announced in our SETTINGS
+   before the server has to wait for us to take the data. As the method
+   handles one response after the other, the streams behind it are filled
+   up to this point while the current one is written to disk, so small
+   files are usually complete once it is their turn. The connection window
+   is credited as data arrives as the per-stream windows already bound the
+   amount of data we buffer. Until the SETTINGS of the server arrive only
+   one stream is opened, as the server may allow fewer than we would open.
+
+   ##################################################################### */
+									/*}}}*/
+// Include Files							/*{{{*/
+#include <config.h>
+
+#include <apt-pkg/error.h>
+#include <apt-pkg/strutl.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "http2.h"
+									/*}}}*/
+
+namespace
+{
+// Frame layer - RFC 7540 §4 and §6					/*{{{*/
+constexpr char const ConnectionPreface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+constexpr uint32_t ConnectionWindow = 1u << 30;
+constexpr uint32_t DefaultWindow = 65535;
+// the default SETTINGS_MAX_FRAME_SIZE which we do not change
+constexpr uint32_t MaxFrameSize = 16384;
+// each stream may buffer up to our window size, so we open at most this
+// many at once even if the server would handle more
+constexpr uint32_t MaxConcurrentStreams = 100;
+
+enum FrameType : uint8_t
+{
+   DATA = 0x0,
+   HEADERS = 0x1,
+   PRIORITY = 0x2,
+   RST_STREAM = 0x3,
+   SETTINGS = 0x4,
+   PUSH_PROMISE = 0x5,
+   PING = 0x6,
+   GOAWAY = 0x7,
+   WINDOW_UPDATE = 0x8,
+   CONTINUATION = 0x9,
+};
+enum FrameFlags : uint8_t
+{
+   FLAG_ACK = 0x1,
+   FLAG_END_STREAM = 0x1,
+   FLAG_END_HEADERS = 0x4,
+   FLAG_PADDED = 0x8,
+   FLAG_PRIORITY = 0x20,
+};
+enum ErrorCodes : uint32_t
+{
+   PROTOCOL_ERROR = 0x1,
+   FRAME_SIZE_ERROR = 0x6,
+   REFUSED_STREAM = 0x7,
+   COMPRESSION_ERROR = 0x9,
+};
+enum SettingsParameters : uint16_t
+{
+   SETTINGS_ENABLE_PUSH = 0x2,
+   SETTINGS_MAX_CONCURRENT_STREAMS = 0x3,
+   SETTINGS_INITIAL_WINDOW_SIZE = 0x4,
+};
+
+uint32_t ReadUInt32(char const *const Data)
+{
+   auto const D = reinterpret_cast<unsigned char const *>(Data);
+   return uint32_t(D[0]) << 24 | uint32_t(D[1]) << 16 | uint32_t(D[2]) << 8 | D[3];
+}
+void AppendUInt32(std::string &Out, uint32_t const Value)
+{
+   Out.push_back(static_cast<char>(Value >> 24));
+   Out.push_back(static_cast<char>(Value >> 16));
+   Out.push_back(static_cast<char>(Value >> 8));
+   Out.push_back(static_cast<char>(Value));
+}
+void AppendSetting(std::string &Out, uint16_t const Id, uint32_t const Value)
+{
+   Out.push_back(static_cast<char>(Id >> 8));
+   Out.push_back(static_cast<char>(Id));
+   AppendUInt32(Out, Value);
+}
+									/*}}}*/
+// HPACK primitives - RFC 7541 §5 and the tables of its appendices	/*{{{*/
+struct StaticEntry
+{
+   char const *Name;
+   char const *Value;
+};
+constexpr StaticEntry StaticTable[] = {
+   {":authority", ""}, {":method", "GET"}, {":method", "POST"}, {":path", "/"},
+   {":path", "/index.html"}, {":scheme", "http"}, {":scheme", "https"}, {":status", "200"},
+   {":status", "204"}, {":status", "206"}, {":status", "304"}, {":status", "400"},
+   {":status", "404"}, {":status", "500"}, {"accept-charset", ""}, {"accept-encoding", "gzip, deflate"},
+   {"accept-language", ""}, {"accept-ranges", ""}, {"accept", ""}, {"access-control-allow-origin", ""},
+   {"age", ""}, {"allow", ""}, {"authorization", ""}, {"cache-control", ""},
+   {"content-disposition", ""}, {"content-encoding", ""}, {"content-language", ""}, {"content-length", ""},
+   {"content-location", ""}, {"content-range", ""}, {"content-type", ""}, {"cookie", ""},
+   {"date", ""}, {"etag", ""}, {"expect", ""}, {"expires", ""},
+   {"from", ""}, {"host", ""}, {"if-match", ""}, {"if-modified-since", ""},
+   {"if-none-match", ""}, {"if-range", ""}, {"if-unmodified-since", ""}, {"last-modified", ""},
+   {"link", ""}, {"location", ""}, {"max-forwards", ""}, {"proxy-authenticate", ""},
+   {"proxy-authorization", ""}, {"range", ""}, {"referer", ""}, {"refresh", ""},
+   {"retry-after", ""}, {"server", ""}, {"set-cookie", ""}, {"strict-transport-security", ""},
+   {"transfer-encoding", ""}, {"user-agent", ""}, {"vary", ""}, {"via", ""},
+   {"www-authenticate", ""},
+};
+constexpr size_t StaticTableSize = sizeof(StaticTable) / sizeof(StaticTable[0]);
+enum StaticIndex : uint32_t
+{
+   INDEX_AUTHORITY = 1,
+   INDEX_METHOD_GET = 2,
+   INDEX_PATH = 4,
+   INDEX_SCHEME_HTTP = 6,
+   INDEX_SCHEME_HTTPS = 7,
+};
+
+struct HuffmanCode
+{
+   uint32_t Code;
+   uint8_t Bits;
+};
+constexpr HuffmanCode HuffmanCodes[257] = {
+   {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28},
+   {0xfffffe4, 28}, {0xfffffe5, 28}, {0xfffffe6, 28}, {0xfffffe7, 28},
+   {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+   {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28},
+   {0xfffffed, 28}, {0xfffffee, 28}, {0xfffffef, 28}, {0xffffff0, 28},
+   {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+   {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28},
+   {0xffffff8, 28}, {0xffffff9, 28}, {0xffffffa, 28}, {0xffffffb, 28},
+   {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12},
+   {0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11},
+   {0x3fa, 10}, {0x3fb, 10}, {0xf9, 8}, {0x7fb, 11},
+   {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6},
+   {0x0, 5}, {0x1, 5}, {0x2, 5}, {0x19, 6},
+   {0x1a, 6}, {0x1b, 6}, {0x1c, 6}, {0x1d, 6},
+   {0x1e, 6}, {0x1f, 6}, {0x5c, 7}, {0xfb, 8},
+   {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10},
+   {0x1ffa, 13}, {0x21, 6}, {0x5d, 7}, {0x5e, 7},
+   {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7},
+   {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7},
+   {0x67, 7}, {0x68, 7}, {0x69, 7}, {0x6a, 7},
+   {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+   {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7},
+   {0xfc, 8}, {0x73, 7}, {0xfd, 8}, {0x1ffb, 13},
+   {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+   {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5},
+   {0x24, 6}, {0x5, 5}, {0x25, 6}, {0x26, 6},
+   {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7},
+   {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5},
+   {0x2b, 6}, {0x76, 7}, {0x2c, 6}, {0x8, 5},
+   {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7},
+   {0x79, 7}, {0x7a, 7}, {0x7b, 7}, {0x7ffe, 15},
+   {0x7fc, 11}, {0x3ffd, 14}, {0x1ffd, 13}, {0xffffffc, 28},
+   {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20},
+   {0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23},
+   {0x3fffd6, 22}, {0x7fffda, 23}, {0x7fffdb, 23}, {0x7fffdc, 23},
+   {0x7fffdd, 23}, {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23},
+   {0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23},
+   {0xffffee, 24}, {0x7fffe1, 23}, {0x7fffe2, 23}, {0x7fffe3, 23},
+   {0x7fffe4, 23}, {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23},
+   {0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24},
+   {0x3fffda, 22}, {0x1fffdd, 21}, {0xfffe9, 20}, {0x3fffdb, 22},
+   {0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21},
+   {0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24},
+   {0x1fffdf, 21}, {0x3fffdf, 22}, {0x7fffeb, 23}, {0x7fffec, 23},
+   {0x1fffe0, 21}, {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21},
+   {0x7fffed, 23}, {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23},
+   {0xfffea, 20}, {0x3fffe2, 22}, {0x3fffe3, 22}, {0x3fffe4, 22},
+   {0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23},
+   {0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19},
+   {0x3fffe7, 22}, {0x7ffff2, 23}, {0x3fffe8, 22}, {0x1ffffec, 25},
+   {0x3ffffe2, 26}, {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27},
+   {0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25},
+   {0x7fff2, 19}, {0x1fffe3, 21}, {0x3ffffe6, 26}, {0x7ffffe0, 27},
+   {0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24},
+   {0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26},
+   {0xffffffd, 28}, {0x7ffffe3, 27}, {0x7ffffe4, 27}, {0x7ffffe5, 27},
+   {0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21},
+   {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23},
+   {0x3fffea, 22}, {0x3fffeb, 22}, {0x1ffffee, 25}, {0x1ffffef, 25},
+   {0xfffff4, 24}, {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23},
+   {0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26},
+   {0x7ffffe7, 27}, {0x7ffffe8, 27}, {0x7ffffe9, 27}, {0x7ffffea, 27},
+   {0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27},
+   {0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26},
+   {0x3fffffff, 30},
+};
+
+bool HuffmanDecode(char const *Data, size_t const Length, std::string &Out)
+{
+   // binary tree of the codes: positive entries point to the next node,
+   // negative ones are the symbol plus one and zero is an invalid code
+   static std::vector<std::pair<int, int>> const Tree = [] {
+      std::vector<std::pair<int, int>> T(1, {0, 0});
+      for (int Sym = 0; Sym < 257; ++Sym)
+      {
+	 size_t Node = 0;
+	 for (int Bit = HuffmanCodes[Sym].Bits - 1; Bit >= 0; --Bit)
+	 {
+	    bool const One = (HuffmanCodes[Sym].Code >> Bit) & 1;
+	    int Next = One ? T[Node].second : T[Node].first;
+	    if (Bit == 0)
+	       Next = -(Sym + 1);
+	    else if (Next == 0)
+	    {
+	       Next = T.size();
+	       T.emplace_back(0, 0);
+	    }
+	    (One ? T[Node].second : T[Node].first) = Next;
+	    Node = Next;
+	 }
+      }
+      return T;
+   }();
+
+   size_t Node = 0;
+   unsigned int Pending = 0;
+   bool AllOnes = true;
+   for (size_t I = 0; I < Length; ++I)
+   {
+      for (int Bit = 7; Bit >= 0; --Bit)
+      {
+	 bool const One = (Data[I] >> Bit) & 1;
+	 int const Next = One ? Tree[Node].second : Tree[Node].first;
+	 if (Next == 0)
+	    return false;
+	 if (Next > 0)
+	 {
+	    Node = Next;
+	    ++Pending;
+	    AllOnes &= One;
+	    continue;
+	 }
+	 // the end-of-string symbol is only allowed as padding
+	 if (Next == -257)
+	    return false;
+	 Out.push_back(static_cast<char>(-Next - 1));
+	 Node = 0;
+	 Pending = 0;
+	 AllOnes = true;
+      }
+   }
+   // padding is the most significant bits of the end-of-string code
+   return Pending < 8 && AllOnes;
+}
+bool DecodeInteger(char const *&P, char const *const End, unsigned int const Prefix, uint32_t &Value)
+{
+   if (P == End)
+      return false;
+   uint32_t const Max = (1u << Prefix) - 1;
+   uint64_t Result = static_cast<unsigned char>(*P++) & Max;
+   if (Result == Max)
+   {
+      for (unsigned int Shift = 0;; Shift += 7)
+      {
+	 if (P == End || Shift > 28)
+	    return false;
+	 unsigned char const B = *P++;
+	 Result += uint64_t(B & 0x7f) << Shift;
+	 if ((B & 0x80) == 0)
+	    break;
+      }
+      if (Result > UINT32_MAX)
+	 return false;
+   }
+   Value = Result;
+   return true;
+}
+bool DecodeString(char const *&P, char const *const End, std::string &Str)
+{
+   if (P == End)
+      return false;
+   bool const Huffman = (*P & 0x80) != 0;
+   uint32_t Length;
+   if (DecodeInteger(P, End, 7, Length) == false || static_cast<size_t>(End - P) < Length)
+      return false;
+   Str.clear();
+   if (Huffman && HuffmanDecode(P, Length, Str) == false)
+      return false;
+   else if (Huffman == false)
+      Str.assign(P, Length);
+   P += Length;
+   return true;
+}
+void EncodeInteger(std::string &Out, uint8_t const First, unsigned int const Prefix, uint32_t Value)
+{
+   uint32_t const Max = (1u << Prefix) - 1;
+   if (Value < Max)
+   {
+      Out.push_back(static_cast<char>(First | Value));
+      return;
+   }
+   Out.push_back(static_cast<char>(First | Max));
+   for (Value -= Max; Value >= 0x80; Value >>= 7)
+      Out.push_back(static_cast<char>((Value & 0x7f) | 0x80));
+   Out.push_back(static_cast<char>(Value));
+}
+void EncodeString(std::string &Out, std::string const &Str)
+{
+   EncodeInteger(Out, 0, 7, Str.length());
+   Out.append(Str);
+}
+// literal header field without indexing, RFC 7541 §6.2.2
+void EncodeHeader(std::string &Out, uint32_t const NameIndex, std::string const &Value)
+{
+   EncodeInteger(Out, 0, 4, NameIndex);
+   EncodeString(Out, Value);
+}
+void EncodeHeader(std::string &Out, std::string const &Name, std::string const &Value)
+{
+   Out.push_back(0);
+   EncodeString(Out, Name);
+   EncodeString(Out, Value);
+}
+char const *ReasonPhrase(unsigned int const Code)
+{
+   // HTTP/2 has no reason phrases, but they are part of our error messages
+   switch (Code)
+   {
+   case 200: return "OK";
+   case 206: return "Partial Content";
+   case 301: return "Moved Permanently";
+   case 302: return "Found";
+   case 303: return "See Other";
+   case 304: return "Not Modified";
+   case 307: return "Temporary Redirect";
+   case 308: return "Permanent Redirect";
+   case 400: return "Bad Request";
+   case 401: return "Unauthorized";
+   case 403: return "Forbidden";
+   case 404: return "Not Found";
+   case 408: return "Request Timeout";
+   case 410: return "Gone";
+   case 416: return "Range Not Satisfiable";
+   case 429: return "Too Many Requests";
+   case 500: return "Internal Server Error";
+   case 502: return "Bad Gateway";
+   case 503: return "Service Unavailable";
+   case 504: return "Gateway Timeout";
+   }
+   return "Unknown";
+}
+} // namespace
+									/*}}}*/
+
+// HpackDecoder::HpackDecoder - Constructor				/*{{{*/
+HpackDecoder::HpackDecoder(size_t const MaxSize) : TableMaxSize(MaxSize), SettingsMaxSize(MaxSize)
+{
+}
+									/*}}}*/
+// HpackDecoder::Decode - Decode a header block				/*{{{*/
+bool HpackDecoder::Decode(std::string const &Block,
+			  std::vector<std::pair<std::string, std::string>> &Headers)
+{
+   char const *P = Block.data();
+   char const *const End = P + Block.length();
+   while (P != End)
+   {
+      unsigned char const B = *P;
+      uint32_t Index;
+      if ((B & 0x80) != 0)
+      {
+	 // indexed header field
+	 std::pair<std::string, std::string> Field;
+	 if (DecodeInteger(P, End, 7, Index) == false || LookupIndex(Index, Field) == false)
+	    return false;
+	 Headers.push_back(std::move(Field));
+      }
+      else if ((B & 0xe0) == 0x20)
+      {
+	 // dynamic table size update, limited by our settings
+	 if (DecodeInteger(P, End, 5, Index) == false || Index > SettingsMaxSize)
+	    return false;
+	 TableMaxSize = Index;
+	 AddToTable("", "");
+      }
+      else
+      {
+	 // literal header field with (6 bit) or without (4 bit) indexing
+	 bool const Indexing = (B & 0x40) != 0;
+	 std::pair<std::string, std::string> Field;
+	 if (DecodeInteger(P, End, Indexing ? 6 : 4, Index) == false)
+	    return false;
+	 if (Index == 0 ? DecodeString(P, End, Field.first) == false : LookupIndex(Index, Field) == false)
+	    return false;
+	 if (DecodeString(P, End, Field.second) == false)
+	    return false;
+	 if (Indexing)
+	    AddToTable(Field.first, Field.second);
+	 Headers.push_back(std::move(Field));
+      }
+   }
+   return true;
+}
+									/*}}}*/
+// HpackDecoder::AddToTable - Add to the dynamic table			/*{{{*/
+// ---------------------------------------------------------------------
+/* An empty name only evicts entries exceeding the maximum size */
+void HpackDecoder::AddToTable(std::string const &Name, std::string const &Value)
+{
+   if (Name.empty() == false)
+   {
+      Table.emplace_front(Name, Value);
+      TableSize += Name.length() + Value.length() + 32;
+   }
+   while (TableSize > TableMaxSize && Table.empty() == false)
+   {
+      TableSize -= Table.back().first.length() + Table.back().second.length() + 32;
+      Table.pop_back();
+   }
+}
+									/*}}}*/
+bool HpackDecoder::LookupIndex(uint32_t const Index, std::pair<std::string, std::string> &Field) const /*{{{*/
+{
+   if (Index == 0)
+      return false;
+   if (Index <= StaticTableSize)
+   {
+      Field.first = StaticTable[Index - 1].Name;
+      Field.second = StaticTable[Index - 1].Value;
+      return true;
+   }
+   if (Index - StaticTableSize > Table.size())
+      return false;
+   Field = Table[Index - StaticTableSize - 1];
+   return true;
+}
+									/*}}}*/
+void HpackEncodeHeader(std::string &Block, std::string const &Name, std::string const &Value) /*{{{*/
+{
+   EncodeHeader(Block, Name, Value);
+}
+									/*}}}*/
+
+// Http2Connection::Http2Connection - Constructor			/*{{{*/
+// ---------------------------------------------------------------------
+/* Prepares the connection preface, which we can send right away without
+   waiting for the SETTINGS of the server */
+Http2Connection::Http2Connection(bool const TLS, uint32_t const WindowSize) : TLS(TLS), WindowSize(WindowSize)
+{
+   Output.append(ConnectionPreface);
+   std::string Settings;
+   AppendSetting(Settings, SETTINGS_ENABLE_PUSH, 0);
+   AppendSetting(Settings, SETTINGS_INITIAL_WINDOW_SIZE, WindowSize);
+   WriteFrame(SETTINGS, 0, 0, Settings);
+   WindowUpdate(0, ConnectionWindow - DefaultWindow);
+}
+									/*}}}*/
+void Http2Connection::WriteFrame(uint8_t const Type, uint8_t const Flags, /*{{{*/
+				 uint32_t const Id, std::string const &Payload)
+{
+   uint32_t const Length = Payload.length();
+   Output.push_back(static_cast<char>(Length >> 16));
+   Output.push_back(static_cast<char>(Length >> 8));
+   Output.push_back(static_cast<char>(Length));
+   Output.push_back(static_cast<char>(Type));
+   Output.push_back(static_cast<char>(Flags));
+   AppendUInt32(Output, Id);
+   Output.append(Payload);
+}
+									/*}}}*/
+void Http2Connection::WindowUpdate(uint32_t const Id, uint32_t const Increment) /*{{{*/
+{
+   std::string Payload;
+   AppendUInt32(Payload, Increment);
+   WriteFrame(WINDOW_UPDATE, 0, Id, Payload);
+}
+									/*}}}*/
+std::string Http2Connection::TakeOutput()				/*{{{*/
+{
+   std::string Data;
+   std::swap(Data, Output);
+   return Data;
+}
+									/*}}}*/
+// Http2Connection::Request - Queue a request as a new stream		/*{{{*/
+// ---------------------------------------------------------------------
+/* The request line and the header fields of the HTTP/1.1 request are
+   turned into pseudo-header and header fields */
+bool Http2Connection::Request(std::string const &Request)
+{
+   Stream S;
+   bool First = true;
+   for (auto const &L : VectorizeString(Request, '\n'))
+   {
+      std::string const Line = APT::String::Strip(L);
+      if (Line.empty())
+	 continue;
+      if (First)
+      {
+	 First = false;
+	 auto const Fields = VectorizeString(Line, ' ');
+	 if (Fields.size() != 3)
+	    return _error->Error("Internal error: Invalid request line %s", Line.c_str());
+	 if (Fields[0] == "GET")
+	    EncodeInteger(S.Request, 0x80, 7, INDEX_METHOD_GET);
+	 else
+	    EncodeHeader(S.Request, ":method", Fields[0]);
+	 EncodeInteger(S.Request, 0x80, 7, TLS ? INDEX_SCHEME_HTTPS : INDEX_SCHEME_HTTP);
+	 EncodeHeader(S.Request, INDEX_PATH, Fields[1]);
+	 continue;
+      }
+      auto const Colon = Line.find(':');
+      if (Colon == std::string::npos)
+	 return _error->Error("Internal error: Invalid request header %s", Line.c_str());
+      std::string Name = Line.substr(0, Colon);
+      std::transform(Name.begin(), Name.end(), Name.begin(), tolower_ascii);
+      std::string const Value = APT::String::Strip(Line.substr(Colon + 1));
+      if (Name == "host")
+	 EncodeHeader(S.Request, INDEX_AUTHORITY, Value);
+      // connection-specific fields are not allowed in HTTP/2
+      else if (Name != "connection" && Name != "keep-alive" && Name != "proxy-connection" &&
+	       Name != "transfer-encoding" && Name != "upgrade")
+	 EncodeHeader(S.Request, Name, Value);
+   }
+   Streams.push_back(std::move(S));
+   SendRequests();
+   return true;
+}
+									/*}}}*/
+// Http2Connection::SendRequests - Open streams for waiting requests	/*{{{*/
+void Http2Connection::SendRequests()
+{
+   for (auto &S : Streams)
+   {
+      if (S.Id != 0 || S.Ended)
+	 continue;
+      if (GoneAway)
+      {
+	 S.Reset = true;
+	 S.ErrorCode = REFUSED_STREAM;
+	 FinishStream(S);
+	 continue;
+      }
+      if (ActiveStreams >= MaxStreams)
+	 break;
+      S.Id = NextStreamId;
+      NextStreamId += 2;
+      ++ActiveStreams;
+
+      std::string::size_type Pos = 0;
+      do
+      {
+	 auto const Size = std::min<std::string::size_type>(S.Request.length() - Pos, MaxFrameSize);
+	 uint8_t Flags = (Pos + Size == S.Request.length()) ? FLAG_END_HEADERS : 0;
+	 if (Pos == 0)
+	    WriteFrame(HEADERS, Flags | FLAG_END_STREAM, S.Id, S.Request.substr(Pos, Size));
+	 else
+	    WriteFrame(CONTINUATION, Flags, S.Id, S.Request.substr(Pos, Size));
+	 Pos += Size;
+      } while (Pos < S.Request.length());
+      S.Request.clear();
+      S.Request.shrink_to_fit();
+   }
+}
+									/*}}}*/
+Http2Connection::Stream *Http2Connection::FindStream(uint32_t const Id)	/*{{{*/
+{
+   auto const S = std::find_if(Streams.begin(), Streams.end(), [&](Stream const &S) { return S.Id == Id; });
+   if (S == Streams.end())
+      return nullptr;
+   return &*S;
+}
+									/*}}}*/
+void Http2Connection::FinishStream(Stream &S)				/*{{{*/
+{
+   if (S.Ended)
+      return;
+   if (S.Chunked && S.Reset == false)
+      S.Data.append("0\r\n\r\n");
+   S.Ended = true;
+   if (S.Id != 0)
+      --ActiveStreams;
+}
+									/*}}}*/
+bool Http2Connection::ProtocolError(char const *const Msg, uint32_t const Code) /*{{{*/
+{
+   std::string Payload;
+   AppendUInt32(Payload, NextStreamId > 1 ? NextStreamId - 2 : 0);
+   AppendUInt32(Payload, Code);
+   WriteFrame(GOAWAY, 0, 0, Payload);
+   GoneAway = true;
+   return _error->Error("HTTP/2 protocol error: %s", Msg);
+}
+									/*}}}*/
+// Http2Connection::Receive - Process data received from the server	/*{{{*/
+bool Http2Connection::Receive(std::string const &Data)
+{
+   Input.append(Data);
+   std::string::size_type Pos = 0;
+   while (Input.length() - Pos >= 9)
+   {
+      auto const H = reinterpret_cast<unsigned char const *>(Input.data() + Pos);
+      uint32_t const Length = uint32_t(H[0]) << 16 | uint32_t(H[1]) << 8 | H[2];
+      if (Length > MaxFrameSize)
+	 return ProtocolError("Frame exceeds the maximum size", FRAME_SIZE_ERROR);
+      if (Input.length() - Pos < 9 + Length)
+	 break;
+      uint32_t const Id = ReadUInt32(Input.data() + Pos + 5) & 0x7fffffff;
+      if (HandleFrame(H[3], H[4], Id, Input.data() + Pos + 9, Length) == false)
+	 return false;
+      Pos += 9 + Length;
+   }
+   Input.erase(0, Pos);
+   return true;
+}
+									/*}}}*/
+// Http2Connection::HandleFrame - Act on a single frame			/*{{{*/
+bool Http2Connection::HandleFrame(uint8_t const Type, uint8_t const Flags, uint32_t const Id,
+				  char const *Data, uint32_t Length)
+{
+   if (HeaderStream != 0 && (Type != CONTINUATION || Id != HeaderStream))
+      return ProtocolError("Header block was interrupted");
+
+   // strip padding and priority information
+   if ((Type == DATA || Type == HEADERS) && (Flags & FLAG_PADDED) != 0)
+   {
+      if (Length == 0 || static_cast<unsigned char>(Data[0]) >= Length)
+	 return ProtocolError("Invalid padding");
+      Length -= static_cast<unsigned char>(Data[0]) + 1;
+      ++Data;
+   }
+   if (Type == HEADERS && (Flags & FLAG_PRIORITY) != 0)
+   {
+      if (Length < 5)
+	 return ProtocolError("Invalid priority");
+      Length -= 5;
+      Data += 5;
+   }
+
+   switch (Type)
+   {
+   case DATA:
+   {
+      if (Id == 0)
+	 return ProtocolError("DATA frame for the connection");
+      // padding counts against the window as well
+      uint32_t const Padding = ((Flags & FLAG_PADDED) != 0) ? (static_cast<unsigned char>(Data[-1]) + 1) : 0;
+      ConnectionConsumed += Length + Padding;
+      if (ConnectionConsumed >= ConnectionWindow / 2)
+      {
+	 WindowUpdate(0, ConnectionConsumed);
+	 ConnectionConsumed = 0;
+      }
+      auto const S = FindStream(Id);
+      if (S == nullptr || S->Ended)
+	 return true;
+      if (S->HaveHeaders == false)
+	 return ProtocolError("DATA frame before the response headers");
+      S->Consumed += Padding;
+      if (Length != 0)
+      {
+	 char Size[20];
+	 snprintf(Size, sizeof(Size), "%x\r\n", Length);
+	 S->Data.append(Size).append(Data, Length).append("\r\n");
+	 S->Buffered += Length;
+      }
+      if ((Flags & FLAG_END_STREAM) != 0)
+      {
+	 FinishStream(*S);
+	 SendRequests();
+      }
+      return true;
+   }
+   case HEADERS:
+      if (Id == 0)
+	 return ProtocolError("HEADERS frame for the connection");
+      HeaderBlock.assign(Data, Length);
+      HeaderEndStream = (Flags & FLAG_END_STREAM) != 0;
+      if ((Flags & FLAG_END_HEADERS) != 0)
+	 return HandleHeaders(Id, HeaderEndStream);
+      HeaderStream = Id;
+      return true;
+   case CONTINUATION:
+      if (HeaderStream == 0)
+	 return ProtocolError("Unexpected CONTINUATION frame");
+      HeaderBlock.append(Data, Length);
+      if ((Flags & FLAG_END_HEADERS) == 0)
+	 return true;
+      HeaderStream = 0;
+      return HandleHeaders(Id, HeaderEndStream);
+   case RST_STREAM:
+   {
+      if (Length != 4 || Id == 0)
+	 return ProtocolError("Invalid RST_STREAM frame");
+      auto const S = FindStream(Id);
+      if (S == nullptr || S->Ended)
+	 return true;
+      S->Reset = true;
+      S->ErrorCode = ReadUInt32(Data);
+      FinishStream(*S);
+      SendRequests();
+      return true;
+   }
+   case SETTINGS:
+      if (Id != 0 || Length % 6 != 0)
+	 return ProtocolError("Invalid SETTINGS frame", FRAME_SIZE_ERROR);
+      if ((Flags & FLAG_ACK) != 0)
+	 return true;
+      // a server not limiting the streams still gets no more than our maximum
+      if (HaveSettings == false)
+      {
+	 HaveSettings = true;
+	 MaxStreams = MaxConcurrentStreams;
+      }
+      for (uint32_t I = 0; I < Length; I += 6)
+      {
+	 uint16_t const Setting = uint16_t(static_cast<unsigned char>(Data[I])) << 8 | static_cast<unsigned char>(Data[I + 1]);
+	 if (Setting == SETTINGS_MAX_CONCURRENT_STREAMS)
+	    MaxStreams = std::min(ReadUInt32(Data + I + 2), MaxConcurrentStreams);
+      }
+      WriteFrame(SETTINGS, FLAG_ACK, 0, "");
+      SendRequests();
+      return true;
+   case PUSH_PROMISE:
+      return ProtocolError("Server push was not enabled");
+   case PING:
+      if (Length != 8 || Id != 0)
+	 return ProtocolError("Invalid PING frame", FRAME_SIZE_ERROR);
+      if ((Flags & FLAG_ACK) == 0)
+	 WriteFrame(PING, FLAG_ACK, 0, std::string(Data, Length));
+      return true;
+   case GOAWAY:
+   {
+      if (Length < 8 || Id != 0)
+	 return ProtocolError("Invalid GOAWAY frame");
+      // streams above the last one will not be processed, so ask again elsewhere
+      uint32_t const Last = ReadUInt32(Data) & 0x7fffffff;
+      GoneAway = true;
+      for (auto &S : Streams)
+	 if (S.Ended == false && (S.Id == 0 || S.Id > Last))
+	 {
+	    S.Reset = true;
+	    S.ErrorCode = REFUSED_STREAM;
+	    FinishStream(S);
+	 }
+      return true;
+   }
+   case PRIORITY:
+   case WINDOW_UPDATE:
+      // we send no data, so the flow control of the server is of no interest
+   default:
+      return true;
+   }
+}
+									/*}}}*/
+// Http2Connection::HandleHeaders - Turn the header block into HTTP/1.1	/*{{{*/
+bool Http2Connection::HandleHeaders(uint32_t const Id, bool const EndStream)
+{
+   std::vector<std::pair<std::string, std::string>> Headers;
+   // the block has to be decoded even if we are not interested in it to
+   // keep the state of the decoder in sync with the server
+   if (Decoder.Decode(HeaderBlock, Headers) == false)
+      return ProtocolError("Invalid header block", COMPRESSION_ERROR);
+   HeaderBlock.clear();
+
+   auto const S = FindStream(Id);
+   if (S == nullptr || S->Ended)
+      return true;
+   if (S->HaveHeaders)
+   {
+      // trailers
+      if (EndStream == false)
+	 return ProtocolError("Header block in the middle of the response");
+      FinishStream(*S);
+      SendRequests();
+      return true;
+   }
+
+   auto const Status = std::find_if(Headers.begin(), Headers.end(), [](std::pair<std::string, std::string> const &H) { return H.first == ":status"; });
+   if (Status == Headers.end() || Status->second.length() != 3 ||
+       std::all_of(Status->second.begin(), Status->second.end(), [](char const c) { return c >= '0' && c <= '9'; }) == false)
+      return ProtocolError("Response without a valid status");
+   // informational responses are of no interest to us
+   if (Status->second[0] == '1')
+      return true;
+
+   S->HaveHeaders = true;
+   S->Data.append("HTTP/2.0 ").append(Status->second).append(" ").append(ReasonPhrase(atoi(Status->second.c_str()))).append("\r\n");
+   for (auto const &H : Headers)
+   {
+      if (H.first.empty() || H.first[0] == ':' || H.first == "transfer-encoding" || H.first == "connection")
+	 continue;
+      // without a body these would make us wait for one
+      if (EndStream && (H.first == "content-length" || H.first == "content-type"))
+	 continue;
+      S->Data.append(H.first).append(": ").append(H.second).append("\r\n");
+   }
+   if (EndStream == false)
+   {
+      S->Data.append("Transfer-Encoding: chunked\r\n");
+      S->Chunked = true;
+   }
+   S->Data.append("\r\n");
+
+   if (EndStream)
+   {
+      FinishStream(*S);
+      SendRequests();
+   }
+   return true;
+}
+									/*}}}*/
+// Http2Connection::Response - Take data of the responses in order	/*{{{*/
+void Http2Connection::Response(std::string &Data, unsigned long long Max)
+{
+   while (Max != 0 && Streams.empty() == false)
+   {
+      auto &S = Streams.front();
+      auto const Size = std::min<unsigned long long>(Max, S.Data.length() - S.Taken);
+      if (Size != 0)
+      {
+	 Data.append(S.Data, S.Taken, Size);
+	 S.Taken += Size;
+	 Max -= Size;
+	 if (S.Taken > S.Data.length() / 2)
+	 {
+	    S.Data.erase(0, S.Taken);
+	    S.Taken = 0;
+	 }
+
+	 auto const Credit = std::min<unsigned long long>(Size, S.Buffered);
+	 S.Buffered -= Credit;
+	 S.Consumed += Credit;
+	 if (S.Ended == false && S.Consumed >= WindowSize / 2)
+	 {
+	    WindowUpdate(S.Id, S.Consumed);
+	    S.Consumed = 0;
+	 }
+      }
+      if (S.Taken != S.Data.length() || S.Ended == false || S.Reset)
+	 break;
+      Streams.pop_front();
+   }
+}
+									/*}}}*/
+bool Http2Connection::Failed(uint32_t &ErrorCode) const			/*{{{*/
+{
+   if (Streams.empty())
+      return false;
+   auto const &S = Streams.front();
+   if (S.Reset == false || S.Taken != S.Data.length())
+      return false;
+   ErrorCode = S.ErrorCode;
+   return true;
+}
+									/*}}}*/
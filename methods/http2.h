@@ -0,0 +1,126 @@
+// -*- mode: cpp; mode: fold -*-
+// Description								/*{{{*/
+/* ######################################################################
+
+   HTTP/2 framing for the HTTP method
+
+   Requests are handed in as HTTP/1.1 requests and responses come back as
+   HTTP/1.1 responses with chunked encoding, so that the rest of the
+   method can stay oblivious of the streams multiplexed on the connection.
+
+   ##################################################################### */
+									/*}}}*/
+#ifndef APT_HTTP2_H
+#define APT_HTTP2_H
+
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+/** \brief Decoder of HPACK (RFC 7541) header blocks
+ *
+ * The dynamic table is shared by all header blocks of a connection, so
+ * each block has to be decoded in the order it was received.
+ */
+class HpackDecoder
+{
+   // newest entry first
+   std::deque<std::pair<std::string, std::string>> Table;
+   size_t TableSize = 0;
+   size_t TableMaxSize;
+   // the limit announced in our SETTINGS, which the encoder may not exceed
+   size_t const SettingsMaxSize;
+
+   void AddToTable(std::string const &Name, std::string const &Value);
+   bool LookupIndex(uint32_t const Index, std::pair<std::string, std::string> &Field) const;
+
+   public:
+   /** \brief Decode a header block and append its fields to Headers */
+   bool Decode(std::string const &Block, std::vector<std::pair<std::string, std::string>> &Headers);
+   std::deque<std::pair<std::string, std::string>> const &DynamicTable() const { return Table; }
+   size_t DynamicTableSize() const { return TableSize; }
+
+   explicit HpackDecoder(size_t const MaxSize = 4096);
+};
+
+/** \brief Append a header field to a HPACK header block
+ *
+ * The field is encoded as literal without indexing, so the block can be
+ * decoded without knowing any of the blocks sent before it.
+ */
+void HpackEncodeHeader(std::string &Block, std::string const &Name, std::string const &Value);
+
+class Http2Connection
+{
+   struct Stream
+   {
+      // 0 while the request still waits for a free stream
+      uint32_t Id = 0;
+      std::string Request;
+      // the response in HTTP/1.1 form not yet taken by Response()
+      std::string Data;
+      std::string::size_type Taken = 0;
+      // flow controlled bytes in Data and bytes taken but not yet acknowledged
+      uint32_t Buffered = 0;
+      uint32_t Consumed = 0;
+      bool HaveHeaders = false;
+      bool Chunked = false;
+      bool Ended = false;
+      bool Reset = false;
+      uint32_t ErrorCode = 0;
+   };
+   // streams in the order the requests were made
+   std::deque<Stream> Streams;
+
+   bool const TLS;
+   uint32_t const WindowSize;
+   uint32_t NextStreamId = 1;
+   // one until the SETTINGS of the server tell us how many it allows
+   uint32_t MaxStreams = 1;
+   bool HaveSettings = false;
+   uint32_t ActiveStreams = 0;
+   uint32_t ConnectionConsumed = 0;
+   bool GoneAway = false;
+
+   std::string Input;
+   std::string Output;
+
+   // header block in progress (HEADERS followed by CONTINUATION frames)
+   uint32_t HeaderStream = 0;
+   bool HeaderEndStream = false;
+   std::string HeaderBlock;
+
+   HpackDecoder Decoder;
+
+   void WriteFrame(uint8_t const Type, uint8_t const Flags, uint32_t const Id, std::string const &Payload);
+   void WindowUpdate(uint32_t const Id, uint32_t const Increment);
+   void SendRequests();
+   Stream *FindStream(uint32_t const Id);
+   void FinishStream(Stream &S);
+
+   bool ProtocolError(char const *const Msg, uint32_t const Code = 1);
+   bool HandleFrame(uint8_t const Type, uint8_t const Flags, uint32_t const Id, char const *Data, uint32_t Length);
+   bool HandleHeaders(uint32_t const Id, bool const EndStream);
+
+   public:
+   /** \brief Queue a request given in HTTP/1.1 form as a new stream */
+   bool Request(std::string const &Request);
+   /** \brief Process data received from the server */
+   bool Receive(std::string const &Data);
+   /** \brief Take up to Max bytes of responses in HTTP/1.1 form
+    *
+    * Responses come in the order the requests were made, each with
+    * chunked transfer encoding if it has a body.
+    */
+   void Response(std::string &Data, unsigned long long Max);
+   /** \brief Take the data which should be sent to the server */
+   std::string TakeOutput();
+   /** \brief If the response we are waiting for will not come and why */
+   bool Failed(uint32_t &ErrorCode) const;
+
+   Http2Connection(bool const TLS, uint32_t const WindowSize);
+};
+
+#endif
@@ -18,11 +18,17 @@
 #include <apt-pkg/metaindex.h>
 #include <apt-pkg/sourcelist.h>
 #include <apt-pkg/strutl.h>
+#include <apt-pkg/tagfile.h>
 
+#include <algorithm>
+#include <cmath>
 #include <functional>
+#include <locale>
 #include <random>
+#include <sstream>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include <sys/utsname.h>
 
@@ -44,6 +50,9 @@ class MirrorMethod : public aptMethod /*{{{*/
    std::mt19937 genrng;
    std::vector<std::string> sourceslist;
    std::unordered_map<std::string, std::string> msgCache;
+   // expected time in seconds to fetch a file from a site as measured in earlier runs
+   std::unordered_map<std::string, double> siteCosts;
+   bool siteCostsLoaded = false;
    enum MirrorFileState
    {
       REQUESTED,
@@ -54,7 +63,7 @@ class MirrorMethod : public aptMethod /*{{{*/
    {
       std::string uri;
       unsigned long priority = std::numeric_limits<decltype(priority)>::max();
-      decltype(genrng)::result_type seed = 0;
+      double rank = 0;
       std::unordered_map<std::string, std::vector<std::string>> tags;
       explicit MirrorInfo(std::string const &u, std::vector<std::string> &&ptags = {}) : uri(u)
       {
@@ -91,6 +100,8 @@ class MirrorMethod : public aptMethod /*{{{*/
 
    virtual bool URIAcquire(std::string const &Message, FetchItem *Itm) APT_OVERRIDE;
 
+   void LoadSiteCosts();
+   void RankMirrors(std::vector<MirrorInfo> &mirrors);
    void RedirectItem(MirrorListInfo const &info, FetchItem *const Itm, std::string const &Message);
    bool MirrorListFileRecieved(MirrorListInfo &info, FetchItem *const Itm);
    std::string GetMirrorFileURI(std::string const &Message, FetchItem *const Itm);
@@ -103,6 +114,90 @@ class MirrorMethod : public aptMethod /*{{{*/
    }
 };
 									/*}}}*/
+// the statistics are written in the C locale, so read them in it as well
+static double ParseStatistic(pkgTagSection const &Section, char const *const Field)
+{
+   std::istringstream In(Section.FindS(Field));
+   In.imbue(std::locale::classic());
+   double Result = 0;
+   In >> Result;
+   return Result;
+}
+void MirrorMethod::LoadSiteCosts()					/*{{{*/
+{
+   if (siteCostsLoaded)
+      return;
+   siteCostsLoaded = true;
+   if (_config->FindB("Acquire::Mirror::Statistics", true) == false)
+      return;
+   std::string const statsfile = _config->FindFile("Dir::State::mirror-stats");
+   if (statsfile.empty() || RealFileExists(statsfile) == false)
+      return;
+   // the statistics are just a hint, so problems reading them are no errors
+   _error->PushToStack();
+   FileFd Fd;
+   if (Fd.Open(statsfile, FileFd::ReadOnly) == false)
+   {
+      _error->RevertToStack();
+      return;
+   }
+   // the time to fetch a typical index or package file
+   double const refsize = _config->FindI("Acquire::Mirror::Reference-Size", 1024 * 1024);
+   pkgTagFile tags(&Fd);
+   pkgTagSection section;
+   while (tags.Step(section))
+   {
+      auto const site = section.FindS("Site");
+      if (site.empty())
+	 continue;
+      double cost = std::max(0.001, ParseStatistic(section, "Latency"));
+      double const throughput = ParseStatistic(section, "Throughput");
+      if (throughput > 0)
+	 cost += refsize / throughput;
+      // a mirror failing half of the time is as good as one six times slower
+      double const failurerate = ParseStatistic(section, "Failure-Rate");
+      cost *= 1 + 10 * std::min(1.0, std::max(0.0, failurerate));
+      siteCosts[site] = cost;
+   }
+   _error->RevertToStack();
+}
+									/*}}}*/
+void MirrorMethod::RankMirrors(std::vector<MirrorInfo> &mirrors)	/*{{{*/
+{
+   /* Faster mirrors are more likely to be picked, but slower ones still get
+      their share to spread the load. Each mirror is weighted with the inverse
+      of its cost squared and the list is shuffled accordingly (Efraimidis and
+      Spirakis). Mirrors we have no measurements for are assumed to be average,
+      so that new mirrors are tried without giving them all the traffic. */
+   LoadSiteCosts();
+   std::vector<double> costs;
+   costs.reserve(mirrors.size());
+   for (auto const &mirror : mirrors)
+   {
+      auto const cost = siteCosts.find(URI::SiteOnly(mirror.uri));
+      costs.push_back(cost == siteCosts.end() ? -1 : cost->second);
+   }
+   std::vector<double> known;
+   std::copy_if(costs.begin(), costs.end(), std::back_inserter(known), [](double const c) { return c > 0; });
+   double average = 1;
+   if (known.empty() == false)
+   {
+      auto const median = known.begin() + (known.size() - 1) / 2;
+      std::nth_element(known.begin(), median, known.end());
+      average = *median;
+   }
+   std::uniform_real_distribution<double> uniform(std::numeric_limits<double>::min(), 1);
+   for (size_t i = 0; i < mirrors.size(); ++i)
+   {
+      double const cost = costs[i] > 0 ? costs[i] : average;
+      double const weight = 1 / (cost * cost);
+      mirrors[i].rank = std::log(uniform(genrng)) / weight;
+      if (DebugEnabled())
+	 std::clog << "Mirror " << mirrors[i].uri << " has cost " << cost << (costs[i] > 0 ? "" : " (unknown)")
+		   << " and rank " << mirrors[i].rank << std::endl;
+   }
+}
+									/*}}}*/
 void MirrorMethod::RedirectItem(MirrorListInfo const &info, FetchItem *const Itm, std::string const &Message) /*{{{*/
 {
    std::unordered_map<std::string, std::string> matchers;
@@ -135,12 +230,11 @@ void MirrorMethod::RedirectItem(MirrorListInfo const &info, FetchItem *const Itm
 	 continue;
       possMirrors.push_back(mirror);
    }
-   for (auto &&mirror : possMirrors)
-      mirror.seed = genrng();
+   RankMirrors(possMirrors);
    std::sort(possMirrors.begin(), possMirrors.end(), [](MirrorInfo const &a, MirrorInfo const &b) {
       if (a.priority != b.priority)
 	 return a.priority < b.priority;
-      return a.seed < b.seed;
+      return a.rank > b.rank;
    });
    std::string const path = Itm->Uri.substr(info.baseuri.length());
    std::string altMirrors;
@@ -6,11 +6,13 @@
 #include <apt-pkg/fileutl.h>
 #include <apt-pkg/strutl.h>
 
+#include "../../methods/http2.h"
 #include "teestream.h"
 
 #include <dirent.h>
 #include <errno.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <regex.h>
 #include <signal.h>
 #include <stddef.h>
@@ -22,9 +24,11 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <deque>
 #include <fstream>
 #include <iostream>
 #include <list>
+#include <memory>
 #include <sstream>
 #include <string>
 #include <thread>
@@ -673,221 +677,559 @@ static bool handleOnTheFlyReconfiguration(std::ostream &log, int const client,/*
    return false;
 }
 									/*}}}*/
-static void * handleClient(int const client, size_t const id)		/*{{{*/
+static void handleRequest(std::ostream &log, int const client, std::string const &request,/*{{{*/
+			  bool &closeConnection, std::list<std::string> &headers)
 {
-   auto logfilepath = _config->FindFile("aptwebserver::logfiles");
-   if (logfilepath.empty() == false)
-      strprintf(logfilepath, "%s.client-%lu.log", logfilepath.c_str(), id);
-   else
-      logfilepath = "/dev/null";
-   std::ofstream logfile(logfilepath);
-   basic_teeostream<char> log(std::clog, logfile);
+   log << ">>> REQUEST from " << client << " >>>" << std::endl << request
+      << std::endl << "<<<<<<<<<<<<<<<<" << std::endl;
+   std::string filename;
+   std::string params;
+   bool sendContent = true;
+   if (parseFirstLine(log, client, request, filename, params, sendContent, closeConnection, headers) == false)
+      return;
 
-   log << "ACCEPT client " << client << std::endl;
-   bool closeConnection = false;
-   while (closeConnection == false)
+   // special webserver command request
+   if (filename.length() > 1 && filename[0] == '_')
    {
-      std::vector<std::string> messages;
-      if (ReadMessages(client, messages) == false)
-	 break;
+      auto const parts = VectorizeString(filename, '/');
+      if (parts[0] == "_config")
+      {
+	 handleOnTheFlyReconfiguration(log, client, request, parts, headers);
+	 return;
+      }
+   }
 
-      std::list<std::string> headers;
-      for (std::vector<std::string>::const_iterator m = messages.begin();
-	    m != messages.end() && closeConnection == false; ++m) {
-	 // if we announced a closing in previous response, do the close now
-	 if (std::find(headers.begin(), headers.end(), std::string("Connection: close")) != headers.end())
+   // string replacements in the requested filename
+   ::Configuration::Item const *Replaces = _config->Tree("aptwebserver::redirect::replace");
+   if (Replaces != NULL)
+   {
+      std::string redirect = "/" + filename;
+      for (::Configuration::Item *I = Replaces->Child; I != NULL; I = I->Next)
+	 redirect = SubstVar(redirect, I->Tag, I->Value);
+      if (redirect.empty() == false && redirect[0] == '/')
+	 redirect.erase(0,1);
+      if (redirect != filename)
+      {
+	 sendRedirect(log, client, _config->FindI("aptwebserver::redirect::httpcode", 301), redirect, request, sendContent);
+	 return;
+      }
+   }
+
+   ::Configuration::Item const *Overwrite = _config->Tree("aptwebserver::overwrite");
+   if (Overwrite != NULL)
+   {
+      for (::Configuration::Item *I = Overwrite->Child; I != NULL; I = I->Next)
+      {
+	 regex_t *pattern = new regex_t;
+	 int const res = regcomp(pattern, I->Tag.c_str(), REG_EXTENDED | REG_ICASE | REG_NOSUB);
+	 if (res != 0)
 	 {
-	    closeConnection = true;
+	    char error[300];
+	    regerror(res, pattern, error, sizeof(error));
+	    sendError(log, client, 500, request, sendContent, error, headers);
+	    continue;
+	 }
+	 if (regexec(pattern, filename.c_str(), 0, 0, 0) == 0)
+	 {
+	    filename = _config->Find("aptwebserver::overwrite::" + I->Tag + "::filename", flNotDir(filename));
+	    if (filename.find("/") == std::string::npos)
+	    {
+	       auto directory = _config->Find("aptwebserver::overwrite::" + I->Tag + "::directory", flNotFile(filename));
+	       filename = flCombine(directory, filename);
+	    }
+	    if (filename.empty() == false && filename[0] == '/')
+	       filename.erase(0,1);
+	    if (filename.empty())
+	       filename = "./";
+	    regfree(pattern);
 	    break;
 	 }
-	 headers.clear();
+	 regfree(pattern);
+      }
+   }
 
-	 log << ">>> REQUEST from " << client << " >>>" << std::endl << *m
-	    << std::endl << "<<<<<<<<<<<<<<<<" << std::endl;
-	 std::string filename;
-	 std::string params;
-	 bool sendContent = true;
-	 if (parseFirstLine(log, client, *m, filename, params, sendContent, closeConnection, headers) == false)
-	    continue;
+   // automatic retry can be tested with this
+   {
+      int failrequests = _config->FindI("aptwebserver::failrequest::" + filename, 0);
+      if (failrequests != 0)
+      {
+	 --failrequests;
+	 _config->Set(("aptwebserver::failrequest::" + filename).c_str(), failrequests);
+	 sendError(log, client, _config->FindI("aptwebserver::failrequest", 400), request, sendContent, "Server is configured to fail this file.", headers);
+	 return;
+      }
+   }
 
-	 // special webserver command request
-	 if (filename.length() > 1 && filename[0] == '_')
+   // deal with the request
+   unsigned int const httpsport = _config->FindI("aptwebserver::port::https", 4433);
+   std::string hosthttpsport;
+   strprintf(hosthttpsport, ":%u", httpsport);
+   if (_config->FindB("aptwebserver::support::http", true) == false &&
+	 LookupTag(request, "Host").find(hosthttpsport) == std::string::npos)
+   {
+      sendError(log, client, 400, request, sendContent, "HTTP disabled, all requests must be HTTPS", headers);
+      return;
+   }
+   else if (RealFileExists(filename) == true)
+   {
+      FileFd data(filename, FileFd::ReadOnly);
+      std::string condition = LookupTag(request, "If-Modified-Since", "");
+      if (_config->FindB("aptwebserver::support::modified-since", true) == true && condition.empty() == false)
+      {
+	 time_t cache;
+	 if (RFC1123StrToTime(condition, cache) == true &&
+	       cache >= data.ModificationTime())
 	 {
-	    auto const parts = VectorizeString(filename, '/');
-	    if (parts[0] == "_config")
-	    {
-	       handleOnTheFlyReconfiguration(log, client, *m, parts, headers);
-	       continue;
-	    }
+	    sendHead(log, client, 304, headers);
+	    return;
 	 }
+      }
 
-	 // string replacements in the requested filename
-	 ::Configuration::Item const *Replaces = _config->Tree("aptwebserver::redirect::replace");
-	 if (Replaces != NULL)
+      if (_config->FindB("aptwebserver::support::range", true) == true)
+	 condition = LookupTag(request, "Range", "");
+      else
+	 condition.clear();
+      if (condition.empty() == false && strncmp(condition.c_str(), "bytes=", 6) == 0)
+      {
+	 std::string ranges = ',' + _config->Find("aptwebserver::response-header::Accept-Ranges") + ',';
+	 ranges.erase(std::remove(ranges.begin(), ranges.end(), ' '), ranges.end());
+	 if (ranges.find(",bytes,") == std::string::npos)
 	 {
-	    std::string redirect = "/" + filename;
-	    for (::Configuration::Item *I = Replaces->Child; I != NULL; I = I->Next)
-	       redirect = SubstVar(redirect, I->Tag, I->Value);
-	    if (redirect.empty() == false && redirect[0] == '/')
-	       redirect.erase(0,1);
-	    if (redirect != filename)
-	    {
-	       sendRedirect(log, client, _config->FindI("aptwebserver::redirect::httpcode", 301), redirect, *m, sendContent);
-	       continue;
-	    }
+	    // we handle it as an error here because we are a test server - a real one should just ignore it
+	    sendError(log, client, 400, request, sendContent, "Client does range requests we don't support", headers);
+	    return;
 	 }
 
-	 ::Configuration::Item const *Overwrite = _config->Tree("aptwebserver::overwrite");
-	 if (Overwrite != NULL)
+	 time_t cache;
+	 std::string ifrange;
+	 if (_config->FindB("aptwebserver::support::if-range", true) == true)
+	    ifrange = LookupTag(request, "If-Range", "");
+	 bool validrange = (ifrange.empty() == true ||
+	       (RFC1123StrToTime(ifrange, cache) == true &&
+		cache <= data.ModificationTime()));
+
+	 // FIXME: support multiple byte-ranges (APT clients do not do this)
+	 if (condition.find(',') == std::string::npos)
 	 {
-	    for (::Configuration::Item *I = Overwrite->Child; I != NULL; I = I->Next)
+	    size_t start = 6;
+	    unsigned long long filestart = strtoull(condition.c_str() + start, NULL, 10);
+	    // FIXME: no support for last-byte-pos being not the end of the file (APT clients do not do this)
+	    size_t dash = condition.find('-') + 1;
+	    unsigned long long fileend = strtoull(condition.c_str() + dash, NULL, 10);
+	    unsigned long long filesize = data.FileSize();
+	    if ((fileend == 0 || (fileend == filesize && fileend >= filestart)) &&
+		  validrange == true)
 	    {
-	       regex_t *pattern = new regex_t;
-	       int const res = regcomp(pattern, I->Tag.c_str(), REG_EXTENDED | REG_ICASE | REG_NOSUB);
-	       if (res != 0)
+	       if (filesize > filestart)
 	       {
-		  char error[300];
-		  regerror(res, pattern, error, sizeof(error));
-		  sendError(log, client, 500, *m, sendContent, error, headers);
-		  continue;
+		  data.Skip(filestart);
+		  // make sure to send content-range before conent-length
+		  // as regression test for LP: #1445239
+		  std::ostringstream contentrange;
+		  contentrange << "Content-Range: bytes " << filestart << "-"
+		     << filesize - 1 << "/" << filesize;
+		  headers.push_back(contentrange.str());
+		  std::ostringstream contentlength;
+		  contentlength << "Content-Length: " << (filesize - filestart);
+		  headers.push_back(contentlength.str());
+		  sendHead(log, client, 206, headers);
+		  if (sendContent == true)
+		     sendFile(client, headers, data);
+		  return;
 	       }
-	       if (regexec(pattern, filename.c_str(), 0, 0, 0) == 0)
+	       else
 	       {
-		  filename = _config->Find("aptwebserver::overwrite::" + I->Tag + "::filename", flNotDir(filename));
-		  if (filename.find("/") == std::string::npos)
+		  if (_config->FindB("aptwebserver::support::content-range", true) == true)
 		  {
-		     auto directory = _config->Find("aptwebserver::overwrite::" + I->Tag + "::directory", flNotFile(filename));
-		     filename = flCombine(directory, filename);
+		     std::ostringstream contentrange;
+		     contentrange << "Content-Range: bytes */" << filesize;
+		     headers.push_back(contentrange.str());
 		  }
-		  if (filename.empty() == false && filename[0] == '/')
-		     filename.erase(0,1);
-		  if (filename.empty())
-		     filename = "./";
-		  regfree(pattern);
-		  break;
+		  sendError(log, client, 416, request, sendContent, "", headers);
+		  return;
 	       }
-	       regfree(pattern);
 	    }
 	 }
+      }
 
-	 // automatic retry can be tested with this
+      addFileHeaders(headers, data);
+      sendHead(log, client, 200, headers);
+      if (sendContent == true)
+	 sendFile(client, headers, data);
+   }
+   else if (DirectoryExists(filename) == true)
+   {
+      if (filename[filename.length()-1] == '/')
+	 sendDirectoryListing(log, client, filename, request, sendContent, headers);
+      else
+	 sendRedirect(log, client, 301, filename.append("/"), request, sendContent);
+   }
+   else
+      sendError(log, client, 404, request, sendContent, "", headers);
+}
+									/*}}}*/
+// HTTP/2 with prior knowledge - RFC 7540 §3.4				/*{{{*/
+/* Requests are handled by handleRequest as HTTP/1.1 requests and their
+   responses, written to a temporary file, are sent as HEADERS and DATA
+   frames. Requests are answered one after the other, but all streams not
+   answered yet count against the SETTINGS_MAX_CONCURRENT_STREAMS we
+   announce, so a client opening more is refused. */
+static bool hasHttp2Preface(int const client)
+{
+   std::string const preface = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+   char buffer[24];
+   ssize_t size = recv(client, buffer, preface.length(), MSG_PEEK);
+   if (size > 0 && size_t(size) < preface.length() && preface.compare(0, size, buffer, size) == 0)
+      size = recv(client, buffer, preface.length(), MSG_PEEK | MSG_WAITALL);
+   return size_t(size) == preface.length() && preface.compare(0, size, buffer, size) == 0;
+}
+static std::string http2UInt32(uint32_t const value)
+{
+   std::string data;
+   for (int shift = 24; shift >= 0; shift -= 8)
+      data.push_back(static_cast<char>(value >> shift));
+   return data;
+}
+static uint32_t http2ReadUInt32(char const * const data)
+{
+   auto const d = reinterpret_cast<unsigned char const *>(data);
+   return uint32_t(d[0]) << 24 | uint32_t(d[1]) << 16 | uint32_t(d[2]) << 8 | d[3];
+}
+class Http2Client
+{
+   enum : uint8_t { DATA = 0x0, HEADERS = 0x1, RST_STREAM = 0x3, SETTINGS = 0x4,
+      PING = 0x6, GOAWAY = 0x7, WINDOW_UPDATE = 0x8, CONTINUATION = 0x9 };
+   enum : uint8_t { FLAG_ACK = 0x1, FLAG_END_STREAM = 0x1, FLAG_END_HEADERS = 0x4,
+      FLAG_PADDED = 0x8, FLAG_PRIORITY = 0x20 };
+   // the default SETTINGS_MAX_FRAME_SIZE of the client
+   static constexpr size_t maxframesize = 16384;
+
+   std::ostream &log;
+   int const client;
+   uint32_t const maxstreams;
+   bool settingsacked = false;
+   std::string input;
+   HpackDecoder decoder;
+   uint32_t headerstream = 0;
+   std::string headerblock;
+   // streams not answered yet with their request in HTTP/1.1 form
+   std::deque<std::pair<uint32_t, std::string>> requests;
+   // what we may send on the connection and on each stream
+   int64_t connectionwindow = 65535;
+   int64_t initialwindow = 65535;
+   std::unordered_map<uint32_t, int64_t> windows;
+
+   bool sendFrame(uint8_t const type, uint8_t const flags, uint32_t const id, std::string const &payload)
+   {
+      std::string frame;
+      frame.push_back(static_cast<char>(payload.length() >> 16));
+      frame.push_back(static_cast<char>(payload.length() >> 8));
+      frame.push_back(static_cast<char>(payload.length()));
+      frame.push_back(static_cast<char>(type));
+      frame.push_back(static_cast<char>(flags));
+      frame.append(http2UInt32(id)).append(payload);
+      return FileFd::Write(client, frame.data(), frame.length());
+   }
+   bool protocolError(char const * const msg)
+   {
+      log << "HTTP/2 PROTOCOL ERROR from " << client << ": " << msg << std::endl;
+      sendFrame(GOAWAY, 0, 0, http2UInt32(0) + http2UInt32(0x1));
+      return false;
+   }
+   bool handleHeaders(uint32_t const id)
+   {
+      std::vector<std::pair<std::string, std::string>> fields;
+      if (decoder.Decode(headerblock, fields) == false)
+	 return protocolError("Invalid header block");
+      // settings only apply once the client acknowledged them
+      if (settingsacked == true && requests.size() >= maxstreams)
+      {
+	 log << "REFUSED stream " << id << " of " << client << " as " << requests.size() << " streams are open" << std::endl;
+	 return sendFrame(RST_STREAM, 0, id, http2UInt32(0x7));
+      }
+      std::string method, path, fieldlines;
+      for (auto const &f : fields)
+      {
+	 if (f.first == ":method")
+	    method = f.second;
+	 else if (f.first == ":path")
+	    path = f.second;
+	 else if (f.first == ":authority")
+	    fieldlines.append("Host: ").append(f.second).append("\r\n");
+	 else if (f.first.empty() == false && f.first[0] != ':')
+	    fieldlines.append(f.first).append(": ").append(f.second).append("\r\n");
+      }
+      requests.emplace_back(id, method + " " + path + " HTTP/1.1\r\n" + fieldlines + "\r\n");
+      windows[id] = initialwindow;
+      return true;
+   }
+   bool handleFrame(uint8_t const type, uint8_t const flags, uint32_t const id, char const *data, uint32_t length)
+   {
+      if (headerstream != 0 && (type != CONTINUATION || id != headerstream))
+	 return protocolError("Header block was interrupted");
+      if (type == HEADERS && (flags & FLAG_PADDED) != 0)
+      {
+	 if (length == 0 || static_cast<unsigned char>(data[0]) >= length)
+	    return protocolError("Invalid padding");
+	 length -= static_cast<unsigned char>(data[0]) + 1;
+	 ++data;
+      }
+      if (type == HEADERS && (flags & FLAG_PRIORITY) != 0)
+      {
+	 if (length < 5)
+	    return protocolError("Invalid priority");
+	 length -= 5;
+	 data += 5;
+      }
+
+      switch (type)
+      {
+	 case HEADERS:
+	    if (id == 0 || (id % 2) == 0)
+	       return protocolError("Invalid stream for HEADERS");
+	    headerblock.assign(data, length);
+	    if ((flags & FLAG_END_HEADERS) != 0)
+	       return handleHeaders(id);
+	    headerstream = id;
+	    return true;
+	 case CONTINUATION:
+	    if (headerstream == 0)
+	       return protocolError("Unexpected CONTINUATION frame");
+	    headerblock.append(data, length);
+	    if ((flags & FLAG_END_HEADERS) == 0)
+	       return true;
+	    headerstream = 0;
+	    return handleHeaders(id);
+	 case SETTINGS:
+	    if (id != 0 || length % 6 != 0)
+	       return protocolError("Invalid SETTINGS frame");
+	    if ((flags & FLAG_ACK) != 0)
+	    {
+	       settingsacked = true;
+	       return true;
+	    }
+	    for (uint32_t i = 0; i < length; i += 6)
+	    {
+	       // SETTINGS_INITIAL_WINDOW_SIZE changes the windows of all streams
+	       if (data[i] != 0 || data[i + 1] != 0x4)
+		  continue;
+	       int64_t const window = http2ReadUInt32(data + i + 2);
+	       for (auto &w : windows)
+		  w.second += window - initialwindow;
+	       initialwindow = window;
+	    }
+	    return sendFrame(SETTINGS, FLAG_ACK, 0, "");
+	 case WINDOW_UPDATE:
 	 {
-	    int failrequests = _config->FindI("aptwebserver::failrequest::" + filename, 0);
-	    if (failrequests != 0)
+	    if (length != 4)
+	       return protocolError("Invalid WINDOW_UPDATE frame");
+	    uint32_t const increment = http2ReadUInt32(data) & 0x7fffffff;
+	    if (id == 0)
+	       connectionwindow += increment;
+	    else
 	    {
-	       --failrequests;
-	       _config->Set(("aptwebserver::failrequest::" + filename).c_str(), failrequests);
-	       sendError(log, client, _config->FindI("aptwebserver::failrequest", 400), *m, sendContent, "Server is configured to fail this file.", headers);
-	       continue;
+	       auto const w = windows.find(id);
+	       if (w != windows.end())
+		  w->second += increment;
 	    }
+	    return true;
 	 }
-
-	 // deal with the request
-	 unsigned int const httpsport = _config->FindI("aptwebserver::port::https", 4433);
-	 std::string hosthttpsport;
-	 strprintf(hosthttpsport, ":%u", httpsport);
-	 if (_config->FindB("aptwebserver::support::http", true) == false &&
-	       LookupTag(*m, "Host").find(hosthttpsport) == std::string::npos)
+	 case RST_STREAM:
+	    requests.erase(std::remove_if(requests.begin(), requests.end(),
+		     [&](std::pair<uint32_t, std::string> const &r) { return r.first == id; }), requests.end());
+	    windows.erase(id);
+	    return true;
+	 case PING:
+	    if ((flags & FLAG_ACK) != 0)
+	       return true;
+	    return sendFrame(PING, FLAG_ACK, 0, std::string(data, length));
+	 case GOAWAY:
+	    log << "GOAWAY from " << client << std::endl;
+	    return false;
+      }
+      return true;
+   }
+   // reads and handles frames, waiting for the first ones if asked to
+   bool readFrames(bool const wait)
+   {
+      int timeout = wait ? -1 : 0;
+      while (true)
+      {
+	 struct pollfd p = {client, POLLIN, 0};
+	 int const ready = poll(&p, 1, timeout);
+	 if (ready < 0 && errno == EINTR)
+	    continue;
+	 else if (ready <= 0)
+	    return ready == 0;
+	 char buffer[4096];
+	 ssize_t const size = read(client, buffer, sizeof(buffer));
+	 if (size <= 0)
+	    return false;
+	 input.append(buffer, size);
+	 size_t pos = 0;
+	 while (input.length() - pos >= 9)
 	 {
-	    sendError(log, client, 400, *m, sendContent, "HTTP disabled, all requests must be HTTPS", headers);
+	    auto const h = reinterpret_cast<unsigned char const *>(input.data() + pos);
+	    uint32_t const length = uint32_t(h[0]) << 16 | uint32_t(h[1]) << 8 | h[2];
+	    if (length > maxframesize)
+	       return protocolError("Frame exceeds the maximum size");
+	    if (input.length() - pos < 9 + length)
+	       break;
+	    uint32_t const id = http2ReadUInt32(input.data() + pos + 5) & 0x7fffffff;
+	    if (handleFrame(h[3], h[4], id, input.data() + pos + 9, length) == false)
+	       return false;
+	    pos += 9 + length;
+	 }
+	 input.erase(0, pos);
+	 timeout = 0;
+      }
+   }
+   bool sendResponse(uint32_t const id, std::string const &request)
+   {
+      std::unique_ptr<FileFd> responsefile(GetTempFile("aptwebserver-http2"));
+      if (responsefile == nullptr)
+	 return false;
+      log << "HTTP/2 stream " << id << " of client " << client << " answered via " << responsefile->Fd() << std::endl;
+      bool closeConnection = false;
+      std::list<std::string> headers;
+      handleRequest(log, responsefile->Fd(), request, closeConnection, headers);
+      std::string response;
+      char buffer[4096];
+      unsigned long long actual = 0;
+      if (responsefile->Seek(0) == false)
+	 return false;
+      while (responsefile->Read(buffer, sizeof(buffer), &actual) == true && actual != 0)
+	 response.append(buffer, actual);
+
+      size_t const headersend = response.find("\r\n\r\n");
+      if (response.compare(0, 9, "HTTP/1.1 ") != 0 || headersend == std::string::npos)
+	 return false;
+      std::string block;
+      HpackEncodeHeader(block, ":status", response.substr(9, 3));
+      bool chunked = false;
+      for (auto const &line : VectorizeString(response.substr(0, headersend), '\n'))
+      {
+	 auto const colon = line.find(':');
+	 if (colon == std::string::npos)
 	    continue;
+	 std::string name = line.substr(0, colon);
+	 std::transform(name.begin(), name.end(), name.begin(), tolower_ascii);
+	 std::string const value = APT::String::Strip(line.substr(colon + 1));
+	 // connection-specific fields are not allowed in HTTP/2
+	 if (name == "transfer-encoding")
+	    chunked = true;
+	 else if (name != "connection" && name != "keep-alive")
+	    HpackEncodeHeader(block, name, value);
+      }
+      std::string body;
+      if (chunked == true)
+      {
+	 for (size_t pos = headersend + 4; pos < response.length();)
+	 {
+	    size_t const size = strtoul(response.c_str() + pos, nullptr, 16);
+	    pos = response.find("\r\n", pos);
+	    if (size == 0 || pos == std::string::npos)
+	       break;
+	    body.append(response, pos + 2, size);
+	    pos += 2 + size + 2;
 	 }
-	 else if (RealFileExists(filename) == true)
+      }
+      else
+	 body = response.substr(headersend + 4);
+
+      if (sendFrame(HEADERS, FLAG_END_HEADERS | (body.empty() ? FLAG_END_STREAM : 0), id, block) == false)
+	 return false;
+      for (size_t pos = 0; pos < body.length();)
+      {
+	 auto const w = windows.find(id);
+	 // reset by the client
+	 if (w == windows.end())
+	    return true;
+	 int64_t const size = std::min({int64_t(body.length() - pos), int64_t(maxframesize), connectionwindow, w->second});
+	 if (size <= 0)
 	 {
-	    FileFd data(filename, FileFd::ReadOnly);
-	    std::string condition = LookupTag(*m, "If-Modified-Since", "");
-	    if (_config->FindB("aptwebserver::support::modified-since", true) == true && condition.empty() == false)
-	    {
-	       time_t cache;
-	       if (RFC1123StrToTime(condition, cache) == true &&
-		     cache >= data.ModificationTime())
-	       {
-		  sendHead(log, client, 304, headers);
-		  continue;
-	       }
-	    }
+	    if (readFrames(true) == false)
+	       return false;
+	    continue;
+	 }
+	 if (sendFrame(DATA, (pos + size == body.length()) ? FLAG_END_STREAM : 0, id, body.substr(pos, size)) == false)
+	    return false;
+	 connectionwindow -= size;
+	 w->second -= size;
+	 pos += size;
+      }
+      return true;
+   }
 
-	    if (_config->FindB("aptwebserver::support::range", true) == true)
-	       condition = LookupTag(*m, "Range", "");
-	    else
-	       condition.clear();
-	    if (condition.empty() == false && strncmp(condition.c_str(), "bytes=", 6) == 0)
-	    {
-	       std::string ranges = ',' + _config->Find("aptwebserver::response-header::Accept-Ranges") + ',';
-	       ranges.erase(std::remove(ranges.begin(), ranges.end(), ' '), ranges.end());
-	       if (ranges.find(",bytes,") == std::string::npos)
-	       {
-		  // we handle it as an error here because we are a test server - a real one should just ignore it
-		  sendError(log, client, 400, *m, sendContent, "Client does range requests we don't support", headers);
-		  continue;
-	       }
+   public:
+   void run()
+   {
+      // the preface was only peeked at so far
+      char preface[24];
+      if (recv(client, preface, sizeof(preface), MSG_WAITALL) != sizeof(preface))
+	 return;
+      std::string settings;
+      settings.push_back(0);
+      settings.push_back(0x3);
+      settings.append(http2UInt32(maxstreams));
+      if (sendFrame(SETTINGS, 0, 0, settings) == false)
+	 return;
+      while (readFrames(requests.empty()) == true)
+      {
+	 if (requests.empty())
+	    continue;
+	 auto const current = requests.front();
+	 if (sendResponse(current.first, current.second) == false)
+	    break;
+	 requests.erase(std::remove_if(requests.begin(), requests.end(),
+		  [&](std::pair<uint32_t, std::string> const &r) { return r.first == current.first; }), requests.end());
+	 windows.erase(current.first);
+	 _error->DumpErrors(std::cerr);
+      }
+   }
 
-	       time_t cache;
-	       std::string ifrange;
-	       if (_config->FindB("aptwebserver::support::if-range", true) == true)
-		  ifrange = LookupTag(*m, "If-Range", "");
-	       bool validrange = (ifrange.empty() == true ||
-		     (RFC1123StrToTime(ifrange, cache) == true &&
-		      cache <= data.ModificationTime()));
+   Http2Client(std::ostream &log, int const client) : log(log), client(client),
+      maxstreams(_config->FindI("aptwebserver::http2::max-concurrent-streams", 100))
+   {
+   }
+};
+									/*}}}*/
+static void * handleClient(int const client, size_t const id)		/*{{{*/
+{
+   auto logfilepath = _config->FindFile("aptwebserver::logfiles");
+   if (logfilepath.empty() == false)
+      strprintf(logfilepath, "%s.client-%lu.log", logfilepath.c_str(), id);
+   else
+      logfilepath = "/dev/null";
+   std::ofstream logfile(logfilepath);
+   basic_teeostream<char> log(std::clog, logfile);
 
-	       // FIXME: support multiple byte-ranges (APT clients do not do this)
-	       if (condition.find(',') == std::string::npos)
-	       {
-		  size_t start = 6;
-		  unsigned long long filestart = strtoull(condition.c_str() + start, NULL, 10);
-		  // FIXME: no support for last-byte-pos being not the end of the file (APT clients do not do this)
-		  size_t dash = condition.find('-') + 1;
-		  unsigned long long fileend = strtoull(condition.c_str() + dash, NULL, 10);
-		  unsigned long long filesize = data.FileSize();
-		  if ((fileend == 0 || (fileend == filesize && fileend >= filestart)) &&
-			validrange == true)
-		  {
-		     if (filesize > filestart)
-		     {
-			data.Skip(filestart);
-                        // make sure to send content-range before conent-length
-                        // as regression test for LP: #1445239
-			std::ostringstream contentrange;
-			contentrange << "Content-Range: bytes " << filestart << "-"
-			   << filesize - 1 << "/" << filesize;
-			headers.push_back(contentrange.str());
-			std::ostringstream contentlength;
-			contentlength << "Content-Length: " << (filesize - filestart);
-			headers.push_back(contentlength.str());
-			sendHead(log, client, 206, headers);
-			if (sendContent == true)
-			   sendFile(client, headers, data);
-			continue;
-		     }
-		     else
-		     {
-			if (_config->FindB("aptwebserver::support::content-range", true) == true)
-			{
-			   std::ostringstream contentrange;
-			   contentrange << "Content-Range: bytes */" << filesize;
-			   headers.push_back(contentrange.str());
-			}
-			sendError(log, client, 416, *m, sendContent, "", headers);
-			continue;
-		     }
-		  }
-	       }
-	    }
+   log << "ACCEPT client " << client << std::endl;
+   bool closeConnection = false;
+   if (_config->FindB("aptwebserver::support::http2", true) == true && hasHttp2Preface(client) == true)
+   {
+      log << "HTTP/2 client " << client << std::endl;
+      Http2Client(log, client).run();
+      closeConnection = true;
+   }
+   while (closeConnection == false)
+   {
+      std::vector<std::string> messages;
+      if (ReadMessages(client, messages) == false)
+	 break;
 
-	    addFileHeaders(headers, data);
-	    sendHead(log, client, 200, headers);
-	    if (sendContent == true)
-	       sendFile(client, headers, data);
-	 }
-	 else if (DirectoryExists(filename) == true)
+      std::list<std::string> headers;
+      for (std::vector<std::string>::const_iterator m = messages.begin();
+	    m != messages.end() && closeConnection == false; ++m) {
+	 // if we announced a closing in previous response, do the close now
+	 if (std::find(headers.begin(), headers.end(), std::string("Connection: close")) != headers.end())
 	 {
-	    if (filename[filename.length()-1] == '/')
-	       sendDirectoryListing(log, client, filename, *m, sendContent, headers);
-	    else
-	       sendRedirect(log, client, 301, filename.append("/"), *m, sendContent);
+	    closeConnection = true;
+	    break;
 	 }
-	 else
-	    sendError(log, client, 404, *m, sendContent, "", headers);
+	 headers.clear();
+
+	 handleRequest(log, client, *m, closeConnection, headers);
       }
 
       // if we announced a closing in the last response, do the close now
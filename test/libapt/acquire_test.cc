@@ -0,0 +1,125 @@
+#include <config.h>
+
+#include <apt-pkg/acquire-item.h>
+#include <apt-pkg/acquire.h>
+#include <apt-pkg/configuration.h>
+#include <apt-pkg/error.h>
+#include <apt-pkg/fileutl.h>
+#include <apt-pkg/hashes.h>
+
+#include <algorithm>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "file-helpers.h"
+
+class PipelineStatus : public pkgAcquireStatus
+{
+   public:
+   unsigned long MaxPipelineDepth = 0;
+   unsigned long MaxConnections = 0;
+
+   virtual bool MediaChange(std::string, std::string) APT_OVERRIDE { return false; }
+   virtual bool Pulse(pkgAcquire *Owner) APT_OVERRIDE
+   {
+      bool const Res = pkgAcquireStatus::Pulse(Owner);
+      MaxPipelineDepth = std::max(MaxPipelineDepth, GetPipelineDepth());
+      MaxConnections = std::max(MaxConnections, GetConnections());
+      return Res;
+   }
+   PipelineStatus() { MorePulses = true; }
+};
+
+/* A method answering each request after a delay, either all of them at
+   the same time like a server with plenty of capacity or one after the
+   other like a server which can't keep up with the pipeline. */
+static void FetchFromFakeServer(PipelineStatus &Stat, char const * const Delay, bool const Parallel, int const Items)
+{
+   std::string tempdir;
+   createTemporaryDirectory("acquire", tempdir);
+   std::string const method = tempdir + "/fake";
+   {
+      FileFd fd;
+      ASSERT_TRUE(fd.Open(method, FileFd::WriteOnly | FileFd::Create | FileFd::Empty, 0755));
+      std::string const script = std::string("#!/bin/sh\n"
+	 "printf '100 Capabilities\\nVersion: 1.2\\nPipeline: true\\n\\n'\n"
+	 "answer() {\n"
+	 "   sleep ") + Delay + "\n"
+	 "   : > \"$2\"\n"
+	 "   printf '200 URI Start\\nURI: %s\\nSize: 0\\n\\n201 URI Done\\nURI: %s\\nFilename: %s\\nSize: 0\\n\\n' \"$1\" \"$1\" \"$2\"\n"
+	 "}\n"
+	 "uri=''\n"
+	 "while read -r line; do\n"
+	 "   case \"$line\" in\n"
+	 "   'URI: '*) uri=\"${line#URI: }\";;\n"
+	 "   'Filename: '*) file=\"${line#Filename: }\";;\n"
+	 "   '') if [ -n \"$uri\" ]; then answer \"$uri\" \"$file\"" + (Parallel ? " &" : ";") + " uri=''; fi;;\n"
+	 "   esac\n"
+	 "done\n"
+	 "wait\n";
+      ASSERT_TRUE(fd.Write(script.c_str(), script.length()));
+      ASSERT_TRUE(fd.Close());
+   }
+   _config->Set("Dir::Bin::Methods::fake", method);
+   _config->Set("APT::Sandbox::User", "root");
+
+   {
+      pkgAcquire Acq(&Stat);
+      for (int I = 0; I < Items; ++I)
+      {
+	 std::string const name = "file" + std::to_string(I);
+	 new pkgAcqFile(&Acq, "fake://example.org/" + name, HashStringList(), 0, name, name, tempdir);
+      }
+      EXPECT_EQ(pkgAcquire::Continue, Acq.Run());
+      for (auto I = Acq.ItemsBegin(); I != Acq.ItemsEnd(); ++I)
+	 EXPECT_EQ(pkgAcquire::Item::StatDone, (*I)->Status) << (*I)->ErrorText;
+   }
+   EXPECT_TRUE(_error->empty());
+   _error->DumpErrors();
+
+   removeDirectory(tempdir);
+   _config->Clear("Dir::Bin::Methods::fake");
+   _config->Clear("APT::Sandbox::User");
+}
+
+TEST(AcquireTest, FixedPipelineDepth)
+{
+   PipelineStatus Stat;
+   FetchFromFakeServer(Stat, "0.01", false, 20);
+   EXPECT_EQ(10u, Stat.MaxPipelineDepth);
+   EXPECT_EQ(1u, Stat.MaxConnections);
+}
+TEST(AcquireTest, AdaptivePipelineDepthGrows)
+{
+   _config->Set("Acquire::Adaptive-Pipeline-Depth", true);
+   PipelineStatus Stat;
+   // all answers arrive as fast as the first ones
+   FetchFromFakeServer(Stat, "0.1", true, 40);
+   EXPECT_LT(5u, Stat.MaxPipelineDepth);
+   EXPECT_GE(10u, Stat.MaxPipelineDepth);
+   EXPECT_EQ(1u, Stat.MaxConnections);
+   _config->Clear("Acquire::Adaptive-Pipeline-Depth");
+}
+TEST(AcquireTest, AdaptivePipelineDepthShrinks)
+{
+   _config->Set("Acquire::Adaptive-Pipeline-Depth", true);
+   PipelineStatus Stat;
+   // the later requests in the pipeline have to wait for the earlier ones
+   FetchFromFakeServer(Stat, "0.03", false, 30);
+   EXPECT_LE(2u, Stat.MaxPipelineDepth);
+   EXPECT_GT(8u, Stat.MaxPipelineDepth);
+   EXPECT_EQ(1u, Stat.MaxConnections);
+   _config->Clear("Acquire::Adaptive-Pipeline-Depth");
+}
+TEST(AcquireTest, MoreConnections)
+{
+   _config->Set("Acquire::Adaptive-Pipeline-Depth", true);
+   _config->Set("Acquire::QueueHost::Max-Connections", 2);
+   PipelineStatus Stat;
+   // keeps the pipeline saturated long enough to open another connection
+   FetchFromFakeServer(Stat, "0.05", false, 70);
+   EXPECT_EQ(2u, Stat.MaxConnections);
+   _config->Clear("Acquire::QueueHost::Max-Connections");
+   _config->Clear("Acquire::Adaptive-Pipeline-Depth");
+}
@@ -0,0 +1,117 @@
+#include <config.h>
+
+#include <apt-pkg/acquire-local.h>
+#include <apt-pkg/configuration.h>
+#include <apt-pkg/error.h>
+#include <apt-pkg/fileutl.h>
+#include <apt-pkg/hashes.h>
+
+#include <string>
+
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+#include "file-helpers.h"
+
+using APT::Internal::LocalFetcher;
+
+static char const * const Content = "Package: foo\nVersion: 1\n";
+
+static void FetchWith(LocalFetcher &Fetcher, LocalFetcher::Item const &Itm,
+		      LocalFetcher::Result &Res, LocalFetcher::Result &Alt, bool &HasAlt)
+{
+   Fetcher.Start = [](LocalFetcher::Result const &) {};
+   Fetcher.Done = [&](LocalFetcher::Result const &R, LocalFetcher::Result const *A) {
+      Res = R;
+      HasAlt = A != nullptr;
+      if (HasAlt)
+	 Alt = *A;
+   };
+   EXPECT_TRUE(Fetcher.Fetch(Itm));
+   EXPECT_TRUE(_error->empty());
+   _error->DumpErrors();
+}
+
+TEST(AcquireLocalTest, StoreExtracts)
+{
+   std::string tempdir;
+   createTemporaryDirectory("acquirelocal", tempdir);
+   {
+      FileFd fd;
+      ASSERT_TRUE(fd.Open(tempdir + "/Packages.gz", FileFd::WriteOnly | FileFd::Create, FileFd::Extension));
+      ASSERT_TRUE(fd.Write(Content, strlen(Content)));
+      ASSERT_TRUE(fd.Close());
+   }
+   Hashes expected(Hashes::SHA256SUM);
+   expected.Add(reinterpret_cast<unsigned char const *>(Content), strlen(Content));
+
+   LocalFetcher::Item Itm;
+   Itm.Uri = "store:" + tempdir + "/Packages.gz";
+   Itm.DestFile = tempdir + "/Packages";
+   Itm.ExpectedHashes = expected.GetHashStringList();
+
+   LocalFetcher Fetcher("store", false);
+   LocalFetcher::Result Res, Alt;
+   bool HasAlt = true;
+   FetchWith(Fetcher, Itm, Res, Alt, HasAlt);
+   EXPECT_FALSE(HasAlt);
+   EXPECT_EQ(Itm.DestFile, Res.Filename);
+   EXPECT_EQ(strlen(Content), Res.Size);
+   // only the expected hashes are calculated
+   EXPECT_EQ(expected.GetHashStringList(), Res.Hashes);
+   EXPECT_EQ(nullptr, Res.Hashes.find("SHA512"));
+   EXPECT_TRUE(Itm.ExpectedHashes.VerifyFile(Itm.DestFile));
+
+   removeDirectory(tempdir);
+}
+TEST(AcquireLocalTest, FileOffersUncompressed)
+{
+   std::string tempdir;
+   createTemporaryDirectory("acquirelocal", tempdir);
+   createFile(tempdir, "Packages.xz");
+   createFile(tempdir, "Packages");
+
+   LocalFetcher::Item Itm;
+   Itm.Uri = "file:" + tempdir + "/Packages.xz";
+   Itm.DestFile = tempdir + "/partial-Packages.xz";
+
+   LocalFetcher Fetcher("file", false);
+   LocalFetcher::Result Res, Alt;
+   bool HasAlt = false;
+   FetchWith(Fetcher, Itm, Res, Alt, HasAlt);
+   EXPECT_EQ(tempdir + "/Packages.xz", Res.Filename);
+   // without expected hashes all of them are calculated
+   EXPECT_NE(nullptr, Res.Hashes.find("SHA256"));
+   EXPECT_NE(nullptr, Res.Hashes.find("SHA512"));
+   ASSERT_TRUE(HasAlt);
+   EXPECT_EQ(tempdir + "/Packages", Alt.Filename);
+
+   removeDirectory(tempdir);
+}
+TEST(AcquireLocalTest, ForceHashMissingCalculatesAll)
+{
+   std::string tempdir;
+   createTemporaryDirectory("acquirelocal", tempdir);
+   createFile(tempdir, "source");
+
+   LocalFetcher::Item Itm;
+   Itm.Uri = "copy:" + tempdir + "/source";
+   Itm.DestFile = tempdir + "/target";
+   Itm.ExpectedHashes.push_back(HashString("SHA256", "0123456789abcdef"));
+
+   // the expected hashes lack the forced one, so they are all calculated
+   _config->Set("Acquire::ForceHash", "SHA1");
+   LocalFetcher Fetcher("copy", false);
+   LocalFetcher::Result Res, Alt;
+   bool HasAlt = true;
+   FetchWith(Fetcher, Itm, Res, Alt, HasAlt);
+   _config->Clear("Acquire::ForceHash");
+   EXPECT_FALSE(HasAlt);
+   EXPECT_TRUE(RealFileExists(Itm.DestFile));
+   EXPECT_NE(nullptr, Res.Hashes.find("SHA256"));
+   EXPECT_NE(nullptr, Res.Hashes.find("SHA1"));
+   EXPECT_NE(nullptr, Res.Hashes.find("MD5Sum"));
+
+   removeDirectory(tempdir);
+}
@@ -22,9 +22,12 @@
 #include <apt-pkg/error.h>
 #include <apt-pkg/fileutl.h>
 
+#include <algorithm>
 #include <fstream>
 #include <string>
+#include <vector>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -60,6 +63,15 @@ static bool callDPKG(const char * const val, const char * const ref, char const
    Res = (Res < 0) ? -1 : ( (Res > 0) ? 1 : Res); \
    EXPECT_EQ(compare, Res) << "APT: A: »" << A << "« B: »" << B << "«"; \
    EXPECT_PRED3(callDPKG, A, B,  ((compare == 1) ? ">>" : ( (compare == 0) ? "=" : "<<"))); \
+   std::string KeyA, KeyB; \
+   if (debVS.SortKey(A, KeyA) && debVS.SortKey(B, KeyB)) \
+   { \
+      Res = memcmp(KeyA.data(), KeyB.data(), std::min(KeyA.length(), KeyB.length())); \
+      if (Res == 0) \
+	 Res = KeyA.length() - KeyB.length(); \
+      Res = (Res < 0) ? -1 : ( (Res > 0) ? 1 : Res); \
+      EXPECT_EQ(compare, Res) << "Key: A: »" << A << "« B: »" << B << "«"; \
+   } \
 }
 #define EXPECT_VERSION(A, compare, B) \
    EXPECT_VERSION_PART(A, compare, B); \
@@ -180,3 +192,44 @@ TEST(CompareVersionTest,CuptTests)
    EXPECT_VERSION("2.2.4-47978_Debian_lenny", EQUAL, "2.2.4-47978_Debian_lenny"); // and underscore...
    // */
 }
+TEST(CompareVersionTest,SortKey)
+{
+   std::string Key;
+   EXPECT_FALSE(debVS.SortKey("", Key));
+   EXPECT_FALSE(debVS.SortKey("1:-1", Key));
+   EXPECT_FALSE(debVS.SortKey("1.0\xc3\xa4-1", Key));
+   EXPECT_FALSE(debVS.SortKey("1." + std::string(40, '9'), Key));
+   EXPECT_TRUE(debVS.SortKey("1." + std::string(40, '0') + "1", Key));
+   EXPECT_TRUE(debVS.SortKey("1:2.30~rc1+dfsg-0ubuntu1", Key));
+
+   // the keys have to order all versions exactly as the comparison does
+   char const Chars[] = "0019a~.+-:";
+   std::vector<std::string> Versions;
+   srand(42);
+   for (size_t i = 0; i < 2000; ++i)
+   {
+      std::string Ver;
+      for (size_t l = 1 + rand() % 8; l != 0; --l)
+	 Ver.append(1, Chars[rand() % (sizeof(Chars) - 1)]);
+      Versions.push_back(Ver);
+   }
+   size_t WithKey = 0;
+   for (auto const &A : Versions)
+   {
+      std::string KeyA;
+      if (debVS.SortKey(A, KeyA) == false)
+	 continue;
+      ++WithKey;
+      for (size_t i = 0; i < 100; ++i)
+      {
+	 auto const &B = Versions[rand() % Versions.size()];
+	 std::string KeyB;
+	 if (debVS.SortKey(B, KeyB) == false)
+	    continue;
+	 int const Res = debVS.CmpVersion(A, B);
+	 int const KeyRes = KeyA.compare(KeyB);
+	 EXPECT_EQ((Res > 0) - (Res < 0), (KeyRes > 0) - (KeyRes < 0)) << "A: »" << A << "« B: »" << B << "«";
+      }
+   }
+   EXPECT_LT(Versions.size() / 2, WithKey);
+}
@@ -4,6 +4,7 @@
 #include <apt-pkg/fileutl.h>
 
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <gtest/gtest.h>
@@ -195,6 +196,112 @@ TEST(ConfigurationTest,Merge)
 	EXPECT_EQ("bar", Cnf.Find("option::foo"));
 	EXPECT_EQ("", Cnf.Find("option::empty"));
 }
+TEST(ConfigurationTest,ManyChildren)
+{
+	Configuration Cnf;
+	for (int i = 0; i < 100; ++i)
+		Cnf.Set(("Test::Item" + std::to_string(i)).c_str(), i);
+	Cnf.Set("Test::", "list");
+	EXPECT_EQ(42, Cnf.FindI("Test::Item42"));
+	EXPECT_EQ(42, Cnf.FindI("TEST::item42"));
+	EXPECT_FALSE(Cnf.Exists("Test::Item100"));
+	Cnf.Set("Test::Item100", 100);
+	Cnf.Set("Test::", "list2");
+	EXPECT_EQ(100, Cnf.FindI("Test::item100"));
+
+	std::vector<std::string> vec = Cnf.FindVector("Test");
+	ASSERT_EQ(103u, vec.size());
+	EXPECT_EQ("0", vec[0]);
+	EXPECT_EQ("list", vec[100]);
+	EXPECT_EQ("100", vec[101]);
+	EXPECT_EQ("list2", vec[102]);
+
+	Cnf.Clear("Test", 42);
+	EXPECT_FALSE(Cnf.Exists("Test::Item42"));
+	EXPECT_EQ(43, Cnf.FindI("Test::Item43"));
+	Cnf.Set("Test::Item42", "again");
+	vec = Cnf.FindVector("Test");
+	ASSERT_EQ(103u, vec.size());
+	EXPECT_EQ("again", vec[102]);
+
+	Cnf.MoveSubTree("Test", "Moved");
+	EXPECT_FALSE(Cnf.Exists("Test::Item43"));
+	EXPECT_EQ(43, Cnf.FindI("Moved::Item43"));
+	Cnf.Clear("Moved");
+	EXPECT_FALSE(Cnf.Exists("Moved::Item43"));
+	Cnf.Set("Moved::Item43", 44);
+	EXPECT_EQ(44, Cnf.FindI("Moved::item43"));
+}
+TEST(ConfigurationTest,ManyChildrenThroughSubtree)
+{
+	Configuration Cnf;
+	for (int i = 0; i < 100; ++i)
+		Cnf.Set(("Top::Test::Item" + std::to_string(i)).c_str(), i);
+	EXPECT_EQ(5, Cnf.FindI("Top::Test::Item5"));
+	{
+		Configuration Sub(Cnf.Tree("Top"));
+		Sub.Set("Test::New", 100);
+		Sub.Clear("Test", 5);
+		EXPECT_EQ(100, Sub.FindI("Test::new"));
+		EXPECT_FALSE(Sub.Exists("Test::Item5"));
+	}
+	EXPECT_EQ(100, Cnf.FindI("Top::Test::New"));
+	EXPECT_FALSE(Cnf.Exists("Top::Test::Item5"));
+	EXPECT_EQ(6, Cnf.FindI("Top::Test::Item6"));
+	Cnf.Set("Top::Test::Item5", 5);
+	EXPECT_EQ(5, Cnf.FindI("Top::TEST::Item5"));
+}
+TEST(ConfigurationTest,ManyChildrenInThreads)
+{
+	Configuration Cnf;
+	for (int i = 0; i < 100; ++i)
+		Cnf.Set(("Test::Item" + std::to_string(i)).c_str(), i);
+	std::vector<int> Failed(4, 0);
+	std::vector<std::thread> Threads;
+	for (size_t t = 0; t < Failed.size(); ++t)
+		Threads.emplace_back([&Cnf, &Failed, t]() {
+			for (int r = 0; r < 100; ++r)
+				for (int i = 0; i < 100; ++i)
+					if (Cnf.FindI(("Test::Item" + std::to_string(i)).c_str(), -1) != i)
+						++Failed[t];
+		});
+	for (auto &T : Threads)
+		T.join();
+	for (auto const F : Failed)
+		EXPECT_EQ(0, F);
+}
+TEST(ConfigurationTest,Option)
+{
+	Configuration * const OldConfig = _config;
+	_config = new Configuration;
+	Configuration::Option<int> const Number("Test::Number", 3);
+	Configuration::Option<bool> const Bool("Test::Bool", true);
+	Configuration::Option<std::string> const String("Test::String", "default");
+	EXPECT_EQ(3, *Number);
+	EXPECT_TRUE(*Bool);
+	EXPECT_EQ("default", *String);
+
+	_config->Set("Test::Number", 4);
+	_config->Set("Test::Bool", false);
+	_config->Set("Test::String", "set");
+	EXPECT_EQ(4, *Number);
+	EXPECT_FALSE(*Bool);
+	EXPECT_EQ("set", *String);
+	_config->CndSet("Test::Number", 5);
+	EXPECT_EQ(4, *Number);
+
+	_config->Clear("Test");
+	EXPECT_EQ(3, *Number);
+	EXPECT_EQ("default", *String);
+
+	_config->Set("Test::Number", 6);
+	EXPECT_EQ(6, *Number);
+	delete _config;
+	_config = new Configuration;
+	EXPECT_EQ(3, *Number);
+	delete _config;
+	_config = OldConfig;
+}
 TEST(ConfigurationTest, Parsing)
 {
    Configuration Cnf;
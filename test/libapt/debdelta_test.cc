@@ -0,0 +1,152 @@
+#include <config.h>
+
+#include <apt-pkg/aptconfiguration.h>
+#include <apt-pkg/debdelta.h>
+#include <apt-pkg/error.h>
+#include <apt-pkg/fileutl.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <gtest/gtest.h>
+
+#include "file-helpers.h"
+
+static void WriteFile(std::string const &File, std::string const &Content)
+{
+   FileFd fd;
+   ASSERT_TRUE(fd.Open(File, FileFd::WriteOnly | FileFd::Create | FileFd::Empty));
+   ASSERT_TRUE(fd.Write(Content.c_str(), Content.length()));
+   ASSERT_TRUE(fd.Close());
+}
+static std::string ReadFile(std::string const &File)
+{
+   FileFd fd;
+   std::string Content;
+   EXPECT_TRUE(fd.Open(File, FileFd::ReadOnly));
+   char Buffer[APT_BUFFER_SIZE];
+   unsigned long long Actual = 0;
+   while (fd.Read(Buffer, sizeof(Buffer), &Actual) && Actual != 0)
+      Content.append(Buffer, Actual);
+   return Content;
+}
+static void AddMember(std::string &Deb, std::string const &Name, std::string const &Content)
+{
+   char Header[61];
+   snprintf(Header, sizeof(Header), "%-16s%-12u%-6u%-6u%-8o%-10zu`\n", Name.c_str(), 0u, 0u, 0u, 0644u, Content.length());
+   Deb.append(Header, 60).append(Content);
+   if (Content.length() % 2 != 0)
+      Deb.append("\n");
+}
+// the tar is compressed by us, so that a delta knows how to do it again
+static void AddTarMember(std::string &Deb, std::string const &Name, std::string const &Dir)
+{
+   auto const compressors = APT::Configuration::getCompressors();
+   auto gzip = std::find_if(compressors.begin(), compressors.end(), [](auto const &c) { return c.Name == "gzip"; });
+   ASSERT_NE(compressors.end(), gzip);
+   auto compressor = *gzip;
+   compressor.CompressArgs = {"-9"};
+
+   std::string const Tar = flCombine(flNotFile(Dir), Name);
+   ASSERT_EQ(0, system(("tar -c -C '" + Dir + "' --owner=0 --group=0 . > '" + Tar + "'").c_str()));
+   FileFd In, Out;
+   ASSERT_TRUE(In.Open(Tar, FileFd::ReadOnly));
+   ASSERT_TRUE(Out.Open(Tar + ".gz", FileFd::WriteOnly | FileFd::Create | FileFd::Empty, compressor));
+   ASSERT_TRUE(CopyFile(In, Out));
+   ASSERT_TRUE(Out.Close());
+   AddMember(Deb, Name + ".gz", ReadFile(Tar + ".gz"));
+}
+/* Builds foo_<Version>.deb from the tree in <Version>/, which doubles as
+   the root directory the package is installed in. */
+static void BuildDeb(std::string const &tempdir, std::string const &Version)
+{
+   std::string const Tree = tempdir + "/" + Version;
+   createDirectory(tempdir, Version + "/usr/share/foo");
+   createDirectory(tempdir, Version + "/etc");
+   createDirectory(tempdir, "control-" + Version);
+   std::string numbers, conf;
+   for (int I = 0; I < 20000; ++I)
+      numbers.append(std::to_string(I)).append("\n");
+   for (int I = 0; I < 200; ++I)
+      conf.append("option").append(std::to_string(I)).append(" = value\n");
+   ASSERT_NO_FATAL_FAILURE(WriteFile(Tree + "/usr/share/foo/numbers", numbers));
+   ASSERT_NO_FATAL_FAILURE(WriteFile(Tree + "/usr/share/foo/version", Version + "\n"));
+   ASSERT_NO_FATAL_FAILURE(WriteFile(Tree + "/etc/foo.conf", conf));
+   ASSERT_NO_FATAL_FAILURE(WriteFile(tempdir + "/control-" + Version + "/control",
+				     "Package: foo\nVersion: " + Version + "\nArchitecture: all\n"));
+   ASSERT_NO_FATAL_FAILURE(WriteFile(tempdir + "/control-" + Version + "/conffiles", "/etc/foo.conf\n"));
+
+   std::string Deb = "!<arch>\n";
+   AddMember(Deb, "debian-binary", "2.0\n");
+   ASSERT_NO_FATAL_FAILURE(AddTarMember(Deb, "control.tar", tempdir + "/control-" + Version));
+   ASSERT_NO_FATAL_FAILURE(AddTarMember(Deb, "data.tar", Tree));
+   ASSERT_NO_FATAL_FAILURE(WriteFile(tempdir + "/foo_" + Version + ".deb", Deb));
+}
+
+TEST(DebDeltaTest, RoundTrip)
+{
+   std::string tempdir;
+   createTemporaryDirectory("debdelta", tempdir);
+   ASSERT_NO_FATAL_FAILURE(BuildDeb(tempdir, "1"));
+   ASSERT_NO_FATAL_FAILURE(BuildDeb(tempdir, "2"));
+   std::string const OldDeb = tempdir + "/foo_1.deb";
+   std::string const NewDeb = tempdir + "/foo_2.deb";
+   std::string const Delta = tempdir + "/foo_1_2.debdelta";
+   std::string const Rebuilt = tempdir + "/rebuilt.deb";
+
+   EXPECT_TRUE(debDelta::Create(OldDeb, NewDeb, Delta));
+   EXPECT_TRUE(_error->empty());
+   _error->DumpErrors();
+   ASSERT_TRUE(RealFileExists(Delta));
+   // the unchanged numbers are taken from the disk
+   FileFd DeltaFd(Delta, FileFd::ReadOnly);
+   FileFd NewFd(NewDeb, FileFd::ReadOnly);
+   EXPECT_LT(DeltaFd.FileSize(), NewFd.FileSize() / 2);
+
+   // the conffile is carried in the delta, so it can be modified
+   ASSERT_NO_FATAL_FAILURE(WriteFile(tempdir + "/1/etc/foo.conf", "modified\n"));
+   EXPECT_TRUE(debDelta::Apply(Delta, tempdir + "/1", Rebuilt));
+   EXPECT_TRUE(_error->empty());
+   _error->DumpErrors();
+   EXPECT_TRUE(ReadFile(NewDeb) == ReadFile(Rebuilt));
+
+   // other files must be exactly what the old version installed
+   std::string numbers = ReadFile(tempdir + "/1/usr/share/foo/numbers");
+   numbers[0] = '9';
+   ASSERT_NO_FATAL_FAILURE(WriteFile(tempdir + "/1/usr/share/foo/numbers", numbers));
+   EXPECT_FALSE(debDelta::Apply(Delta, tempdir + "/1", Rebuilt));
+   std::string msg;
+   EXPECT_TRUE(_error->PopMessage(msg));
+   EXPECT_NE(std::string::npos, msg.find("usr/share/foo/numbers")) << msg;
+   _error->Discard();
+
+   removeDirectory(tempdir);
+}
+TEST(DebDeltaTest, ApplyRejectsOtherFiles)
+{
+   std::string tempdir;
+   createTemporaryDirectory("debdelta", tempdir);
+   std::string const Delta = tempdir + "/foo.debdelta";
+   {
+      FileFd fd;
+      ASSERT_TRUE(fd.Open(Delta, FileFd::WriteOnly | FileFd::Create, FileFd::Xz));
+      ASSERT_TRUE(fd.Write("apt-delta 1\nC 1 0 ../etc/passwd\n", 32));
+      ASSERT_TRUE(fd.Close());
+   }
+   // paths leaving the root directory are refused
+   EXPECT_FALSE(debDelta::Apply(Delta, tempdir, tempdir + "/foo.deb"));
+   std::string msg;
+   EXPECT_TRUE(_error->PopMessage(msg));
+   EXPECT_NE(std::string::npos, msg.find("not a delta in a supported format")) << msg;
+   _error->Discard();
+
+   ASSERT_NO_FATAL_FAILURE(WriteFile(Delta, "Package: foo\n"));
+   EXPECT_FALSE(debDelta::Apply(Delta, tempdir, tempdir + "/foo.deb"));
+   _error->Discard();
+
+   removeDirectory(tempdir);
+}
@@ -397,3 +397,217 @@ TEST(FileUtlTest, FailingAtomic)
    EXPECT_TRUE(f.Close());
    TestFailingAtomicKeepsFile("closed", file.Name());
 }
+TEST(FileUtlTest, CopyFile)
+{
+   std::string content;
+   for (size_t i = 0; content.size() < 3 * APT_BUFFER_SIZE; ++i)
+      content.append(std::to_string(i)).append("\n");
+   auto const source = createTemporaryFile("copyfile-source", content.c_str());
+   auto const target = createTemporaryFile("copyfile-target");
+
+   FileFd from(source.Name(), FileFd::ReadOnly);
+   FileFd to(target.Name(), FileFd::WriteOnly | FileFd::Create | FileFd::Empty | FileFd::BufferedWrite);
+   EXPECT_TRUE(CopyFile(from, to));
+   EXPECT_EQ(content.size(), to.Tell());
+   // positions are kept in sync, even if data was buffered before
+   EXPECT_TRUE(to.Write("foo", 3));
+   EXPECT_TRUE(from.Seek(10));
+   char buffer[5];
+   EXPECT_TRUE(from.Read(buffer, sizeof(buffer)));
+   EXPECT_TRUE(CopyFile(from, to));
+   EXPECT_TRUE(from.Close());
+   EXPECT_TRUE(to.Close());
+   EXPECT_FALSE(to.Failed());
+
+   EXPECT_TRUE(from.Open(target.Name(), FileFd::ReadOnly));
+   std::string copied(from.Size(), '\0');
+   EXPECT_TRUE(from.Read(&copied[0], copied.size()));
+   EXPECT_EQ(content + "foo" + content.substr(15), copied);
+}
+static std::string ReadWholeFile(FileFd &fd)
+{
+   std::string content;
+   char buffer[APT_BUFFER_SIZE];
+   unsigned long long actual = 0;
+   while (fd.Read(buffer, sizeof(buffer), &actual) && actual != 0)
+      content.append(buffer, actual);
+   return content;
+}
+TEST(FileUtlTest, ThreadedCompressors)
+{
+   std::string content;
+   // big enough to be split into several blocks with -1
+   for (size_t i = 0; content.size() < 10 * 1024 * 1024; ++i)
+      content.append("Package: ").append(std::to_string(i)).append("\n");
+
+   for (auto const &name : {"xz", "zstd"})
+   {
+      auto const compressors = APT::Configuration::getCompressors();
+      auto const c = std::find_if(compressors.begin(), compressors.end(), [&](auto const &c) { return c.Name == name; });
+      ASSERT_NE(compressors.end(), c);
+      if (c->Binary == "false")
+	 continue;
+      SCOPED_TRACE(name);
+
+      std::string compressed[3];
+      for (unsigned int threads = 1; threads <= 3; ++threads)
+      {
+	 auto compressor = *c;
+	 compressor.CompressArgs = {"-1", "-T" + std::to_string(threads)};
+	 auto const file = createTemporaryFile("threaded");
+	 FileFd fd;
+	 EXPECT_TRUE(fd.Open(file.Name(), FileFd::WriteOnly | FileFd::Create | FileFd::Empty, compressor));
+	 EXPECT_TRUE(fd.Write(content.c_str(), content.size()));
+	 EXPECT_TRUE(fd.Close());
+
+	 EXPECT_TRUE(fd.Open(file.Name(), FileFd::ReadOnly, FileFd::None));
+	 compressed[threads - 1] = ReadWholeFile(fd);
+	 for (auto const &args : {"-d", "-T1", "-T0", "-T3"})
+	 {
+	    compressor.UncompressArgs = {"-d", args};
+	    EXPECT_TRUE(fd.Open(file.Name(), FileFd::ReadOnly, compressor));
+	    EXPECT_EQ(content, ReadWholeFile(fd));
+	    EXPECT_FALSE(fd.Failed());
+	 }
+      }
+      // parallel output doesn't depend on the number of threads
+      EXPECT_EQ(compressed[1], compressed[2]);
+   }
+}
+TEST(FileUtlTest, ReadAhead)
+{
+   std::string content;
+   for (size_t i = 0; content.size() < 5 * APT_BUFFER_SIZE * 8; ++i)
+      content.append("Line ").append(std::to_string(i)).append("\n");
+
+   _config->Set("APT::FileFd::Read-Ahead", true);
+   for (auto const &c : APT::Configuration::getCompressors())
+   {
+      // only the built-in compressors read ahead, the others are piped
+      std::vector<std::string> const builtin = {"gzip", "bzip2", "xz", "lzma", "lz4", "zstd"};
+      if (std::find(builtin.begin(), builtin.end(), c.Name) == builtin.end())
+	 continue;
+      SCOPED_TRACE(c.Name);
+      auto const file = createTemporaryFile("readahead");
+      FileFd fd;
+      EXPECT_TRUE(fd.Open(file.Name(), FileFd::WriteOnly | FileFd::Create | FileFd::Empty, c));
+      EXPECT_TRUE(fd.Write(content.c_str(), content.size()));
+      EXPECT_TRUE(fd.Close());
+
+      EXPECT_TRUE(fd.Open(file.Name(), FileFd::ReadOnly, c));
+      EXPECT_EQ(content, ReadWholeFile(fd));
+      EXPECT_FALSE(fd.Failed());
+      EXPECT_EQ(content.size(), fd.Tell());
+
+      // everything but sequential reading falls back to the usual ways
+      EXPECT_TRUE(fd.Seek(5));
+      char line[100];
+      EXPECT_STREQ("0\n", fd.ReadLine(line, sizeof(line)));
+      EXPECT_TRUE(fd.Skip(content.find("Line 100\n") - fd.Tell()));
+      EXPECT_STREQ("Line 100\n", fd.ReadLine(line, sizeof(line)));
+      EXPECT_TRUE(fd.Seek(0));
+      EXPECT_EQ(content.size(), fd.Size());
+      EXPECT_EQ(0u, fd.Tell());
+      EXPECT_EQ(content, ReadWholeFile(fd));
+      EXPECT_TRUE(fd.Close());
+
+      // errors of the thread are reported to the reader
+      auto const compressed = file.Name();
+      EXPECT_EQ(0, truncate(compressed.c_str(), 1000));
+      EXPECT_TRUE(fd.Open(compressed, FileFd::ReadOnly, c));
+      ReadWholeFile(fd);
+      if (c.Name != "gzip") // zlib reports truncated files as EOF
+      {
+	 EXPECT_TRUE(fd.Failed());
+	 EXPECT_FALSE(_error->empty());
+      }
+      // recorded by the thread, but applied to the FileFd by the reader
+      if (c.Name == "lz4" || c.Name == "zstd")
+      {
+	 std::string msg;
+	 EXPECT_TRUE(_error->PopMessage(msg));
+	 EXPECT_NE(std::string::npos, msg.find("Unexpected end of file")) << msg;
+      }
+      _error->Discard();
+      fd.Close();
+   }
+   _config->Clear("APT::FileFd::Read-Ahead");
+}
+static std::string Compress(APT::Configuration::Compressor compressor, std::vector<std::string> const &args, std::string const &content)
+{
+   compressor.CompressArgs = args;
+   auto const file = createTemporaryFile("compressargs");
+   FileFd fd;
+   EXPECT_TRUE(fd.Open(file.Name(), FileFd::WriteOnly | FileFd::Create | FileFd::Empty, compressor));
+   // all at once, so that the compressor has to split it up itself
+   EXPECT_TRUE(fd.Write(content.c_str(), content.size()));
+   EXPECT_TRUE(fd.Close());
+
+   EXPECT_TRUE(fd.Open(file.Name(), FileFd::ReadOnly, compressor));
+   EXPECT_TRUE(content == ReadWholeFile(fd));
+   EXPECT_FALSE(fd.Failed());
+   EXPECT_TRUE(fd.Open(file.Name(), FileFd::ReadOnly, FileFd::None));
+   return ReadWholeFile(fd);
+}
+static bool FindCompressor(char const * const name, APT::Configuration::Compressor &compressor)
+{
+   auto const compressors = APT::Configuration::getCompressors();
+   auto const c = std::find_if(compressors.begin(), compressors.end(), [&](auto const &c) { return c.Name == name; });
+   if (c == compressors.end())
+      return false;
+   compressor = *c;
+   return true;
+}
+#ifdef HAVE_ZLIB
+TEST(FileUtlTest, GzipLevelFromCompressArgs)
+{
+   APT::Configuration::Compressor gzip;
+   ASSERT_TRUE(FindCompressor("gzip", gzip));
+   std::string content;
+   for (size_t i = 0; content.size() < 100 * 1024; ++i)
+      content.append("Package: ").append(std::to_string(i)).append("\n");
+
+   // the extra flags of the gzip header tell which level zlib used
+   auto const fast = Compress(gzip, {"-1"}, content);
+   ASSERT_LT(9u, fast.size());
+   EXPECT_EQ(4, fast[8]);
+   auto const best = Compress(gzip, {"-9n"}, content);
+   ASSERT_LT(9u, best.size());
+   EXPECT_EQ(2, best[8]);
+   EXPECT_LT(best.size(), fast.size());
+   // the last level wins like it does for the binary
+   EXPECT_EQ(best, Compress(gzip, {"-1", "-9"}, content));
+   auto const standard = Compress(gzip, {"-c"}, content);
+   ASSERT_LT(9u, standard.size());
+   EXPECT_EQ(0, standard[8]);
+}
+#endif
+#ifdef HAVE_ZSTD
+TEST(FileUtlTest, ZstdChecksumFromCompressArgs)
+{
+   APT::Configuration::Compressor zstd;
+   ASSERT_TRUE(FindCompressor("zstd", zstd));
+   std::string const content = "Package: foo\nVersion: 1\n";
+   // bit 2 of the frame header descriptor flags a content checksum
+   auto const plain = Compress(zstd, {"-19"}, content);
+   ASSERT_LT(5u, plain.size());
+   EXPECT_EQ(0, plain[4] & 0x04);
+   auto const checked = Compress(zstd, {"-19", "-C"}, content);
+   ASSERT_LT(5u, checked.size());
+   EXPECT_EQ(0x04, checked[4] & 0x04);
+   EXPECT_EQ(plain.size() + 4, checked.size());
+   EXPECT_EQ(checked, Compress(zstd, {"-19", "--check"}, content));
+}
+TEST(FileUtlTest, ZstdWritesBiggerThanItsBuffer)
+{
+   APT::Configuration::Compressor zstd;
+   ASSERT_TRUE(FindCompressor("zstd", zstd));
+   // incompressible data fills the output buffer before all input is used
+   std::string content(4 * 1024 * 1024, '\0');
+   unsigned int seed = 42;
+   for (auto &c : content)
+      c = static_cast<char>(rand_r(&seed));
+   auto const compressed = Compress(zstd, {"-1"}, content);
+   EXPECT_LT(content.size(), compressed.size());
+}
+#endif
@@ -0,0 +1,496 @@
+#include <config.h>
+
+#include <apt-pkg/error.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <stdint.h>
+
+#include <gtest/gtest.h>
+
+#include "../../methods/http2.h"
+
+typedef std::vector<std::pair<std::string, std::string>> HeaderList;
+
+static std::string FromHex(std::string const &Hex)
+{
+   std::string Data;
+   for (size_t I = 0; I < Hex.length(); ++I)
+   {
+      if (Hex[I] == ' ')
+	 continue;
+      Data.push_back(static_cast<char>(std::stoi(Hex.substr(I, 2), nullptr, 16)));
+      ++I;
+   }
+   return Data;
+}
+static std::string UInt32(uint32_t const Value)
+{
+   std::string Data;
+   for (int Shift = 24; Shift >= 0; Shift -= 8)
+      Data.push_back(static_cast<char>(Value >> Shift));
+   return Data;
+}
+static std::string Frame(uint8_t const Type, uint8_t const Flags, uint32_t const Id, std::string const &Payload)
+{
+   std::string Data;
+   Data.push_back(static_cast<char>(Payload.length() >> 16));
+   Data.push_back(static_cast<char>(Payload.length() >> 8));
+   Data.push_back(static_cast<char>(Payload.length()));
+   Data.push_back(static_cast<char>(Type));
+   Data.push_back(static_cast<char>(Flags));
+   return Data.append(UInt32(Id)).append(Payload);
+}
+static std::string Setting(uint16_t const Id, uint32_t const Value)
+{
+   std::string Data;
+   Data.push_back(static_cast<char>(Id >> 8));
+   Data.push_back(static_cast<char>(Id));
+   return Data.append(UInt32(Value));
+}
+static std::string HeaderBlock(HeaderList const &Headers)
+{
+   std::string Block;
+   for (auto const &H : Headers)
+      HpackEncodeHeader(Block, H.first, H.second);
+   return Block;
+}
+
+struct ParsedFrame
+{
+   uint8_t Type;
+   uint8_t Flags;
+   uint32_t Id;
+   std::string Payload;
+};
+static std::vector<ParsedFrame> ParseFrames(std::string const &Data)
+{
+   std::vector<ParsedFrame> Frames;
+   std::string::size_type Pos = 0;
+   while (Pos + 9 <= Data.length())
+   {
+      auto const H = reinterpret_cast<unsigned char const *>(Data.data() + Pos);
+      uint32_t const Length = uint32_t(H[0]) << 16 | uint32_t(H[1]) << 8 | H[2];
+      uint32_t const Id = uint32_t(H[5]) << 24 | uint32_t(H[6]) << 16 | uint32_t(H[7]) << 8 | H[8];
+      EXPECT_LE(Pos + 9 + Length, Data.length());
+      Frames.push_back({H[3], H[4], Id, Data.substr(Pos + 9, Length)});
+      Pos += 9 + Length;
+   }
+   EXPECT_EQ(Pos, Data.length());
+   return Frames;
+}
+static size_t CountFrames(std::vector<ParsedFrame> const &Frames, uint8_t const Type)
+{
+   size_t Count = 0;
+   for (auto const &F : Frames)
+      if (F.Type == Type)
+	 ++Count;
+   return Count;
+}
+// a connection which has exchanged the SETTINGS with the server already
+static void Connect(Http2Connection &Connection, std::string const &Settings = "")
+{
+   std::string const Preface = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+   std::string Output = Connection.TakeOutput();
+   ASSERT_EQ(Preface, Output.substr(0, Preface.length()));
+   ASSERT_TRUE(Connection.Receive(Frame(0x4, 0, 0, Settings)));
+   auto const Frames = ParseFrames(Connection.TakeOutput());
+   ASSERT_EQ(1u, Frames.size());
+   EXPECT_EQ(0x4, Frames[0].Type);
+   EXPECT_EQ(0x1, Frames[0].Flags);
+}
+static std::string Request(std::string const &Path)
+{
+   return "GET " + Path + " HTTP/1.1\r\nHost: example.org\r\n\r\n";
+}
+
+// Examples of RFC 7541 Appendix C
+static void ExpectTable(HpackDecoder const &Decoder, HeaderList const &Table, size_t const Size)
+{
+   EXPECT_EQ(Size, Decoder.DynamicTableSize());
+   ASSERT_EQ(Table.size(), Decoder.DynamicTable().size());
+   for (size_t I = 0; I < Table.size(); ++I)
+      EXPECT_EQ(Table[I], Decoder.DynamicTable()[I]);
+}
+static void CheckRequests(std::vector<std::string> const &Blocks)
+{
+   HpackDecoder Decoder;
+   HeaderList Headers;
+   EXPECT_TRUE(Decoder.Decode(FromHex(Blocks[0]), Headers));
+   EXPECT_EQ(HeaderList({{":method", "GET"}, {":scheme", "http"}, {":path", "/"}, {":authority", "www.example.com"}}), Headers);
+   ExpectTable(Decoder, {{":authority", "www.example.com"}}, 57);
+
+   Headers.clear();
+   EXPECT_TRUE(Decoder.Decode(FromHex(Blocks[1]), Headers));
+   EXPECT_EQ(HeaderList({{":method", "GET"}, {":scheme", "http"}, {":path", "/"}, {":authority", "www.example.com"},
+			 {"cache-control", "no-cache"}}), Headers);
+   ExpectTable(Decoder, {{"cache-control", "no-cache"}, {":authority", "www.example.com"}}, 110);
+
+   Headers.clear();
+   EXPECT_TRUE(Decoder.Decode(FromHex(Blocks[2]), Headers));
+   EXPECT_EQ(HeaderList({{":method", "GET"}, {":scheme", "https"}, {":path", "/index.html"}, {":authority", "www.example.com"},
+			 {"custom-key", "custom-value"}}), Headers);
+   ExpectTable(Decoder, {{"custom-key", "custom-value"}, {"cache-control", "no-cache"}, {":authority", "www.example.com"}}, 164);
+}
+static void CheckResponses(std::vector<std::string> const &Blocks)
+{
+   // the examples are for a SETTINGS_HEADER_TABLE_SIZE of 256
+   HpackDecoder Decoder(256);
+   std::string const Date1 = "Mon, 21 Oct 2013 20:13:21 GMT";
+   std::string const Date2 = "Mon, 21 Oct 2013 20:13:22 GMT";
+   std::string const Location = "https://www.example.com";
+   std::string const Cookie = "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1";
+   HeaderList Headers;
+   EXPECT_TRUE(Decoder.Decode(FromHex(Blocks[0]), Headers));
+   EXPECT_EQ(HeaderList({{":status", "302"}, {"cache-control", "private"}, {"date", Date1}, {"location", Location}}), Headers);
+   ExpectTable(Decoder, {{"location", Location}, {"date", Date1}, {"cache-control", "private"}, {":status", "302"}}, 222);
+
+   Headers.clear();
+   EXPECT_TRUE(Decoder.Decode(FromHex(Blocks[1]), Headers));
+   EXPECT_EQ(HeaderList({{":status", "307"}, {"cache-control", "private"}, {"date", Date1}, {"location", Location}}), Headers);
+   ExpectTable(Decoder, {{":status", "307"}, {"location", Location}, {"date", Date1}, {"cache-control", "private"}}, 222);
+
+   Headers.clear();
+   EXPECT_TRUE(Decoder.Decode(FromHex(Blocks[2]), Headers));
+   EXPECT_EQ(HeaderList({{":status", "200"}, {"cache-control", "private"}, {"date", Date2}, {"location", Location},
+			 {"content-encoding", "gzip"}, {"set-cookie", Cookie}}), Headers);
+   ExpectTable(Decoder, {{"set-cookie", Cookie}, {"content-encoding", "gzip"}, {"date", Date2}}, 215);
+}
+TEST(HpackTest, RequestsWithoutHuffman)
+{
+   CheckRequests({
+      "8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d",
+      "8286 84be 5808 6e6f 2d63 6163 6865",
+      "8287 85bf 400a 6375 7374 6f6d 2d6b 6579 0c63 7573 746f 6d2d 7661 6c75 65",
+   });
+}
+TEST(HpackTest, RequestsWithHuffman)
+{
+   CheckRequests({
+      "8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff",
+      "8286 84be 5886 a8eb 1064 9cbf",
+      "8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 e95b b8e8 b4bf",
+   });
+}
+TEST(HpackTest, ResponsesWithoutHuffman)
+{
+   CheckResponses({
+      "4803 3330 3258 0770 7269 7661 7465 611d 4d6f 6e2c 2032 3120 4f63 7420 3230 3133 2032 303a 3133 3a32 3120 474d"
+      "546e 1768 7474 7073 3a2f 2f77 7777 2e65 7861 6d70 6c65 2e63 6f6d",
+      "4803 3330 37c1 c0bf",
+      "88c1 611d 4d6f 6e2c 2032 3120 4f63 7420 3230 3133 2032 303a 3133 3a32 3220 474d 54c0 5a04 677a 6970 7738 666f"
+      "6f3d 4153 444a 4b48 514b 425a 584f 5157 454f 5049 5541 5851 5745 4f49 553b 206d 6178 2d61 6765 3d33 3630 303b"
+      "2076 6572 7369 6f6e 3d31",
+   });
+}
+TEST(HpackTest, ResponsesWithHuffman)
+{
+   CheckResponses({
+      "4882 6402 5885 aec3 771a 4b61 96d0 7abe 9410 54d4 44a8 2005 9504 0b81 66e0 82a6 2d1b ff6e 919d 29ad 1718 63c7"
+      "8f0b 97c8 e9ae 82ae 43d3",
+      "4883 640e ffc1 c0bf",
+      "88c1 6196 d07a be94 1054 d444 a820 0595 040b 8166 e084 a62d 1bff c05a 839b d9ab 77ad 94e7 821d d7f2 e6c7 b335"
+      "dfdf cd5b 3960 d5af 2708 7f36 72c1 ab27 0fb5 291f 9587 3160 65c0 03ed 4ee5 b106 3d50 07",
+   });
+}
+TEST(HpackTest, TableSizeUpdate)
+{
+   HpackDecoder Decoder;
+   HeaderList Headers;
+   EXPECT_TRUE(Decoder.Decode(FromHex("4803 3330 32"), Headers));
+   ExpectTable(Decoder, {{":status", "302"}}, 42);
+   // 1337 as integer with a 5 bit prefix, RFC 7541 C.1.2
+   EXPECT_TRUE(Decoder.Decode(FromHex("3f9a 0a"), Headers));
+   ExpectTable(Decoder, {{":status", "302"}}, 42);
+   // size 0 evicts everything
+   EXPECT_TRUE(Decoder.Decode(FromHex("20"), Headers));
+   ExpectTable(Decoder, {}, 0);
+   EXPECT_TRUE(Decoder.Decode(FromHex("4803 3330 32"), Headers));
+   ExpectTable(Decoder, {}, 0);
+   EXPECT_EQ(2u, Headers.size());
+   // more than our SETTINGS allow
+   EXPECT_TRUE(Decoder.Decode(FromHex("3fe1 1f"), Headers));
+   EXPECT_FALSE(Decoder.Decode(FromHex("3fe2 1f"), Headers));
+}
+TEST(HpackTest, InvalidBlocks)
+{
+   HeaderList Headers;
+   // beyond the static table with an empty dynamic table
+   EXPECT_FALSE(HpackDecoder().Decode(FromHex("be"), Headers));
+   EXPECT_FALSE(HpackDecoder().Decode(FromHex("80"), Headers));
+   // truncated integer and string
+   EXPECT_FALSE(HpackDecoder().Decode(FromHex("3fe1"), Headers));
+   EXPECT_FALSE(HpackDecoder().Decode(FromHex("4803 3330"), Headers));
+   // padding longer than 7 bits and padding not made of ones
+   EXPECT_FALSE(HpackDecoder().Decode(FromHex("4883 6402 ff"), Headers));
+   EXPECT_FALSE(HpackDecoder().Decode(FromHex("4881 00"), Headers));
+   // the end-of-string symbol
+   EXPECT_FALSE(HpackDecoder().Decode(FromHex("4884 ffff ffff"), Headers));
+   EXPECT_TRUE(Headers.empty());
+}
+TEST(HpackTest, EncodeHeader)
+{
+   std::string const Long(300, 'x');
+   HeaderList const Expected = {{":path", "/"}, {"x-long", Long}, {Long, ""}};
+   std::string const Block = HeaderBlock(Expected);
+   HpackDecoder Decoder;
+   HeaderList Headers;
+   EXPECT_TRUE(Decoder.Decode(Block, Headers));
+   EXPECT_EQ(Expected, Headers);
+   ExpectTable(Decoder, {}, 0);
+}
+
+TEST(Http2Test, Preface)
+{
+   Http2Connection Connection(false, 1234567);
+   std::string const Preface = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+   std::string const Output = Connection.TakeOutput();
+   ASSERT_EQ(Preface, Output.substr(0, Preface.length()));
+   auto const Frames = ParseFrames(Output.substr(Preface.length()));
+   ASSERT_EQ(2u, Frames.size());
+   EXPECT_EQ(0x4, Frames[0].Type);
+   EXPECT_EQ(0u, Frames[0].Id);
+   EXPECT_EQ(Setting(0x2, 0) + Setting(0x4, 1234567), Frames[0].Payload);
+   EXPECT_EQ(0x8, Frames[1].Type);
+   EXPECT_EQ(0u, Frames[1].Id);
+   EXPECT_EQ(UInt32((1u << 30) - 65535), Frames[1].Payload);
+   EXPECT_TRUE(Connection.TakeOutput().empty());
+}
+TEST(Http2Test, Request)
+{
+   Http2Connection Connection(true, 65535);
+   ASSERT_NO_FATAL_FAILURE(Connect(Connection));
+   EXPECT_TRUE(Connection.Request("GET /foo/bar HTTP/1.1\r\nHost: example.org\r\nConnection: keep-alive\r\n"
+				  "User-Agent: Debian APT-HTTP/1.3\r\nIf-Modified-Since: Thu, 01 Jan 1970 00:00:00 GMT\r\n\r\n"));
+   EXPECT_TRUE(Connection.Request("HEAD /baz HTTP/1.1\r\nHost: example.org\r\n\r\n"));
+   auto const Frames = ParseFrames(Connection.TakeOutput());
+   ASSERT_EQ(2u, Frames.size());
+
+   HpackDecoder Decoder;
+   HeaderList Headers;
+   EXPECT_EQ(0x1, Frames[0].Type);
+   EXPECT_EQ(0x5, Frames[0].Flags);
+   EXPECT_EQ(1u, Frames[0].Id);
+   EXPECT_TRUE(Decoder.Decode(Frames[0].Payload, Headers));
+   EXPECT_EQ(HeaderList({{":method", "GET"}, {":scheme", "https"}, {":path", "/foo/bar"}, {":authority", "example.org"},
+			 {"user-agent", "Debian APT-HTTP/1.3"}, {"if-modified-since", "Thu, 01 Jan 1970 00:00:00 GMT"}}), Headers);
+
+   Headers.clear();
+   EXPECT_EQ(0x1, Frames[1].Type);
+   EXPECT_EQ(3u, Frames[1].Id);
+   EXPECT_TRUE(Decoder.Decode(Frames[1].Payload, Headers));
+   EXPECT_EQ(HeaderList({{":method", "HEAD"}, {":scheme", "https"}, {":path", "/baz"}, {":authority", "example.org"}}), Headers);
+   ExpectTable(Decoder, {}, 0);
+
+   EXPECT_FALSE(Connection.Request("GET /\r\n\r\n"));
+   _error->Discard();
+}
+TEST(Http2Test, Response)
+{
+   Http2Connection Connection(false, 65535);
+   ASSERT_NO_FATAL_FAILURE(Connect(Connection));
+   EXPECT_TRUE(Connection.Request(Request("/foo")));
+   EXPECT_TRUE(Connection.Request(Request("/bar")));
+   EXPECT_TRUE(Connection.Request(Request("/baz")));
+   Connection.TakeOutput();
+
+   // the second response is complete before the first one
+   std::string const Headers = HeaderBlock({{":status", "200"}, {"content-length", "5"}, {"connection", "close"}});
+   EXPECT_TRUE(Connection.Receive(Frame(0x1, 0x5, 3, HeaderBlock({{":status", "304"}, {"content-length", "5"}}))));
+   EXPECT_TRUE(Connection.Receive(Frame(0x1, 0x4, 1, Headers)));
+   std::string Data;
+   Connection.Response(Data, 1000);
+   EXPECT_EQ("HTTP/2.0 200 OK\r\ncontent-length: 5\r\nTransfer-Encoding: chunked\r\n\r\n", Data);
+   // padded data, split into two frames
+   EXPECT_TRUE(Connection.Receive(Frame(0x0, 0x8, 1, FromHex("03") + "hel" + std::string(3, '\0'))));
+   EXPECT_TRUE(Connection.Receive(Frame(0x0, 0x1, 1, "lo")));
+   Data.clear();
+   Connection.Response(Data, 1000);
+   EXPECT_EQ("3\r\nhel\r\n2\r\nlo\r\n0\r\n\r\nHTTP/2.0 304 Not Modified\r\n\r\n", Data);
+
+   // informational response, header block continued and partial frames
+   std::string const Input = Frame(0x1, 0x4, 5, HeaderBlock({{":status", "103"}})) + Frame(0x1, 0x0, 5, Headers.substr(0, 3)) +
+			     Frame(0x9, 0x4, 5, Headers.substr(3)) + Frame(0x0, 0x1, 5, "abcde");
+   for (size_t I = 0; I < Input.length(); I += 7)
+      EXPECT_TRUE(Connection.Receive(Input.substr(I, 7)));
+   Data.clear();
+   Connection.Response(Data, 10);
+   Connection.Response(Data, 1000);
+   EXPECT_EQ("HTTP/2.0 200 OK\r\ncontent-length: 5\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nabcde\r\n0\r\n\r\n", Data);
+}
+TEST(Http2Test, ConnectionFrames)
+{
+   Http2Connection Connection(false, 65535);
+   ASSERT_NO_FATAL_FAILURE(Connect(Connection));
+   EXPECT_TRUE(Connection.Receive(Frame(0x6, 0x0, 0, "12345678") + Frame(0x6, 0x1, 0, "abcdefgh")));
+   auto Frames = ParseFrames(Connection.TakeOutput());
+   ASSERT_EQ(1u, Frames.size());
+   EXPECT_EQ(0x6, Frames[0].Type);
+   EXPECT_EQ(0x1, Frames[0].Flags);
+   EXPECT_EQ("12345678", Frames[0].Payload);
+
+   EXPECT_TRUE(Connection.Receive(Frame(0x4, 0x1, 0, "") + Frame(0x8, 0x0, 0, UInt32(1000)) + Frame(0x2, 0x0, 1, "12345")));
+   EXPECT_TRUE(Connection.TakeOutput().empty());
+
+   EXPECT_FALSE(Connection.Receive(Frame(0x6, 0x0, 0, "1234")));
+   _error->Discard();
+   Frames = ParseFrames(Connection.TakeOutput());
+   ASSERT_EQ(1u, Frames.size());
+   EXPECT_EQ(0x7, Frames[0].Type);
+   EXPECT_EQ(UInt32(6), Frames[0].Payload.substr(4));
+}
+TEST(Http2Test, InvalidFrames)
+{
+   {
+      Http2Connection Connection(false, 65535);
+      ASSERT_NO_FATAL_FAILURE(Connect(Connection));
+      // the header is enough to know that the frame is too large
+      std::string const Header = Frame(0x0, 0x0, 1, std::string(16385, 'x')).substr(0, 9);
+      EXPECT_FALSE(Connection.Receive(Header));
+      std::string msg;
+      EXPECT_TRUE(_error->PopMessage(msg));
+      EXPECT_EQ("HTTP/2 protocol error: Frame exceeds the maximum size", msg);
+      auto const Frames = ParseFrames(Connection.TakeOutput());
+      ASSERT_EQ(1u, Frames.size());
+      EXPECT_EQ(0x7, Frames[0].Type);
+      EXPECT_EQ(UInt32(6), Frames[0].Payload.substr(4));
+   }
+   std::vector<std::string> const Invalid = {
+      Frame(0x5, 0x4, 1, UInt32(2) + HeaderBlock({{":status", "200"}})),
+      Frame(0x0, 0x1, 1, "data before headers"),
+      Frame(0x1, 0x5, 1, HeaderBlock({{"content-length", "0"}})),
+      Frame(0x1, 0x5, 1, FromHex("be")),
+      Frame(0x1, 0xd, 1, FromHex("20") + HeaderBlock({{":status", "200"}})),
+      Frame(0x1, 0x0, 1, HeaderBlock({{":status", "200"}})) + Frame(0x0, 0x1, 1, "interrupted"),
+      Frame(0x9, 0x4, 1, HeaderBlock({{":status", "200"}})),
+      Frame(0x3, 0x0, 1, "12"),
+      Frame(0x4, 0x0, 0, "12345"),
+   };
+   for (auto const &F : Invalid)
+   {
+      Http2Connection Connection(false, 65535);
+      ASSERT_NO_FATAL_FAILURE(Connect(Connection));
+      EXPECT_TRUE(Connection.Request(Request("/")));
+      Connection.TakeOutput();
+      EXPECT_FALSE(Connection.Receive(F));
+      EXPECT_TRUE(_error->PendingError());
+      _error->Discard();
+      auto const Frames = ParseFrames(Connection.TakeOutput());
+      ASSERT_EQ(1u, Frames.size());
+      EXPECT_EQ(0x7, Frames[0].Type);
+      EXPECT_EQ(UInt32(1), Frames[0].Payload.substr(0, 4));
+   }
+}
+TEST(Http2Test, ResetStreams)
+{
+   Http2Connection Connection(false, 65535);
+   ASSERT_NO_FATAL_FAILURE(Connect(Connection));
+   for (auto const &Path : {"/1", "/3", "/5", "/7"})
+      EXPECT_TRUE(Connection.Request(Request(Path)));
+   Connection.TakeOutput();
+   uint32_t ErrorCode = 0;
+   EXPECT_FALSE(Connection.Failed(ErrorCode));
+
+   // the partial response has to be taken before the failure is reported
+   EXPECT_TRUE(Connection.Receive(Frame(0x1, 0x4, 1, HeaderBlock({{":status", "200"}}))));
+   EXPECT_TRUE(Connection.Receive(Frame(0x3, 0x0, 1, UInt32(2))));
+   EXPECT_FALSE(Connection.Failed(ErrorCode));
+   std::string Data;
+   Connection.Response(Data, 1000);
+   EXPECT_EQ("HTTP/2.0 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n", Data);
+   EXPECT_TRUE(Connection.Failed(ErrorCode));
+   EXPECT_EQ(2u, ErrorCode);
+
+   // streams the server will not process are refused
+   EXPECT_TRUE(Connection.Receive(Frame(0x7, 0x0, 0, UInt32(3) + UInt32(0))));
+   EXPECT_TRUE(Connection.Request(Request("/9")));
+   EXPECT_TRUE(Connection.TakeOutput().empty());
+   EXPECT_TRUE(Connection.Receive(Frame(0x1, 0x5, 3, HeaderBlock({{":status", "404"}}))));
+   EXPECT_TRUE(Connection.Receive(Frame(0x1, 0x5, 5, HeaderBlock({{":status", "200"}}))));
+   // the first response stays in the way until the method gives up on it
+   Data.clear();
+   Connection.Response(Data, 1000);
+   EXPECT_TRUE(Data.empty());
+}
+TEST(Http2Test, ConcurrentStreams)
+{
+   Http2Connection Connection(false, 65535);
+   ASSERT_NO_FATAL_FAILURE(Connect(Connection, Setting(0x3, 2)));
+   for (auto const &Path : {"/1", "/3", "/5", "/7"})
+      EXPECT_TRUE(Connection.Request(Request(Path)));
+   auto Frames = ParseFrames(Connection.TakeOutput());
+   ASSERT_EQ(2u, Frames.size());
+   EXPECT_EQ(1u, Frames[0].Id);
+   EXPECT_EQ(3u, Frames[1].Id);
+
+   EXPECT_TRUE(Connection.Receive(Frame(0x1, 0x5, 3, HeaderBlock({{":status", "200"}}))));
+   Frames = ParseFrames(Connection.TakeOutput());
+   ASSERT_EQ(1u, Frames.size());
+   EXPECT_EQ(0x1, Frames[0].Type);
+   EXPECT_EQ(5u, Frames[0].Id);
+
+   // the server allows more streams now
+   EXPECT_TRUE(Connection.Receive(Frame(0x4, 0x0, 0, Setting(0x3, 10))));
+   Frames = ParseFrames(Connection.TakeOutput());
+   ASSERT_EQ(2u, Frames.size());
+   EXPECT_EQ(0x4, Frames[0].Type);
+   EXPECT_EQ(0x1, Frames[1].Type);
+   EXPECT_EQ(7u, Frames[1].Id);
+}
+TEST(Http2Test, ConcurrentStreamsBeforeSettings)
+{
+   Http2Connection Connection(false, 65535);
+   Connection.TakeOutput();
+   for (auto const &Path : {"/1", "/3", "/5"})
+      EXPECT_TRUE(Connection.Request(Request(Path)));
+   auto Frames = ParseFrames(Connection.TakeOutput());
+   ASSERT_EQ(1u, Frames.size());
+   EXPECT_EQ(1u, Frames[0].Id);
+
+   EXPECT_TRUE(Connection.Receive(Frame(0x4, 0x0, 0, Setting(0x3, 2))));
+   Frames = ParseFrames(Connection.TakeOutput());
+   ASSERT_EQ(2u, Frames.size());
+   EXPECT_EQ(0x4, Frames[0].Type);
+   EXPECT_EQ(0x1, Frames[1].Type);
+   EXPECT_EQ(3u, Frames[1].Id);
+
+   // later SETTINGS without a limit keep the one we have
+   EXPECT_TRUE(Connection.Receive(Frame(0x4, 0x0, 0, Setting(0x4, 65535))));
+   EXPECT_EQ(1u, ParseFrames(Connection.TakeOutput()).size());
+}
+TEST(Http2Test, ConcurrentStreamsAreCapped)
+{
+   Http2Connection Connection(false, 65535);
+   ASSERT_NO_FATAL_FAILURE(Connect(Connection, Setting(0x3, 1000)));
+   for (int I = 0; I < 150; ++I)
+      EXPECT_TRUE(Connection.Request(Request("/" + std::to_string(I))));
+   EXPECT_EQ(100u, CountFrames(ParseFrames(Connection.TakeOutput()), 0x1));
+
+   Http2Connection Unlimited(false, 65535);
+   ASSERT_NO_FATAL_FAILURE(Connect(Unlimited));
+   for (int I = 0; I < 150; ++I)
+      EXPECT_TRUE(Unlimited.Request(Request("/" + std::to_string(I))));
+   EXPECT_EQ(100u, CountFrames(ParseFrames(Unlimited.TakeOutput()), 0x1));
+}
+TEST(Http2Test, FlowControl)
+{
+   Http2Connection Connection(false, 100);
+   ASSERT_NO_FATAL_FAILURE(Connect(Connection));
+   EXPECT_TRUE(Connection.Request(Request("/")));
+   Connection.TakeOutput();
+   EXPECT_TRUE(Connection.Receive(Frame(0x1, 0x4, 1, HeaderBlock({{":status", "200"}}))));
+   std::string Data;
+   Connection.Response(Data, 1000);
+   // data is only acknowledged once it is taken
+   EXPECT_TRUE(Connection.Receive(Frame(0x0, 0x0, 1, std::string(30, 'x'))));
+   EXPECT_TRUE(Connection.Receive(Frame(0x0, 0x0, 1, std::string(30, 'x'))));
+   EXPECT_TRUE(Connection.TakeOutput().empty());
+   Connection.Response(Data, 1000);
+   auto const Frames = ParseFrames(Connection.TakeOutput());
+   ASSERT_EQ(1u, Frames.size());
+   EXPECT_EQ(0x8, Frames[0].Type);
+   EXPECT_EQ(1u, Frames[0].Id);
+   EXPECT_EQ(UInt32(60), Frames[0].Payload);
+}
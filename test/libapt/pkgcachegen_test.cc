@@ -0,0 +1,223 @@
+#include <config.h>
+
+#include <apt-pkg/cachefile.h>
+#include <apt-pkg/configuration.h>
+#include <apt-pkg/debindexfile.h>
+#include <apt-pkg/error.h>
+#include <apt-pkg/fileutl.h>
+#include <apt-pkg/pkgcache.h>
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "file-helpers.h"
+
+static std::string Stanzas(int const From, int const To)
+{
+   std::string content;
+   for (int I = From; I < To; ++I)
+      content.append("Package: pkg").append(std::to_string(I)).append("\nArchitecture: amd64\nVersion: 1\n\n");
+   return content;
+}
+static void ExpectAllFound(pkgCache &Cache, int const Count)
+{
+   EXPECT_EQ(static_cast<map_id_t>(Count), Cache.Head().GroupCount);
+   for (int I = 0; I < Count; ++I)
+      EXPECT_FALSE(Cache.FindGrp("pkg" + std::to_string(I)).end()) << I;
+   EXPECT_TRUE(Cache.FindGrp("pkg" + std::to_string(Count)).end());
+   // the index and the hash table chains agree on every group
+   for (auto G = Cache.GrpBegin(); G.end() == false; ++G)
+      EXPECT_EQ(G, Cache.FindGrp(G.Name()));
+}
+
+static void SetupEmptySystem(std::string &tempdir)
+{
+   createTemporaryDirectory("pkgcachegen", tempdir);
+   createFile(tempdir, "sources.list");
+   createDirectory(tempdir, "sources.list.d");
+   _config->Set("Dir::Etc::sourcelist", tempdir + "/sources.list");
+   _config->Set("Dir::Etc::sourceparts", tempdir + "/sources.list.d");
+   _config->Set("Dir::State::lists", tempdir);
+   // the status file index is kept around by the system, so nothing temporary
+   _config->Set("Dir::State::status", "/dev/null");
+   _config->Set("Dir::Cache::pkgcache", "");
+   _config->Set("Dir::Cache::srcpkgcache", "");
+   _config->Set("APT::Architecture", "amd64");
+   _config->Set("APT::Architectures::", "amd64");
+}
+static void ClearEmptySystem(std::string const &tempdir)
+{
+   for (auto const &option : {"Dir::Etc::sourcelist", "Dir::Etc::sourceparts", "Dir::State::lists",
+			      "Dir::State::status", "Dir::Cache::pkgcache", "Dir::Cache::srcpkgcache",
+			      "APT::Architecture", "APT::Architectures"})
+      _config->Clear(option);
+   removeDirectory(tempdir);
+}
+
+TEST(PkgCacheGenTest, GrpIndexIsRebuiltAfterFillingUp)
+{
+   std::string tempdir;
+   SetupEmptySystem(tempdir);
+   {
+      pkgCacheFile CacheFile;
+      ASSERT_TRUE(CacheFile.BuildCaches(nullptr, false));
+      ASSERT_NE(nullptr, CacheFile.GetPkgCache());
+      EXPECT_TRUE(CacheFile.GetPkgCache()->Head().GrpIndex != 0);
+      EXPECT_EQ(1024u, CacheFile.GetPkgCache()->Head().GrpIndexSize);
+
+      // groups are inserted into the index as long as it has room
+      ASSERT_TRUE(CacheFile.AddIndexFile(new debStringPackageIndex(Stanzas(0, 700))));
+      ASSERT_NE(nullptr, CacheFile.GetPkgCache());
+      auto const SmallIndex = CacheFile.GetPkgCache()->Head().GrpIndex;
+      EXPECT_TRUE(SmallIndex != 0);
+      EXPECT_EQ(1024u, CacheFile.GetPkgCache()->Head().GrpIndexSize);
+      ExpectAllFound(*CacheFile.GetPkgCache(), 700);
+
+      // beyond three quarters it is dropped and rebuilt larger afterwards
+      ASSERT_TRUE(CacheFile.AddIndexFile(new debStringPackageIndex(Stanzas(700, 1100))));
+      ASSERT_NE(nullptr, CacheFile.GetPkgCache());
+      EXPECT_TRUE(CacheFile.GetPkgCache()->Head().GrpIndex != 0);
+      EXPECT_TRUE(SmallIndex != CacheFile.GetPkgCache()->Head().GrpIndex);
+      EXPECT_EQ(4096u, CacheFile.GetPkgCache()->Head().GrpIndexSize);
+      ExpectAllFound(*CacheFile.GetPkgCache(), 1100);
+   }
+   EXPECT_TRUE(_error->empty());
+   _error->DumpErrors();
+
+   ClearEmptySystem(tempdir);
+}
+
+static char const * const DependsOld =
+   "Package: pkga\nArchitecture: amd64\nVersion: 1\nDepends: libc (>= 2.1), libc (>= 2.0)\n\n"
+   "Package: pkgb\nArchitecture: amd64\nVersion: 1\nDepends: libc (>= 2.0)\n\n";
+static char const * const DependsNew =
+   "Package: pkgc\nArchitecture: amd64\nVersion: 1\nDepends: libc (>= 2.1), libc (<< 3)\n\n"
+   "Package: pkgd\nArchitecture: amd64\nVersion: 1\nDepends: libc (>= 2.0)\n\n"
+   "Package: pkge\nArchitecture: amd64\nVersion: 1\nDepends: libc (<= 2.1)\n\n";
+static void ExpectRevDepends(pkgCache &Cache)
+{
+   /* The DependencyData chain of a package is sorted by the address of the
+      version string, the RevDepends start with a user of each new head and
+      have the users of older data linked in behind that. */
+   std::vector<std::string> const expected = {
+      "pkgc < 3", "pkge <= 2.1", "pkgd >= 2.0", "pkga >= 2.0", "pkgc >= 2.1", "pkgb >= 2.0", "pkga >= 2.1"};
+   std::vector<std::string> revdepends;
+   auto const Pkg = Cache.FindPkg("libc", "amd64");
+   ASSERT_FALSE(Pkg.end());
+   for (auto D = Pkg.RevDependsList(); D.end() == false; ++D)
+      revdepends.push_back(std::string(D.ParentPkg().Name()) + " " + D.CompType() + " " + D.TargetVer());
+   EXPECT_EQ(expected, revdepends);
+   EXPECT_EQ(7u, Cache.Head().DependsCount);
+   EXPECT_EQ(4u, Cache.Head().DependsDataCount);
+}
+TEST(PkgCacheGenTest, DependencyDataOrder)
+{
+   std::string tempdir;
+   SetupEmptySystem(tempdir);
+   {
+      pkgCacheFile CacheFile;
+      ASSERT_TRUE(CacheFile.BuildCaches(nullptr, false));
+      ASSERT_TRUE(CacheFile.AddIndexFile(new debStringPackageIndex(std::string(DependsOld) + DependsNew)));
+      ASSERT_NE(nullptr, CacheFile.GetPkgCache());
+      ExpectRevDepends(*CacheFile.GetPkgCache());
+   }
+   EXPECT_TRUE(_error->empty());
+   _error->DumpErrors();
+   ClearEmptySystem(tempdir);
+}
+TEST(PkgCacheGenTest, DependencyDataOfLoadedCache)
+{
+   std::string tempdir;
+   SetupEmptySystem(tempdir);
+   {
+      pkgCacheFile CacheFile;
+      ASSERT_TRUE(CacheFile.BuildCaches(nullptr, false));
+      ASSERT_TRUE(CacheFile.AddIndexFile(new debStringPackageIndex(DependsOld)));
+      ASSERT_NE(nullptr, CacheFile.GetPkgCache());
+      EXPECT_EQ(2u, CacheFile.GetPkgCache()->Head().DependsDataCount);
+      // a new generator learns the data of libc on first use and shares it
+      ASSERT_TRUE(CacheFile.AddIndexFile(new debStringPackageIndex(DependsNew)));
+      ASSERT_NE(nullptr, CacheFile.GetPkgCache());
+      ExpectRevDepends(*CacheFile.GetPkgCache());
+   }
+   EXPECT_TRUE(_error->empty());
+   _error->DumpErrors();
+   ClearEmptySystem(tempdir);
+}
+TEST(PkgCacheGenTest, StringsOfLoadedCacheAreShared)
+{
+   std::string tempdir;
+   SetupEmptySystem(tempdir);
+   {
+      pkgCacheFile CacheFile;
+      ASSERT_TRUE(CacheFile.BuildCaches(nullptr, false));
+      ASSERT_TRUE(CacheFile.AddIndexFile(new debStringPackageIndex(
+	 "Package: pkga\nArchitecture: amd64\nVersion: 1\nSection: libs\nDepends: libc (>= 2.0)\n\n")));
+      // a new generator finds the strings stored by the previous one
+      ASSERT_TRUE(CacheFile.AddIndexFile(new debStringPackageIndex(
+	 "Package: pkgb\nArchitecture: amd64\nVersion: 2.0\nSection: libs\nDepends: libc (>= 1)\n\n")));
+      pkgCache * const Cache = CacheFile.GetPkgCache();
+      ASSERT_NE(nullptr, Cache);
+      auto const A = Cache->FindPkg("pkga", "amd64").VersionList();
+      auto const B = Cache->FindPkg("pkgb", "amd64").VersionList();
+      ASSERT_FALSE(A.end());
+      ASSERT_FALSE(B.end());
+      EXPECT_EQ(A->Section, B->Section);
+      EXPECT_EQ(A->VerStr, B.DependsList()->Version);
+      EXPECT_EQ(A.DependsList()->Version, B->VerStr);
+      auto const FileA = A.FileList().File();
+      auto const FileB = B.FileList().File();
+      EXPECT_TRUE(FileA->IndexType != 0);
+      EXPECT_EQ(FileA->IndexType, FileB->IndexType);
+   }
+   EXPECT_TRUE(_error->empty());
+   _error->DumpErrors();
+   ClearEmptySystem(tempdir);
+}
+static std::vector<std::string> DependsOf(pkgCache::VerIterator const &Ver)
+{
+   std::vector<std::string> depends;
+   for (auto D = Ver.DependsList(); D.end() == false; ++D)
+   {
+      EXPECT_EQ(Ver, D.ParentVer());
+      depends.push_back(std::string(D.DepType()) + " " + D.TargetPkg().FullName(true));
+   }
+   return depends;
+}
+TEST(PkgCacheGenTest, DependsListsAreShared)
+{
+   std::string tempdir;
+   SetupEmptySystem(tempdir);
+   _config->Set("APT::Architectures::", "i386");
+   {
+      pkgCacheFile CacheFile;
+      ASSERT_TRUE(CacheFile.BuildCaches(nullptr, false));
+      ASSERT_TRUE(CacheFile.AddIndexFile(new debStringPackageIndex(
+	 "Package: pkga\nArchitecture: amd64\nVersion: 1\nDepends: libc (>= 2.0)\nConflicts: old\n\n"
+	 "Package: old\nArchitecture: i386\nVersion: 1\n\n"
+	 "Package: pkgb\nArchitecture: amd64\nVersion: 1\nDepends: libc (>= 2.0)\nConflicts: old\n\n"
+	 "Package: pkgc\nArchitecture: i386\nVersion: 1\nDepends: libc (>= 2.0)\nConflicts: old\n\n")));
+      pkgCache * const Cache = CacheFile.GetPkgCache();
+      ASSERT_NE(nullptr, Cache);
+      auto const A = Cache->FindPkg("pkga", "amd64").VersionList();
+      auto const B = Cache->FindPkg("pkgb", "amd64").VersionList();
+      auto const C = Cache->FindPkg("pkgc", "i386").VersionList();
+      ASSERT_FALSE(A.end());
+      ASSERT_FALSE(B.end());
+      ASSERT_FALSE(C.end());
+      // the conflicts cover all packages of the group, also those added later
+      EXPECT_EQ((std::vector<std::string>{"Depends libc", "Conflicts old", "Conflicts old:i386"}), DependsOf(A));
+      EXPECT_EQ((std::vector<std::string>{"Depends libc", "Conflicts old", "Conflicts old:i386"}), DependsOf(B));
+      // the same text names other packages in another architecture
+      EXPECT_EQ((std::vector<std::string>{"Depends libc:i386", "Conflicts old", "Conflicts old:i386"}), DependsOf(C));
+      EXPECT_EQ(A.DependsList()->DependencyData, B.DependsList()->DependencyData);
+      EXPECT_NE(A.DependsList()->DependencyData, C.DependsList()->DependencyData);
+      EXPECT_EQ(9u, Cache->Head().DependsCount);
+      EXPECT_EQ(4u, Cache->Head().DependsDataCount);
+   }
+   EXPECT_TRUE(_error->empty());
+   _error->DumpErrors();
+   ClearEmptySystem(tempdir);
+}
@@ -0,0 +1,132 @@
+#include <config.h>
+
+#include <apt-pkg/configuration.h>
+#include <apt-pkg/fileutl.h>
+#include <apt-pkg/trace.h>
+
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "file-helpers.h"
+
+// just enough of a JSON parser to tell if the trace is well-formed
+static bool ParseJSONValue(std::string const &In, size_t &Pos);
+static void SkipJSONSpace(std::string const &In, size_t &Pos)
+{
+   while (Pos < In.size() && isspace(In[Pos]) != 0)
+      ++Pos;
+}
+static bool ParseJSONString(std::string const &In, size_t &Pos)
+{
+   if (In[Pos] != '"')
+      return false;
+   for (++Pos; Pos < In.size(); ++Pos)
+   {
+      if (In[Pos] == '"')
+      {
+	 ++Pos;
+	 return true;
+      }
+      else if (In[Pos] == '\\')
+	 ++Pos;
+      else if (static_cast<unsigned char>(In[Pos]) < 0x20)
+	 return false;
+   }
+   return false;
+}
+static bool ParseJSONList(std::string const &In, size_t &Pos, char const Close, bool const Object)
+{
+   ++Pos;
+   SkipJSONSpace(In, Pos);
+   if (Pos < In.size() && In[Pos] == Close)
+      return ++Pos, true;
+   while (Pos < In.size())
+   {
+      if (Object == true)
+      {
+	 if (ParseJSONString(In, Pos) == false)
+	    return false;
+	 SkipJSONSpace(In, Pos);
+	 if (Pos >= In.size() || In[Pos++] != ':')
+	    return false;
+      }
+      if (ParseJSONValue(In, Pos) == false)
+	 return false;
+      if (Pos >= In.size())
+	 return false;
+      if (In[Pos] == Close)
+	 return ++Pos, true;
+      if (In[Pos++] != ',')
+	 return false;
+      SkipJSONSpace(In, Pos);
+   }
+   return false;
+}
+static bool ParseJSONValue(std::string const &In, size_t &Pos)
+{
+   SkipJSONSpace(In, Pos);
+   if (Pos >= In.size())
+      return false;
+   bool Okay = true;
+   if (In[Pos] == '{')
+      Okay = ParseJSONList(In, Pos, '}', true);
+   else if (In[Pos] == '[')
+      Okay = ParseJSONList(In, Pos, ']', false);
+   else if (In[Pos] == '"')
+      Okay = ParseJSONString(In, Pos);
+   else if (isdigit(In[Pos]) != 0)
+      while (Pos < In.size() && isdigit(In[Pos]) != 0)
+	 ++Pos;
+   else
+      return false;
+   SkipJSONSpace(In, Pos);
+   return Okay;
+}
+
+TEST(TraceTest, TraceFileIsJSON)
+{
+   auto const file = createTemporaryFile("trace");
+   RemoveFile("TraceFileIsJSON", file.Name());
+
+   // the trace is written on exit, so the phases happen in a child
+   pid_t const child = fork();
+   ASSERT_NE(-1, child);
+   if (child == 0)
+   {
+      // tracing is decided on again once the configuration changed
+      {
+	 APT::Trace::Phase const phase("untraced");
+      }
+      _config->Set("Debug::Trace-File", file.Name());
+      {
+	 APT::Trace::Phase const phase("traced");
+	 std::thread thread([]() { APT::Trace::Phase const inner("in a \"thread\""); });
+	 thread.join();
+      }
+      exit(APT::Trace::Enabled() ? 0 : 1);
+   }
+   int status;
+   ASSERT_EQ(child, waitpid(child, &status, 0));
+   ASSERT_TRUE(WIFEXITED(status));
+   EXPECT_EQ(0, WEXITSTATUS(status));
+
+   std::ifstream in(file.Name());
+   ASSERT_TRUE(in.is_open());
+   std::string const trace((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+   size_t pos = 0;
+   EXPECT_TRUE(ParseJSONValue(trace, pos)) << trace;
+   EXPECT_EQ(trace.size(), pos) << trace;
+   EXPECT_EQ(std::string::npos, trace.find("\"untraced\"")) << trace;
+   EXPECT_NE(std::string::npos, trace.find("\"name\":\"traced\"")) << trace;
+   EXPECT_NE(std::string::npos, trace.find("\"name\":\"in a \\\"thread\\\"\"")) << trace;
+   EXPECT_NE(std::string::npos, trace.find("\"traceEvents\":[")) << trace;
+}